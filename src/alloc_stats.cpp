@@ -0,0 +1,256 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "base.h"
+#include "alloc_stats.h"
+
+#ifdef ALLOC_STATS
+
+/* здесь нужен настоящий free */
+#undef free
+
+/** Сколько разных мест вызова помещается в таблицу; остальные сливаются в одну строку "other". */
+const size_t ALLOC_MAX_SITES = 512;
+/** Начальная емкость таблицы живых указателей (степень двойки). */
+const size_t ALLOC_LIVE_INITIAL = 1024;
+
+/** Место вызова и его счетчики. */
+typedef struct {
+    const char *file;
+    const char *func;
+    int line;
+    size_t count;
+    size_t bytes;
+    size_t live;
+    size_t buckets[ALLOC_BUCKETS];
+} alloc_site_t;
+
+/** Живой указатель: размер и место, где он выделен. */
+typedef struct {
+    void *ptr;
+    size_t size;
+    size_t site;
+} alloc_live_t;
+
+global pthread_mutex_t g_alloc_lock = PTHREAD_MUTEX_INITIALIZER;
+global alloc_totals_t g_alloc_totals = {};
+global alloc_site_t g_alloc_sites[ALLOC_MAX_SITES + 1] = {};
+global size_t g_alloc_nsites = 0;
+/* открытая адресация с линейным пробированием, удаление сдвигом назад */
+global alloc_live_t *g_alloc_live = nullptr;
+global size_t g_alloc_live_cap = 0;
+global size_t g_alloc_live_count = 0;
+
+function size_t hash_ptr(const void *ptr);
+function size_t find_site(const char *file, int line, const char *func);
+function int grow_live(void);
+function void record_alloc(void *ptr, size_t size, const char *file, int line, const char *func);
+function void insert_live(alloc_live_t entry);
+function alloc_live_t record_free(void *ptr);
+
+function size_t hash_ptr(const void *ptr) {
+    uint64_t x = (uint64_t) (uintptr_t) ptr;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    return (size_t) x;
+}
+
+/**
+ * @brief Ищет место вызова или заводит новое; при переполнении таблицы - последняя строка "other".
+ * @return индекс в g_alloc_sites.
+ */
+function size_t find_site(const char *file, int line, const char *func) {
+    for (size_t i = 0; i < g_alloc_nsites; ++i)
+        if (g_alloc_sites[i].line == line && g_alloc_sites[i].file == file)
+            return i;
+    if (g_alloc_nsites == ALLOC_MAX_SITES) {
+        g_alloc_sites[ALLOC_MAX_SITES].file = "other";
+        g_alloc_sites[ALLOC_MAX_SITES].func = "";
+        return ALLOC_MAX_SITES;
+    }
+    alloc_site_t *site = &g_alloc_sites[g_alloc_nsites];
+    site->file = file;
+    site->line = line;
+    site->func = func;
+    return g_alloc_nsites++;
+}
+
+/**
+ * @brief Удваивает таблицу живых указателей.
+ * @return 0 при успехе, -1 при нехватке памяти (тогда указатель просто не учитывается).
+ */
+function int grow_live(void) {
+    size_t cap = g_alloc_live_cap ? g_alloc_live_cap * 2 : ALLOC_LIVE_INITIAL;
+    alloc_live_t *table = (alloc_live_t *) calloc(cap, sizeof(alloc_live_t));
+    if (!table) return -1;
+    for (size_t i = 0; i < g_alloc_live_cap; ++i) {
+        if (!g_alloc_live[i].ptr) continue;
+        size_t pos = hash_ptr(g_alloc_live[i].ptr) & (cap - 1);
+        while (table[pos].ptr) pos = (pos + 1) & (cap - 1);
+        table[pos] = g_alloc_live[i];
+    }
+    free(g_alloc_live);
+    g_alloc_live = table;
+    g_alloc_live_cap = cap;
+    return 0;
+}
+
+function void record_alloc(void *ptr, size_t size, const char *file, int line, const char *func) {
+    size_t idx = find_site(file, line, func);
+    alloc_site_t *site = &g_alloc_sites[idx];
+    size_t bucket = 0;
+    while (bucket + 1 < ALLOC_BUCKETS && size > ALLOC_BUCKET_LIMITS[bucket]) ++bucket;
+    ++site->count;
+    site->bytes += size;
+    ++site->buckets[bucket];
+    ++g_alloc_totals.count;
+    g_alloc_totals.bytes += size;
+    insert_live({ptr, size, idx});
+}
+
+/**
+ * @brief Заносит указатель в таблицу живых и добавляет его размер к живым байтам места.
+ */
+function void insert_live(alloc_live_t entry) {
+    if ((g_alloc_live_count + 1) * 2 > g_alloc_live_cap && grow_live()) return;
+    size_t mask = g_alloc_live_cap - 1;
+    size_t pos = hash_ptr(entry.ptr) & mask;
+    while (g_alloc_live[pos].ptr && g_alloc_live[pos].ptr != entry.ptr) pos = (pos + 1) & mask;
+    if (g_alloc_live[pos].ptr) {
+        /* адрес вернулся в malloc мимо учета (например, его освободила внешняя библиотека) */
+        g_alloc_totals.live -= g_alloc_live[pos].size;
+        g_alloc_sites[g_alloc_live[pos].site].live -= g_alloc_live[pos].size;
+    } else
+        ++g_alloc_live_count;
+    g_alloc_live[pos] = entry;
+    g_alloc_sites[entry.site].live += entry.size;
+    g_alloc_totals.live += entry.size;
+    if (g_alloc_totals.live > g_alloc_totals.peak)
+        g_alloc_totals.peak = g_alloc_totals.live;
+}
+
+/**
+ * @brief Убирает указатель из таблицы живых.
+ * @return запись указателя (для insert_live, если освобождение не состоялось) или {}.
+ */
+function alloc_live_t record_free(void *ptr) {
+    if (!ptr || !g_alloc_live_count) return {};
+    size_t mask = g_alloc_live_cap - 1;
+    size_t pos = hash_ptr(ptr) & mask;
+    while (g_alloc_live[pos].ptr != ptr) {
+        if (!g_alloc_live[pos].ptr) return {};
+        pos = (pos + 1) & mask;
+    }
+    alloc_live_t entry = g_alloc_live[pos];
+    g_alloc_totals.live -= g_alloc_live[pos].size;
+    g_alloc_sites[g_alloc_live[pos].site].live -= g_alloc_live[pos].size;
+    --g_alloc_live_count;
+
+    size_t hole = pos;
+    for (size_t next = (hole + 1) & mask; g_alloc_live[next].ptr; next = (next + 1) & mask) {
+        size_t home = hash_ptr(g_alloc_live[next].ptr) & mask;
+        /* элемент можно сдвинуть в дыру, если его домашняя ячейка не лежит между дырой и им */
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            g_alloc_live[hole] = g_alloc_live[next];
+            hole = next;
+        }
+    }
+    g_alloc_live[hole] = {};
+    return entry;
+}
+
+void *alloc_stats_calloc(size_t nmemb, size_t size, const char *file, int line, const char *func) {
+    void *ptr = calloc(nmemb, size);
+    if (!ptr) return nullptr;
+    pthread_mutex_lock(&g_alloc_lock);
+    record_alloc(ptr, nmemb * size, file, line, func);
+    pthread_mutex_unlock(&g_alloc_lock);
+    return ptr;
+}
+
+void *alloc_stats_realloc(void *ptr, size_t size, const char *file, int line, const char *func) {
+    /* до realloc: после него адрес может уже получить и записать другой поток */
+    pthread_mutex_lock(&g_alloc_lock);
+    alloc_live_t old = record_free(ptr);
+    pthread_mutex_unlock(&g_alloc_lock);
+    void *res = realloc(ptr, size);
+    pthread_mutex_lock(&g_alloc_lock);
+    if (res)
+        record_alloc(res, size, file, line, func);
+    else if (size && old.ptr)
+        insert_live(old);
+    pthread_mutex_unlock(&g_alloc_lock);
+    return res;
+}
+
+char *alloc_stats_strndup(const char *text, size_t len, const char *file, int line, const char *func) {
+    char *res = strndup(text, len);
+    if (!res) return nullptr;
+    pthread_mutex_lock(&g_alloc_lock);
+    record_alloc(res, strlen(res) + 1, file, line, func);
+    pthread_mutex_unlock(&g_alloc_lock);
+    return res;
+}
+
+char *alloc_stats_strdup(const char *text, const char *file, int line, const char *func) {
+    return alloc_stats_strndup(text, strlen(text), file, line, func);
+}
+
+void alloc_stats_free(void *ptr) {
+    if (!ptr) return;
+    pthread_mutex_lock(&g_alloc_lock);
+    record_free(ptr);
+    pthread_mutex_unlock(&g_alloc_lock);
+    free(ptr);
+}
+
+void alloc_stats_totals(alloc_totals_t *out) {
+    if (!out) return;
+    pthread_mutex_lock(&g_alloc_lock);
+    *out = g_alloc_totals;
+    pthread_mutex_unlock(&g_alloc_lock);
+}
+
+void alloc_stats_dump(FILE *fp) {
+    if (!fp) return;
+    pthread_mutex_lock(&g_alloc_lock);
+    size_t nsites = g_alloc_nsites + (g_alloc_sites[ALLOC_MAX_SITES].count ? 1 : 0);
+    size_t order[ALLOC_MAX_SITES + 1] = {};
+    for (size_t i = 0; i < g_alloc_nsites; ++i) order[i] = i;
+    if (nsites > g_alloc_nsites) order[g_alloc_nsites] = ALLOC_MAX_SITES;
+    for (size_t i = 1; i < nsites; ++i) {
+        size_t cur = order[i], j = i;
+        for (; j > 0 && g_alloc_sites[order[j - 1]].count < g_alloc_sites[cur].count; --j)
+            order[j] = order[j - 1];
+        order[j] = cur;
+    }
+
+    fprintf(fp, "allocations: %zu calls, %zu bytes, peak live %zu bytes, live %zu bytes\n",
+            g_alloc_totals.count, g_alloc_totals.bytes, g_alloc_totals.peak, g_alloc_totals.live);
+    fprintf(fp, "%-44s %10s %12s %10s", "site", "calls", "bytes", "live");
+    for (size_t b = 0; b + 1 < ALLOC_BUCKETS; ++b) {
+        char head[24] = "";
+        if (ALLOC_BUCKET_LIMITS[b] >= 1024) snprintf(head, sizeof(head), "<=%zuK", ALLOC_BUCKET_LIMITS[b] / 1024);
+        else snprintf(head, sizeof(head), "<=%zu", ALLOC_BUCKET_LIMITS[b]);
+        fprintf(fp, " %8s", head);
+    }
+    fprintf(fp, " %8s\n", "more");
+    for (size_t i = 0; i < nsites; ++i) {
+        const alloc_site_t *site = &g_alloc_sites[order[i]];
+        const char *name = strrchr(site->file, '/');
+        char where[64] = "";
+        if (order[i] == ALLOC_MAX_SITES) snprintf(where, sizeof(where), "other");
+        else snprintf(where, sizeof(where), "%s:%d %s", name ? name + 1 : site->file, site->line, site->func);
+        fprintf(fp, "%-44s %10zu %12zu %10zu", where, site->count, site->bytes, site->live);
+        for (size_t b = 0; b < ALLOC_BUCKETS; ++b)
+            fprintf(fp, " %8zu", site->buckets[b]);
+        fprintf(fp, "\n");
+    }
+    pthread_mutex_unlock(&g_alloc_lock);
+}
+
+#endif // ALLOC_STATS
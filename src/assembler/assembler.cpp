@@ -0,0 +1,437 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "assembler.h"
+#include "base.h"
+
+enum ARG_KIND {
+    ARG_NONE,
+    ARG_NUMBER,
+    ARG_REG,
+    ARG_MEM,
+    ARG_LABEL,
+};
+
+typedef struct {
+    const char     *name;
+    SPU_OP::SPU_OP  op;
+    ARG_KIND        arg;
+} mnemonic_t;
+
+global const mnemonic_t MNEMONICS[] = {
+    {"HLT",   SPU_OP::HLT,   ARG_NONE},
+    {"PUSH",  SPU_OP::PUSH,  ARG_NUMBER},
+    {"PUSHR", SPU_OP::PUSHR, ARG_REG},
+    {"POPR",  SPU_OP::POPR,  ARG_REG},
+    {"PUSHM", SPU_OP::PUSHM, ARG_MEM},
+    {"POPM",  SPU_OP::POPM,  ARG_MEM},
+    {"ADD",   SPU_OP::ADD,   ARG_NONE},
+    {"SUB",   SPU_OP::SUB,   ARG_NONE},
+    {"MUL",   SPU_OP::MUL,   ARG_NONE},
+    {"DIV",   SPU_OP::DIV,   ARG_NONE},
+    {"MOD",   SPU_OP::MOD,   ARG_NONE},
+    {"SQRT",  SPU_OP::SQRT,  ARG_NONE},
+    {"SIN",   SPU_OP::SIN,   ARG_NONE},
+    {"COS",   SPU_OP::COS,   ARG_NONE},
+    {"IN",    SPU_OP::IN,    ARG_NONE},
+    {"OUT",   SPU_OP::OUT,   ARG_NONE},
+    {"JMP",   SPU_OP::JMP,   ARG_LABEL},
+    {"JE",    SPU_OP::JE,    ARG_LABEL},
+    {"JNE",   SPU_OP::JNE,   ARG_LABEL},
+    {"JB",    SPU_OP::JB,    ARG_LABEL},
+    {"JA",    SPU_OP::JA,    ARG_LABEL},
+    {"JBE",   SPU_OP::JBE,   ARG_LABEL},
+    {"JAE",   SPU_OP::JAE,   ARG_LABEL},
+    {"CALL",  SPU_OP::CALL,  ARG_LABEL},
+    {"RET",   SPU_OP::RET,   ARG_NONE},
+    {"DRAW",  SPU_OP::DRAW,  ARG_NUMBER},
+};
+
+/* тот же порядок, что и REGISTERS в бэкенде */
+global const char *REGISTER_NAMES[SPU_REGISTERS] = {"RAX", "RBX", "RCX", "RDX", "RTX", "DED", "INSIDE", "CURVA"};
+
+typedef struct {
+    const char *str;
+    size_t      len;
+} slice_t;
+
+typedef struct {
+    const char *name;           /**< Указатель в исходный текст; nullptr - пустая ячейка. */
+    size_t      len;
+    uint64_t    hash;
+    size_t      addr;
+} label_entry_t;
+
+/**
+ * @brief Открытая адресация с линейным пробированием, емкость - степень двойки.
+ */
+typedef struct {
+    label_entry_t *data;
+    size_t         capacity;
+    size_t         size;
+} label_table_t;
+
+typedef struct {
+    size_t  at;                 /**< Индекс слова-операнда в коде. */
+    slice_t name;
+    size_t  line;
+} fixup_t;
+
+typedef struct {
+    fixup_t *data;
+    size_t   size;
+    size_t   capacity;
+} fixup_list_t;
+
+function uint64_t hash_slice(slice_t s);
+function int table_grow(label_table_t *table);
+function label_entry_t *table_find(const label_table_t *table, slice_t name, uint64_t hash);
+function int table_insert(label_table_t *table, slice_t name, size_t addr, size_t line);
+function int emit_word(spu_program_t *prog, uint64_t word);
+function int add_fixup(fixup_list_t *list, size_t at, slice_t name, size_t line);
+function int add_symbol(spu_program_t *prog, slice_t name);
+function int copy_symbol_names(spu_program_t *prog);
+function slice_t next_token(const char **cur, const char *end);
+function bool slice_eq(slice_t s, const char *lit);
+function const mnemonic_t *find_mnemonic(slice_t s);
+function int find_register(slice_t s);
+function int parse_number(slice_t s, double *out);
+function int assemble_line(spu_program_t *prog, label_table_t *labels, fixup_list_t *fixups, const char *cur, const char *end, size_t line);
+function int resolve_fixups(spu_program_t *prog, const label_table_t *labels, const fixup_list_t *fixups);
+
+/**
+ * @brief FNV-1a по байтам имени метки.
+ */
+function uint64_t hash_slice(slice_t s) {
+    uint64_t h = 1469598103934665603ULL;
+    for (size_t i = 0; i < s.len; ++i) {
+        h ^= (unsigned char) s.str[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+function int table_grow(label_table_t *table) {
+    size_t cap = table->capacity ? table->capacity * 2 : 256;
+    label_entry_t *data = TYPED_CALLOC(cap, label_entry_t);
+    if (!data) return -1;
+    for (size_t i = 0; i < table->capacity; ++i) {
+        const label_entry_t *e = &table->data[i];
+        if (!e->name) continue;
+        size_t pos = e->hash & (cap - 1);
+        while (data[pos].name)
+            pos = (pos + 1) & (cap - 1);
+        data[pos] = *e;
+    }
+    free(table->data);
+    table->data = data;
+    table->capacity = cap;
+    return 0;
+}
+
+function label_entry_t *table_find(const label_table_t *table, slice_t name, uint64_t hash) {
+    if (!table->capacity) return nullptr;
+    size_t pos = hash & (table->capacity - 1);
+    while (table->data[pos].name) {
+        label_entry_t *e = &table->data[pos];
+        if (e->hash == hash && e->len == name.len && memcmp(e->name, name.str, name.len) == 0)
+            return e;
+        pos = (pos + 1) & (table->capacity - 1);
+    }
+    return nullptr;
+}
+
+function int table_insert(label_table_t *table, slice_t name, size_t addr, size_t line) {
+    if (2 * (table->size + 1) > table->capacity && table_grow(table)) {
+        fprintf(stderr, "не удалось выделить память под таблицу меток\n");
+        return -1;
+    }
+    uint64_t hash = hash_slice(name);
+    if (table_find(table, name, hash)) {
+        fprintf(stderr, "строка %zu: метка :%.*s объявлена повторно\n", line, (int) name.len, name.str);
+        return -1;
+    }
+    size_t pos = hash & (table->capacity - 1);
+    while (table->data[pos].name)
+        pos = (pos + 1) & (table->capacity - 1);
+    table->data[pos].name = name.str;
+    table->data[pos].len = name.len;
+    table->data[pos].hash = hash;
+    table->data[pos].addr = addr;
+    table->size++;
+    return 0;
+}
+
+function int emit_word(spu_program_t *prog, uint64_t word) {
+    if (prog->size >= prog->capacity) {
+        size_t cap = prog->capacity ? prog->capacity * 2 : 1024;
+        uint64_t *tmp = TYPED_REALLOC(prog->code, cap, uint64_t);
+        if (!tmp) {
+            fprintf(stderr, "не удалось выделить память под байт-код\n");
+            return -1;
+        }
+        prog->code = tmp;
+        prog->capacity = cap;
+    }
+    prog->code[prog->size++] = word;
+    return 0;
+}
+
+function int add_fixup(fixup_list_t *list, size_t at, slice_t name, size_t line) {
+    if (list->size >= list->capacity) {
+        size_t cap = list->capacity ? list->capacity * 2 : 256;
+        fixup_t *tmp = TYPED_REALLOC(list->data, cap, fixup_t);
+        if (!tmp) {
+            fprintf(stderr, "не удалось выделить память под ссылки на метки\n");
+            return -1;
+        }
+        list->data = tmp;
+        list->capacity = cap;
+    }
+    list->data[list->size].at = at;
+    list->data[list->size].name = name;
+    list->data[list->size].line = line;
+    list->size++;
+    return 0;
+}
+
+function int add_symbol(spu_program_t *prog, slice_t name) {
+    if (prog->symbol_count >= prog->symbol_capacity) {
+        size_t cap = prog->symbol_capacity ? prog->symbol_capacity * 2 : 256;
+        spu_symbol_t *tmp = TYPED_REALLOC(prog->symbols, cap, spu_symbol_t);
+        if (!tmp) {
+            fprintf(stderr, "не удалось выделить память под таблицу символов\n");
+            return -1;
+        }
+        prog->symbols = tmp;
+        prog->symbol_capacity = cap;
+    }
+    spu_symbol_t *sym = &prog->symbols[prog->symbol_count++];
+    sym->addr = prog->size;
+    sym->name = name.str;
+    sym->len = name.len;
+    return 0;
+}
+
+/**
+ * @brief Переносит имена меток из исходного текста в собственный буфер программы.
+ */
+function int copy_symbol_names(spu_program_t *prog) {
+    size_t total = 0;
+    for (size_t i = 0; i < prog->symbol_count; ++i)
+        total += prog->symbols[i].len;
+    prog->names = TYPED_CALLOC(total ? total : 1, char);
+    if (!prog->names) return -1;
+    char *dst = prog->names;
+    for (size_t i = 0; i < prog->symbol_count; ++i) {
+        memcpy(dst, prog->symbols[i].name, prog->symbols[i].len);
+        prog->symbols[i].name = dst;
+        dst += prog->symbols[i].len;
+    }
+    return 0;
+}
+
+/**
+ * @brief Возвращает следующее слово строки; ';' начинает комментарий.
+ */
+function slice_t next_token(const char **cur, const char *end) {
+    const char *p = *cur;
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+        ++p;
+    slice_t tok = {p, 0};
+    if (p < end && *p == ';') {
+        *cur = end;
+        return tok;
+    }
+    while (p < end && *p != ' ' && *p != '\t' && *p != '\r' && *p != ';')
+        ++p;
+    tok.len = (size_t) (p - tok.str);
+    *cur = p;
+    return tok;
+}
+
+function bool slice_eq(slice_t s, const char *lit) {
+    if (!s.len || s.str[0] != lit[0]) return false;
+    size_t n = strlen(lit);
+    return s.len == n && memcmp(s.str, lit, n) == 0;
+}
+
+function const mnemonic_t *find_mnemonic(slice_t s) {
+    for (size_t i = 0; i < ARRAY_COUNT(MNEMONICS); ++i) {
+        if (slice_eq(s, MNEMONICS[i].name))
+            return &MNEMONICS[i];
+    }
+    return nullptr;
+}
+
+function int find_register(slice_t s) {
+    for (size_t i = 0; i < ARRAY_COUNT(REGISTER_NAMES); ++i) {
+        if (slice_eq(s, REGISTER_NAMES[i]))
+            return (int) i;
+    }
+    return -1;
+}
+
+function int parse_number(slice_t s, double *out) {
+    char buf[64] = "";
+    if (!s.len || s.len >= sizeof(buf)) return -1;
+    memcpy(buf, s.str, s.len);
+    char *end = nullptr;
+    *out = strtod(buf, &end);
+    return (end == buf + s.len) ? 0 : -1;
+}
+
+/**
+ * @brief Первый проход для одной строки: метка в таблицу или команда в код.
+ */
+function int assemble_line(spu_program_t *prog, label_table_t *labels, fixup_list_t *fixups, const char *cur, const char *end, size_t line) {
+    slice_t head = next_token(&cur, end);
+    if (!head.len) return 0;
+
+    if (head.str[0] == ':') {
+        slice_t name = {head.str + 1, head.len - 1};
+        if (!name.len) {
+            fprintf(stderr, "строка %zu: пустое имя метки\n", line);
+            return -1;
+        }
+        if (table_insert(labels, name, prog->size, line)) return -1;
+        if (add_symbol(prog, name)) return -1;
+        if (next_token(&cur, end).len) {
+            fprintf(stderr, "строка %zu: лишний текст после метки\n", line);
+            return -1;
+        }
+        return 0;
+    }
+
+    const mnemonic_t *mn = find_mnemonic(head);
+    if (!mn) {
+        fprintf(stderr, "строка %zu: неизвестная команда %.*s\n", line, (int) head.len, head.str);
+        return -1;
+    }
+    slice_t arg = next_token(&cur, end);
+    if ((mn->arg == ARG_NONE) != (arg.len == 0) || next_token(&cur, end).len) {
+        fprintf(stderr, "строка %zu: неверное число операндов у %s\n", line, mn->name);
+        return -1;
+    }
+
+    int reg = 0;
+    switch (mn->arg) {
+        case ARG_NONE:
+            return emit_word(prog, SPU_MAKE_WORD(mn->op, 0));
+        case ARG_NUMBER: {
+            double num = 0.0;
+            if (parse_number(arg, &num)) {
+                fprintf(stderr, "строка %zu: ожидалось число, получено %.*s\n", line, (int) arg.len, arg.str);
+                return -1;
+            }
+            uint64_t bits = 0;
+            memcpy(&bits, &num, sizeof(bits));
+            if (emit_word(prog, SPU_MAKE_WORD(mn->op, 0))) return -1;
+            return emit_word(prog, bits);
+        }
+        case ARG_MEM:
+            if (arg.len < 3 || arg.str[0] != '[' || arg.str[arg.len - 1] != ']') {
+                fprintf(stderr, "строка %zu: ожидалось [регистр], получено %.*s\n", line, (int) arg.len, arg.str);
+                return -1;
+            }
+            arg.str++;
+            arg.len -= 2;
+            /* fallthrough */
+        case ARG_REG:
+            reg = find_register(arg);
+            if (reg < 0) {
+                fprintf(stderr, "строка %zu: неизвестный регистр %.*s\n", line, (int) arg.len, arg.str);
+                return -1;
+            }
+            return emit_word(prog, SPU_MAKE_WORD(mn->op, reg));
+        case ARG_LABEL: {
+            if (arg.str[0] != ':' || arg.len < 2) {
+                fprintf(stderr, "строка %zu: ожидалась метка, получено %.*s\n", line, (int) arg.len, arg.str);
+                return -1;
+            }
+            slice_t name = {arg.str + 1, arg.len - 1};
+            if (emit_word(prog, SPU_MAKE_WORD(mn->op, 0))) return -1;
+            if (add_fixup(fixups, prog->size, name, line)) return -1;
+            return emit_word(prog, 0);
+        }
+        default:
+            return -1;
+    }
+}
+
+/**
+ * @brief Второй проход: проставляет адреса меток в операнды переходов.
+ */
+function int resolve_fixups(spu_program_t *prog, const label_table_t *labels, const fixup_list_t *fixups) {
+    for (size_t i = 0; i < fixups->size; ++i) {
+        const fixup_t *f = &fixups->data[i];
+        const label_entry_t *e = table_find(labels, f->name, hash_slice(f->name));
+        if (!e) {
+            fprintf(stderr, "строка %zu: метка :%.*s не объявлена\n", f->line, (int) f->name.len, f->name.str);
+            return -1;
+        }
+        prog->code[f->at] = (uint64_t) e->addr;
+    }
+    return 0;
+}
+
+int assemble(const char *text, size_t len, spu_program_t *prog) {
+    if (!text || !prog) return -1;
+    *prog = {};
+    label_table_t labels = {};
+    fixup_list_t fixups = {};
+
+    int rc = 0;
+    const char *cur = text;
+    const char *end = text + len;
+    for (size_t line = 1; cur < end && !rc; ++line) {
+        const char *eol = (const char *) memchr(cur, '\n', (size_t) (end - cur));
+        if (!eol) eol = end;
+        rc = assemble_line(prog, &labels, &fixups, cur, eol, line);
+        cur = eol + 1;
+    }
+    if (!rc)
+        rc = resolve_fixups(prog, &labels, &fixups);
+    if (!rc)
+        rc = copy_symbol_names(prog);
+
+    free(labels.data);
+    free(fixups.data);
+    if (rc)
+        destruct_program(prog);
+    return rc;
+}
+
+int write_bytecode(const spu_program_t *prog, FILE *out) {
+    if (!prog || !out) return -1;
+    spu_header_t hdr = {};
+    hdr.signature = SPU_SIGNATURE;
+    hdr.version = SPU_VERSION;
+    hdr.byte_count = prog->size * sizeof(uint64_t);
+    hdr.assembly_date = (uint64_t) time(nullptr);
+    if (fwrite(&hdr, sizeof(hdr), 1, out) != 1) return -1;
+    if (prog->size && fwrite(prog->code, sizeof(uint64_t), prog->size, out) != prog->size) return -1;
+
+    uint64_t count = prog->symbol_count;
+    if (fwrite(&count, sizeof(count), 1, out) != 1) return -1;
+    for (size_t i = 0; i < prog->symbol_count; ++i) {
+        const spu_symbol_t *sym = &prog->symbols[i];
+        uint64_t meta[2] = {sym->addr, sym->len};
+        uint64_t pad = 0;
+        size_t tail = (sizeof(uint64_t) - sym->len % sizeof(uint64_t)) % sizeof(uint64_t);
+        if (fwrite(meta, sizeof(meta), 1, out) != 1) return -1;
+        if (sym->len && fwrite(sym->name, 1, sym->len, out) != sym->len) return -1;
+        if (tail && fwrite(&pad, 1, tail, out) != tail) return -1;
+    }
+    return 0;
+}
+
+void destruct_program(spu_program_t *prog) {
+    if (!prog) return;
+    free(prog->code);
+    free(prog->symbols);
+    free(prog->names);
+    *prog = {};
+}
@@ -0,0 +1,52 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "assembler.h"
+#include "base.h"
+#include "io_utils.h"
+
+function void usage(const char *prog) {
+    fprintf(stderr, "usage: %s <input.asm> [output.spu]\n", prog ? prog : "assembler");
+}
+
+/**
+ * @brief CLI: assembler <input.asm> [output.spu]; по умолчанию пишет в a.spu.
+ */
+int main(int argc, char **argv) {
+    if (argc < 2 || !argv[1] || !argv[1][0]) {
+        usage(argc ? argv[0] : "assembler");
+        return 1;
+    }
+    const char *input = argv[1];
+    const char *output = (argc > 2 && argv[2] && argv[2][0]) ? argv[2] : "a.spu";
+
+    size_t len = 0;
+    char *text = read_file_to_buf(input, &len);
+    if (!text) {
+        fprintf(stderr, "cannot read %s\n", input);
+        return 1;
+    }
+
+    spu_program_t prog = {};
+    int rc = assemble(text, len, &prog);
+    free(text);
+    if (rc) {
+        fprintf(stderr, "assembly failed on %s\n", input);
+        return 1;
+    }
+
+    FILE *fp = fopen(output, "wb");
+    if (!fp) {
+        fprintf(stderr, "cannot open %s for writing\n", output);
+        destruct_program(&prog);
+        return 1;
+    }
+    rc = write_bytecode(&prog, fp);
+    fclose(fp);
+    destruct_program(&prog);
+    if (rc) {
+        fprintf(stderr, "cannot write %s\n", output);
+        return 1;
+    }
+    return 0;
+}
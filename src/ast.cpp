@@ -5,6 +5,7 @@
 
 #include "ast.h"
 #include "base.h"
+#include "frontend.h"
 #include "io_utils.h"
 
 /** Проверяет, что токен является заданным ключевым словом. */
@@ -57,6 +58,26 @@ NODE_T *new_node(NODE_TYPE type, NODE_VALUE_T value, NODE_T *left, NODE_T *right
     return node;
 }
 
+/**
+ * @brief Рекурсивно копирует поддерево.
+ */
+NODE_T *clone_node(const NODE_T *node) {
+    if (!node) return nullptr;
+    NODE_T *left = clone_node(node->left);
+    if (node->left && !left) return nullptr;
+    NODE_T *right = clone_node(node->right);
+    if (node->right && !right) {
+        destruct_node(left);
+        return nullptr;
+    }
+    NODE_T *copy = new_node(node->type, node->value, left, right);
+    if (!copy) {
+        destruct_node(left);
+        destruct_node(right);
+    }
+    return copy;
+}
+
 /**
  * @brief Возвращает true если оба потомка заданы.
  */
@@ -260,12 +281,8 @@ static int read_token(ast_loader_t *p, char *out, size_t cap, bool *is_str) {
 
 static size_t intern_literal(ast_loader_t *p, const char *text) {
     if (!p || !p->vars || !text) return (size_t)-1;
-    char *dup = strdup(text);
-    if (!dup) return (size_t)-1;
-    mystr::mystr_t str = mystr::construct(dup);
-    size_t idx = varlist::add(p->vars, &str);
-    free(dup);
-    return idx;
+    mystr::mystr_t str = mystr::construct(text);
+    return varlist::add(p->vars, &str);
 }
 
 static bool parse_keyword(const char *tok, KEYWORD::KEYWORD *out) {
@@ -474,4 +491,83 @@ void destroy_ast(NODE_T *root, varlist::VarList *vars) {
     destruct_node(root);
     if (vars)
         varlist::destruct(vars);
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Строит индекс начал строк ctx->line_starts, если его еще нет.
+ * @return 0 при успехе, -1 при нехватке памяти.
+ */
+static int ensure_line_index(FRONT_COMPL_T *ctx) {
+    if (ctx->line_starts) return 0;
+    const char *buf = ctx->buf, *end = ctx->buf + ctx->buf_len;
+    size_t count = 1;
+    for (const char *nl = buf; (nl = (const char *) memchr(nl, '\n', (size_t) (end - nl))); ++nl)
+        ++count;
+    size_t *starts = TYPED_CALLOC(count, size_t);
+    if (!starts) return -1;
+    size_t n = 1;
+    for (const char *nl = buf; (nl = (const char *) memchr(nl, '\n', (size_t) (end - nl))); ++nl)
+        starts[n++] = (size_t) (nl + 1 - buf);
+    ctx->line_starts = starts;
+    ctx->line_count = count;
+    return 0;
+}
+
+/**
+ * @brief Начинается ли с токена first тройка кавычка-содержимое-кавычка одной строки "...".
+ */
+static bool is_string_at(const FRONT_COMPL_T *ctx, size_t first) {
+    if (first + 2 >= ctx->lexed_count) return false;
+    const TOKEN_T *open = &ctx->tokens[first];
+    const TOKEN_T *body = open + 1;
+    const TOKEN_T *close = open + 2;
+    return open->node.type == DELIMITER_T && open->node.value.delimiter == DELIMITER::QUOTE &&
+           body->node.type == LITERAL_T && body->text == open->text + 1 &&
+           close->node.type == DELIMITER_T && close->node.value.delimiter == DELIMITER::QUOTE &&
+           close->text == body->text + body->length;
+}
+
+/**
+ * @brief Токен, по которому считается позиция токена idx.
+ *
+ * Лексер всегда ставил всем трем токенам строки "..." позицию ее содержимого
+ * (открывающая кавычка + 1); дампы и диагностика это сохраняют.
+ */
+static const TOKEN_T *location_anchor(const FRONT_COMPL_T *ctx, size_t idx) {
+    const TOKEN_T *tok = &ctx->tokens[idx];
+    if (tok->node.type != DELIMITER_T || tok->node.value.delimiter != DELIMITER::QUOTE) return tok;
+    if (is_string_at(ctx, idx)) return tok + 1;
+    if (idx >= 2 && is_string_at(ctx, idx - 2)) return tok - 1;
+    return tok;
+}
+
+/**
+ * @brief Находит строку и позицию токена (с 1) по его смещению в буфере.
+ *
+ * Строка - двоичный поиск по индексу начал строк (живет до lexer_reset/lexer_recycle),
+ * позиция - число символов UTF-8 от начала строки, как раньше считал лексер.
+ * @return 0 при успехе, -1 если позиции нет.
+ */
+int token_location(FRONT_COMPL_T *ctx, size_t idx, int32_t *line, int32_t *pos) {
+    if (!ctx || !line || !pos) return -1;
+    *line = 0;
+    *pos = 0;
+    if (idx >= ctx->lexed_count || !ctx->buf || ensure_line_index(ctx)) return -1;
+    const TOKEN_T *tok = location_anchor(ctx, idx);
+    if (!tok->text || tok->text < ctx->buf || tok->text > ctx->buf + ctx->buf_len) return -1;
+    size_t offset = (size_t) (tok->text - ctx->buf);
+
+    /* последняя строка, начало которой не дальше offset */
+    size_t lo = 0, hi = ctx->line_count;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (ctx->line_starts[mid] <= offset) lo = mid;
+        else hi = mid;
+    }
+    size_t chars = 0;
+    for (size_t i = ctx->line_starts[lo]; i < offset; ++i)
+        chars += ((unsigned char) ctx->buf[i] & 0xC0) != 0x80;
+    *line = (int32_t) (lo + 1);
+    *pos = (int32_t) (chars + 1);
+    return 0;
+}
@@ -1,55 +1,132 @@
+#include <errno.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "ast.h"
+#include "backend.h"
 #include "base.h"
 #include "io_utils.h"
+#include "middleend.h"
+#include "profile.h"
 
 global const char *REGISTERS[8] = {"RAX", "RBX", "RCX", "RDX", "RTX", "DED", "INSIDE", "CURVA"};
 
-global size_t g_if_counter = 0;
-global size_t g_while_counter = 0;
-global size_t g_do_counter = 0;
-global size_t g_tmp_counter = 0;
+/** Длина буфера метки с учетом префикса подстановки и имени функции. */
+const size_t LABEL_CAP = 256;
+/** Префикс меток функции "<имя>."; для более длинных имен - "f<хэш имени>.". */
+const size_t LABEL_NS_CAP = 160;
+/** Меняется вместе с кодогенерацией: старые записи кэша тогда не подходят. */
+global const char CACHE_VERSION[] = "physlab-backend-cache 1";
+/** Подставляются функции не больше этого числа узлов AST... */
+const size_t PGO_INLINE_MAX_NODES = 64;
+/** ...вызванные в профиле хотя бы столько раз. */
+const uint64_t PGO_INLINE_MIN_CALLS = 16;
 
+global const profile_t *g_profile = nullptr;
+global const NODE_T *g_functions = nullptr;
+/** Каталог кэша кода функций (backend_set_cache) или nullptr. */
+global const char *g_cache_dir = nullptr;
+/** Потоков генерации ФОРМУЛ (backend_set_threads). */
+global size_t g_threads = 1;
+
+/** Нумерация меток одного тела: main или ФОРМУЛЫ вместе с подставленными в нее функциями. */
 typedef struct {
-    const mystr::mystr_t *name;
-    const char           *reg;
-} binding_t;
+    size_t      if_id,
+                while_id,
+                do_id,
+                tmp_id,
+                inline_id;
+    const char *func_ns;    /**< "<имя>." у ФОРМУЛЫ, "" у main. */
+    const char *ns;         /**< Префикс текущих меток: func_ns или префикс подставленного тела. */
+    const char *profile_ns; /**< Префикс тех же меток в профиле: у подставленного тела - ns вызываемой ФОРМУЛЫ. */
+} labels_t;
 
 typedef struct {
     const NODE_T         *func_node;
     const mystr::mystr_t *func_name;
     varlist::VarList     *globals;
-    binding_t             bindings[8];
-    size_t                bind_count;
-    const char           *param_regs[8];
+    uint8_t              *slot_of;      /**< По id имени в globals: номер регистра + 1, 0 - имя не связано. */
+    size_t                var_count;
+    size_t                bind_count;   /**< Регистры 0..bind_count-1 заняты, по одному на имя. */
+    size_t                param_regs[8];
     size_t                param_count;
+    const char           *ret_lbl;      /**< Для подставленного тела: RETURN - переход сюда вместо RET. */
+    FILE                 *cold;         /**< С профилем: холодные ветви, выводятся после RET/HLT. */
+    size_t                loop_depth;
+    labels_t             *labels;
 } func_ctx_t;
 
-function void make_label(char *buf, size_t cap, const char *prefix, size_t id, const char *suffix);
+typedef struct {
+    const NODE_T *node;
+    uint64_t      calls;
+    char         *text;
+    size_t        len;
+} emitted_func_t;
+
+/** Поток emit_function_texts: подряд идущие функции [begin, end). */
+typedef struct {
+    const varlist::VarList *globals;
+    emitted_func_t         *funcs;
+    size_t                  begin,
+                            end;
+    int                     rc;
+} emit_shard_t;
+
+function void make_label(const func_ctx_t *ctx, char *buf, size_t cap, const char *prefix, size_t id, const char *suffix);
+function void function_ns(const mystr::mystr_t *fname, char *ns, size_t cap);
+function uint64_t profile_count(const func_ctx_t *ctx, const char *label);
+function bool same_label(const char *a, const char *b);
+function const char *comparison_jump(OPERATOR::OPERATOR op, bool inverse);
 function const mystr::mystr_t *literal_name(const varlist::VarList *vars, const NODE_T *node);
-function int find_binding(const func_ctx_t *ctx, const mystr::mystr_t *name);
-function const char *binding_reg(const func_ctx_t *ctx, const mystr::mystr_t *name);
-function int add_binding(func_ctx_t *ctx, const mystr::mystr_t *name, const char **out_reg);
-function const char *ensure_binding(func_ctx_t *ctx, const mystr::mystr_t *name);
+function size_t literal_id(const func_ctx_t *ctx, const NODE_T *node);
+function int init_bindings(func_ctx_t *ctx);
+function int binding_reg(const func_ctx_t *ctx, size_t id);
+function int add_binding(func_ctx_t *ctx, size_t id);
+function int ensure_binding(func_ctx_t *ctx, size_t id);
 function int collect_params(func_ctx_t *ctx, const NODE_T *node);
 function void collect_args_in_order(const NODE_T *node, const NODE_T **dst, size_t *count, size_t cap);
 function int emit_builtin_draw(func_ctx_t *ctx, const NODE_T *args, FILE *out);
 function int emit_builtin_set_pixel(func_ctx_t *ctx, const NODE_T *args, FILE *out);
-function const char *alloc_temp_reg(const func_ctx_t *ctx);
+function int alloc_temp_reg(const func_ctx_t *ctx);
 function int emit_call(func_ctx_t *ctx, const NODE_T *node, FILE *out);
+function bool is_self_tail_call(const func_ctx_t *ctx, const NODE_T *node);
+function int emit_tail_call(func_ctx_t *ctx, const NODE_T *node, FILE *out);
+function size_t callee_id(const NODE_T *call);
+function const NODE_T *find_function(const NODE_T *list, size_t id);
+function bool calls_function(const NODE_T *node, size_t id);
+function size_t count_nodes(const NODE_T *node);
+function const NODE_T *inline_candidate(const func_ctx_t *ctx, const mystr::mystr_t *fname, size_t id);
+function int emit_inline(func_ctx_t *ctx, const NODE_T *callee, FILE *out);
+function size_t count_list_items(const NODE_T *node);
+function size_t call_footprint(const func_ctx_t *ctx, const NODE_T *node, size_t depth);
+function size_t function_footprint(const func_ctx_t *ctx, const NODE_T *func, size_t depth);
+function bool row_loop_fits(const func_ctx_t *ctx, const NODE_T *loop, const row_loop_t *rows, const char **reason);
+function int emit_row_marker(const func_ctx_t *ctx, const row_loop_t *rows, size_t id, FILE *out);
+function void *emit_shard_main(void *arg);
+function int emit_function_texts(const varlist::VarList *globals, emitted_func_t *funcs, size_t count);
+function int emit_functions_buffered(const varlist::VarList *globals, const NODE_T *list, FILE *out);
 function int emit_assignment(func_ctx_t *ctx, const NODE_T *node, FILE *out, bool keep);
 function int emit_comparison_value(func_ctx_t *ctx, const NODE_T *node, FILE *out);
 function int emit_expression(func_ctx_t *ctx, const NODE_T *node, FILE *out);
-function int emit_conditional(func_ctx_t *ctx, const NODE_T *node, const char *true_lbl, const char *false_lbl, FILE *out);
+function int emit_conditional(func_ctx_t *ctx, const NODE_T *node, const char *true_lbl, const char *false_lbl, const char *next_lbl, FILE *out);
 function int emit_statement(func_ctx_t *ctx, const NODE_T *node, FILE *out, bool *did_ret);
+function void close_cold(func_ctx_t *ctx, char **cold, size_t *cold_len, FILE *out);
+function int emit_block(func_ctx_t *ctx, const NODE_T *node, char **text, size_t *len, bool *did_ret);
+function int emit_if_by_profile(func_ctx_t *ctx, const NODE_T *node, const char *then_lbl, const char *else_lbl,
+                                const char *end_lbl, FILE *out, bool *did_ret);
 function int emit_function(const varlist::VarList *globals, const NODE_T *node, FILE *out);
+function uint64_t hash_bytes(uint64_t h, const void *data, size_t len);
+function uint64_t hash_subtree(const varlist::VarList *globals, const NODE_T *node, uint64_t h);
+function uint64_t hash_callees(const func_ctx_t *ctx, const NODE_T *node, uint64_t h);
+function uint64_t function_hash(const varlist::VarList *globals, const NODE_T *node);
+function int emit_function_cached(const varlist::VarList *globals, const NODE_T *node, FILE *out);
 function int emit_function_list(const varlist::VarList *globals, const NODE_T *node, FILE *out);
 function int emit_builtin_draw(func_ctx_t *ctx, const NODE_T *args, FILE *out);
 function int emit_builtin_set_pixel(func_ctx_t *ctx, const NODE_T *args, FILE *out);
-function const char *alloc_temp_reg(const func_ctx_t *ctx);
 
 
 typedef int (*emit_builtin_func)(func_ctx_t *ctx, const NODE_T *args, FILE *out);
@@ -62,10 +139,57 @@ global struct {mystr::mystr_t name; emit_builtin_func func;} builtin_funcs[] = {
 /**
  * @brief Формирует текст метки вида :prefix<id>suffix.
  */
-function void make_label(char *buf, size_t cap, const char *prefix, size_t id, const char *suffix) {
+function void make_label(const func_ctx_t *ctx, char *buf, size_t cap, const char *prefix, size_t id, const char *suffix) {
     if (!buf || cap == 0) return;
     if (!suffix) suffix = "";
-    snprintf(buf, cap, ":%s%zu%s", prefix ? prefix : "", id, suffix);
+    snprintf(buf, cap, ":%s%s%zu%s", ctx->labels->ns, prefix ? prefix : "", id, suffix);
+}
+
+/**
+ * @brief Префикс меток ФОРМУЛЫ: "<имя>." или, для слишком длинного имени, "f<хэш>.".
+ */
+function void function_ns(const mystr::mystr_t *fname, char *ns, size_t cap) {
+    if (strlen(fname->str) + 2 <= cap)
+        snprintf(ns, cap, "%s.", fname->str);
+    else
+        snprintf(ns, cap, "f%016llx.", (unsigned long long) hash_bytes(0, fname->str, strlen(fname->str)));
+}
+
+/**
+ * @brief Счетчик метки в профиле; метка подставленного тела ищется под именем из вызываемой ФОРМУЛЫ.
+ */
+function uint64_t profile_count(const func_ctx_t *ctx, const char *label) {
+    const labels_t *labels = ctx->labels;
+    size_t ns_len = strlen(labels->ns);
+    if (!labels->profile_ns || strcmp(labels->profile_ns, labels->ns) == 0
+        || strncmp(label + 1, labels->ns, ns_len) != 0)
+        return profile_label_count(g_profile, label);
+    char mapped[LABEL_CAP + LABEL_NS_CAP] = "";
+    snprintf(mapped, sizeof(mapped), ":%s%s", labels->profile_ns, label + 1 + ns_len);
+    return profile_label_count(g_profile, mapped);
+}
+
+/**
+ * @brief Сравнивает тексты меток; nullptr не совпадает ни с чем.
+ */
+function bool same_label(const char *a, const char *b) {
+    return a && b && strcmp(a, b) == 0;
+}
+
+/**
+ * @brief Возвращает условный переход для сравнения или для его отрицания (nullptr, если отрицания нет).
+ */
+function const char *comparison_jump(OPERATOR::OPERATOR op, bool inverse) {
+    /* у упорядоченных сравнений отрицания нет: с NaN ложны и a < b, и a >= b */
+    switch (op) {
+        case OPERATOR::EQ:       return inverse ? "JNE" : "JE";
+        case OPERATOR::NEQ:      return inverse ? "JE"  : "JNE";
+        case OPERATOR::BELOW:    return inverse ? nullptr : "JB";
+        case OPERATOR::ABOVE:    return inverse ? nullptr : "JA";
+        case OPERATOR::BELOW_EQ: return inverse ? nullptr : "JBE";
+        case OPERATOR::ABOVE_EQ: return inverse ? nullptr : "JAE";
+        default:                 return nullptr;
+    }
 }
 
 /**
@@ -77,52 +201,57 @@ function const mystr::mystr_t *literal_name(const varlist::VarList *vars, const
 }
 
 /**
- * @brief Ищет индекс биндинга по имени.
+ * @brief Возвращает id имени literal-узла или varlist::NPOS.
  */
-function int find_binding(const func_ctx_t *ctx, const mystr::mystr_t *name) {
-    if (!ctx || !name) return -1;
-    for (size_t i = 0; i < ctx->bind_count; ++i) {
-        if (ctx->bindings[i].name && ctx->bindings[i].name->is_same(name))
-            return (int) i;
-    }
-    return -1;
+function size_t literal_id(const func_ctx_t *ctx, const NODE_T *node) {
+    if (!ctx || !node || node->type != LITERAL_T || node->value.id >= ctx->var_count) return varlist::NPOS;
+    return node->value.id;
 }
 
 /**
- * @brief Возвращает регистр, связанный с именем, или NULL.
+ * @brief Заводит пустую таблицу регистров имен; освобождает вызывающий (free(ctx->slot_of)).
+ *
+ * Имена связываются с регистрами по id из VarList, так что поиск регистра - одно
+ * обращение к таблице, без сравнения строк; текст регистра нужен только при выводе.
+ * @return 0 при успехе, -1 при нехватке памяти.
  */
-function const char *binding_reg(const func_ctx_t *ctx, const mystr::mystr_t *name) {
-    int idx = find_binding(ctx, name);
-    return (idx >= 0) ? ctx->bindings[idx].reg : nullptr;
+function int init_bindings(func_ctx_t *ctx) {
+    ctx->var_count = varlist::size(ctx->globals);
+    ctx->slot_of = TYPED_CALLOC(ctx->var_count + 1, uint8_t);
+    return ctx->slot_of ? 0 : -1;
+}
+
+/**
+ * @brief Возвращает регистр, связанный с именем, или -1.
+ */
+function int binding_reg(const func_ctx_t *ctx, size_t id) {
+    if (!ctx || id >= ctx->var_count) return -1;
+    return (int) ctx->slot_of[id] - 1;
 }
 
 /**
  * @brief Назначает следующий свободный регистр имени переменной.
+ * @return номер регистра или -1.
  */
-function int add_binding(func_ctx_t *ctx, const mystr::mystr_t *name, const char **out_reg) {
-    if (!ctx || !name) return -1;
-    if (ctx->bind_count >= ARRAY_COUNT(ctx->bindings)) {
+function int add_binding(func_ctx_t *ctx, size_t id) {
+    if (!ctx || id >= ctx->var_count) return -1;
+    if (ctx->bind_count >= ARRAY_COUNT(REGISTERS)) {
         fprintf(stderr, "функция %s требует %zu переменных; максимум 8 (только регистровый бэкенд).\n",
                 ctx->func_name && ctx->func_name->str ? ctx->func_name->str : "<unnamed>",
                 ctx->bind_count + 1);
         return -1;
     }
-    size_t idx = ctx->bind_count;
-    ctx->bindings[idx].name = name;
-    ctx->bindings[idx].reg = REGISTERS[idx];
-    ctx->bind_count++;
-    if (out_reg) *out_reg = ctx->bindings[idx].reg;
-    return 0;
+    size_t reg = ctx->bind_count++;
+    ctx->slot_of[id] = (uint8_t) (reg + 1);
+    return (int) reg;
 }
 
 /**
  * @brief Возвращает регистр переменной, создавая биндинг при необходимости.
  */
-function const char *ensure_binding(func_ctx_t *ctx, const mystr::mystr_t *name) {
-    const char *reg = binding_reg(ctx, name);
-    if (reg) return reg;
-    if (add_binding(ctx, name, &reg)) return nullptr;
-    return reg;
+function int ensure_binding(func_ctx_t *ctx, size_t id) {
+    int reg = binding_reg(ctx, id);
+    return reg >= 0 ? reg : add_binding(ctx, id);
 }
 
 /**
@@ -135,30 +264,18 @@ function int collect_params(func_ctx_t *ctx, const NODE_T *node) {
         if (collect_params(ctx, node->right)) return -1;
         return 0;
     }
-    const mystr::mystr_t *nm = literal_name(ctx->globals, node);
-    if (!nm) return -1;
-    const char *reg = ensure_binding(ctx, nm);
-    if (!reg) return -1;
+    int reg = ensure_binding(ctx, literal_id(ctx, node));
+    if (reg < 0) return -1;
     if (ctx->param_count < ARRAY_COUNT(ctx->param_regs))
-        ctx->param_regs[ctx->param_count++] = reg;
+        ctx->param_regs[ctx->param_count++] = (size_t) reg;
     return 0;
 }
 
-function bool reg_used(const func_ctx_t *ctx, const char *reg) {
-    if (!ctx || !reg) return true;
-    for (size_t i = 0; i < ctx->bind_count; ++i) {
-        if (ctx->bindings[i].reg && strcmp(ctx->bindings[i].reg, reg) == 0)
-            return true;
-    }
-    return false;
-}
-
-function const char *alloc_temp_reg(const func_ctx_t *ctx) {
-    for (size_t i = 0; i < ARRAY_COUNT(REGISTERS); ++i) {
-        if (!reg_used(ctx, REGISTERS[i]))
-            return REGISTERS[i];
-    }
-    return nullptr;
+/**
+ * @brief Временный регистр: первый не занятый именами.
+ */
+function int alloc_temp_reg(const func_ctx_t *ctx) {
+    return ctx->bind_count < ARRAY_COUNT(REGISTERS) ? (int) ctx->bind_count : -1;
 }
 
 /**
@@ -203,19 +320,19 @@ function int emit_builtin_set_pixel(func_ctx_t *ctx, const NODE_T *args, FILE *o
     const NODE_T *val_node = ordered[0];
     const NODE_T *idx_node = ordered[1];
 
-    const char *tmp_reg = alloc_temp_reg(ctx);
-    if (!tmp_reg) {
+    int tmp_reg = alloc_temp_reg(ctx);
+    if (tmp_reg < 0) {
         fprintf(stderr, "нет свободных регистров для SET_PIXEL\n");
         return -1;
     }
 
     /* addr -> tmp_reg */
     if (emit_expression(ctx, idx_node, out)) return -1;
-    fprintf(out, "POPR %s\n", tmp_reg);
+    fprintf(out, "POPR %s\n", REGISTERS[tmp_reg]);
 
     /* val -> mem[tmp_reg] */
     if (emit_expression(ctx, val_node, out)) return -1;
-    fprintf(out, "POPM [%s]\n", tmp_reg);
+    fprintf(out, "POPM [%s]\n", REGISTERS[tmp_reg]);
     return 0;
 }
 
@@ -242,10 +359,253 @@ function int emit_call(func_ctx_t *ctx, const NODE_T *node, FILE *out) {
         if (emit_expression(ctx, arg, out)) return -1;
     }
 
+    const NODE_T *callee = inline_candidate(ctx, fname, name_node->value.id);
+    if (callee)
+        return emit_inline(ctx, callee, out);
     fprintf(out, "CALL :%s\n", fname->str);
     return 0;
 }
 
+/**
+ * @brief Проверяет, что выражение под RETURN - вызов текущей функции с полным набором аргументов.
+ */
+function bool is_self_tail_call(const func_ctx_t *ctx, const NODE_T *node) {
+    if (!ctx || !ctx->func_name || !node) return false;
+    if (node->type != KEYWORD_T || node->value.keyword != KEYWORD::FUNC_CALL) return false;
+    if (callee_id(node) != ctx->func_node->value.id) return false;
+
+    const NODE_T *ordered[16] = {};
+    size_t count = 0;
+    collect_args_in_order(node->right, ordered, &count, ARRAY_COUNT(ordered));
+    return count == ctx->param_count;
+}
+
+/**
+ * @brief Генерирует хвостовой самовызов: аргументы в стек и переход на пролог функции.
+ *
+ * Пролог снимает аргументы в регистры параметров, поэтому JMP на метку функции
+ * переприсваивает параметры без роста стека вызовов.
+ */
+function int emit_tail_call(func_ctx_t *ctx, const NODE_T *node, FILE *out) {
+    if (!ctx || !node || !out) return -1;
+    const NODE_T *ordered[16] = {};
+    size_t count = 0;
+    collect_args_in_order(node->right, ordered, &count, ARRAY_COUNT(ordered));
+    while (count > 0) {
+        const NODE_T *arg = ordered[--count];
+        if (emit_expression(ctx, arg, out)) return -1;
+    }
+
+    fprintf(out, "JMP :%s\n", ctx->func_name->str);
+    return 0;
+}
+
+/**
+ * @brief Id имени вызываемой функции или varlist::NPOS; имена в VarList уникальны, так что id заменяет сравнение строк.
+ */
+function size_t callee_id(const NODE_T *call) {
+    return (call->left && call->left->type == LITERAL_T) ? call->left->value.id : varlist::NPOS;
+}
+
+/**
+ * @brief Ищет функцию по id имени в списке функций программы.
+ */
+function const NODE_T *find_function(const NODE_T *list, size_t id) {
+    if (!list) return nullptr;
+    if (list->type == DELIMITER_T && list->value.delimiter == DELIMITER::COMA) {
+        const NODE_T *found = find_function(list->left, id);
+        return found ? found : find_function(list->right, id);
+    }
+    return (list->type == LITERAL_T && list->value.id == id) ? list : nullptr;
+}
+
+/**
+ * @brief Есть ли в поддереве вызов функции с id имени id.
+ */
+function bool calls_function(const NODE_T *node, size_t id) {
+    if (!node) return false;
+    if (node->type == KEYWORD_T && node->value.keyword == KEYWORD::FUNC_CALL && callee_id(node) == id)
+        return true;
+    return calls_function(node->left, id) || calls_function(node->right, id);
+}
+
+function size_t count_nodes(const NODE_T *node) {
+    if (!node) return 0;
+    return 1 + count_nodes(node->left) + count_nodes(node->right);
+}
+
+/**
+ * @brief Возвращает функцию для подстановки: горячую по профилю, маленькую и без самовызова.
+ *
+ * Внутри подставленного тела подстановка не делается: хватает одного уровня.
+ */
+function const NODE_T *inline_candidate(const func_ctx_t *ctx, const mystr::mystr_t *fname, size_t id) {
+    if (!g_profile || ctx->ret_lbl) return nullptr;
+    if (profile_label_count(g_profile, fname->str) < PGO_INLINE_MIN_CALLS) return nullptr;
+    const NODE_T *callee = find_function(g_functions, id);
+    if (!callee || count_nodes(callee->right) > PGO_INLINE_MAX_NODES) return nullptr;
+    if (calls_function(callee->right, id)) return nullptr;
+    return callee;
+}
+
+/**
+ * @brief Сколько первых регистров могут затереть вызовы в поддереве.
+ *
+ * Функция раздает регистры своим именам с RAX, как и вызывающая, поэтому вызов
+ * портит столько регистров, сколько разных имен в ней и в вызываемых ею функциях.
+ */
+function size_t call_footprint(const func_ctx_t *ctx, const NODE_T *node, size_t depth) {
+    if (!node) return 0;
+    size_t used = 0;
+    if (node->type == KEYWORD_T && node->value.keyword == KEYWORD::FUNC_CALL) {
+        const NODE_T *callee = find_function(g_functions, callee_id(node));
+        if (callee)
+            used = function_footprint(ctx, callee, depth + 1);
+        size_t args = call_footprint(ctx, node->right, depth);
+        return used > args ? used : args;
+    }
+    size_t left = call_footprint(ctx, node->left, depth);
+    size_t right = call_footprint(ctx, node->right, depth);
+    return left > right ? left : right;
+}
+
+function size_t function_footprint(const func_ctx_t *ctx, const NODE_T *func, size_t depth) {
+    if (depth > ARRAY_COUNT(REGISTERS)) return ARRAY_COUNT(REGISTERS);
+    size_t ids[ARRAY_COUNT(REGISTERS)] = {};
+    size_t count = 0;
+    /* обход без рекурсии по вызовам: имена самой функции - параметры и LITERAL_T тела */
+    const NODE_T *stack[256] = {};
+    size_t top = 0;
+    stack[top++] = func->left;
+    stack[top++] = func->right;
+    while (top && count < ARRAY_COUNT(ids)) {
+        const NODE_T *node = stack[--top];
+        if (!node) continue;
+        if (node->type == LITERAL_T) {
+            bool seen = false;
+            for (size_t i = 0; i < count && !seen; ++i)
+                seen = (ids[i] == node->value.id);
+            if (!seen) ids[count++] = node->value.id;
+            continue;
+        }
+        if (top + 2 > ARRAY_COUNT(stack)) return ARRAY_COUNT(REGISTERS);
+        bool is_call = node->type == KEYWORD_T && node->value.keyword == KEYWORD::FUNC_CALL;
+        if (!is_call) stack[top++] = node->left;
+        stack[top++] = node->right;
+    }
+    size_t nested = call_footprint(ctx, func->right, depth);
+    return count > nested ? count : nested;
+}
+
+/**
+ * @brief Проверяет то, чего не видно в AST: вызовы не затирают регистры величин, читаемых итерацией.
+ */
+function bool row_loop_fits(const func_ctx_t *ctx, const NODE_T *loop, const row_loop_t *rows, const char **reason) {
+    size_t clobbered = call_footprint(ctx, loop, 0);
+    for (size_t id = 0; id < ctx->var_count; ++id) {
+        if (!rows->live_in[id]) continue;
+        int reg = binding_reg(ctx, id);
+        if (reg >= 0 && (size_t) reg < clobbered) {
+            *reason = "вызов затирает регистр величины, читаемой итерацией";
+            return false;
+        }
+    }
+    for (size_t k = 0; k < rows->iv_count; ++k) {
+        if (binding_reg(ctx, rows->iv[k]) < 0) {
+            *reason = "счетчик без регистра";
+            return false;
+        }
+    }
+    if (rows->bound->type == LITERAL_T && binding_reg(ctx, rows->bound->value.id) < 0) {
+        *reason = "граница цикла без регистра";
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Метка-описание цикла по строкам для spu --parallel:
+ *        rows_<id>_in<K>_r<reg><+step>..._<lt|le|gt|ge><k><+offset>_<r<reg>|n<число>>.
+ */
+function int emit_row_marker(const func_ctx_t *ctx, const row_loop_t *rows, size_t id, FILE *out) {
+    fprintf(out, ":rows_%zu_in%zu", id, rows->inputs);
+    for (size_t k = 0; k < rows->iv_count; ++k) {
+        fprintf(out, "_r%d%+.0f", binding_reg(ctx, rows->iv[k]), rows->step[k]);
+    }
+    const char *op = rows->cond_op == OPERATOR::BELOW    ? "lt"
+                   : rows->cond_op == OPERATOR::BELOW_EQ ? "le"
+                   : rows->cond_op == OPERATOR::ABOVE    ? "gt" : "ge";
+    fprintf(out, "_%s%zu%+.0f", op, rows->cond_iv, rows->cond_offset);
+    if (rows->bound->type == LITERAL_T)
+        fprintf(out, "_r%d\n", binding_reg(ctx, rows->bound->value.id));
+    else
+        fprintf(out, "_n%.17g\n", rows->bound->value.num);
+    return 0;
+}
+
+/**
+ * @brief Подставляет тело функции вместо CALL; аргументы уже в стеке.
+ *
+ * Параметры снимаются в регистры, как в прологе функции, RETURN оставляет значение
+ * в стеке и переходит в конец. Метки тела получают префикс <имя>.i<N>_ (в main - i<N>_)
+ * с нумерацией подстановок внутри функции и внутри тела нумеруются с нуля, как в самой
+ * ФОРМУЛЕ: ЕСЛИ тела раскладывается по ее счетчикам из профиля. Потом счетчики меток
+ * восстанавливаются, чтобы остальная нумерация совпадала с профилем.
+ */
+function int emit_inline(func_ctx_t *ctx, const NODE_T *callee, FILE *out) {
+    labels_t *labels = ctx->labels;
+    char ns[LABEL_NS_CAP + 24] = "";
+    char ret_lbl[LABEL_CAP] = "";
+    snprintf(ns, sizeof(ns), "%si%zu_", labels->func_ns, ++labels->inline_id);
+    snprintf(ret_lbl, sizeof(ret_lbl), ":%sret", ns);
+
+    func_ctx_t inl = {};
+    inl.func_node = callee;
+    inl.func_name = literal_name(ctx->globals, callee);
+    inl.globals = ctx->globals;
+    inl.ret_lbl = ret_lbl;
+    inl.cold = ctx->cold;
+    inl.labels = labels;
+    if (init_bindings(&inl)) return -1;
+    collect_params(&inl, callee->left);
+
+    char *body = nullptr;
+    size_t body_len = 0;
+    FILE *mem = open_memstream(&body, &body_len);
+    if (!mem) {
+        free(inl.slot_of);
+        return -1;
+    }
+
+    /* тело нумерует метки с нуля, как сама ФОРМУЛА, и по профилю читает ее счетчики */
+    char callee_ns[LABEL_NS_CAP] = "";
+    if (inl.func_name)
+        function_ns(inl.func_name, callee_ns, sizeof(callee_ns));
+    labels_t saved = *labels;
+    labels->if_id = labels->while_id = labels->do_id = labels->tmp_id = 0;
+    labels->ns = ns;
+    labels->profile_ns = inl.func_name ? callee_ns : ns;
+    for (size_t i = 0; i < inl.param_count; ++i)
+        fprintf(mem, "POPR %s\n", REGISTERS[inl.param_regs[i]]);
+    int rc = callee->right ? emit_statement(&inl, callee->right, mem, nullptr) : 0;
+    saved.inline_id = labels->inline_id;
+    *labels = saved;
+    fclose(mem);
+    free(inl.slot_of);
+
+    if (!rc) {
+        /* переход из последнего RETURN на следующую строку не нужен */
+        char tail[LABEL_CAP + 8] = "";
+        size_t tail_len = (size_t) snprintf(tail, sizeof(tail), "JMP %s\n", ret_lbl);
+        if (body_len >= tail_len && memcmp(body + body_len - tail_len, tail, tail_len) == 0)
+            body_len -= tail_len;
+        fwrite(body, 1, body_len, out);
+        fprintf(out, "%s\n", ret_lbl);
+    }
+    free(body);
+    return rc;
+}
+
 /**
  * @brief Генерирует присваивание lhs = rhs.
  */
@@ -253,14 +613,12 @@ function int emit_assignment(func_ctx_t *ctx, const NODE_T *node, FILE *out, boo
     if (!ctx || !node || !out) return -1;
     const NODE_T *lhs = node->left;
     const NODE_T *rhs = node->right;
-    const mystr::mystr_t *nm = literal_name(ctx->globals, lhs);
-    if (!nm) return -1;
-    const char *reg = ensure_binding(ctx, nm);
-    if (!reg) return -1;
+    int reg = ensure_binding(ctx, literal_id(ctx, lhs));
+    if (reg < 0) return -1;
     if (emit_expression(ctx, rhs, out)) return -1;
-    fprintf(out, "POPR %s\n", reg);
+    fprintf(out, "POPR %s\n", REGISTERS[reg]);
     if (keep)
-        fprintf(out, "PUSHR %s\n", reg);
+        fprintf(out, "PUSHR %s\n", REGISTERS[reg]);
     return 0;
 }
 
@@ -269,11 +627,11 @@ function int emit_assignment(func_ctx_t *ctx, const NODE_T *node, FILE *out, boo
  */
 function int emit_comparison_value(func_ctx_t *ctx, const NODE_T *node, FILE *out) {
     if (!ctx || !node || !out) return -1;
-    char true_lbl[32] = "", false_lbl[32] = "", end_lbl[32] = "";
-    make_label(true_lbl, sizeof(true_lbl), "cmp_true_", ++g_tmp_counter, "");
-    make_label(false_lbl, sizeof(false_lbl), "cmp_false_", g_tmp_counter, "");
-    make_label(end_lbl, sizeof(end_lbl), "cmp_end_", g_tmp_counter, "");
-    if (emit_conditional(ctx, node, true_lbl, false_lbl, out)) return -1;
+    char true_lbl[LABEL_CAP] = "", false_lbl[LABEL_CAP] = "", end_lbl[LABEL_CAP] = "";
+    make_label(ctx, true_lbl, sizeof(true_lbl), "cmp_true_", ++ctx->labels->tmp_id, "");
+    make_label(ctx, false_lbl, sizeof(false_lbl), "cmp_false_", ctx->labels->tmp_id, "");
+    make_label(ctx, end_lbl, sizeof(end_lbl), "cmp_end_", ctx->labels->tmp_id, "");
+    if (emit_conditional(ctx, node, true_lbl, false_lbl, false_lbl, out)) return -1;
     fprintf(out, "%s\nPUSH 0\nJMP %s\n%s\nPUSH 1\n%s\n", false_lbl, end_lbl, true_lbl, end_lbl);
     return 0;
 }
@@ -288,13 +646,12 @@ function int emit_expression(func_ctx_t *ctx, const NODE_T *node, FILE *out) {
             fprintf(out, "PUSH %.15g\n", node->value.num);
             return 0;
         case LITERAL_T: {
-            const mystr::mystr_t *nm = literal_name(ctx->globals, node);
-            const char *reg = binding_reg(ctx, nm);
-            if (!nm || !reg) {
+            int reg = binding_reg(ctx, literal_id(ctx, node));
+            if (reg < 0) {
                 fprintf(stderr, "целевой процессор пока не поддерживает строковые литералы\n");
                 return -1;
             }
-            fprintf(out, "PUSHR %s\n", reg);
+            fprintf(out, "PUSHR %s\n", REGISTERS[reg]);
             return 0;
         }
         case OPERATOR_T: {
@@ -333,15 +690,15 @@ function int emit_expression(func_ctx_t *ctx, const NODE_T *node, FILE *out) {
                     if (emit_expression(ctx, node->left, out)) return -1;
                     return emit_expression(ctx, node->right, out);
                 case OPERATOR::SET_PIXEL: {
-                    const char *tmp_reg = alloc_temp_reg(ctx);
-                    if (!tmp_reg) {
+                    int tmp_reg = alloc_temp_reg(ctx);
+                    if (tmp_reg < 0) {
                         fprintf(stderr, "нет свободных регистров для SET_PIXEL\n");
                         return -1;
                     }
                     if (emit_expression(ctx, node->right, out)) return -1;
-                    fprintf(out, "POPR %s\n", tmp_reg);
+                    fprintf(out, "POPR %s\n", REGISTERS[tmp_reg]);
                     if (emit_expression(ctx, node->left, out)) return -1;
-                    fprintf(out, "POPM [%s]\n", tmp_reg);
+                    fprintf(out, "POPM [%s]\n", REGISTERS[tmp_reg]);
                     return 0;
                 }
                 case OPERATOR::DRAW: {
@@ -383,49 +740,135 @@ function int emit_expression(func_ctx_t *ctx, const NODE_T *node, FILE *out) {
 
 /**
  * @brief Генерирует условный переход: при истине -> true_lbl, иначе -> false_lbl.
+ *
+ * next_lbl - метка, которая будет выведена сразу после условия (или nullptr).
+ * Переход на нее не генерируется: управление попадает туда само.
  */
-function int emit_conditional(func_ctx_t *ctx, const NODE_T *node, const char *true_lbl, const char *false_lbl, FILE *out) {
+function int emit_conditional(func_ctx_t *ctx, const NODE_T *node, const char *true_lbl, const char *false_lbl, const char *next_lbl, FILE *out) {
     if (!ctx || !node || !true_lbl || !false_lbl) return -1;
     if (node->type == OPERATOR_T) {
         OPERATOR::OPERATOR op = node->value.opr;
         if (op == OPERATOR::AND) {
-            char mid[32] = "";
-            make_label(mid, sizeof(mid), "if_and_", ++g_tmp_counter, "");
-            if (emit_conditional(ctx, node->left, mid, false_lbl, out)) return -1;
+            char mid[LABEL_CAP] = "";
+            make_label(ctx, mid, sizeof(mid), "if_and_", ++ctx->labels->tmp_id, "");
+            if (emit_conditional(ctx, node->left, mid, false_lbl, mid, out)) return -1;
             fprintf(out, "%s\n", mid);
-            return emit_conditional(ctx, node->right, true_lbl, false_lbl, out);
+            return emit_conditional(ctx, node->right, true_lbl, false_lbl, next_lbl, out);
         }
         if (op == OPERATOR::OR) {
-            char mid[32] = "";
-            make_label(mid, sizeof(mid), "if_or_", ++g_tmp_counter, "");
-            if (emit_conditional(ctx, node->left, true_lbl, mid, out)) return -1;
+            char mid[LABEL_CAP] = "";
+            make_label(ctx, mid, sizeof(mid), "if_or_", ++ctx->labels->tmp_id, "");
+            if (emit_conditional(ctx, node->left, true_lbl, mid, mid, out)) return -1;
             fprintf(out, "%s\n", mid);
-            return emit_conditional(ctx, node->right, true_lbl, false_lbl, out);
+            return emit_conditional(ctx, node->right, true_lbl, false_lbl, next_lbl, out);
         }
         if (op == OPERATOR::NOT)
-            return emit_conditional(ctx, node->left, false_lbl, true_lbl, out);
-        if (op == OPERATOR::EQ || op == OPERATOR::NEQ || op == OPERATOR::BELOW || op == OPERATOR::ABOVE ||
-            op == OPERATOR::BELOW_EQ || op == OPERATOR::ABOVE_EQ) {
+            return emit_conditional(ctx, node->left, false_lbl, true_lbl, next_lbl, out);
+        if (comparison_jump(op, false)) {
             if (emit_expression(ctx, node->left, out)) return -1;
             if (emit_expression(ctx, node->right, out)) return -1;
-            const char *jmp = nullptr;
-            switch (op) {
-                case OPERATOR::EQ:       jmp = "JE";  break;
-                case OPERATOR::NEQ:      jmp = "JNE"; break;
-                case OPERATOR::BELOW:    jmp = "JB";  break;
-                case OPERATOR::ABOVE:    jmp = "JA";  break;
-                case OPERATOR::BELOW_EQ: jmp = "JBE"; break;
-                case OPERATOR::ABOVE_EQ: jmp = "JAE"; break;
-                default: break;
+            if (same_label(next_lbl, true_lbl) && comparison_jump(op, true)) {
+                fprintf(out, "%s %s\n", comparison_jump(op, true), false_lbl);
+                return 0;
             }
-            if (!jmp) return -1;
-            fprintf(out, "%s %s\n", jmp, true_lbl);
-            fprintf(out, "JMP %s\n", false_lbl);
+            fprintf(out, "%s %s\n", comparison_jump(op, false), true_lbl);
+            if (!same_label(next_lbl, false_lbl))
+                fprintf(out, "JMP %s\n", false_lbl);
             return 0;
         }
     }
     if (emit_expression(ctx, node, out)) return -1;
-    fprintf(out, "PUSH 0\nJNE %s\nJMP %s\n", true_lbl, false_lbl);
+    if (same_label(next_lbl, true_lbl)) {
+        fprintf(out, "PUSH 0\nJE %s\n", false_lbl);
+        return 0;
+    }
+    fprintf(out, "PUSH 0\nJNE %s\n", true_lbl);
+    if (!same_label(next_lbl, false_lbl))
+        fprintf(out, "JMP %s\n", false_lbl);
+    return 0;
+}
+
+/**
+ * @brief Генерирует ветвь в отдельный буфер (освобождать через free()).
+ */
+function int emit_block(func_ctx_t *ctx, const NODE_T *node, char **text, size_t *len, bool *did_ret) {
+    *text = nullptr;
+    *len = 0;
+    if (did_ret) *did_ret = false;
+    FILE *mem = open_memstream(text, len);
+    if (!mem) return -1;
+    int rc = node ? emit_statement(ctx, node, mem, did_ret) : 0;
+    fclose(mem);
+    return rc;
+}
+
+/**
+ * @brief ЕСЛИ по профилю: горячая ветвь идет сразу за условием без переходов,
+ *        холодная уносится в ctx->cold и возвращается в конец через JMP.
+ *
+ * Ветви генерируются в исходном порядке, чтобы нумерация вложенных меток
+ * совпадала со сборкой, с которой снят профиль.
+ */
+function int emit_if_by_profile(func_ctx_t *ctx, const NODE_T *node, const char *then_lbl, const char *else_lbl,
+                                const char *end_lbl, FILE *out, bool *did_ret) {
+    const NODE_T *then_ops = node->right ? node->right->left : nullptr;
+    const NODE_T *else_ops = node->right ? node->right->right : nullptr;
+
+    uint64_t then_hits = profile_count(ctx, then_lbl);
+    uint64_t else_hits = 0;
+    if (else_ops) {
+        else_hits = profile_count(ctx, else_lbl);
+    } else {
+        /* без ИНАЧЕ: на конец приходят и после ТО, и в обход нее */
+        uint64_t end_hits = profile_count(ctx, end_lbl);
+        else_hits = end_hits > then_hits ? end_hits - then_hits : 0;
+    }
+    bool cold_then = then_hits < else_hits;
+    bool cold_else = else_ops && else_hits < then_hits;
+
+    const char *false_target = else_ops ? else_lbl : end_lbl;
+    const char *next = cold_then ? false_target : then_lbl;
+    if (emit_conditional(ctx, node->left, then_lbl, false_target, next, out)) return -1;
+
+    char *then_text = nullptr, *else_text = nullptr;
+    size_t then_len = 0, else_len = 0;
+    bool then_ret = false, else_ret = false;
+    int rc = emit_block(ctx, then_ops, &then_text, &then_len, &then_ret);
+    if (!rc && else_ops)
+        rc = emit_block(ctx, else_ops, &else_text, &else_len, &else_ret);
+    if (rc) {
+        free(then_text);
+        free(else_text);
+        return -1;
+    }
+    if (did_ret) *did_ret = else_ops ? else_ret : then_ret;
+
+    if (cold_then) {
+        fprintf(ctx->cold, "%s\n", then_lbl);
+        fwrite(then_text, 1, then_len, ctx->cold);
+        fprintf(ctx->cold, "JMP %s\n", end_lbl);
+        fprintf(out, "%s\n", false_target);
+        if (else_ops) {
+            fwrite(else_text, 1, else_len, out);
+            fprintf(out, "%s\n", end_lbl);
+        }
+    } else if (cold_else) {
+        fprintf(out, "%s\n", then_lbl);
+        fwrite(then_text, 1, then_len, out);
+        fprintf(out, "%s\n", end_lbl);
+        fprintf(ctx->cold, "%s\n", else_lbl);
+        fwrite(else_text, 1, else_len, ctx->cold);
+        fprintf(ctx->cold, "JMP %s\n", end_lbl);
+    } else {
+        fprintf(out, "%s\n", then_lbl);
+        fwrite(then_text, 1, then_len, out);
+        if (else_ops)
+            fprintf(out, "JMP %s\n%s\n", end_lbl, else_lbl);
+        fwrite(else_text, 1, else_len, out);
+        fprintf(out, "%s\n", end_lbl);
+    }
+    free(then_text);
+    free(else_text);
     return 0;
 }
 
@@ -445,13 +888,19 @@ function int emit_statement(func_ctx_t *ctx, const NODE_T *node, FILE *out, bool
     if (node->type == OPERATOR_T && node->value.opr == OPERATOR::ASSIGNMENT)
         return emit_assignment(ctx, node, out, false);
     if (node->type == KEYWORD_T && node->value.keyword == KEYWORD::VAR_DECLARATION) {
-        const mystr::mystr_t *nm = literal_name(ctx->globals, node->left);
-        if (!nm) return -1;
-        return ensure_binding(ctx, nm) ? 0 : -1;
+        return ensure_binding(ctx, literal_id(ctx, node->left)) < 0 ? -1 : 0;
     }
     if (node->type == KEYWORD_T && node->value.keyword == KEYWORD::RETURN) {
+        if (is_self_tail_call(ctx, node->left)) {
+            if (emit_tail_call(ctx, node->left, out)) return -1;
+            if (did_ret) *did_ret = true;
+            return 0;
+        }
         if (emit_expression(ctx, node->left, out)) return -1;
-        fprintf(out, "RET\n");
+        if (ctx->ret_lbl)
+            fprintf(out, "JMP %s\n", ctx->ret_lbl);
+        else
+            fprintf(out, "RET\n");
         if (did_ret) *did_ret = true;
         return 0;
     }
@@ -461,10 +910,9 @@ function int emit_statement(func_ctx_t *ctx, const NODE_T *node, FILE *out, bool
         return 0;
     }
     if (node->type == OPERATOR_T && node->value.opr == OPERATOR::IN) {
-        const mystr::mystr_t *nm = literal_name(ctx->globals, node->left);
-        const char *reg = ensure_binding(ctx, nm);
-        if (!reg) return -1;
-        fprintf(out, "IN\nPOPR %s\n", reg);
+        int reg = ensure_binding(ctx, literal_id(ctx, node->left));
+        if (reg < 0) return -1;
+        fprintf(out, "IN\nPOPR %s\n", REGISTERS[reg]);
         return 0;
     }
     if (node->type == KEYWORD_T && node->value.keyword == KEYWORD::FUNC_CALL)
@@ -474,13 +922,16 @@ function int emit_statement(func_ctx_t *ctx, const NODE_T *node, FILE *out, bool
         const NODE_T *then_ops = branches ? branches->left : nullptr;
         const NODE_T *else_ops = branches ? branches->right : nullptr;
 
-        char then_lbl[32] = "", else_lbl[32] = "", end_lbl[32] = "";
-        make_label(then_lbl, sizeof(then_lbl), "if_", ++g_if_counter, "_then");
-        make_label(else_lbl, sizeof(else_lbl), "if_", g_if_counter, "");
-        make_label(end_lbl, sizeof(end_lbl), "if_", g_if_counter, "_end");
+        char then_lbl[LABEL_CAP] = "", else_lbl[LABEL_CAP] = "", end_lbl[LABEL_CAP] = "";
+        make_label(ctx, then_lbl, sizeof(then_lbl), "if_", ++ctx->labels->if_id, "_then");
+        make_label(ctx, else_lbl, sizeof(else_lbl), "if_", ctx->labels->if_id, "");
+        make_label(ctx, end_lbl, sizeof(end_lbl), "if_", ctx->labels->if_id, "_end");
+
+        if (g_profile && ctx->cold)
+            return emit_if_by_profile(ctx, node, then_lbl, else_lbl, end_lbl, out, did_ret);
 
         const char *false_target = else_ops ? else_lbl : end_lbl;
-        if (emit_conditional(ctx, node->left, then_lbl, false_target, out)) return -1;
+        if (emit_conditional(ctx, node->left, then_lbl, false_target, then_lbl, out)) return -1;
 
         fprintf(out, "%s\n", then_lbl);
         if (then_ops && emit_statement(ctx, then_ops, out, did_ret)) return -1;
@@ -494,30 +945,68 @@ function int emit_statement(func_ctx_t *ctx, const NODE_T *node, FILE *out, bool
         return 0;
     }
     if (node->type == KEYWORD_T && node->value.keyword == KEYWORD::WHILE) {
-        char start_lbl[32] = "", body_lbl[32] = "", end_lbl[32] = "";
-        make_label(start_lbl, sizeof(start_lbl), "while_", ++g_while_counter, "");
-        make_label(body_lbl, sizeof(body_lbl), "while_", g_while_counter, "_body");
-        make_label(end_lbl, sizeof(end_lbl), "while_", g_while_counter, "_end");
-        fprintf(out, "%s\n", start_lbl);
-        if (emit_conditional(ctx, node->left, body_lbl, end_lbl, out)) return -1;
-        fprintf(out, "%s\n", body_lbl);
-        if (emit_statement(ctx, node->right, out, did_ret)) return -1;
-        fprintf(out, "JMP %s\n%s\n", start_lbl, end_lbl);
-        return 0;
+        char start_lbl[LABEL_CAP] = "", body_lbl[LABEL_CAP] = "", end_lbl[LABEL_CAP] = "";
+        size_t id = ++ctx->labels->while_id;
+        make_label(ctx, start_lbl, sizeof(start_lbl), "while_", id, "");
+        make_label(ctx, body_lbl, sizeof(body_lbl), "while_", id, "_body");
+        make_label(ctx, end_lbl, sizeof(end_lbl), "while_", id, "_end");
+
+        /* внешние циклы ХОДА РАБОТЫ проверяются на независимость итераций (spu --parallel) */
+        row_loop_t rows = {};
+        const char *why = nullptr;
+        bool row_loop = !ctx->func_name && !ctx->loop_depth
+                     && analyze_row_loop(g_functions, node, varlist::size(ctx->globals), &rows, &why)
+                     && row_loop_fits(ctx, node, &rows, &why);
+        if (!ctx->func_name && !ctx->loop_depth && !row_loop)
+            fprintf(out, "; %s: итерации зависимы: %s\n", start_lbl + 1, why ? why : "?");
+
+        /* условие внизу: на итерацию один условный переход вместо пары Jcc/JMP */
+        fprintf(out, "JMP %s\n%s\n", start_lbl, body_lbl);
+        ctx->loop_depth++;
+        int rc = node->right ? emit_statement(ctx, node->right, out, did_ret) : 0;
+        ctx->loop_depth--;
+        if (!rc && row_loop)
+            emit_row_marker(ctx, &rows, id, out);
+        if (!rc)
+            fprintf(out, "%s\n", start_lbl);
+        if (!rc && emit_conditional(ctx, node->left, body_lbl, end_lbl, end_lbl, out)) rc = -1;
+        if (!rc)
+            fprintf(out, "%s\n", end_lbl);
+        if (!rc && row_loop)
+            fprintf(out, ":rows_%zu_end\n", id);
+        destruct_row_loop(&rows);
+        return rc;
     }
     if (node->type == KEYWORD_T && node->value.keyword == KEYWORD::DO_WHILE) {
-        char body_lbl[32] = "", end_lbl[32] = "";
-        make_label(body_lbl, sizeof(body_lbl), "do-while_", ++g_do_counter, "");
-        make_label(end_lbl, sizeof(end_lbl), "do-while_", g_do_counter, "_end");
+        char body_lbl[LABEL_CAP] = "", end_lbl[LABEL_CAP] = "";
+        make_label(ctx, body_lbl, sizeof(body_lbl), "do-while_", ++ctx->labels->do_id, "");
+        make_label(ctx, end_lbl, sizeof(end_lbl), "do-while_", ctx->labels->do_id, "_end");
         fprintf(out, "%s\n", body_lbl);
-        if (emit_statement(ctx, node->right, out, did_ret)) return -1;
-        if (emit_conditional(ctx, node->left, body_lbl, end_lbl, out)) return -1;
+        ctx->loop_depth++;
+        int rc = node->right ? emit_statement(ctx, node->right, out, did_ret) : 0;
+        ctx->loop_depth--;
+        if (rc) return -1;
+        if (emit_conditional(ctx, node->left, body_lbl, end_lbl, end_lbl, out)) return -1;
         fprintf(out, "%s\n", end_lbl);
         return 0;
     }
     return emit_expression(ctx, node, out);
 }
 
+/**
+ * @brief Закрывает буфер холодных ветвей и дописывает их в out (если out не nullptr).
+ */
+function void close_cold(func_ctx_t *ctx, char **cold, size_t *cold_len, FILE *out) {
+    if (!ctx->cold) return;
+    fclose(ctx->cold);
+    ctx->cold = nullptr;
+    if (out)
+        fwrite(*cold, 1, *cold_len, out);
+    free(*cold);
+    *cold = nullptr;
+    *cold_len = 0;
+}
+
 /**
  * @brief Эмитирует тело функции и ее пролог/рет.
  */
@@ -529,18 +1018,149 @@ function int emit_function(const varlist::VarList *globals, const NODE_T *node,
     ctx.func_node = node;
     ctx.func_name = fname;
     ctx.globals = (varlist::VarList *)globals;
+    if (init_bindings(&ctx)) return -1;
 
     collect_params(&ctx, node->left);
 
     fprintf(out, ":%s\n", fname->str);
     for (size_t i = 0; i < ctx.param_count; ++i)
-        fprintf(out, "POPR %s\n", ctx.param_regs[i]);
+        fprintf(out, "POPR %s\n", REGISTERS[ctx.param_regs[i]]);
+
+    char *cold = nullptr;
+    size_t cold_len = 0;
+    if (g_profile && !(ctx.cold = open_memstream(&cold, &cold_len))) {
+        free(ctx.slot_of);
+        return -1;
+    }
+
+    /* метки функции - "<имя>.if_1_then" с нумерацией с нуля: код функции не зависит
+       от соседей, поэтому его можно взять из кэша или генерировать в своем потоке */
+    char ns[LABEL_NS_CAP] = "";
+    function_ns(fname, ns, sizeof(ns));
+    labels_t labels = {};
+    labels.func_ns = labels.ns = labels.profile_ns = ns;
+    ctx.labels = &labels;
 
     bool body_ret = false;
-    if (emit_statement(&ctx, node->right, out, &body_ret)) return -1;
-    if (!body_ret)
+    int rc = node->right ? emit_statement(&ctx, node->right, out, &body_ret) : 0;
+    if (!rc && !body_ret)
         fprintf(out, "RET\n");
-    return 0;
+    close_cold(&ctx, &cold, &cold_len, rc ? nullptr : out);
+    free(ctx.slot_of);
+    return rc ? -1 : 0;
+}
+
+/**
+ * @brief FNV-1a.
+ */
+function uint64_t hash_bytes(uint64_t h, const void *data, size_t len) {
+    if (!h) h = 1469598103934665603ULL;
+    const unsigned char *p = (const unsigned char *) data;
+    for (size_t i = 0; i < len; ++i)
+        h = (h ^ p[i]) * 1099511628211ULL;
+    return h;
+}
+
+/**
+ * @brief Хэш поддерева: имена вместо id, которые сдвигаются при правке других функций.
+ */
+function uint64_t hash_subtree(const varlist::VarList *globals, const NODE_T *node, uint64_t h) {
+    unsigned char tag = node ? (unsigned char) (node->type + 1) : 0;
+    h = hash_bytes(h, &tag, 1);
+    if (!node) return h;
+    switch (node->type) {
+        case LITERAL_T:
+        case IDENTIFIER_T: {
+            const mystr::mystr_t *nm = varlist::get(globals, node->value.id);
+            const char *str = (nm && nm->str) ? nm->str : "";
+            h = hash_bytes(h, str, strlen(str) + 1);
+            break;
+        }
+        case NUMBER_T:
+            h = hash_bytes(h, &node->value.num, sizeof(node->value.num));
+            break;
+        default: {
+            int value = node->type == OPERATOR_T ? (int) node->value.opr :
+                        node->type == KEYWORD_T ? (int) node->value.keyword : (int) node->value.delimiter;
+            h = hash_bytes(h, &value, sizeof(value));
+            break;
+        }
+    }
+    h = hash_subtree(globals, node->left, h);
+    return hash_subtree(globals, node->right, h);
+}
+
+/**
+ * @brief Добавляет к хэшу сигнатуры вызываемых функций: имя и число параметров.
+ */
+function uint64_t hash_callees(const func_ctx_t *ctx, const NODE_T *node, uint64_t h) {
+    if (!node) return h;
+    if (node->type == KEYWORD_T && node->value.keyword == KEYWORD::FUNC_CALL) {
+        const NODE_T *callee = find_function(g_functions, callee_id(node));
+        long params = callee ? (long) count_list_items(callee->left) : -1;
+        h = hash_subtree(ctx->globals, node->left, h);
+        h = hash_bytes(h, &params, sizeof(params));
+    }
+    h = hash_callees(ctx, node->left, h);
+    return hash_callees(ctx, node->right, h);
+}
+
+/**
+ * @brief Ключ кэша функции: версия кэша, имя, параметры, тело и сигнатуры вызываемых.
+ */
+function uint64_t function_hash(const varlist::VarList *globals, const NODE_T *node) {
+    func_ctx_t ctx = {};
+    ctx.globals = (varlist::VarList *) globals;
+    uint64_t h = hash_bytes(0, CACHE_VERSION, sizeof(CACHE_VERSION));
+    h = hash_subtree(globals, node, h);
+    return hash_callees(&ctx, node->right, h);
+}
+
+/**
+ * @brief emit_function() через кэш: готовый код берется из <каталог>/<хэш>.asm, новый туда пишется.
+ *
+ * С профилем кэш не используется: код зависит от счетчиков и от подставляемых функций.
+ */
+function int emit_function_cached(const varlist::VarList *globals, const NODE_T *node, FILE *out) {
+    if (!g_cache_dir || g_profile || !node || !out)
+        return emit_function(globals, node, out);
+
+    char path[4096] = "";
+    snprintf(path, sizeof(path), "%s/%016llx.asm", g_cache_dir, (unsigned long long) function_hash(globals, node));
+    FILE *fp = fopen(path, "rb");
+    if (fp) {
+        long size = (fseek(fp, 0, SEEK_END) == 0) ? ftell(fp) : -1;
+        char *cached = nullptr;
+        if (size > 0 && fseek(fp, 0, SEEK_SET) == 0) {
+            cached = TYPED_CALLOC((size_t) size, char);
+        }
+        bool ok = cached && fread(cached, 1, (size_t) size, fp) == (size_t) size;
+        fclose(fp);
+        if (ok)
+            fwrite(cached, 1, (size_t) size, out);
+        free(cached);
+        if (ok) return 0;
+    }
+
+    char *text = nullptr;
+    size_t len = 0;
+    FILE *mem = open_memstream(&text, &len);
+    if (!mem) return -1;
+    int rc = emit_function(globals, node, mem);
+    fclose(mem);
+    if (!rc) {
+        fwrite(text, 1, len, out);
+        /* запись через временный файл: параллельные сборки и потоки не увидят половину записи */
+        char tmp[4096 + 48] = "";
+        snprintf(tmp, sizeof(tmp), "%s.%ld.%lx.tmp", path, (long) getpid(), (unsigned long) pthread_self());
+        FILE *cache = fopen(tmp, "wb");
+        bool ok = cache && fwrite(text, 1, len, cache) == len;
+        if (cache && fclose(cache)) ok = false;
+        if (!ok || rename(tmp, path))
+            remove(tmp);
+    }
+    free(text);
+    return rc;
 }
 
 /**
@@ -552,7 +1172,125 @@ function int emit_function_list(const varlist::VarList *globals, const NODE_T *n
         if (emit_function_list(globals, node->left, out)) return -1;
         return emit_function_list(globals, node->right, out);
     }
-    return emit_function(globals, node, out);
+    return emit_function_cached(globals, node, out);
+}
+
+function size_t count_list_items(const NODE_T *node) {
+    if (!node) return 0;
+    if (node->type == DELIMITER_T && node->value.delimiter == DELIMITER::COMA)
+        return count_list_items(node->left) + count_list_items(node->right);
+    return 1;
+}
+
+function void *emit_shard_main(void *arg) {
+    emit_shard_t *sh = (emit_shard_t *) arg;
+    for (size_t i = sh->begin; i < sh->end && !sh->rc; ++i) {
+        FILE *mem = open_memstream(&sh->funcs[i].text, &sh->funcs[i].len);
+        if (!mem) {
+            sh->rc = -1;
+            break;
+        }
+        if (emit_function_cached(sh->globals, sh->funcs[i].node, mem)) sh->rc = -1;
+        fclose(mem);
+    }
+    return nullptr;
+}
+
+/**
+ * @brief Генерирует код функций funcs[i].node в буферы funcs[i].text, при g_threads > 1 - в потоках.
+ *
+ * Метки и регистры функции зависят только от нее самой (labels_t в emit_function),
+ * поэтому буферы совпадают побайтно при любом числе потоков. Функции делятся на
+ * подряд идущие куски с примерно равным числом узлов AST.
+ * @return 0 при успехе, -1 при ошибке (сообщение в stderr).
+ */
+function int emit_function_texts(const varlist::VarList *globals, emitted_func_t *funcs, size_t count) {
+    size_t threads = g_threads < count ? g_threads : count;
+    if (threads <= 1) {
+        emit_shard_t one = {globals, funcs, 0, count, 0};
+        emit_shard_main(&one);
+        return one.rc;
+    }
+
+    emit_shard_t *shards = TYPED_CALLOC(threads, emit_shard_t);
+    pthread_t *tids = TYPED_CALLOC(threads, pthread_t);
+    if (!shards || !tids) {
+        free(shards);
+        free(tids);
+        return -1;
+    }
+    size_t total = 0;
+    for (size_t i = 0; i < count; ++i) total += count_nodes(funcs[i].node);
+    size_t used = 0;
+    for (size_t i = 0, acc = 0; i < count; ++i) {
+        if (!used || (acc >= total / threads * used && used < threads)) {
+            shards[used] = {globals, funcs, i, i, 0};
+            ++used;
+        }
+        shards[used - 1].end = i + 1;
+        acc += count_nodes(funcs[i].node);
+    }
+
+    size_t started = 1;
+    for (; started < used; ++started) {
+        if (pthread_create(&tids[started], nullptr, emit_shard_main, &shards[started])) break;
+    }
+    emit_shard_main(&shards[0]);
+    for (size_t t = started; t < used; ++t)
+        emit_shard_main(&shards[t]);
+    for (size_t t = 1; t < started; ++t)
+        pthread_join(tids[t], nullptr);
+    int rc = 0;
+    for (size_t t = 0; t < used; ++t)
+        if (shards[t].rc) rc = -1;
+    free(shards);
+    free(tids);
+    return rc;
+}
+
+/**
+ * @brief Генерирует функции в отдельные буферы и выводит их; с профилем - от самых часто вызываемых.
+ *
+ * Функции генерируются в исходном порядке (от него зависит совпадение с профилем),
+ * без профиля и печатаются в нем же.
+ */
+function int emit_functions_buffered(const varlist::VarList *globals, const NODE_T *list, FILE *out) {
+    size_t cap = count_list_items(list);
+    const NODE_T **nodes = TYPED_CALLOC(cap ? cap : 1, const NODE_T *);
+    emitted_func_t *funcs = TYPED_CALLOC(cap ? cap : 1, emitted_func_t);
+    if (!nodes || !funcs) {
+        free(nodes);
+        free(funcs);
+        return -1;
+    }
+    size_t count = 0;
+    collect_args_in_order(list, nodes, &count, cap);
+
+    for (size_t i = 0; i < count; ++i) {
+        const mystr::mystr_t *nm = literal_name(globals, nodes[i]);
+        funcs[i].node = nodes[i];
+        funcs[i].calls = (g_profile && nm && nm->str) ? profile_label_count(g_profile, nm->str) : 0;
+    }
+    int rc = emit_function_texts(globals, funcs, count);
+
+    /* устойчивая сортировка вставками: функций немного */
+    for (size_t i = 1; i < count && !rc && g_profile; ++i) {
+        emitted_func_t cur = funcs[i];
+        size_t j = i;
+        while (j > 0 && funcs[j - 1].calls < cur.calls) {
+            funcs[j] = funcs[j - 1];
+            --j;
+        }
+        funcs[j] = cur;
+    }
+    for (size_t i = 0; i < count && !rc; ++i)
+        fwrite(funcs[i].text, 1, funcs[i].len, out);
+
+    for (size_t i = 0; i < count; ++i)
+        free(funcs[i].text);
+    free(funcs);
+    free(nodes);
+    return rc;
 }
 
 /**
@@ -569,12 +1307,49 @@ int reverse_program(NODE_T *root, varlist::VarList *vars, FILE *out) {
         body = root;
     }
 
+    g_functions = funcs;
+    labels_t labels = {};
+    labels.func_ns = labels.ns = labels.profile_ns = "";
     func_ctx_t main_ctx = {};
     main_ctx.globals = vars;
     main_ctx.func_name = nullptr;
-    if (body && emit_statement(&main_ctx, body, out, nullptr)) return -1;
-    fprintf(out, "HLT\n");
+    main_ctx.labels = &labels;
+    if (init_bindings(&main_ctx)) return -1;
+    char *cold = nullptr;
+    size_t cold_len = 0;
+    if (g_profile && !(main_ctx.cold = open_memstream(&cold, &cold_len))) {
+        free(main_ctx.slot_of);
+        return -1;
+    }
+
+    int rc = body ? emit_statement(&main_ctx, body, out, nullptr) : 0;
+    if (!rc)
+        fprintf(out, "HLT\n");
+    close_cold(&main_ctx, &cold, &cold_len, rc ? nullptr : out);
+    free(main_ctx.slot_of);
+    if (rc) return -1;
 
+    if (g_profile || g_threads > 1)
+        return emit_functions_buffered(vars, funcs, out);
     if (emit_function_list(vars, funcs, out)) return -1;
     return 0;
 }
+
+void backend_set_profile(const profile_t *profile) {
+    g_profile = profile;
+}
+
+void backend_set_threads(size_t threads) {
+    g_threads = threads ? threads : 1;
+}
+
+int backend_set_cache(const char *dir) {
+    g_cache_dir = nullptr;
+    if (!dir) return 0;
+    if (mkdir(dir, 0755) && errno != EEXIST) {
+        fprintf(stderr, "не удалось создать каталог кэша %s\n", dir);
+        return -1;
+    }
+    g_cache_dir = dir;
+    return 0;
+}
@@ -0,0 +1,511 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ast.h"
+#include "backend.h"
+#include "base.h"
+#include "vm.h"
+
+/** Аргументов ФОРМУЛЫ не больше, чем в бэкенде x86-64: все параметры - double. */
+const size_t C_MAX_ARGS = 64;
+
+typedef struct {
+    const varlist::VarList *globals;
+    const NODE_T          **funcs;
+    size_t                  func_count;
+    const NODE_T           *func;           /**< nullptr - ХОД РАБОТЫ (main). */
+    bool                   *declared;       /**< id -> переменная функции (параметр или объявлена). */
+    size_t                  indent;
+    FILE                   *out;
+} c_ctx_t;
+
+function void put_name(const c_ctx_t *ctx, char prefix, size_t id);
+function void put_number(FILE *out, double value);
+function void put_indent(const c_ctx_t *ctx);
+function void collect_list(const NODE_T *node, const NODE_T **dst, size_t *count, size_t cap);
+function const NODE_T *find_func(const c_ctx_t *ctx, size_t id);
+function int declare_vars(c_ctx_t *ctx, const NODE_T *node);
+function int emit_call(c_ctx_t *ctx, const NODE_T *node);
+function int emit_expr(c_ctx_t *ctx, const NODE_T *node);
+function int emit_stmt(c_ctx_t *ctx, const NODE_T *node);
+function int emit_block(c_ctx_t *ctx, const NODE_T *node);
+function int emit_signature(const c_ctx_t *ctx, const NODE_T *func);
+function int emit_function(c_ctx_t *ctx, const NODE_T *func, const NODE_T *body);
+function void emit_prelude(FILE *out);
+
+/**
+ * @brief Имя в C: v<id>/f<id>, для ASCII-имен с суффиксом _<имя> - ради читаемости.
+ */
+function void put_name(const c_ctx_t *ctx, char prefix, size_t id) {
+    fprintf(ctx->out, "%c%zu", prefix, id);
+    const mystr::mystr_t *nm = varlist::get(ctx->globals, id);
+    if (!nm || !nm->str || !nm->str[0]) return;
+    for (const char *p = nm->str; *p; ++p) {
+        char c = *p;
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_'))
+            return;
+    }
+    fprintf(ctx->out, "_%s", nm->str);
+}
+
+/**
+ * @brief Число как литерал double: %.17g сохраняет значение точно.
+ */
+function void put_number(FILE *out, double value) {
+    if (isnan(value)) {
+        fputs("NAN", out);
+        return;
+    }
+    if (isinf(value)) {
+        fputs(value > 0 ? "HUGE_VAL" : "(-HUGE_VAL)", out);
+        return;
+    }
+    char text[40] = "";
+    snprintf(text, sizeof(text), "%.17g", value);
+    bool has_dot = strpbrk(text, ".e") != nullptr;
+    fprintf(out, value < 0 ? "(%s%s)" : "%s%s", text, has_dot ? "" : ".0");
+}
+
+function void put_indent(const c_ctx_t *ctx) {
+    for (size_t i = 0; i < ctx->indent; ++i)
+        fputs("    ", ctx->out);
+}
+
+function void collect_list(const NODE_T *node, const NODE_T **dst, size_t *count, size_t cap) {
+    if (!node || *count >= cap) return;
+    if (node->type == DELIMITER_T && node->value.delimiter == DELIMITER::COMA) {
+        collect_list(node->left, dst, count, cap);
+        collect_list(node->right, dst, count, cap);
+        return;
+    }
+    dst[(*count)++] = node;
+}
+
+function const NODE_T *find_func(const c_ctx_t *ctx, size_t id) {
+    for (size_t i = 0; i < ctx->func_count; ++i) {
+        if (ctx->funcs[i]->value.id == id)
+            return ctx->funcs[i];
+    }
+    return nullptr;
+}
+
+/**
+ * @brief Отмечает переменные, которые функция объявляет, присваивает или читает из ИЗМЕРИТЬ.
+ *
+ * Все они объявляются в начале функции с нулем, как обнуленные регистры SPU.
+ */
+function int declare_vars(c_ctx_t *ctx, const NODE_T *node) {
+    if (!node) return 0;
+    const NODE_T *var = nullptr;
+    if (node->type == KEYWORD_T && node->value.keyword == KEYWORD::VAR_DECLARATION)
+        var = node->left;
+    else if (node->type == OPERATOR_T && (node->value.opr == OPERATOR::ASSIGNMENT || node->value.opr == OPERATOR::IN))
+        var = node->left;
+    if (var) {
+        if (var->type != LITERAL_T || var->value.id >= varlist::size(ctx->globals)) {
+            fprintf(stderr, "C: ожидалось имя переменной\n");
+            return -1;
+        }
+        ctx->declared[var->value.id] = true;
+    }
+    if (node->type == KEYWORD_T && node->value.keyword == KEYWORD::FUNC_CALL)
+        return declare_vars(ctx, node->right);
+    if (declare_vars(ctx, node->left)) return -1;
+    return declare_vars(ctx, node->right);
+}
+
+/**
+ * @brief Вызов ФОРМУЛЫ или встроенных DRAW/SET_PIXEL.
+ */
+function int emit_call(c_ctx_t *ctx, const NODE_T *node) {
+    const NODE_T *args[C_MAX_ARGS + 1] = {};
+    size_t argc = 0;
+    collect_list(node->right, args, &argc, ARRAY_COUNT(args));
+    const mystr::mystr_t *nm = (node->left && node->left->type == LITERAL_T)
+                             ? varlist::get(ctx->globals, node->left->value.id) : nullptr;
+    if (!nm || !nm->str) return -1;
+
+    bool draw = strcmp(nm->str, "DRAW") == 0;
+    if (draw || strcmp(nm->str, "SET_PIXEL") == 0) {
+        if (argc != (draw ? 1u : 2u)) {
+            fprintf(stderr, "%s: неверное число аргументов\n", nm->str);
+            return -1;
+        }
+        fputs(draw ? "physlab_draw(" : "physlab_set_pixel(", ctx->out);
+    } else {
+        const NODE_T *func = find_func(ctx, node->left->value.id);
+        if (!func) {
+            fprintf(stderr, "C: неизвестная функция %s\n", nm->str);
+            return -1;
+        }
+        const NODE_T *params[C_MAX_ARGS + 1] = {};
+        size_t param_count = 0;
+        collect_list(func->left, params, &param_count, ARRAY_COUNT(params));
+        if (argc != param_count) {
+            fprintf(stderr, "%s: неверное число аргументов\n", nm->str);
+            return -1;
+        }
+        put_name(ctx, 'f', node->left->value.id);
+        fputc('(', ctx->out);
+    }
+    for (size_t i = 0; i < argc; ++i) {
+        if (i) fputs(", ", ctx->out);
+        if (emit_expr(ctx, args[i])) return -1;
+    }
+    fputc(')', ctx->out);
+    return 0;
+}
+
+/**
+ * @brief Выражение в полных скобках; сравнения и логика дают 0/1, как в VM.
+ */
+function int emit_expr(c_ctx_t *ctx, const NODE_T *node) {
+    FILE *out = ctx->out;
+    if (!node) return -1;
+    switch (node->type) {
+        case NUMBER_T:
+            put_number(out, node->value.num);
+            return 0;
+        case LITERAL_T:
+            if (node->value.id >= varlist::size(ctx->globals) || !ctx->declared[node->value.id]) {
+                const mystr::mystr_t *nm = varlist::get(ctx->globals, node->value.id);
+                fprintf(stderr, "C: переменная %s не объявлена\n", nm && nm->str ? nm->str : "?");
+                return -1;
+            }
+            put_name(ctx, 'v', node->value.id);
+            return 0;
+        case KEYWORD_T:
+            if (node->value.keyword == KEYWORD::FUNC_CALL)
+                return emit_call(ctx, node);
+            break;
+        case OPERATOR_T: {
+            const char *infix = nullptr, *call = nullptr;
+            switch (node->value.opr) {
+                case OPERATOR::ADD:        infix = " + ";  break;
+                case OPERATOR::SUB:        infix = " - ";  break;
+                case OPERATOR::MUL:        infix = " * ";  break;
+                case OPERATOR::DIV:        infix = " / ";  break;
+                case OPERATOR::EQ:         infix = " == "; break;
+                case OPERATOR::NEQ:        infix = " != "; break;
+                case OPERATOR::BELOW:      infix = " < ";  break;
+                case OPERATOR::ABOVE:      infix = " > ";  break;
+                case OPERATOR::BELOW_EQ:   infix = " <= "; break;
+                case OPERATOR::ABOVE_EQ:   infix = " >= "; break;
+                case OPERATOR::AND:        infix = " && "; break;
+                case OPERATOR::OR:         infix = " || "; break;
+                case OPERATOR::ASSIGNMENT: infix = " = ";  break;
+                case OPERATOR::CONNECTOR:  infix = ", ";   break;
+                case OPERATOR::POW:        call = "pow";   break;
+                case OPERATOR::MOD:        call = "fmod";  break;
+                case OPERATOR::LN:         call = "log";   break;
+                case OPERATOR::SQRT:       call = "sqrt";  break;
+                case OPERATOR::SIN:        call = "sin";   break;
+                case OPERATOR::COS:        call = "cos";   break;
+                case OPERATOR::TAN:        call = "tan";   break;
+                case OPERATOR::ASIN:       call = "asin";  break;
+                case OPERATOR::ACOS:       call = "acos";  break;
+                case OPERATOR::ATAN:       call = "atan";  break;
+                case OPERATOR::SET_PIXEL:  call = "physlab_set_pixel"; break;
+                case OPERATOR::DRAW:       call = "physlab_draw";      break;
+                default: break;
+            }
+            if (node->value.opr == OPERATOR::ASSIGNMENT && (!node->left || node->left->type != LITERAL_T)) {
+                fprintf(stderr, "C: ожидалось имя переменной\n");
+                return -1;
+            }
+            if (infix) {
+                fputc('(', out);
+                if (emit_expr(ctx, node->left)) return -1;
+                fputs(infix, out);
+                if (emit_expr(ctx, node->right)) return -1;
+                fputc(')', out);
+                return 0;
+            }
+            if (call) {
+                fprintf(out, "%s(", call);
+                if (emit_expr(ctx, node->left)) return -1;
+                if (node->value.opr == OPERATOR::POW || node->value.opr == OPERATOR::MOD || node->value.opr == OPERATOR::SET_PIXEL) {
+                    fputs(", ", out);
+                    if (emit_expr(ctx, node->right)) return -1;
+                }
+                fputc(')', out);
+                return 0;
+            }
+            if (node->value.opr == OPERATOR::NOT || node->value.opr == OPERATOR::CTG || node->value.opr == OPERATOR::ACTG) {
+                /* ctg x = 1 / tan x, arcctg x = atan(1 / x), как в simplify */
+                const char *open = node->value.opr == OPERATOR::NOT ? "(!" :
+                                   node->value.opr == OPERATOR::CTG ? "(1.0 / tan(" : "atan(1.0 / (";
+                fputs(open, out);
+                if (emit_expr(ctx, node->left)) return -1;
+                fputs(node->value.opr == OPERATOR::NOT ? ")" : "))", out);
+                return 0;
+            }
+            break;
+        }
+        default:
+            break;
+    }
+    fprintf(stderr, "C: неподдерживаемый узел выражения\n");
+    return -1;
+}
+
+/**
+ * @brief Тело ЕСЛИ/цикла в фигурных скобках с отступом.
+ */
+function int emit_block(c_ctx_t *ctx, const NODE_T *node) {
+    fputs("{\n", ctx->out);
+    ctx->indent++;
+    int rc = emit_stmt(ctx, node);
+    ctx->indent--;
+    put_indent(ctx);
+    fputc('}', ctx->out);
+    return rc;
+}
+
+function int emit_stmt(c_ctx_t *ctx, const NODE_T *node) {
+    FILE *out = ctx->out;
+    if (!node) return 0;
+    if (node->type == OPERATOR_T && node->value.opr == OPERATOR::CONNECTOR) {
+        if (emit_stmt(ctx, node->left)) return -1;
+        return emit_stmt(ctx, node->right);
+    }
+    if (node->type == KEYWORD_T && node->value.keyword == KEYWORD::VAR_DECLARATION)
+        return 0;
+
+    put_indent(ctx);
+    if (node->type == OPERATOR_T && node->value.opr == OPERATOR::OUT) {
+        fputs("physlab_out(", out);
+        if (emit_expr(ctx, node->left)) return -1;
+        fputs(");\n", out);
+        return 0;
+    }
+    if (node->type == OPERATOR_T && node->value.opr == OPERATOR::IN) {
+        if (!node->left || node->left->type != LITERAL_T) return -1;
+        put_name(ctx, 'v', node->left->value.id);
+        fputs(" = physlab_in();\n", out);
+        return 0;
+    }
+    if (node->type == OPERATOR_T && node->value.opr == OPERATOR::ASSIGNMENT) {
+        if (!node->left || node->left->type != LITERAL_T) return -1;
+        put_name(ctx, 'v', node->left->value.id);
+        fputs(" = ", out);
+        if (emit_expr(ctx, node->right)) return -1;
+        fputs(";\n", out);
+        return 0;
+    }
+    if (node->type != KEYWORD_T) {
+        fputs("(void) ", out);
+        if (emit_expr(ctx, node)) return -1;
+        fputs(";\n", out);
+        return 0;
+    }
+
+    switch (node->value.keyword) {
+        case KEYWORD::RETURN:
+            if (!ctx->func) {
+                fputs("return 0;\n", out);
+                return 0;
+            }
+            fputs("return ", out);
+            if (emit_expr(ctx, node->left)) return -1;
+            fputs(";\n", out);
+            return 0;
+        case KEYWORD::IF: {
+            const NODE_T *then_ops = node->right ? node->right->left : nullptr;
+            const NODE_T *else_ops = node->right ? node->right->right : nullptr;
+            fputs("if (", out);
+            if (emit_expr(ctx, node->left)) return -1;
+            fputs(") ", out);
+            if (emit_block(ctx, then_ops)) return -1;
+            if (else_ops) {
+                fputs(" else ", out);
+                if (emit_block(ctx, else_ops)) return -1;
+            }
+            fputc('\n', out);
+            return 0;
+        }
+        case KEYWORD::WHILE:
+            fputs("while (", out);
+            if (emit_expr(ctx, node->left)) return -1;
+            fputs(") ", out);
+            if (emit_block(ctx, node->right)) return -1;
+            fputc('\n', out);
+            return 0;
+        case KEYWORD::DO_WHILE:
+            fputs("do ", out);
+            if (emit_block(ctx, node->right)) return -1;
+            fputs(" while (", out);
+            if (emit_expr(ctx, node->left)) return -1;
+            fputs(");\n", out);
+            return 0;
+        case KEYWORD::FUNC_CALL:
+            fputs("(void) ", out);
+            if (emit_call(ctx, node)) return -1;
+            fputs(";\n", out);
+            return 0;
+        default:
+            fprintf(stderr, "C: неподдерживаемый оператор\n");
+            return -1;
+    }
+}
+
+function int emit_signature(const c_ctx_t *ctx, const NODE_T *func) {
+    const NODE_T *params[C_MAX_ARGS + 1] = {};
+    size_t count = 0;
+    collect_list(func->left, params, &count, ARRAY_COUNT(params));
+    if (count > C_MAX_ARGS) {
+        fprintf(stderr, "C: больше %zu параметров не поддерживается\n", C_MAX_ARGS);
+        return -1;
+    }
+    fputs("static double ", ctx->out);
+    put_name(ctx, 'f', func->value.id);
+    fputc('(', ctx->out);
+    for (size_t i = 0; i < count; ++i) {
+        if (params[i]->type != LITERAL_T || params[i]->value.id >= varlist::size(ctx->globals)) {
+            fprintf(stderr, "C: ожидалось имя параметра\n");
+            return -1;
+        }
+        fputs(i ? ", double " : "double ", ctx->out);
+        put_name(ctx, 'v', params[i]->value.id);
+    }
+    fputs(count ? ")" : "void)", ctx->out);
+    return 0;
+}
+
+/**
+ * @brief Функция (func == nullptr - main с телом body): все переменные - локальные double.
+ */
+function int emit_function(c_ctx_t *ctx, const NODE_T *func, const NODE_T *body) {
+    size_t var_count = varlist::size(ctx->globals);
+    memset(ctx->declared, 0, var_count * sizeof(bool));
+    ctx->func = func;
+    ctx->indent = 1;
+
+    bool *params = TYPED_CALLOC(var_count + 1, bool);
+    if (!params) return -1;
+    const NODE_T *list[C_MAX_ARGS + 1] = {};
+    size_t count = 0;
+    int rc = 0;
+    if (func) {
+        collect_list(func->left, list, &count, ARRAY_COUNT(list));
+        for (size_t i = 0; i < count; ++i) {
+            if (list[i]->type == LITERAL_T && list[i]->value.id < var_count)
+                params[list[i]->value.id] = ctx->declared[list[i]->value.id] = true;
+        }
+        rc = emit_signature(ctx, func);
+        fputs(" {\n", ctx->out);
+    } else {
+        fputs("int main(void) {\n", ctx->out);
+    }
+    if (!rc) rc = declare_vars(ctx, body);
+    for (size_t id = 0; id < var_count && !rc; ++id) {
+        if (!ctx->declared[id] || params[id]) continue;
+        fputs("    double ", ctx->out);
+        put_name(ctx, 'v', id);
+        fputs(" = 0.0;\n", ctx->out);
+    }
+    if (!rc) rc = emit_stmt(ctx, body);
+    fputs(func ? "    return 0.0;\n}\n\n" : "    return 0;\n}\n", ctx->out);
+    free(params);
+    return rc;
+}
+
+/**
+ * @brief Рантайм в самом файле: поведение как у spu без ключей и src/runtime/physlab_rt.cpp.
+ */
+function void emit_prelude(FILE *out) {
+    fprintf(out,
+        "/* Сгенерировано backend --target=c. Сборка: cc -O3 prog.c -lm -o prog */\n"
+        "#define _POSIX_C_SOURCE 200809L\n"
+        "#include <math.h>\n"
+        "#include <stdio.h>\n"
+        "#include <stdlib.h>\n"
+        "#include <time.h>\n"
+        "\n"
+        "static double physlab_ram[%zu];\n"
+        "\n"
+        "static inline void physlab_fail(const char *err) {\n"
+        "    fflush(stdout);\n"
+        "    fprintf(stderr, \"ошибка исполнения: %%s\\n\", err);\n"
+        "    exit(1);\n"
+        "}\n"
+        "\n"
+        "static inline int physlab_sep(int ch) {\n"
+        "    return ch == ',' || ch == ';' || ch == ' ' || ch == '\\t' || ch == '\\r' || ch == '\\n';\n"
+        "}\n"
+        "\n"
+        "static inline double physlab_in(void) {\n"
+        "    char token[64] = \"\", *end = NULL;\n"
+        "    size_t len = 0;\n"
+        "    int ch = getchar_unlocked();\n"
+        "    while (physlab_sep(ch)) ch = getchar_unlocked();\n"
+        "    for (; ch != EOF && !physlab_sep(ch); ch = getchar_unlocked())\n"
+        "        if (len + 1 < sizeof(token)) token[len++] = (char) ch;\n"
+        "    double value = strtod(token, &end);\n"
+        "    if (!len || end != token + len) physlab_fail(\"IN: нет числа во входных данных\");\n"
+        "    return value;\n"
+        "}\n"
+        "\n"
+        "static inline double physlab_out(double value) {\n"
+        "    printf(\"%%.15g\\n\", value);\n"
+        "    return value;\n"
+        "}\n"
+        "\n"
+        "static inline double physlab_set_pixel(double value, double index) {\n"
+        "    if (!(index >= 0) || index >= %zu.0) physlab_fail(\"адрес памяти вне диапазона\");\n"
+        "    physlab_ram[(size_t) index] = value;\n"
+        "    return value;\n"
+        "}\n"
+        "\n"
+        "static inline double physlab_draw(double delay_ms) {\n"
+        "    for (size_t y = 0; y < %zu; ++y) {\n"
+        "        for (size_t x = 0; x < %zu; ++x) {\n"
+        "            int ch = (int) physlab_ram[y * %zu + x];\n"
+        "            putchar(ch >= 32 && ch < 127 ? ch : ' ');\n"
+        "        }\n"
+        "        putchar('\\n');\n"
+        "    }\n"
+        "    fflush(stdout);\n"
+        "    if (delay_ms > 0) {\n"
+        "        struct timespec ts = {(time_t) (delay_ms / 1000), (long) (fmod(delay_ms, 1000) * 1e6)};\n"
+        "        nanosleep(&ts, NULL);\n"
+        "    }\n"
+        "    return 0;\n"
+        "}\n"
+        "\n",
+        VM_RAM_SIZE, VM_RAM_SIZE, VM_FRAME_H, VM_FRAME_W, VM_FRAME_W);
+}
+
+int emit_c_source(NODE_T *root, varlist::VarList *vars, FILE *out) {
+    if (!root || !vars || !out) return -1;
+    const NODE_T *funcs = nullptr;
+    const NODE_T *body = root;
+    if (root->type == OPERATOR_T && root->value.opr == OPERATOR::CONNECTOR) {
+        funcs = root->left;
+        body = root->right;
+    }
+
+    c_ctx_t ctx = {};
+    ctx.globals = vars;
+    ctx.out = out;
+    ctx.declared = TYPED_CALLOC(varlist::size(vars) + 1, bool);
+    ctx.funcs = TYPED_CALLOC(varlist::size(vars) + 1, const NODE_T *);
+    int rc = (ctx.declared && ctx.funcs) ? 0 : -1;
+    if (!rc) collect_list(funcs, ctx.funcs, &ctx.func_count, varlist::size(vars) + 1);
+
+    if (!rc) emit_prelude(out);
+    for (size_t i = 0; i < ctx.func_count && !rc; ++i) {
+        rc = emit_signature(&ctx, ctx.funcs[i]);
+        fputs(";\n", out);
+    }
+    if (!rc && ctx.func_count) fputc('\n', out);
+    for (size_t i = 0; i < ctx.func_count && !rc; ++i)
+        rc = emit_function(&ctx, ctx.funcs[i], ctx.funcs[i]->right);
+    if (!rc) rc = emit_function(&ctx, nullptr, body);
+
+    free(ctx.declared);
+    free(ctx.funcs);
+    return rc;
+}
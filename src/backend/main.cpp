@@ -6,29 +6,88 @@
 #include "base.h"
 #include "io_utils.h"
 #include "backend.h"
+#include "middleend.h"
 
 function void usage(const char *prog) {
-    fprintf(stderr, "usage: %s <input.ast> [output.asm]\n", prog ? prog : "backend");
+    fprintf(stderr, "usage: %s [--unroll N] [--profile in.profile] [--cache dir] [--parallel N] [--target=spu|elf|c]\n"
+                    "          [--stats] <input.ast> [output.asm|output.o|output.c]\n", prog ? prog : "backend");
 }
 
+/** Число копий тела счетного цикла по умолчанию. */
+const size_t DEFAULT_UNROLL = 4;
+
 /**
- * @brief CLI: backend <input.ast> [output.asm].
+ * @brief CLI: backend [--unroll N] [--profile in.profile] [--cache dir] [--parallel N] [--target=spu|elf|c] [--stats] <input.ast> [output].
+ *
+ * --target=elf пишет объектный файл x86-64, --target=c - исходник C99 вместо ассемблера SPU;
+ * --profile на них не влияет. --cache dir берет из dir код неизмененных ФОРМУЛ (только SPU без профиля).
+ * --parallel N генерирует ФОРМУЛЫ SPU в N потоках, вывод тот же.
+ * --stats печатает в stderr таблицу выделений памяти (в сборке с -DALLOC_STATS).
  */
 int main(int argc, char **argv) {
     const char *input = nullptr;
     const char *output = nullptr;
+    const char *profile_path = nullptr;
+    const char *cache_dir = nullptr;
+    size_t unroll = DEFAULT_UNROLL;
+    size_t threads = 1;
+    bool elf = false;
+    bool c_source = false;
+    bool print_stats = false;
+
+    int argi = 1;
+    while (argi + 1 < argc && argv[argi] && argv[argi][0] == '-' && argv[argi][1] == '-') {
+        if (strncmp(argv[argi], "--target=", 9) == 0) {
+            if (strcmp(argv[argi] + 9, "elf") == 0)
+                elf = true;
+            else if (strcmp(argv[argi] + 9, "c") == 0)
+                c_source = true;
+            else if (strcmp(argv[argi] + 9, "spu") != 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            argi += 1;
+            continue;
+        }
+        if (strcmp(argv[argi], "--stats") == 0) {
+            print_stats = true;
+            argi += 1;
+            continue;
+        }
+        if (strcmp(argv[argi], "--unroll") == 0 || strcmp(argv[argi], "--parallel") == 0) {
+            char *end = nullptr;
+            unsigned long val = strtoul(argv[argi + 1], &end, 10);
+            bool is_unroll = strcmp(argv[argi], "--unroll") == 0;
+            if (!end || *end || end == argv[argi + 1] || (!is_unroll && (!val || val > BACKEND_MAX_THREADS))) {
+                usage(argv[0]);
+                return 1;
+            }
+            if (is_unroll)
+                unroll = (size_t) val;
+            else
+                threads = (size_t) val;
+        } else if (strcmp(argv[argi], "--profile") == 0) {
+            profile_path = argv[argi + 1];
+        } else if (strcmp(argv[argi], "--cache") == 0) {
+            cache_dir = argv[argi + 1];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+        argi += 2;
+    }
 
-    if (argc < 2) {
+    if (argc <= argi) {
         usage(argc ? argv[0] : "backend");
         return 1;
     }
-    input = argv[1];
+    input = argv[argi];
     if (!input || !*input) {
         usage(argc ? argv[0] : "backend");
         return 1;
     }
-    if (argc > 2 && argv[2] && argv[2][0])
-        output = argv[2];
+    if (argc > argi + 1 && argv[argi + 1] && argv[argi + 1][0])
+        output = argv[argi + 1];
 
     NODE_T *root = nullptr;
     varlist::VarList vars = {};
@@ -37,19 +96,52 @@ int main(int argc, char **argv) {
         return 1;
     }
 
+    if (eliminate_dead_code(root, &vars)) {
+        fprintf(stderr, "dead code elimination failed on %s\n", input);
+        destroy_ast(root, &vars);
+        return 1;
+    }
+
+    if (optimize_loops(root, &vars, unroll)) {
+        fprintf(stderr, "loop optimization failed on %s\n", input);
+        destroy_ast(root, &vars);
+        return 1;
+    }
+
+    profile_t profile = {};
+    if (profile_path) {
+        if (load_profile(profile_path, &profile)) {
+            destroy_ast(root, &vars);
+            return 1;
+        }
+        backend_set_profile(&profile);
+    }
+    backend_set_threads(threads);
+    if (cache_dir && backend_set_cache(cache_dir)) {
+        destruct_profile(&profile);
+        destroy_ast(root, &vars);
+        return 1;
+    }
+
     FILE *fp = stdout;
     if (output)
-        fp = fopen(output, "w");
+        fp = fopen(output, elf ? "wb" : "w");
     if (!fp) {
         fprintf(stderr, "cannot open %s for writing\n", output);
+        destruct_profile(&profile);
         destroy_ast(root, &vars);
         return 1;
     }
 
-    int rc = reverse_program(root, &vars, fp);
+    int rc = elf ? emit_elf_object(root, &vars, fp) :
+             c_source ? emit_c_source(root, &vars, fp) : reverse_program(root, &vars, fp);
     if (fp && fp != stdout)
         fclose(fp);
+    backend_set_profile(nullptr);
+    destruct_profile(&profile);
     destroy_ast(root, &vars);
+    if (print_stats)
+        alloc_stats_dump(stderr);
 
     return rc ? 1 : 0;
 }
@@ -0,0 +1,153 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "base.h"
+#include "io_utils.h"
+#include "profile.h"
+
+function uint64_t hash_name(const char *name, size_t len);
+function int profile_grow(profile_t *profile);
+function profile_entry_t *profile_slot(const profile_t *profile, const char *name, size_t len, uint64_t hash);
+function profile_entry_t *profile_upsert(profile_t *profile, const char *name, size_t len);
+function int parse_line(profile_t *profile, char *line, size_t lineno);
+
+/**
+ * @brief FNV-1a, как у таблицы меток ассемблера.
+ */
+function uint64_t hash_name(const char *name, size_t len) {
+    uint64_t h = 1469598103934665603ULL;
+    for (size_t i = 0; i < len; ++i) {
+        h ^= (unsigned char) name[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+function int profile_grow(profile_t *profile) {
+    size_t cap = profile->capacity ? profile->capacity * 2 : 64;
+    profile_entry_t *data = TYPED_CALLOC(cap, profile_entry_t);
+    if (!data) return -1;
+    for (size_t i = 0; i < profile->capacity; ++i) {
+        const profile_entry_t *e = &profile->data[i];
+        if (!e->name) continue;
+        size_t pos = e->hash & (cap - 1);
+        while (data[pos].name)
+            pos = (pos + 1) & (cap - 1);
+        data[pos] = *e;
+    }
+    free(profile->data);
+    profile->data = data;
+    profile->capacity = cap;
+    return 0;
+}
+
+/**
+ * @brief Ячейка с этим именем или пустая ячейка, куда его можно вставить.
+ */
+function profile_entry_t *profile_slot(const profile_t *profile, const char *name, size_t len, uint64_t hash) {
+    size_t pos = hash & (profile->capacity - 1);
+    while (profile->data[pos].name) {
+        profile_entry_t *e = &profile->data[pos];
+        if (e->hash == hash && e->len == len && memcmp(e->name, name, len) == 0)
+            return e;
+        pos = (pos + 1) & (profile->capacity - 1);
+    }
+    return &profile->data[pos];
+}
+
+function profile_entry_t *profile_upsert(profile_t *profile, const char *name, size_t len) {
+    if (2 * (profile->size + 1) > profile->capacity && profile_grow(profile)) return nullptr;
+    uint64_t hash = hash_name(name, len);
+    profile_entry_t *e = profile_slot(profile, name, len, hash);
+    if (!e->name) {
+        e->name = name;
+        e->len = len;
+        e->hash = hash;
+        profile->size++;
+    }
+    return e;
+}
+
+function int parse_line(profile_t *profile, char *line, size_t lineno) {
+    while (*line == ' ' || *line == '\t')
+        ++line;
+    if (!*line || *line == '#') return 0;
+
+    char *save = nullptr;
+    char *kind = strtok_r(line, " \t\r", &save);
+    char *name = strtok_r(nullptr, " \t\r", &save);
+    char *a = strtok_r(nullptr, " \t\r", &save);
+    char *b = strtok_r(nullptr, " \t\r", &save);
+    if (!kind || !name || !a) {
+        fprintf(stderr, "профиль, строка %zu: ожидалось '<вид> <метка> <счетчик>'\n", lineno);
+        return -1;
+    }
+    if (*name == ':')
+        ++name;
+    profile_entry_t *e = profile_upsert(profile, name, strlen(name));
+    if (!e) return -1;
+
+    if (strcmp(kind, "label") == 0) {
+        e->count += strtoull(a, nullptr, 10);
+    } else if (strcmp(kind, "branch") == 0 && b) {
+        e->taken += strtoull(a, nullptr, 10);
+        e->executed += strtoull(b, nullptr, 10);
+    } else {
+        fprintf(stderr, "профиль, строка %zu: неизвестная запись %s\n", lineno, kind);
+        return -1;
+    }
+    return 0;
+}
+
+int load_profile(const char *path, profile_t *profile) {
+    if (!path || !profile) return -1;
+    *profile = {};
+    size_t len = 0;
+    char *raw = read_file_to_buf(path, &len);
+    if (!raw) {
+        fprintf(stderr, "не удалось прочитать профиль %s\n", path);
+        return -1;
+    }
+    /* своя копия с завершающим нулем: строки режутся на месте */
+    profile->text = TYPED_CALLOC(len + 1, char);
+    if (profile->text)
+        memcpy(profile->text, raw, len);
+    free(raw);
+    if (!profile->text) return -1;
+
+    char *cur = profile->text;
+    char *end = profile->text + len;
+    for (size_t lineno = 1; cur < end; ++lineno) {
+        char *eol = (char *) memchr(cur, '\n', (size_t) (end - cur));
+        if (!eol) eol = end;
+        *eol = '\0';
+        if (parse_line(profile, cur, lineno)) {
+            destruct_profile(profile);
+            return -1;
+        }
+        cur = eol + 1;
+    }
+    return 0;
+}
+
+const profile_entry_t *profile_find(const profile_t *profile, const char *label) {
+    if (!profile || !profile->capacity || !label) return nullptr;
+    if (*label == ':')
+        ++label;
+    size_t len = strlen(label);
+    const profile_entry_t *e = profile_slot(profile, label, len, hash_name(label, len));
+    return e->name ? e : nullptr;
+}
+
+uint64_t profile_label_count(const profile_t *profile, const char *label) {
+    const profile_entry_t *e = profile_find(profile, label);
+    return e ? e->count : 0;
+}
+
+void destruct_profile(profile_t *profile) {
+    if (!profile) return;
+    free(profile->data);
+    free(profile->text);
+    *profile = {};
+}
@@ -0,0 +1,905 @@
+#include <elf.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ast.h"
+#include "backend.h"
+#include "base.h"
+
+/** XMM0..XMM13 - стек промежуточных значений выражения; выше - временные. */
+const size_t X64_EXPR_REGS = 14;
+/** Аргументов в XMM по System V ABI. */
+const size_t X64_ARG_REGS = 8;
+const size_t X64_NONE = (size_t) -1;
+
+/** Условные переходы после ucomisd: младшие 4 бита второго байта 0F 8x. */
+namespace X64_CC {
+    enum X64_CC {
+        B  = 0x2, AE = 0x3, E  = 0x4, NE = 0x5,
+        BE = 0x6, A  = 0x7, P  = 0xA,
+    };
+}
+
+/** Внешние функции: рантайм (src/runtime/physlab_rt.cpp) и libm. */
+namespace X64_EXT {
+    enum X64_EXT {
+        IN, OUT, SET_PIXEL, DRAW,
+        SIN, COS, TAN, ASIN, ACOS, ATAN, POW, LOG, FMOD,
+        COUNT,
+    };
+}
+
+global const char *EXTERN_NAMES[X64_EXT::COUNT] = {
+    "physlab_in", "physlab_out", "physlab_set_pixel", "physlab_draw",
+    "sin", "cos", "tan", "asin", "acos", "atan", "pow", "log", "fmod",
+};
+
+typedef struct {
+    uint8_t *data;
+    size_t   size;
+    size_t   cap;
+    bool     failed;
+} code_buf_t;
+
+/** rel32 в коде: позиция и цель (метка, функция или внешний символ). */
+typedef struct {
+    size_t pos;
+    size_t target;
+} fixup_t;
+
+typedef struct {
+    fixup_t *items;
+    size_t   count;
+    size_t   cap;
+} fixup_list_t;
+
+typedef struct {
+    code_buf_t              code;
+    const varlist::VarList *globals;
+    const NODE_T          **funcs;
+    size_t                  func_count;
+    size_t                 *func_start;     /**< Смещения функций в .text; main - с нуля. */
+    size_t                 *func_size;
+    size_t                  main_size;
+    fixup_list_t            calls;          /**< Вызовы ФОРМУЛ: target - индекс в funcs. */
+    fixup_list_t            relocs;         /**< Вызовы X64_EXT: target - X64_EXT. */
+} x64_t;
+
+typedef struct {
+    x64_t        *x;
+    const NODE_T *func;                     /**< nullptr - ХОД РАБОТЫ (main). */
+    size_t        param_count;
+    size_t       *slots;                    /**< id переменной -> номер слота + 1. */
+    size_t        slot_count;
+    size_t       *labels;                   /**< Смещения меток; X64_NONE - еще не поставлена. */
+    size_t        label_count;
+    size_t        label_cap;
+    fixup_list_t  jumps;
+    size_t        spill_depth;              /**< Занятые слоты сохранения XMM (вложенные вызовы). */
+    size_t        max_spill;
+} x64_func_t;
+
+function void put_bytes(code_buf_t *buf, const void *bytes, size_t len);
+function void put_u8(code_buf_t *buf, uint8_t byte);
+function void put_u32(code_buf_t *buf, uint32_t value);
+function void patch_u32(code_buf_t *buf, size_t pos, uint32_t value);
+function int add_fixup(fixup_list_t *list, size_t pos, size_t target);
+function void sse_rr(code_buf_t *buf, uint8_t prefix, uint8_t op, size_t dst, size_t src);
+function void sse_slot(code_buf_t *buf, uint8_t op, size_t reg, int32_t disp);
+function void load_const(code_buf_t *buf, size_t reg, double value);
+function int32_t slot_disp(size_t slot);
+function size_t new_label(x64_func_t *fn);
+function void bind_label(x64_func_t *fn, size_t label);
+function int emit_jump(x64_func_t *fn, int cc, size_t label);
+function int emit_call_rel(x64_func_t *fn, fixup_list_t *list, size_t target);
+function size_t find_func(const x64_t *x, size_t id);
+function int var_slot(x64_func_t *fn, const NODE_T *node, bool create, size_t *slot);
+function int collect_list(const NODE_T *node, const NODE_T **dst, size_t *count, size_t cap);
+function size_t spill(x64_func_t *fn, size_t depth);
+function void unspill(x64_func_t *fn, size_t depth, size_t base);
+function int gen_call(x64_func_t *fn, const NODE_T **args, size_t argc, size_t depth, size_t ext, size_t func);
+function int gen_call_reg(x64_func_t *fn, size_t depth, X64_EXT::X64_EXT ext);
+function int gen_func_call(x64_func_t *fn, const NODE_T *node, size_t depth);
+function int gen_expr(x64_func_t *fn, const NODE_T *node, size_t depth);
+function int gen_cond(x64_func_t *fn, const NODE_T *node, size_t depth, size_t true_lbl, size_t false_lbl, size_t next_lbl);
+function bool is_self_tail_call(const x64_func_t *fn, const NODE_T *node);
+function int gen_stmt(x64_func_t *fn, const NODE_T *node);
+function int gen_function(x64_t *x, const NODE_T *func, const NODE_T *body, size_t *size);
+function int write_elf(const x64_t *x, FILE *out);
+
+function void put_bytes(code_buf_t *buf, const void *bytes, size_t len) {
+    if (buf->failed) return;
+    if (buf->size + len > buf->cap) {
+        size_t cap = buf->cap ? buf->cap * 2 : 4096;
+        while (cap < buf->size + len) cap *= 2;
+        uint8_t *tmp = TYPED_REALLOC(buf->data, cap, uint8_t);
+        if (!tmp) {
+            buf->failed = true;
+            return;
+        }
+        buf->data = tmp;
+        buf->cap = cap;
+    }
+    memcpy(buf->data + buf->size, bytes, len);
+    buf->size += len;
+}
+
+function void put_u8(code_buf_t *buf, uint8_t byte) {
+    put_bytes(buf, &byte, 1);
+}
+
+function void put_u32(code_buf_t *buf, uint32_t value) {
+    uint8_t le[4] = {(uint8_t) value, (uint8_t) (value >> 8), (uint8_t) (value >> 16), (uint8_t) (value >> 24)};
+    put_bytes(buf, le, sizeof(le));
+}
+
+function void patch_u32(code_buf_t *buf, size_t pos, uint32_t value) {
+    if (buf->failed || pos + 4 > buf->size) return;
+    for (size_t i = 0; i < 4; ++i)
+        buf->data[pos + i] = (uint8_t) (value >> (8 * i));
+}
+
+function int add_fixup(fixup_list_t *list, size_t pos, size_t target) {
+    if (list->count == list->cap) {
+        size_t cap = list->cap ? list->cap * 2 : 64;
+        fixup_t *tmp = TYPED_REALLOC(list->items, cap, fixup_t);
+        if (!tmp) return -1;
+        list->items = tmp;
+        list->cap = cap;
+    }
+    list->items[list->count++] = {pos, target};
+    return 0;
+}
+
+/**
+ * @brief Команда SSE2 регистр-регистр: prefix [REX] 0F op modrm.
+ */
+function void sse_rr(code_buf_t *buf, uint8_t prefix, uint8_t op, size_t dst, size_t src) {
+    put_u8(buf, prefix);
+    if (dst >= 8 || src >= 8)
+        put_u8(buf, (uint8_t) (0x40 | (dst >= 8 ? 4 : 0) | (src >= 8 ? 1 : 0)));
+    uint8_t insn[3] = {0x0F, op, (uint8_t) (0xC0 | (dst & 7) << 3 | (src & 7))};
+    put_bytes(buf, insn, sizeof(insn));
+}
+
+/**
+ * @brief movsd между регистром и [rbp + disp]: op 0x10 - загрузка, 0x11 - запись.
+ */
+function void sse_slot(code_buf_t *buf, uint8_t op, size_t reg, int32_t disp) {
+    put_u8(buf, 0xF2);
+    if (reg >= 8) put_u8(buf, 0x44);
+    uint8_t insn[3] = {0x0F, op, (uint8_t) (0x85 | (reg & 7) << 3)};
+    put_bytes(buf, insn, sizeof(insn));
+    put_u32(buf, (uint32_t) disp);
+}
+
+/**
+ * @brief reg = value: ноль - xorpd, иначе mov rax, imm64; movq reg, rax.
+ */
+function void load_const(code_buf_t *buf, size_t reg, double value) {
+    uint64_t bits = 0;
+    memcpy(&bits, &value, sizeof(bits));
+    if (!bits) {
+        sse_rr(buf, 0x66, 0x57, reg, reg);
+        return;
+    }
+    put_u8(buf, 0x48);
+    put_u8(buf, 0xB8);
+    for (size_t i = 0; i < 8; ++i)
+        put_u8(buf, (uint8_t) (bits >> (8 * i)));
+    uint8_t insn[5] = {0x66, (uint8_t) (0x48 | (reg >= 8 ? 4 : 0)), 0x0F, 0x6E, (uint8_t) (0xC0 | (reg & 7) << 3)};
+    put_bytes(buf, insn, sizeof(insn));
+}
+
+function int32_t slot_disp(size_t slot) {
+    return -8 * (int32_t) (slot + 1);
+}
+
+function size_t new_label(x64_func_t *fn) {
+    if (fn->label_count == fn->label_cap) {
+        size_t cap = fn->label_cap ? fn->label_cap * 2 : 64;
+        size_t *tmp = TYPED_REALLOC(fn->labels, cap, size_t);
+        if (!tmp) {
+            fn->x->code.failed = true;
+            return 0;
+        }
+        fn->labels = tmp;
+        fn->label_cap = cap;
+    }
+    fn->labels[fn->label_count] = X64_NONE;
+    return fn->label_count++;
+}
+
+function void bind_label(x64_func_t *fn, size_t label) {
+    if (label < fn->label_count)
+        fn->labels[label] = fn->x->code.size;
+}
+
+/**
+ * @brief jmp (cc < 0) или jcc на метку; rel32 проставляется в конце функции.
+ */
+function int emit_jump(x64_func_t *fn, int cc, size_t label) {
+    code_buf_t *buf = &fn->x->code;
+    if (cc < 0) {
+        put_u8(buf, 0xE9);
+    } else {
+        put_u8(buf, 0x0F);
+        put_u8(buf, (uint8_t) (0x80 | cc));
+    }
+    size_t pos = buf->size;
+    put_u32(buf, 0);
+    return add_fixup(&fn->jumps, pos, label);
+}
+
+function int emit_call_rel(x64_func_t *fn, fixup_list_t *list, size_t target) {
+    code_buf_t *buf = &fn->x->code;
+    put_u8(buf, 0xE8);
+    size_t pos = buf->size;
+    put_u32(buf, 0);
+    return add_fixup(list, pos, target);
+}
+
+function size_t find_func(const x64_t *x, size_t id) {
+    for (size_t i = 0; i < x->func_count; ++i) {
+        if (x->funcs[i]->value.id == id)
+            return i;
+    }
+    return X64_NONE;
+}
+
+/**
+ * @brief Слот переменной в кадре; create - завести, если его еще нет.
+ */
+function int var_slot(x64_func_t *fn, const NODE_T *node, bool create, size_t *slot) {
+    if (!node || node->type != LITERAL_T || node->value.id >= varlist::size(fn->x->globals)) {
+        fprintf(stderr, "x86-64: ожидалось имя переменной\n");
+        return -1;
+    }
+    size_t id = node->value.id;
+    if (!fn->slots[id]) {
+        if (!create) {
+            const mystr::mystr_t *nm = varlist::get(fn->x->globals, id);
+            fprintf(stderr, "x86-64: переменная %s не объявлена\n", nm && nm->str ? nm->str : "?");
+            return -1;
+        }
+        fn->slots[id] = ++fn->slot_count;
+    }
+    *slot = fn->slots[id] - 1;
+    return 0;
+}
+
+/**
+ * @brief Раскладывает список через COMA (вложенный в любую сторону) в dst по порядку.
+ * @return 0, -1 если элементов больше cap: в dst первые cap, *count == cap.
+ */
+function int collect_list(const NODE_T *node, const NODE_T **dst, size_t *count, size_t cap) {
+    if (!node) return 0;
+    if (node->type == DELIMITER_T && node->value.delimiter == DELIMITER::COMA)
+        return collect_list(node->left, dst, count, cap) | collect_list(node->right, dst, count, cap);
+    if (*count >= cap) return -1;
+    dst[(*count)++] = node;
+    return 0;
+}
+
+/**
+ * @brief Сохраняет XMM0..XMM[depth-1] перед вызовом: вызов портит все XMM.
+ *
+ * Слоты сохранения лежат у дна кадра, [rsp + 8k]: их адрес не зависит от
+ * числа переменных, которое известно только в конце функции.
+ */
+function size_t spill(x64_func_t *fn, size_t depth) {
+    code_buf_t *buf = &fn->x->code;
+    size_t base = fn->spill_depth;
+    for (size_t i = 0; i < depth; ++i) {
+        /* movsd [rsp + disp32], xmm_i */
+        put_u8(buf, 0xF2);
+        if (i >= 8) put_u8(buf, 0x44);
+        uint8_t insn[4] = {0x0F, 0x11, (uint8_t) (0x84 | (i & 7) << 3), 0x24};
+        put_bytes(buf, insn, sizeof(insn));
+        put_u32(buf, (uint32_t) (8 * (base + i)));
+    }
+    fn->spill_depth += depth;
+    if (fn->spill_depth > fn->max_spill)
+        fn->max_spill = fn->spill_depth;
+    return base;
+}
+
+function void unspill(x64_func_t *fn, size_t depth, size_t base) {
+    code_buf_t *buf = &fn->x->code;
+    for (size_t i = 0; i < depth; ++i) {
+        put_u8(buf, 0xF2);
+        if (i >= 8) put_u8(buf, 0x44);
+        uint8_t insn[4] = {0x0F, 0x10, (uint8_t) (0x84 | (i & 7) << 3), 0x24};
+        put_bytes(buf, insn, sizeof(insn));
+        put_u32(buf, (uint32_t) (8 * (base + i)));
+    }
+    fn->spill_depth = base;
+}
+
+/**
+ * @brief Вызов с аргументами в XMM0..; результат - в XMM[depth].
+ *
+ * Аргумент i вычисляется сразу в XMM[i]: уже готовые аргументы лежат ниже
+ * по стеку выражения и не портятся. func == X64_NONE - внешняя функция ext.
+ */
+function int gen_call(x64_func_t *fn, const NODE_T **args, size_t argc, size_t depth, size_t ext, size_t func) {
+    if (argc > X64_ARG_REGS) {
+        fprintf(stderr, "x86-64: больше %zu аргументов не поддерживается\n", X64_ARG_REGS);
+        return -1;
+    }
+    size_t base = spill(fn, depth);
+    for (size_t i = 0; i < argc; ++i) {
+        if (gen_expr(fn, args[i], i)) return -1;
+    }
+    int rc = (func == X64_NONE) ? emit_call_rel(fn, &fn->x->relocs, ext)
+                                : emit_call_rel(fn, &fn->x->calls, func);
+    if (rc) return -1;
+    if (depth)
+        sse_rr(&fn->x->code, 0x66, 0x28, depth, 0);
+    unspill(fn, depth, base);
+    return 0;
+}
+
+/**
+ * @brief Вызов ext от уже вычисленного XMM[depth], результат туда же.
+ */
+function int gen_call_reg(x64_func_t *fn, size_t depth, X64_EXT::X64_EXT ext) {
+    size_t base = spill(fn, depth);
+    if (depth)
+        sse_rr(&fn->x->code, 0x66, 0x28, 0, depth);
+    if (emit_call_rel(fn, &fn->x->relocs, ext)) return -1;
+    if (depth)
+        sse_rr(&fn->x->code, 0x66, 0x28, depth, 0);
+    unspill(fn, depth, base);
+    return 0;
+}
+
+/**
+ * @brief Вызов ФОРМУЛЫ или встроенных DRAW/SET_PIXEL.
+ */
+function int gen_func_call(x64_func_t *fn, const NODE_T *node, size_t depth) {
+    const NODE_T *args[X64_ARG_REGS + 1] = {};
+    size_t argc = 0;
+    collect_list(node->right, args, &argc, ARRAY_COUNT(args));
+    const mystr::mystr_t *nm = (node->left && node->left->type == LITERAL_T)
+                             ? varlist::get(fn->x->globals, node->left->value.id) : nullptr;
+    if (!nm || !nm->str) return -1;
+
+    bool draw = strcmp(nm->str, "DRAW") == 0;
+    if (draw || strcmp(nm->str, "SET_PIXEL") == 0) {
+        if (argc != (draw ? 1u : 2u)) {
+            fprintf(stderr, "%s: неверное число аргументов\n", nm->str);
+            return -1;
+        }
+        return gen_call(fn, args, argc, depth, draw ? X64_EXT::DRAW : X64_EXT::SET_PIXEL, X64_NONE);
+    }
+    size_t func = find_func(fn->x, node->left->value.id);
+    if (func == X64_NONE) {
+        fprintf(stderr, "x86-64: неизвестная функция %s\n", nm->str);
+        return -1;
+    }
+    return gen_call(fn, args, argc, depth, 0, func);
+}
+
+/**
+ * @brief Вычисляет выражение в XMM[depth], не трогая XMM0..XMM[depth-1].
+ */
+function int gen_expr(x64_func_t *fn, const NODE_T *node, size_t depth) {
+    code_buf_t *buf = &fn->x->code;
+    if (!node) return -1;
+    if (depth + 1 >= X64_EXPR_REGS) {
+        fprintf(stderr, "x86-64: выражение глубже %zu уровней\n", X64_EXPR_REGS - 1);
+        return -1;
+    }
+    size_t slot = 0;
+
+    switch (node->type) {
+        case NUMBER_T:
+            load_const(buf, depth, node->value.num);
+            return 0;
+        case LITERAL_T:
+            if (var_slot(fn, node, false, &slot)) return -1;
+            sse_slot(buf, 0x10, depth, slot_disp(slot));
+            return 0;
+        case KEYWORD_T:
+            if (node->value.keyword == KEYWORD::FUNC_CALL)
+                return gen_func_call(fn, node, depth);
+            break;
+        case OPERATOR_T: {
+            const NODE_T *args[2] = {node->left, node->right};
+            switch (node->value.opr) {
+                case OPERATOR::ADD: case OPERATOR::SUB:
+                case OPERATOR::MUL: case OPERATOR::DIV: {
+                    if (gen_expr(fn, node->left, depth)) return -1;
+                    if (gen_expr(fn, node->right, depth + 1)) return -1;
+                    uint8_t op = node->value.opr == OPERATOR::ADD ? 0x58 :
+                                 node->value.opr == OPERATOR::SUB ? 0x5C :
+                                 node->value.opr == OPERATOR::MUL ? 0x59 : 0x5E;
+                    sse_rr(buf, 0xF2, op, depth, depth + 1);
+                    return 0;
+                }
+                case OPERATOR::SQRT:
+                    if (gen_expr(fn, node->left, depth)) return -1;
+                    sse_rr(buf, 0xF2, 0x51, depth, depth);
+                    return 0;
+                case OPERATOR::MOD:  return gen_call(fn, args, 2, depth, X64_EXT::FMOD, X64_NONE);
+                case OPERATOR::POW:  return gen_call(fn, args, 2, depth, X64_EXT::POW, X64_NONE);
+                case OPERATOR::LN:   return gen_call(fn, args, 1, depth, X64_EXT::LOG, X64_NONE);
+                case OPERATOR::SIN:  return gen_call(fn, args, 1, depth, X64_EXT::SIN, X64_NONE);
+                case OPERATOR::COS:  return gen_call(fn, args, 1, depth, X64_EXT::COS, X64_NONE);
+                case OPERATOR::TAN:  return gen_call(fn, args, 1, depth, X64_EXT::TAN, X64_NONE);
+                case OPERATOR::ASIN: return gen_call(fn, args, 1, depth, X64_EXT::ASIN, X64_NONE);
+                case OPERATOR::ACOS: return gen_call(fn, args, 1, depth, X64_EXT::ACOS, X64_NONE);
+                case OPERATOR::ATAN: return gen_call(fn, args, 1, depth, X64_EXT::ATAN, X64_NONE);
+                case OPERATOR::CTG:
+                case OPERATOR::ACTG: {
+                    /* ctg x = 1 / tan x, arcctg x = atan(1 / x), как в simplify */
+                    bool ctg = node->value.opr == OPERATOR::CTG;
+                    int rc = ctg ? gen_call(fn, args, 1, depth, X64_EXT::TAN, X64_NONE)
+                                 : gen_expr(fn, node->left, depth);
+                    if (rc) return -1;
+                    load_const(buf, depth + 1, 1.0);
+                    sse_rr(buf, 0xF2, 0x5E, depth + 1, depth);
+                    sse_rr(buf, 0x66, 0x28, depth, depth + 1);
+                    return ctg ? 0 : gen_call_reg(fn, depth, X64_EXT::ATAN);
+                }
+                case OPERATOR::ASSIGNMENT:
+                    if (gen_expr(fn, node->right, depth)) return -1;
+                    if (var_slot(fn, node->left, true, &slot)) return -1;
+                    sse_slot(buf, 0x11, depth, slot_disp(slot));
+                    return 0;
+                case OPERATOR::CONNECTOR:
+                    if (gen_expr(fn, node->left, depth)) return -1;
+                    return gen_expr(fn, node->right, depth);
+                case OPERATOR::SET_PIXEL:
+                    /* значение слева, индекс справа - как SET_PIXEL(value, index) */
+                    return gen_call(fn, args, 2, depth, X64_EXT::SET_PIXEL, X64_NONE);
+                case OPERATOR::DRAW:
+                    return gen_call(fn, args, 1, depth, X64_EXT::DRAW, X64_NONE);
+                case OPERATOR::EQ: case OPERATOR::NEQ:
+                case OPERATOR::BELOW: case OPERATOR::ABOVE:
+                case OPERATOR::BELOW_EQ: case OPERATOR::ABOVE_EQ:
+                case OPERATOR::AND: case OPERATOR::OR: case OPERATOR::NOT: {
+                    size_t t = new_label(fn), f = new_label(fn), end = new_label(fn);
+                    if (gen_cond(fn, node, depth, t, f, f)) return -1;
+                    bind_label(fn, f);
+                    load_const(buf, depth, 0.0);
+                    if (emit_jump(fn, -1, end)) return -1;
+                    bind_label(fn, t);
+                    load_const(buf, depth, 1.0);
+                    bind_label(fn, end);
+                    return 0;
+                }
+                default:
+                    break;
+            }
+            break;
+        }
+        default:
+            break;
+    }
+    fprintf(stderr, "x86-64: неподдерживаемый узел выражения\n");
+    return -1;
+}
+
+/**
+ * @brief Переход на true_lbl/false_lbl по условию; next_lbl будет поставлена сразу за ним.
+ *
+ * ucomisd выставляет CF/ZF как беззнаковое сравнение, PF - для NaN. a < b
+ * проверяется как b > a (ja), чтобы с NaN сравнение было ложным, как в VM.
+ */
+function int gen_cond(x64_func_t *fn, const NODE_T *node, size_t depth, size_t true_lbl, size_t false_lbl, size_t next_lbl) {
+    code_buf_t *buf = &fn->x->code;
+    if (node && node->type == OPERATOR_T) {
+        OPERATOR::OPERATOR op = node->value.opr;
+        if (op == OPERATOR::AND || op == OPERATOR::OR) {
+            size_t mid = new_label(fn);
+            int rc = (op == OPERATOR::AND) ? gen_cond(fn, node->left, depth, mid, false_lbl, mid)
+                                           : gen_cond(fn, node->left, depth, true_lbl, mid, mid);
+            if (rc) return -1;
+            bind_label(fn, mid);
+            return gen_cond(fn, node->right, depth, true_lbl, false_lbl, next_lbl);
+        }
+        if (op == OPERATOR::NOT)
+            return gen_cond(fn, node->left, depth, false_lbl, true_lbl, next_lbl);
+
+        int cc = -1, inverse = -1;
+        switch (op) {
+            case OPERATOR::BELOW: case OPERATOR::ABOVE:       cc = X64_CC::A;  inverse = X64_CC::BE; break;
+            case OPERATOR::BELOW_EQ: case OPERATOR::ABOVE_EQ: cc = X64_CC::AE; inverse = X64_CC::B;  break;
+            case OPERATOR::EQ:                                cc = X64_CC::E;  inverse = X64_CC::NE; break;
+            case OPERATOR::NEQ:                               cc = X64_CC::NE; inverse = X64_CC::E;  break;
+            default: break;
+        }
+        if (cc >= 0) {
+            if (gen_expr(fn, node->left, depth) || gen_expr(fn, node->right, depth + 1)) return -1;
+            bool swap = op == OPERATOR::BELOW || op == OPERATOR::BELOW_EQ;
+            sse_rr(buf, 0x66, 0x2E, swap ? depth + 1 : depth, swap ? depth : depth + 1);
+            /* NaN (PF = 1): == ложно, != истинно */
+            if (op == OPERATOR::EQ && emit_jump(fn, X64_CC::P, false_lbl)) return -1;
+            if (op == OPERATOR::NEQ && emit_jump(fn, X64_CC::P, true_lbl)) return -1;
+            if (next_lbl == true_lbl)
+                return emit_jump(fn, inverse, false_lbl);
+            if (emit_jump(fn, cc, true_lbl)) return -1;
+            return next_lbl != false_lbl ? emit_jump(fn, -1, false_lbl) : 0;
+        }
+    }
+    /* прочие выражения: истина - не ноль (NaN тоже, как JNE в VM) */
+    if (gen_expr(fn, node, depth)) return -1;
+    load_const(buf, depth + 1, 0.0);
+    sse_rr(buf, 0x66, 0x2E, depth, depth + 1);
+    if (emit_jump(fn, X64_CC::P, true_lbl)) return -1;
+    if (next_lbl == true_lbl)
+        return emit_jump(fn, X64_CC::E, false_lbl);
+    if (emit_jump(fn, X64_CC::NE, true_lbl)) return -1;
+    return next_lbl != false_lbl ? emit_jump(fn, -1, false_lbl) : 0;
+}
+
+/**
+ * @brief ВОЗВРАТИТЬ f(...) внутри f: вызов заменяется переходом в начало (как в бэкенде SPU).
+ */
+function bool is_self_tail_call(const x64_func_t *fn, const NODE_T *node) {
+    if (!fn->func || !node || node->type != KEYWORD_T || node->value.keyword != KEYWORD::FUNC_CALL) return false;
+    if (!node->left || node->left->type != LITERAL_T || node->left->value.id != fn->func->value.id) return false;
+    const NODE_T *args[X64_ARG_REGS + 1] = {};
+    size_t argc = 0;
+    collect_list(node->right, args, &argc, ARRAY_COUNT(args));
+    return argc == fn->param_count;
+}
+
+function int gen_stmt(x64_func_t *fn, const NODE_T *node) {
+    code_buf_t *buf = &fn->x->code;
+    if (!node) return 0;
+    size_t slot = 0;
+    if (node->type == OPERATOR_T) {
+        switch (node->value.opr) {
+            case OPERATOR::CONNECTOR:
+                if (gen_stmt(fn, node->left)) return -1;
+                return gen_stmt(fn, node->right);
+            case OPERATOR::OUT: {
+                const NODE_T *args[1] = {node->left};
+                return gen_call(fn, args, 1, 0, X64_EXT::OUT, X64_NONE);
+            }
+            case OPERATOR::IN:
+                if (gen_call(fn, nullptr, 0, 0, X64_EXT::IN, X64_NONE)) return -1;
+                if (var_slot(fn, node->left, true, &slot)) return -1;
+                sse_slot(buf, 0x11, 0, slot_disp(slot));
+                return 0;
+            default:
+                return gen_expr(fn, node, 0);
+        }
+    }
+    if (node->type != KEYWORD_T)
+        return gen_expr(fn, node, 0);
+
+    switch (node->value.keyword) {
+        case KEYWORD::VAR_DECLARATION:
+            return var_slot(fn, node->left, true, &slot);
+        case KEYWORD::RETURN:
+            if (is_self_tail_call(fn, node->left)) {
+                /* аргументы в XMM0.. и переход к обнулению кадра: метка 1 */
+                const NODE_T *args[X64_ARG_REGS + 1] = {};
+                size_t argc = 0;
+                collect_list(node->left->right, args, &argc, ARRAY_COUNT(args));
+                for (size_t i = 0; i < argc; ++i) {
+                    if (gen_expr(fn, args[i], i)) return -1;
+                }
+                return emit_jump(fn, -1, 1);
+            }
+            if (fn->func && gen_expr(fn, node->left, 0)) return -1;
+            /* метка 0 - эпилог */
+            return emit_jump(fn, -1, 0);
+        case KEYWORD::IF: {
+            const NODE_T *then_ops = node->right ? node->right->left : nullptr;
+            const NODE_T *else_ops = node->right ? node->right->right : nullptr;
+            size_t then_lbl = new_label(fn), else_lbl = new_label(fn), end_lbl = new_label(fn);
+            if (gen_cond(fn, node->left, 0, then_lbl, else_ops ? else_lbl : end_lbl, then_lbl)) return -1;
+            bind_label(fn, then_lbl);
+            if (gen_stmt(fn, then_ops)) return -1;
+            if (else_ops) {
+                if (emit_jump(fn, -1, end_lbl)) return -1;
+                bind_label(fn, else_lbl);
+                if (gen_stmt(fn, else_ops)) return -1;
+            }
+            bind_label(fn, end_lbl);
+            return 0;
+        }
+        case KEYWORD::WHILE: {
+            /* условие внизу, как в бэкенде SPU */
+            size_t cond_lbl = new_label(fn), body_lbl = new_label(fn), end_lbl = new_label(fn);
+            if (emit_jump(fn, -1, cond_lbl)) return -1;
+            bind_label(fn, body_lbl);
+            if (gen_stmt(fn, node->right)) return -1;
+            bind_label(fn, cond_lbl);
+            if (gen_cond(fn, node->left, 0, body_lbl, end_lbl, end_lbl)) return -1;
+            bind_label(fn, end_lbl);
+            return 0;
+        }
+        case KEYWORD::DO_WHILE: {
+            size_t body_lbl = new_label(fn), end_lbl = new_label(fn);
+            bind_label(fn, body_lbl);
+            if (gen_stmt(fn, node->right)) return -1;
+            if (gen_cond(fn, node->left, 0, body_lbl, end_lbl, end_lbl)) return -1;
+            bind_label(fn, end_lbl);
+            return 0;
+        }
+        default:
+            return gen_expr(fn, node, 0);
+    }
+}
+
+/**
+ * @brief Функция (func == nullptr - main с телом body): пролог, параметры, тело, эпилог.
+ *
+ * Кадр: [rbp - 8(k+1)] - переменная k (обнуляются в прологе, как регистры VM),
+ * ниже, от rsp - слоты сохранения XMM на время вызовов. Размер кадра известен
+ * только после тела и дописывается в пролог.
+ */
+function int gen_function(x64_t *x, const NODE_T *func, const NODE_T *body, size_t *size) {
+    code_buf_t *buf = &x->code;
+    size_t start = buf->size;
+    x64_func_t fn = {};
+    fn.x = x;
+    fn.func = func;
+    fn.slots = TYPED_CALLOC(varlist::size(x->globals) + 1, size_t);
+    if (!fn.slots) return -1;
+    size_t ret_label = new_label(&fn);
+    size_t tail_label = new_label(&fn);
+
+    const NODE_T *params[X64_ARG_REGS + 1] = {};
+    size_t param_count = 0;
+    if (func) collect_list(func->left, params, &param_count, ARRAY_COUNT(params));
+    fn.param_count = param_count;
+    int rc = 0;
+    if (param_count > X64_ARG_REGS) {
+        fprintf(stderr, "x86-64: больше %zu параметров не поддерживается\n", X64_ARG_REGS);
+        rc = -1;
+    }
+
+    /* push rbp; mov rbp, rsp; sub rsp, frame */
+    const uint8_t enter[] = {0x55, 0x48, 0x89, 0xE5, 0x48, 0x81, 0xEC};
+    put_bytes(buf, enter, sizeof(enter));
+    size_t frame_pos = buf->size;
+    put_u32(buf, 0);
+    bind_label(&fn, tail_label);
+    /* mov ecx, count; lea rdi, [rbp - 8 * count]; xor eax, eax; rep stosq */
+    put_u8(buf, 0xB9);
+    size_t count_pos = buf->size;
+    put_u32(buf, 0);
+    const uint8_t lea[] = {0x48, 0x8D, 0xBD};
+    put_bytes(buf, lea, sizeof(lea));
+    size_t vars_pos = buf->size;
+    put_u32(buf, 0);
+    const uint8_t zero[] = {0x31, 0xC0, 0xF3, 0x48, 0xAB};
+    put_bytes(buf, zero, sizeof(zero));
+
+    for (size_t i = 0; i < param_count && !rc; ++i) {
+        size_t slot = 0;
+        rc = var_slot(&fn, params[i], true, &slot);
+        if (!rc) sse_slot(buf, 0x11, i, slot_disp(slot));
+    }
+    if (!rc) rc = gen_stmt(&fn, body);
+
+    /* без ВОЗВРАТИТЬ функция возвращает 0, main - код 0 */
+    if (func) load_const(buf, 0, 0.0);
+    bind_label(&fn, ret_label);
+    if (!func) {
+        const uint8_t ret0[] = {0x31, 0xC0};
+        put_bytes(buf, ret0, sizeof(ret0));
+    }
+    const uint8_t leave[] = {0xC9, 0xC3};
+    put_bytes(buf, leave, sizeof(leave));
+
+    size_t frame = (fn.slot_count + fn.max_spill) * 8;
+    frame = (frame + 15) / 16 * 16;
+    patch_u32(buf, frame_pos, (uint32_t) frame);
+    patch_u32(buf, count_pos, (uint32_t) fn.slot_count);
+    patch_u32(buf, vars_pos, (uint32_t) slot_disp(fn.slot_count ? fn.slot_count - 1 : 0));
+    for (size_t i = 0; i < fn.jumps.count && !rc; ++i) {
+        const fixup_t *fx = &fn.jumps.items[i];
+        size_t target = fn.labels[fx->target];
+        if (target == X64_NONE) rc = -1;
+        else patch_u32(buf, fx->pos, (uint32_t) (int32_t) ((int64_t) target - (int64_t) (fx->pos + 4)));
+    }
+    if (buf->failed) rc = -1;
+    *size = buf->size - start;
+    free(fn.slots);
+    free(fn.labels);
+    free(fn.jumps.items);
+    return rc;
+}
+
+/**
+ * @brief Пишет перемещаемый ELF64: .text, .rela.text, .symtab, .strtab, .shstrtab, .note.GNU-stack.
+ *
+ * Символы: ФОРМУЛЫ - локальные функции (вызовы между ними уже разрешены),
+ * main - глобальная, внешние функции - неопределенные с R_X86_64_PLT32.
+ */
+function int write_elf(const x64_t *x, FILE *out) {
+    enum {SEC_NULL, SEC_TEXT, SEC_RELA, SEC_SYMTAB, SEC_STRTAB, SEC_SHSTRTAB, SEC_NOTE, SEC_COUNT};
+    const char shstrtab[] = "\0.text\0.rela.text\0.symtab\0.strtab\0.shstrtab\0.note.GNU-stack";
+    const Elf64_Word sec_names[SEC_COUNT] = {0, 1, 7, 18, 26, 34, 44};
+
+    bool used[X64_EXT::COUNT] = {};
+    for (size_t i = 0; i < x->relocs.count; ++i)
+        used[x->relocs.items[i].target] = true;
+
+    /* строки: "\0", имена функций, main, внешние */
+    code_buf_t strtab = {};
+    put_u8(&strtab, 0);
+    size_t sym_cap = x->func_count + X64_EXT::COUNT + 3;
+    Elf64_Sym *syms = TYPED_CALLOC(sym_cap, Elf64_Sym);
+    size_t ext_sym[X64_EXT::COUNT] = {};
+    size_t sym_count = 0;
+    if (!syms) return -1;
+    syms[sym_count++] = {};
+    Elf64_Sym section = {};
+    section.st_info = ELF64_ST_INFO(STB_LOCAL, STT_SECTION);
+    section.st_shndx = SEC_TEXT;
+    syms[sym_count++] = section;
+    for (size_t i = 0; i < x->func_count; ++i) {
+        const mystr::mystr_t *nm = varlist::get(x->globals, x->funcs[i]->value.id);
+        Elf64_Sym sym = {};
+        sym.st_name = (Elf64_Word) strtab.size;
+        put_bytes(&strtab, nm && nm->str ? nm->str : "formula", strlen(nm && nm->str ? nm->str : "formula") + 1);
+        sym.st_info = ELF64_ST_INFO(STB_LOCAL, STT_FUNC);
+        sym.st_shndx = SEC_TEXT;
+        sym.st_value = x->func_start[i];
+        sym.st_size = x->func_size[i];
+        syms[sym_count++] = sym;
+    }
+    size_t first_global = sym_count;
+    Elf64_Sym main_sym = {};
+    main_sym.st_name = (Elf64_Word) strtab.size;
+    put_bytes(&strtab, "main", 5);
+    main_sym.st_info = ELF64_ST_INFO(STB_GLOBAL, STT_FUNC);
+    main_sym.st_shndx = SEC_TEXT;
+    main_sym.st_size = x->main_size;
+    syms[sym_count++] = main_sym;
+    for (size_t e = 0; e < X64_EXT::COUNT; ++e) {
+        if (!used[e]) continue;
+        Elf64_Sym sym = {};
+        sym.st_name = (Elf64_Word) strtab.size;
+        put_bytes(&strtab, EXTERN_NAMES[e], strlen(EXTERN_NAMES[e]) + 1);
+        sym.st_info = ELF64_ST_INFO(STB_GLOBAL, STT_NOTYPE);
+        sym.st_shndx = SHN_UNDEF;
+        ext_sym[e] = sym_count;
+        syms[sym_count++] = sym;
+    }
+
+    Elf64_Rela *relas = TYPED_CALLOC(x->relocs.count + 1, Elf64_Rela);
+    for (size_t i = 0; relas && i < x->relocs.count; ++i) {
+        relas[i].r_offset = x->relocs.items[i].pos;
+        relas[i].r_info = ELF64_R_INFO(ext_sym[x->relocs.items[i].target], R_X86_64_PLT32);
+        relas[i].r_addend = -4;
+    }
+
+    /* раскладка: заголовок, .text, .rela.text, .symtab, .strtab, .shstrtab, таблица секций */
+    size_t text_off = sizeof(Elf64_Ehdr);
+    size_t rela_off = (text_off + x->code.size + 7) / 8 * 8;
+    size_t rela_size = x->relocs.count * sizeof(Elf64_Rela);
+    size_t sym_off = rela_off + rela_size;
+    size_t sym_size = sym_count * sizeof(Elf64_Sym);
+    size_t str_off = sym_off + sym_size;
+    size_t shstr_off = str_off + strtab.size;
+    size_t sh_off = (shstr_off + sizeof(shstrtab) + 7) / 8 * 8;
+
+    Elf64_Shdr sh[SEC_COUNT] = {};
+    for (size_t i = 0; i < SEC_COUNT; ++i)
+        sh[i].sh_name = sec_names[i];
+    sh[SEC_TEXT].sh_type = SHT_PROGBITS;
+    sh[SEC_TEXT].sh_flags = SHF_ALLOC | SHF_EXECINSTR;
+    sh[SEC_TEXT].sh_offset = text_off;
+    sh[SEC_TEXT].sh_size = x->code.size;
+    sh[SEC_TEXT].sh_addralign = 16;
+    sh[SEC_RELA].sh_type = SHT_RELA;
+    sh[SEC_RELA].sh_flags = SHF_INFO_LINK;
+    sh[SEC_RELA].sh_offset = rela_off;
+    sh[SEC_RELA].sh_size = rela_size;
+    sh[SEC_RELA].sh_link = SEC_SYMTAB;
+    sh[SEC_RELA].sh_info = SEC_TEXT;
+    sh[SEC_RELA].sh_addralign = 8;
+    sh[SEC_RELA].sh_entsize = sizeof(Elf64_Rela);
+    sh[SEC_SYMTAB].sh_type = SHT_SYMTAB;
+    sh[SEC_SYMTAB].sh_offset = sym_off;
+    sh[SEC_SYMTAB].sh_size = sym_size;
+    sh[SEC_SYMTAB].sh_link = SEC_STRTAB;
+    sh[SEC_SYMTAB].sh_info = (Elf64_Word) first_global;
+    sh[SEC_SYMTAB].sh_addralign = 8;
+    sh[SEC_SYMTAB].sh_entsize = sizeof(Elf64_Sym);
+    sh[SEC_STRTAB].sh_type = SHT_STRTAB;
+    sh[SEC_STRTAB].sh_offset = str_off;
+    sh[SEC_STRTAB].sh_size = strtab.size;
+    sh[SEC_STRTAB].sh_addralign = 1;
+    sh[SEC_SHSTRTAB].sh_type = SHT_STRTAB;
+    sh[SEC_SHSTRTAB].sh_offset = shstr_off;
+    sh[SEC_SHSTRTAB].sh_size = sizeof(shstrtab);
+    sh[SEC_SHSTRTAB].sh_addralign = 1;
+    sh[SEC_NOTE].sh_type = SHT_PROGBITS;
+    sh[SEC_NOTE].sh_offset = sh_off;
+    sh[SEC_NOTE].sh_addralign = 1;
+
+    Elf64_Ehdr eh = {};
+    memcpy(eh.e_ident, ELFMAG, SELFMAG);
+    eh.e_ident[EI_CLASS] = ELFCLASS64;
+    eh.e_ident[EI_DATA] = ELFDATA2LSB;
+    eh.e_ident[EI_VERSION] = EV_CURRENT;
+    eh.e_ident[EI_OSABI] = ELFOSABI_SYSV;
+    eh.e_type = ET_REL;
+    eh.e_machine = EM_X86_64;
+    eh.e_version = EV_CURRENT;
+    eh.e_shoff = sh_off;
+    eh.e_ehsize = sizeof(Elf64_Ehdr);
+    eh.e_shentsize = sizeof(Elf64_Shdr);
+    eh.e_shnum = SEC_COUNT;
+    eh.e_shstrndx = SEC_SHSTRTAB;
+
+    const uint8_t pad[8] = {};
+    int rc = (relas && !strtab.failed) ? 0 : -1;
+    if (!rc) {
+        bool ok = fwrite(&eh, sizeof(eh), 1, out) == 1
+               && fwrite(x->code.data, 1, x->code.size, out) == x->code.size
+               && fwrite(pad, 1, rela_off - text_off - x->code.size, out) == rela_off - text_off - x->code.size
+               && fwrite(relas, 1, rela_size, out) == rela_size
+               && fwrite(syms, 1, sym_size, out) == sym_size
+               && fwrite(strtab.data, 1, strtab.size, out) == strtab.size
+               && fwrite(shstrtab, 1, sizeof(shstrtab), out) == sizeof(shstrtab)
+               && fwrite(pad, 1, sh_off - shstr_off - sizeof(shstrtab), out) == sh_off - shstr_off - sizeof(shstrtab)
+               && fwrite(sh, sizeof(sh), 1, out) == 1;
+        if (!ok) {
+            fprintf(stderr, "x86-64: ошибка записи объектного файла\n");
+            rc = -1;
+        }
+    }
+    free(strtab.data);
+    free(syms);
+    free(relas);
+    return rc;
+}
+
+int emit_elf_object(NODE_T *root, varlist::VarList *vars, FILE *out) {
+    if (!root || !vars || !out) return -1;
+    const NODE_T *funcs = nullptr;
+    const NODE_T *body = root;
+    if (root->type == OPERATOR_T && root->value.opr == OPERATOR::CONNECTOR) {
+        funcs = root->left;
+        body = root->right;
+    }
+
+    x64_t x = {};
+    x.globals = vars;
+    /* имена функций уникальны в таблице имен, так что их не больше ее размера */
+    size_t cap = varlist::size(vars) + 1;
+    x.funcs = TYPED_CALLOC(cap, const NODE_T *);
+    x.func_start = TYPED_CALLOC(cap, size_t);
+    x.func_size = TYPED_CALLOC(cap, size_t);
+    int rc = (x.funcs && x.func_start && x.func_size) ? 0 : -1;
+    if (!rc && collect_list(funcs, x.funcs, &x.func_count, cap)) {
+        fprintf(stderr, "x86-64: функций больше, чем имен в программе\n");
+        rc = -1;
+    }
+
+    if (!rc) rc = gen_function(&x, nullptr, body, &x.main_size);
+    for (size_t i = 0; i < x.func_count && !rc; ++i) {
+        while (x.code.size % 16) put_u8(&x.code, 0x90);
+        x.func_start[i] = x.code.size;
+        rc = gen_function(&x, x.funcs[i], x.funcs[i]->right, &x.func_size[i]);
+    }
+    for (size_t i = 0; i < x.calls.count && !rc; ++i) {
+        const fixup_t *fx = &x.calls.items[i];
+        int64_t rel = (int64_t) x.func_start[fx->target] - (int64_t) (fx->pos + 4);
+        patch_u32(&x.code, fx->pos, (uint32_t) (int32_t) rel);
+    }
+    if (!rc && x.code.failed) rc = -1;
+    if (!rc) rc = write_elf(&x, out);
+
+    free(x.code.data);
+    free(x.funcs);
+    free(x.func_start);
+    free(x.func_size);
+    free(x.calls.items);
+    free(x.relocs.items);
+    return rc;
+}
@@ -0,0 +1,644 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+    #include <immintrin.h>
+    #define BATCH_X86 1
+#endif
+
+#include "base.h"
+#include "batch.h"
+
+const uint32_t NO_SLOT = UINT32_MAX;
+/** Предикат "все строки": ветвления еще не было. */
+const uint32_t ALL_ROWS = UINT32_MAX - 1;
+
+namespace SLOT_KIND {
+    enum SLOT_KIND {
+        PARAM, CONST, TEMP,
+    };
+}
+
+/**
+ * @brief Состояние компиляции. Слоты здесь виртуальные: каждая команда пишет
+ *        в новый слот, физические номера раздает allocate_slots().
+ */
+typedef struct {
+    batch_kernel_t *kernel;
+    uint8_t        *kind;           /**< SLOT_KIND виртуального слота. */
+    uint32_t       *index;          /**< Номер параметра или константы. */
+    size_t          vcount;
+    size_t          vcapacity;
+    size_t          const_capacity;
+    uint32_t       *var_slot;       /**< id переменной -> текущий слот, NO_SLOT - еще не присвоена. */
+    size_t          nvars;
+    uint32_t        pred;           /**< Маска строк, для которых исполняется текущий оператор. */
+    uint32_t        done;           /**< Маска строк, которые уже вернули значение. */
+    uint32_t        result;
+    bool            finished;       /**< Все строки вернули значение, дальше мертвый код. */
+} compile_ctx_t;
+
+function uint32_t new_vslot(compile_ctx_t *ctx, SLOT_KIND::SLOT_KIND kind, uint32_t index);
+function uint32_t const_slot(compile_ctx_t *ctx, double value);
+function uint32_t emit(compile_ctx_t *ctx, BATCH_OP::BATCH_OP op, uint32_t a, uint32_t b, uint32_t c);
+function size_t max_literal_id(const NODE_T *node);
+function int collect_params(compile_ctx_t *ctx, const NODE_T *node);
+function bool map_operator(OPERATOR::OPERATOR op, BATCH_OP::BATCH_OP *out);
+function bool is_mask_operator(OPERATOR::OPERATOR op);
+function uint32_t compile_num(compile_ctx_t *ctx, const NODE_T *node);
+function uint32_t compile_mask(compile_ctx_t *ctx, const NODE_T *node);
+function uint32_t active_rows(compile_ctx_t *ctx);
+function int compile_stmt(compile_ctx_t *ctx, const NODE_T *node);
+function int allocate_slots(compile_ctx_t *ctx);
+function void op_scalar(unsigned op, double *d, const double *a, const double *b, const double *c, size_t i, size_t len);
+function void run_block(const batch_kernel_t *kernel, BATCH_ISA::BATCH_ISA isa, double *const *cols, size_t len);
+
+function uint32_t new_vslot(compile_ctx_t *ctx, SLOT_KIND::SLOT_KIND kind, uint32_t index) {
+    if (ctx->vcount == ctx->vcapacity) {
+        size_t cap = ctx->vcapacity ? ctx->vcapacity * 2 : 64;
+        uint8_t *kinds = TYPED_REALLOC(ctx->kind, cap, uint8_t);
+        if (!kinds) return NO_SLOT;
+        ctx->kind = kinds;
+        uint32_t *idx = TYPED_REALLOC(ctx->index, cap, uint32_t);
+        if (!idx) return NO_SLOT;
+        ctx->index = idx;
+        ctx->vcapacity = cap;
+    }
+    ctx->kind[ctx->vcount] = (uint8_t) kind;
+    ctx->index[ctx->vcount] = index;
+    return (uint32_t) ctx->vcount++;
+}
+
+function uint32_t const_slot(compile_ctx_t *ctx, double value) {
+    batch_kernel_t *k = ctx->kernel;
+    for (size_t v = 0; v < ctx->vcount; ++v)
+        if (ctx->kind[v] == SLOT_KIND::CONST && memcmp(&k->consts[ctx->index[v]], &value, sizeof(value)) == 0)
+            return (uint32_t) v;
+    if (k->const_count == ctx->const_capacity) {
+        size_t cap = ctx->const_capacity ? ctx->const_capacity * 2 : 16;
+        double *consts = TYPED_REALLOC(k->consts, cap, double);
+        if (!consts) return NO_SLOT;
+        k->consts = consts;
+        ctx->const_capacity = cap;
+    }
+    k->consts[k->const_count] = value;
+    return new_vslot(ctx, SLOT_KIND::CONST, (uint32_t) k->const_count++);
+}
+
+function uint32_t emit(compile_ctx_t *ctx, BATCH_OP::BATCH_OP op, uint32_t a, uint32_t b, uint32_t c) {
+    if (a == NO_SLOT) return NO_SLOT;
+    batch_kernel_t *k = ctx->kernel;
+    if (k->size == k->capacity) {
+        size_t cap = k->capacity ? k->capacity * 2 : 64;
+        batch_insn_t *code = TYPED_REALLOC(k->code, cap, batch_insn_t);
+        if (!code) return NO_SLOT;
+        k->code = code;
+        k->capacity = cap;
+    }
+    uint32_t dst = new_vslot(ctx, SLOT_KIND::TEMP, 0);
+    if (dst == NO_SLOT) return NO_SLOT;
+    k->code[k->size++] = {(uint8_t) op, dst, a, b, c};
+    return dst;
+}
+
+function size_t max_literal_id(const NODE_T *node) {
+    if (!node) return 0;
+    size_t id = (node->type == LITERAL_T) ? node->value.id : 0;
+    size_t l = max_literal_id(node->left);
+    size_t r = max_literal_id(node->right);
+    if (l > id) id = l;
+    return r > id ? r : id;
+}
+
+function int collect_params(compile_ctx_t *ctx, const NODE_T *node) {
+    if (!node) return 0;
+    if (node->type == DELIMITER_T && node->value.delimiter == DELIMITER::COMA) {
+        if (collect_params(ctx, node->left)) return -1;
+        return collect_params(ctx, node->right);
+    }
+    if (node->type != LITERAL_T) return -1;
+    uint32_t slot = new_vslot(ctx, SLOT_KIND::PARAM, (uint32_t) ctx->kernel->param_count++);
+    if (slot == NO_SLOT) return -1;
+    ctx->var_slot[node->value.id] = slot;
+    return 0;
+}
+
+/**
+ * @brief Команда ядра для арифметического оператора или сравнения AST.
+ */
+function bool map_operator(OPERATOR::OPERATOR op, BATCH_OP::BATCH_OP *out) {
+    switch (op) {
+        case OPERATOR::ADD:      *out = BATCH_OP::ADD;      return true;
+        case OPERATOR::SUB:      *out = BATCH_OP::SUB;      return true;
+        case OPERATOR::MUL:      *out = BATCH_OP::MUL;      return true;
+        case OPERATOR::DIV:      *out = BATCH_OP::DIV;      return true;
+        case OPERATOR::MOD:      *out = BATCH_OP::MOD;      return true;
+        case OPERATOR::POW:      *out = BATCH_OP::POW;      return true;
+        case OPERATOR::SQRT:     *out = BATCH_OP::SQRT;     return true;
+        case OPERATOR::LN:       *out = BATCH_OP::LN;       return true;
+        case OPERATOR::SIN:      *out = BATCH_OP::SIN;      return true;
+        case OPERATOR::COS:      *out = BATCH_OP::COS;      return true;
+        case OPERATOR::TAN:      *out = BATCH_OP::TAN;      return true;
+        case OPERATOR::CTG:      *out = BATCH_OP::CTG;      return true;
+        case OPERATOR::ASIN:     *out = BATCH_OP::ASIN;     return true;
+        case OPERATOR::ACOS:     *out = BATCH_OP::ACOS;     return true;
+        case OPERATOR::ATAN:     *out = BATCH_OP::ATAN;     return true;
+        case OPERATOR::ACTG:     *out = BATCH_OP::ACTG;     return true;
+        case OPERATOR::EQ:       *out = BATCH_OP::EQ;       return true;
+        case OPERATOR::NEQ:      *out = BATCH_OP::NEQ;      return true;
+        case OPERATOR::BELOW:    *out = BATCH_OP::BELOW;    return true;
+        case OPERATOR::ABOVE:    *out = BATCH_OP::ABOVE;    return true;
+        case OPERATOR::BELOW_EQ: *out = BATCH_OP::BELOW_EQ; return true;
+        case OPERATOR::ABOVE_EQ: *out = BATCH_OP::ABOVE_EQ; return true;
+        default:                 return false;
+    }
+}
+
+function bool is_mask_operator(OPERATOR::OPERATOR op) {
+    return op == OPERATOR::EQ || op == OPERATOR::NEQ || op == OPERATOR::BELOW || op == OPERATOR::ABOVE ||
+           op == OPERATOR::BELOW_EQ || op == OPERATOR::ABOVE_EQ ||
+           op == OPERATOR::AND || op == OPERATOR::OR || op == OPERATOR::NOT;
+}
+
+/**
+ * @brief Выражение как число; возвращает слот или NO_SLOT.
+ */
+function uint32_t compile_num(compile_ctx_t *ctx, const NODE_T *node) {
+    if (!node) return NO_SLOT;
+    if (node->type == NUMBER_T)
+        return const_slot(ctx, node->value.num);
+    if (node->type == LITERAL_T) {
+        uint32_t slot = ctx->var_slot[node->value.id];
+        return slot != NO_SLOT ? slot : const_slot(ctx, 0.0);
+    }
+    if (node->type == OPERATOR_T) {
+        OPERATOR::OPERATOR opr = node->value.opr;
+        if (is_mask_operator(opr))
+            return emit(ctx, BATCH_OP::TO_NUM, compile_mask(ctx, node), NO_SLOT, NO_SLOT);
+        BATCH_OP::BATCH_OP op = BATCH_OP::COUNT;
+        if (map_operator(opr, &op)) {
+            uint32_t a = compile_num(ctx, node->left);
+            bool unary = op == BATCH_OP::SQRT || op == BATCH_OP::LN || (op >= BATCH_OP::SIN && op <= BATCH_OP::ACTG);
+            if (unary)
+                return emit(ctx, op, a, NO_SLOT, NO_SLOT);
+            uint32_t b = compile_num(ctx, node->right);
+            return b == NO_SLOT ? NO_SLOT : emit(ctx, op, a, b, NO_SLOT);
+        }
+    }
+    fprintf(stderr, "пакетное вычисление: неподдерживаемый узел выражения (вызов, ввод-вывод или графика)\n");
+    return NO_SLOT;
+}
+
+/**
+ * @brief Условие как маска; числовое значение истинно, если не равно 0.
+ */
+function uint32_t compile_mask(compile_ctx_t *ctx, const NODE_T *node) {
+    if (!node) return NO_SLOT;
+    if (node->type == OPERATOR_T) {
+        OPERATOR::OPERATOR opr = node->value.opr;
+        BATCH_OP::BATCH_OP op = BATCH_OP::COUNT;
+        if (opr == OPERATOR::NOT)
+            return emit(ctx, BATCH_OP::NOT, compile_mask(ctx, node->left), NO_SLOT, NO_SLOT);
+        if (opr == OPERATOR::AND || opr == OPERATOR::OR) {
+            uint32_t a = compile_mask(ctx, node->left);
+            uint32_t b = compile_mask(ctx, node->right);
+            if (b == NO_SLOT) return NO_SLOT;
+            return emit(ctx, opr == OPERATOR::AND ? BATCH_OP::AND : BATCH_OP::OR, a, b, NO_SLOT);
+        }
+        if (is_mask_operator(opr) && map_operator(opr, &op)) {
+            uint32_t a = compile_num(ctx, node->left);
+            uint32_t b = compile_num(ctx, node->right);
+            return b == NO_SLOT ? NO_SLOT : emit(ctx, op, a, b, NO_SLOT);
+        }
+    }
+    return emit(ctx, BATCH_OP::TO_MASK, compile_num(ctx, node), NO_SLOT, NO_SLOT);
+}
+
+/**
+ * @brief Строки, которые исполняют текущий оператор: pred без вернувшихся.
+ * @return ALL_ROWS, слот маски или NO_SLOT при ошибке.
+ */
+function uint32_t active_rows(compile_ctx_t *ctx) {
+    if (ctx->done == NO_SLOT)
+        return ctx->pred;
+    uint32_t live = emit(ctx, BATCH_OP::NOT, ctx->done, NO_SLOT, NO_SLOT);
+    if (ctx->pred == ALL_ROWS || live == NO_SLOT)
+        return live;
+    return emit(ctx, BATCH_OP::AND, ctx->pred, live, NO_SLOT);
+}
+
+function int compile_stmt(compile_ctx_t *ctx, const NODE_T *node) {
+    if (!node || ctx->finished) return 0;
+    if (node->type == OPERATOR_T && node->value.opr == OPERATOR::CONNECTOR) {
+        if (compile_stmt(ctx, node->left)) return -1;
+        return compile_stmt(ctx, node->right);
+    }
+    if (node->type == KEYWORD_T && node->value.keyword == KEYWORD::VAR_DECLARATION)
+        return 0;
+    if (node->type == OPERATOR_T && node->value.opr == OPERATOR::ASSIGNMENT) {
+        if (!node->left || node->left->type != LITERAL_T) return -1;
+        uint32_t value = compile_num(ctx, node->right);
+        uint32_t act = active_rows(ctx);
+        if (value == NO_SLOT || act == NO_SLOT) return -1;
+        uint32_t *var = &ctx->var_slot[node->left->value.id];
+        if (act != ALL_ROWS) {
+            uint32_t old = (*var != NO_SLOT) ? *var : const_slot(ctx, 0.0);
+            value = (old == NO_SLOT) ? NO_SLOT : emit(ctx, BATCH_OP::BLEND, value, old, act);
+        }
+        *var = value;
+        return value == NO_SLOT ? -1 : 0;
+    }
+    if (node->type == KEYWORD_T && node->value.keyword == KEYWORD::RETURN) {
+        uint32_t value = compile_num(ctx, node->left);
+        uint32_t act = active_rows(ctx);
+        if (value == NO_SLOT || act == NO_SLOT) return -1;
+        if (act == ALL_ROWS) {
+            ctx->result = value;
+            ctx->finished = true;
+            return 0;
+        }
+        uint32_t old = (ctx->result != NO_SLOT) ? ctx->result : const_slot(ctx, 0.0);
+        ctx->result = (old == NO_SLOT) ? NO_SLOT : emit(ctx, BATCH_OP::BLEND, value, old, act);
+        ctx->done = (ctx->done == NO_SLOT) ? act : emit(ctx, BATCH_OP::OR, ctx->done, act, NO_SLOT);
+        /* вне ветвления вернули все оставшиеся строки */
+        if (ctx->pred == ALL_ROWS)
+            ctx->finished = true;
+        return (ctx->result == NO_SLOT || ctx->done == NO_SLOT) ? -1 : 0;
+    }
+    if (node->type == KEYWORD_T && node->value.keyword == KEYWORD::IF) {
+        const NODE_T *then_ops = node->right ? node->right->left : nullptr;
+        const NODE_T *else_ops = node->right ? node->right->right : nullptr;
+        uint32_t cond = compile_mask(ctx, node->left);
+        if (cond == NO_SLOT) return -1;
+        uint32_t outer = ctx->pred;
+
+        ctx->pred = (outer == ALL_ROWS) ? cond : emit(ctx, BATCH_OP::AND, outer, cond, NO_SLOT);
+        int rc = (ctx->pred == NO_SLOT) ? -1 : compile_stmt(ctx, then_ops);
+        if (!rc && else_ops) {
+            uint32_t inv = emit(ctx, BATCH_OP::NOT, cond, NO_SLOT, NO_SLOT);
+            ctx->pred = (outer == ALL_ROWS || inv == NO_SLOT) ? inv : emit(ctx, BATCH_OP::AND, outer, inv, NO_SLOT);
+            rc = (ctx->pred == NO_SLOT) ? -1 : compile_stmt(ctx, else_ops);
+        }
+        ctx->pred = outer;
+        return rc;
+    }
+    fprintf(stderr, "пакетное вычисление: в теле формулы допустимы только ВЕЛИЧИНА, присваивания, ЕСЛИ и ВОЗВРАТИТЬ\n");
+    return -1;
+}
+
+/**
+ * @brief Убирает команды, не влияющие на ответ, и раздает физические слоты.
+ *
+ * Временный слот освобождается после последнего чтения, поэтому команде
+ * может достаться слот собственного операнда: команды поэлементные.
+ */
+function int allocate_slots(compile_ctx_t *ctx) {
+    batch_kernel_t *k = ctx->kernel;
+    size_t vcount = ctx->vcount;
+    bool *needed = TYPED_CALLOC(vcount + 1, bool);
+    size_t *last_use = TYPED_CALLOC(vcount + 1, size_t);
+    uint32_t *phys = TYPED_CALLOC(vcount + 1, uint32_t);
+    uint32_t *free_list = TYPED_CALLOC(vcount + 1, uint32_t);
+    int rc = (needed && last_use && phys && free_list) ? 0 : -1;
+
+    if (!rc) {
+        needed[ctx->result] = true;
+        for (size_t j = k->size; j-- > 0;) {
+            batch_insn_t *insn = &k->code[j];
+            if (!needed[insn->dst]) {
+                insn->dst = NO_SLOT;
+                continue;
+            }
+            uint32_t ops[3] = {insn->a, insn->b, insn->c};
+            for (size_t o = 0; o < 3; ++o)
+                if (ops[o] != NO_SLOT) needed[ops[o]] = true;
+        }
+
+        size_t pos = 0;
+        for (size_t j = 0; j < k->size; ++j)
+            if (k->code[j].dst != NO_SLOT)
+                k->code[pos++] = k->code[j];
+        k->size = pos;
+        for (size_t j = 0; j < k->size; ++j) {
+            uint32_t ops[3] = {k->code[j].a, k->code[j].b, k->code[j].c};
+            for (size_t o = 0; o < 3; ++o)
+                if (ops[o] != NO_SLOT) last_use[ops[o]] = j;
+        }
+        last_use[ctx->result] = SIZE_MAX;
+
+        for (size_t v = 0; v < vcount; ++v) {
+            if (ctx->kind[v] == SLOT_KIND::PARAM) phys[v] = ctx->index[v];
+            if (ctx->kind[v] == SLOT_KIND::CONST) phys[v] = (uint32_t) (k->param_count + ctx->index[v]);
+        }
+        uint32_t next = (uint32_t) (k->param_count + k->const_count);
+        size_t free_count = 0;
+        for (size_t j = 0; j < k->size; ++j) {
+            batch_insn_t *insn = &k->code[j];
+            uint32_t *ops[3] = {&insn->a, &insn->b, &insn->c};
+            for (size_t o = 0; o < 3; ++o) {
+                uint32_t v = *ops[o];
+                if (v == NO_SLOT) continue;
+                bool repeated = (o > 0 && *ops[0] == v) || (o > 1 && *ops[1] == v);
+                if (!repeated && ctx->kind[v] == SLOT_KIND::TEMP && last_use[v] == j)
+                    free_list[free_count++] = phys[v];
+            }
+            uint32_t slot = free_count ? free_list[--free_count] : next++;
+            phys[insn->dst] = slot;
+            insn->dst = slot;
+            for (size_t o = 0; o < 3; ++o)
+                *ops[o] = (*ops[o] == NO_SLOT) ? slot : phys[*ops[o]];
+        }
+        k->slot_count = next;
+        k->result = phys[ctx->result];
+    }
+    free(needed);
+    free(last_use);
+    free(phys);
+    free(free_list);
+    return rc;
+}
+
+int compile_formula_batch(const NODE_T *func, batch_kernel_t *kernel) {
+    if (!func || !kernel) return -1;
+    *kernel = {};
+    kernel->isa = batch_best_isa();
+
+    compile_ctx_t ctx = {};
+    ctx.kernel = kernel;
+    ctx.pred = ALL_ROWS;
+    ctx.done = NO_SLOT;
+    ctx.result = NO_SLOT;
+    ctx.nvars = max_literal_id(func) + 1;
+    ctx.var_slot = TYPED_CALLOC(ctx.nvars, uint32_t);
+    int rc = ctx.var_slot ? 0 : -1;
+    for (size_t i = 0; !rc && i < ctx.nvars; ++i)
+        ctx.var_slot[i] = NO_SLOT;
+
+    if (!rc && collect_params(&ctx, func->left)) {
+        fprintf(stderr, "пакетное вычисление: некорректный список параметров\n");
+        rc = -1;
+    }
+    if (!rc)
+        rc = compile_stmt(&ctx, func->right);
+    if (!rc && ctx.result == NO_SLOT) {
+        fprintf(stderr, "пакетное вычисление: формула ничего не возвращает\n");
+        rc = -1;
+    }
+    if (!rc)
+        rc = allocate_slots(&ctx);
+
+    free(ctx.kind);
+    free(ctx.index);
+    free(ctx.var_slot);
+    if (rc)
+        destruct_batch_kernel(kernel);
+    return rc;
+}
+
+function inline double mask_of(bool value) {
+    uint64_t bits = value ? ~0ULL : 0ULL;
+    double d = 0;
+    memcpy(&d, &bits, sizeof(d));
+    return d;
+}
+
+function inline uint64_t bits_of(double value) {
+    uint64_t bits = 0;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+function inline double from_bits(uint64_t bits) {
+    double d = 0;
+    memcpy(&d, &bits, sizeof(d));
+    return d;
+}
+
+/**
+ * @brief Команда для строк [i, len): хвост после SIMD и функции libm.
+ */
+function void op_scalar(unsigned op, double *d, const double *a, const double *b, const double *c, size_t i, size_t len) {
+    switch (op) {
+        case BATCH_OP::ADD:      for (; i < len; ++i) d[i] = a[i] + b[i]; break;
+        case BATCH_OP::SUB:      for (; i < len; ++i) d[i] = a[i] - b[i]; break;
+        case BATCH_OP::MUL:      for (; i < len; ++i) d[i] = a[i] * b[i]; break;
+        case BATCH_OP::DIV:      for (; i < len; ++i) d[i] = a[i] / b[i]; break;
+        case BATCH_OP::SQRT:     for (; i < len; ++i) d[i] = sqrt(a[i]); break;
+        case BATCH_OP::MOD:      for (; i < len; ++i) d[i] = fmod(a[i], b[i]); break;
+        case BATCH_OP::POW:      for (; i < len; ++i) d[i] = pow(a[i], b[i]); break;
+        case BATCH_OP::LN:       for (; i < len; ++i) d[i] = log(a[i]); break;
+        case BATCH_OP::SIN:      for (; i < len; ++i) d[i] = sin(a[i]); break;
+        case BATCH_OP::COS:      for (; i < len; ++i) d[i] = cos(a[i]); break;
+        case BATCH_OP::TAN:      for (; i < len; ++i) d[i] = tan(a[i]); break;
+        case BATCH_OP::CTG:      for (; i < len; ++i) d[i] = 1.0 / tan(a[i]); break;
+        case BATCH_OP::ASIN:     for (; i < len; ++i) d[i] = asin(a[i]); break;
+        case BATCH_OP::ACOS:     for (; i < len; ++i) d[i] = acos(a[i]); break;
+        case BATCH_OP::ATAN:     for (; i < len; ++i) d[i] = atan(a[i]); break;
+        case BATCH_OP::ACTG:     for (; i < len; ++i) d[i] = atan(1.0 / a[i]); break;
+        case BATCH_OP::EQ:       for (; i < len; ++i) d[i] = mask_of(a[i] == b[i]); break;
+        case BATCH_OP::NEQ:      for (; i < len; ++i) d[i] = mask_of(a[i] != b[i]); break;
+        case BATCH_OP::BELOW:    for (; i < len; ++i) d[i] = mask_of(a[i] < b[i]); break;
+        case BATCH_OP::ABOVE:    for (; i < len; ++i) d[i] = mask_of(a[i] > b[i]); break;
+        case BATCH_OP::BELOW_EQ: for (; i < len; ++i) d[i] = mask_of(a[i] <= b[i]); break;
+        case BATCH_OP::ABOVE_EQ: for (; i < len; ++i) d[i] = mask_of(a[i] >= b[i]); break;
+        case BATCH_OP::AND:      for (; i < len; ++i) d[i] = from_bits(bits_of(a[i]) & bits_of(b[i])); break;
+        case BATCH_OP::OR:       for (; i < len; ++i) d[i] = from_bits(bits_of(a[i]) | bits_of(b[i])); break;
+        case BATCH_OP::NOT:      for (; i < len; ++i) d[i] = from_bits(~bits_of(a[i])); break;
+        case BATCH_OP::BLEND:    for (; i < len; ++i) d[i] = bits_of(c[i]) ? a[i] : b[i]; break;
+        case BATCH_OP::TO_NUM:   for (; i < len; ++i) d[i] = bits_of(a[i]) ? 1.0 : 0.0; break;
+        case BATCH_OP::TO_MASK:  for (; i < len; ++i) d[i] = mask_of(a[i] != 0.0); break;
+        default: break;
+    }
+}
+
+#ifdef BATCH_X86
+
+#define SSE2_UNARY(expr)                                            \
+    for (; i + 2 <= len; i += 2) {                                  \
+        __m128d x = _mm_loadu_pd(a + i);                            \
+        _mm_storeu_pd(d + i, (expr));                               \
+    }                                                               \
+    break
+
+#define SSE2_BINARY(expr)                                           \
+    for (; i + 2 <= len; i += 2) {                                  \
+        __m128d x = _mm_loadu_pd(a + i), y = _mm_loadu_pd(b + i);   \
+        _mm_storeu_pd(d + i, (expr));                               \
+    }                                                               \
+    break
+
+/**
+ * @brief SSE2-часть команды; возвращает, сколько строк обработано.
+ */
+function size_t op_sse2(unsigned op, double *d, const double *a, const double *b, const double *c, size_t len) {
+    const __m128d ones = _mm_castsi128_pd(_mm_set1_epi32(-1));
+    const __m128d one = _mm_set1_pd(1.0);
+    const __m128d zero = _mm_setzero_pd();
+    size_t i = 0;
+    switch (op) {
+        case BATCH_OP::ADD:      SSE2_BINARY(_mm_add_pd(x, y));
+        case BATCH_OP::SUB:      SSE2_BINARY(_mm_sub_pd(x, y));
+        case BATCH_OP::MUL:      SSE2_BINARY(_mm_mul_pd(x, y));
+        case BATCH_OP::DIV:      SSE2_BINARY(_mm_div_pd(x, y));
+        case BATCH_OP::SQRT:     SSE2_UNARY(_mm_sqrt_pd(x));
+        case BATCH_OP::EQ:       SSE2_BINARY(_mm_cmpeq_pd(x, y));
+        case BATCH_OP::NEQ:      SSE2_BINARY(_mm_cmpneq_pd(x, y));
+        case BATCH_OP::BELOW:    SSE2_BINARY(_mm_cmplt_pd(x, y));
+        case BATCH_OP::ABOVE:    SSE2_BINARY(_mm_cmpgt_pd(x, y));
+        case BATCH_OP::BELOW_EQ: SSE2_BINARY(_mm_cmple_pd(x, y));
+        case BATCH_OP::ABOVE_EQ: SSE2_BINARY(_mm_cmpge_pd(x, y));
+        case BATCH_OP::AND:      SSE2_BINARY(_mm_and_pd(x, y));
+        case BATCH_OP::OR:       SSE2_BINARY(_mm_or_pd(x, y));
+        case BATCH_OP::NOT:      SSE2_UNARY(_mm_xor_pd(x, ones));
+        case BATCH_OP::TO_NUM:   SSE2_UNARY(_mm_and_pd(x, one));
+        case BATCH_OP::TO_MASK:  SSE2_UNARY(_mm_cmpneq_pd(x, zero));
+        case BATCH_OP::BLEND:
+            for (; i + 2 <= len; i += 2) {
+                __m128d m = _mm_loadu_pd(c + i);
+                __m128d x = _mm_and_pd(m, _mm_loadu_pd(a + i));
+                _mm_storeu_pd(d + i, _mm_or_pd(x, _mm_andnot_pd(m, _mm_loadu_pd(b + i))));
+            }
+            break;
+        default: break;
+    }
+    return i;
+}
+
+#define AVX_UNARY(expr)                                                 \
+    for (; i + 4 <= len; i += 4) {                                      \
+        __m256d x = _mm256_loadu_pd(a + i);                             \
+        _mm256_storeu_pd(d + i, (expr));                                \
+    }                                                                   \
+    break
+
+#define AVX_BINARY(expr)                                                \
+    for (; i + 4 <= len; i += 4) {                                      \
+        __m256d x = _mm256_loadu_pd(a + i), y = _mm256_loadu_pd(b + i); \
+        _mm256_storeu_pd(d + i, (expr));                                \
+    }                                                                   \
+    break
+
+/**
+ * @brief AVX2-часть команды; собирается отдельно, выбирается во время исполнения.
+ */
+__attribute__((target("avx2")))
+function size_t op_avx2(unsigned op, double *d, const double *a, const double *b, const double *c, size_t len) {
+    const __m256d ones = _mm256_castsi256_pd(_mm256_set1_epi32(-1));
+    const __m256d one = _mm256_set1_pd(1.0);
+    const __m256d zero = _mm256_setzero_pd();
+    size_t i = 0;
+    switch (op) {
+        case BATCH_OP::ADD:      AVX_BINARY(_mm256_add_pd(x, y));
+        case BATCH_OP::SUB:      AVX_BINARY(_mm256_sub_pd(x, y));
+        case BATCH_OP::MUL:      AVX_BINARY(_mm256_mul_pd(x, y));
+        case BATCH_OP::DIV:      AVX_BINARY(_mm256_div_pd(x, y));
+        case BATCH_OP::SQRT:     AVX_UNARY(_mm256_sqrt_pd(x));
+        case BATCH_OP::EQ:       AVX_BINARY(_mm256_cmp_pd(x, y, _CMP_EQ_OQ));
+        case BATCH_OP::NEQ:      AVX_BINARY(_mm256_cmp_pd(x, y, _CMP_NEQ_UQ));
+        case BATCH_OP::BELOW:    AVX_BINARY(_mm256_cmp_pd(x, y, _CMP_LT_OQ));
+        case BATCH_OP::ABOVE:    AVX_BINARY(_mm256_cmp_pd(x, y, _CMP_GT_OQ));
+        case BATCH_OP::BELOW_EQ: AVX_BINARY(_mm256_cmp_pd(x, y, _CMP_LE_OQ));
+        case BATCH_OP::ABOVE_EQ: AVX_BINARY(_mm256_cmp_pd(x, y, _CMP_GE_OQ));
+        case BATCH_OP::AND:      AVX_BINARY(_mm256_and_pd(x, y));
+        case BATCH_OP::OR:       AVX_BINARY(_mm256_or_pd(x, y));
+        case BATCH_OP::NOT:      AVX_UNARY(_mm256_xor_pd(x, ones));
+        case BATCH_OP::TO_NUM:   AVX_UNARY(_mm256_and_pd(x, one));
+        case BATCH_OP::TO_MASK:  AVX_UNARY(_mm256_cmp_pd(x, zero, _CMP_NEQ_UQ));
+        case BATCH_OP::BLEND:
+            for (; i + 4 <= len; i += 4) {
+                __m256d m = _mm256_loadu_pd(c + i);
+                _mm256_storeu_pd(d + i, _mm256_blendv_pd(_mm256_loadu_pd(b + i), _mm256_loadu_pd(a + i), m));
+            }
+            break;
+        default: break;
+    }
+    return i;
+}
+
+#undef SSE2_UNARY
+#undef SSE2_BINARY
+#undef AVX_UNARY
+#undef AVX_BINARY
+
+#endif // BATCH_X86
+
+function void run_block(const batch_kernel_t *kernel, BATCH_ISA::BATCH_ISA isa, double *const *cols, size_t len) {
+    for (size_t j = 0; j < kernel->size; ++j) {
+        const batch_insn_t *insn = &kernel->code[j];
+        double *d = cols[insn->dst];
+        const double *a = cols[insn->a], *b = cols[insn->b], *c = cols[insn->c];
+        size_t i = 0;
+#ifdef BATCH_X86
+        if (isa == BATCH_ISA::AVX2)
+            i = op_avx2(insn->op, d, a, b, c, len);
+        else if (isa == BATCH_ISA::SSE2)
+            i = op_sse2(insn->op, d, a, b, c, len);
+#else
+        (void) isa;
+#endif
+        op_scalar(insn->op, d, a, b, c, i, len);
+    }
+}
+
+int eval_formula_batch(const batch_kernel_t *kernel, const double *const *inputs, size_t n, double *out) {
+    if (!kernel || !out || (kernel->param_count && !inputs)) return -1;
+    BATCH_ISA::BATCH_ISA isa = kernel->isa;
+    BATCH_ISA::BATCH_ISA best = batch_best_isa();
+    if (isa > best) isa = best;
+
+    size_t own = kernel->slot_count - kernel->param_count;
+    double *scratch = TYPED_CALLOC(own * BATCH_BLOCK + 1, double);
+    double **cols = TYPED_CALLOC(kernel->slot_count + 1, double *);
+    if (!scratch || !cols) {
+        free(scratch);
+        free(cols);
+        return -1;
+    }
+    for (size_t s = kernel->param_count; s < kernel->slot_count; ++s)
+        cols[s] = scratch + (s - kernel->param_count) * BATCH_BLOCK;
+    for (size_t k = 0; k < kernel->const_count; ++k) {
+        double *col = cols[kernel->param_count + k];
+        for (size_t i = 0; i < BATCH_BLOCK; ++i)
+            col[i] = kernel->consts[k];
+    }
+
+    for (size_t row = 0; row < n; row += BATCH_BLOCK) {
+        size_t len = (n - row < BATCH_BLOCK) ? n - row : BATCH_BLOCK;
+        /* входные столбцы читаются на месте, запись в них не идет */
+        for (size_t p = 0; p < kernel->param_count; ++p)
+            cols[p] = (double *) inputs[p] + row;
+        run_block(kernel, isa, cols, len);
+        memcpy(out + row, cols[kernel->result], len * sizeof(double));
+    }
+    free(scratch);
+    free(cols);
+    return 0;
+}
+
+BATCH_ISA::BATCH_ISA batch_best_isa() {
+#ifdef BATCH_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return BATCH_ISA::AVX2;
+    return BATCH_ISA::SSE2;
+#else
+    return BATCH_ISA::SCALAR;
+#endif
+}
+
+const char *batch_isa_name(BATCH_ISA::BATCH_ISA isa) {
+    switch (isa) {
+        case BATCH_ISA::AVX2: return "avx2";
+        case BATCH_ISA::SSE2: return "sse2";
+        default:              return "scalar";
+    }
+}
+
+void destruct_batch_kernel(batch_kernel_t *kernel) {
+    if (!kernel) return;
+    free(kernel->code);
+    free(kernel->consts);
+    *kernel = {};
+}
@@ -0,0 +1,1693 @@
+#include <malloc.h>
+#include <math.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "assembler.h"
+#include "backend.h"
+#include "base.h"
+#include "batch.h"
+#include "frontend.h"
+#include "middleend.h"
+#include "rev-front.h"
+#include "vm.h"
+#include "vm_io.h"
+
+/** Повторов одного замера; печатается медиана. */
+const size_t DEFAULT_REPEATS = 7;
+/** Число ЕСЛИ-блоков в минимальной сгенерированной программе. */
+const size_t DEFAULT_BLOCKS = 50000;
+/** Итераций внешнего цикла в программах для замера VM. */
+const size_t DEFAULT_ITERATIONS = 2000000;
+/** Строк во входных столбцах для замера пакетного вычисления. */
+const size_t DEFAULT_ROWS = 1000000;
+/** Значений во входном файле для замера ввода-вывода VM. */
+const size_t DEFAULT_VALUES = 3000000;
+/** Кадров в программах для замера DRAW. */
+const size_t DEFAULT_FRAMES = 20000;
+/** Переменных в формулах замера: параметры, локальные и имя функции. */
+const size_t FORMULA_VARS = 16;
+/** Программа генератора по умолчанию: около 200 КБ исходника. */
+const size_t GEN_FORMULAS = 50;
+const size_t GEN_STMTS = 12;
+const size_t GEN_DEPTH = 3;
+const size_t GEN_IDENTS = 64;
+const size_t GEN_NESTING = 2;
+const size_t GEN_TEXT = 100;
+/** Повторов замера стадий: p95 считается по ним. */
+const size_t STAGE_REPEATS = 20;
+/** Копий тела счетного цикла в middleend, как у backend по умолчанию. */
+const size_t DEFAULT_UNROLL = 4;
+/** Прогонов стадий до замера по умолчанию. */
+const size_t GATE_WARMUP = 2;
+/** Допустимое ухудшение метрики против базовой линии по умолчанию, %. */
+const double GATE_THRESHOLD = 10.0;
+/** Метрик в базовой линии: по две на стадию и общие. */
+const size_t GATE_MAX_METRICS = 32;
+/** Глубже вложенные циклы не оставили бы регистров под переменные. */
+const size_t GEN_MAX_NESTING = 3;
+/** Переменных (параметры и локальные) в одной области генератора. */
+const size_t GEN_MAX_VARS = 6;
+
+typedef struct {
+    char   *data;
+    size_t  size;
+    size_t  capacity;
+} text_buf_t;
+
+typedef struct {
+    NODE_T nodes[64];
+    size_t count;
+} node_pool_t;
+
+typedef struct {
+    const char *name;
+    NODE_T     *func;
+    size_t      params;
+} formula_t;
+
+/**
+ * @brief Размеры и форма программы генератора (bench gen/stages).
+ */
+typedef struct {
+    size_t   formulas;      /**< Число ФОРМУЛ. */
+    size_t   stmts;         /**< Операторов в теле; во вложенном блоке вдвое меньше. */
+    size_t   depth;         /**< Глубина выражений. */
+    size_t   idents;        /**< Размер пула имен переменных x<k>. */
+    size_t   nesting;       /**< Вложенность ЕСЛИ/ПОКА (не больше GEN_MAX_NESTING). */
+    size_t   text;          /**< Строк текста в аннотации и теории. */
+    uint64_t seed;
+} gen_params_t;
+
+/**
+ * @brief Ключи сравнения с базовой линией (bench stages, bench --compare).
+ */
+typedef struct {
+    const char *compare;        /**< Базовая линия для сравнения или nullptr. */
+    const char *save;           /**< Куда записать текущие метрики или nullptr. */
+    double      threshold;      /**< Допустимое ухудшение, %. */
+    size_t      warmup;         /**< Прогонов до замера, они не учитываются. */
+    int         cpu;            /**< Ядро для sched_setaffinity; -1 - то, на котором запущен замер. */
+    size_t      threads;        /**< FRONT_COMPL_T::threads и backend_set_threads; больше 1 - замер не привязывается к ядру. */
+} gate_opts_t;
+
+/**
+ * @brief Метрика замера: у времени - медиана и 95% доверительный интервал, у остальных lo = hi = value.
+ */
+typedef struct {
+    char   name[32];
+    double value, lo, hi;
+    bool   timed;
+} metric_t;
+
+typedef struct {
+    metric_t items[GATE_MAX_METRICS];
+    size_t   count;
+} metrics_t;
+
+/**
+ * @brief Отметка начала стадии: время, занятая куча и число учтенных выделений (с -DALLOC_STATS).
+ */
+typedef struct {
+    double start;
+    double heap;
+    size_t allocs;
+} stage_mark_t;
+
+typedef struct {
+    text_buf_t         *buf;
+    const gen_params_t *params;
+    uint64_t            state;
+    size_t              nesting;
+    size_t             *arity;          /**< Число параметров каждой ФОРМУЛЫ. */
+    size_t              callable;       /**< Вызывать можно f0..f<callable - 1>. */
+    bool                in_main;
+    size_t              remarks;
+    char                names[GEN_MAX_VARS][24];
+    char                counters[GEN_MAX_NESTING][24];
+    const char         *vars[GEN_MAX_VARS];                     /**< Кому можно присваивать. */
+    size_t              nvars;
+    const char         *reads[GEN_MAX_VARS + GEN_MAX_NESTING];  /**< Что можно читать: еще и счетчики. */
+    size_t              nreads;
+} gen_t;
+
+function void usage(const char *prog);
+function double now_sec(void);
+function int compare_doubles(const void *a, const void *b);
+function double median(double *samples, size_t count);
+function int buf_printf(text_buf_t *buf, const char *fmt, ...);
+function int generate_asm(text_buf_t *buf, size_t blocks);
+function int bench_asm(size_t blocks, size_t repeats);
+function int generate_loop(text_buf_t *buf, const char *kernel, size_t iterations);
+function int time_vm(const vm_program_t *prog, size_t repeats, double *median_sec, vm_stats_t *stats);
+function int bench_vm(size_t iterations, size_t repeats);
+function NODE_T *mk(node_pool_t *pool, NODE_TYPE type, NODE_VALUE_T value, NODE_T *left, NODE_T *right);
+function NODE_T *num(node_pool_t *pool, double x);
+function NODE_T *var(node_pool_t *pool, size_t id);
+function NODE_T *opr(node_pool_t *pool, OPERATOR::OPERATOR op, NODE_T *left, NODE_T *right);
+function NODE_T *kw(node_pool_t *pool, KEYWORD::KEYWORD keyword, NODE_T *left, NODE_T *right);
+function void build_formulas(node_pool_t *pool, formula_t *formulas);
+function double row_expr(const NODE_T *node, const double *env);
+function bool row_stmt(const NODE_T *node, double *env, double *ret);
+function double eval_row(const formula_t *formula, const double *const *inputs, size_t row);
+function int bench_batch(size_t rows, size_t repeats);
+function int write_inputs(const char *csv_path, const char *bin_path, double *values, size_t count);
+function int time_reads(const char *path, bool use_scanf, size_t count, size_t repeats, double *median_sec);
+function int time_writes(const char *path, const double *values, size_t count, size_t repeats, double *median_sec);
+function int bench_io(size_t count, size_t repeats);
+function int generate_frames(text_buf_t *buf, const char *kernel, size_t frames);
+function int time_draw(const vm_program_t *prog, const char *mode, size_t repeats, double *median_sec);
+function int bench_draw(size_t frames, size_t repeats);
+function NODE_T *build_loop_ast(node_pool_t *pool, const char *kernel);
+function char *read_text(const char *path);
+function int bench_c(size_t iterations, size_t repeats);
+function uint64_t gen_rand(gen_t *gen);
+function size_t gen_below(gen_t *gen, size_t n);
+function int gen_indent(gen_t *gen, size_t level);
+function int gen_text(gen_t *gen, size_t lines);
+function int gen_atom(gen_t *gen);
+function int gen_expr(gen_t *gen, size_t depth, bool parens);
+function int gen_cond(gen_t *gen);
+function int gen_simple(gen_t *gen, size_t level, size_t nest);
+function int gen_block(gen_t *gen, size_t level, size_t nest, size_t count, bool allow_if, bool in_do);
+function int gen_scope(gen_t *gen, size_t level, size_t params);
+function int generate_program(text_buf_t *buf, const gen_params_t *params);
+function int parse_gen_args(int argc, char **argv, int argi, gen_params_t *params, gate_opts_t *gate,
+                            const char **positional);
+function int bench_gen(const gen_params_t *params, const char *path);
+function ssize_t count_write(void *cookie, const char *data, size_t size);
+function void summarize(double *samples, size_t count, double *med, double *lo, double *hi, double *p95);
+function double heap_in_use(void);
+function void stage_begin(stage_mark_t *mark);
+function void stage_end(const stage_mark_t *mark, double *elapsed, double *heap, double *allocs);
+function void add_metric(metrics_t *metrics, const char *stage, const char *what, double value, double lo, double hi,
+                         bool timed);
+function int pin_cpu(int cpu);
+function int measure_vm(const FRONT_COMPL_T *front, double *instructions, double *steps);
+function void format_program(const gen_params_t *params, char *buf, size_t cap);
+function int save_baseline(const char *path, const char *program, const metrics_t *metrics);
+function int load_baseline(const char *path, const char *program, metrics_t *metrics);
+function size_t compare_metrics(const metrics_t *base, const metrics_t *cur, double threshold);
+function int bench_stages(const gen_params_t *params, size_t repeats, const gate_opts_t *gate);
+
+function void usage(const char *prog) {
+    if (!prog) prog = "bench";
+    fprintf(stderr, "usage: %s asm [blocks] [repeats]\n"
+                    "       %s vm [iterations] [repeats]\n"
+                    "       %s batch [rows] [repeats]\n"
+                    "       %s io [values] [repeats]\n"
+                    "       %s draw [frames] [repeats]\n"
+                    "       %s c [iterations] [repeats]\n"
+                    "       %s gen [program options] [out.physlab]\n"
+                    "       %s stages [program options] [gate options] [repeats]\n"
+                    "       %s --compare baseline.json [program options] [gate options] [repeats]\n"
+                    "program options: --formulas N --stmts N --depth N --idents N --nesting 0..3 --text N --seed N\n"
+                    "gate options:    --save baseline.json --compare baseline.json --threshold PCT --warmup N --cpu N\n"
+                    "                 --threads N\n",
+            prog, prog, prog, prog, prog, prog, prog, prog, prog);
+}
+
+function double now_sec(void) {
+    struct timespec ts = {};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
+
+function int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+function double median(double *samples, size_t count) {
+    qsort(samples, count, sizeof(double), compare_doubles);
+    return samples[count / 2];
+}
+
+function int buf_printf(text_buf_t *buf, const char *fmt, ...) {
+    while (true) {
+        va_list ap;
+        va_start(ap, fmt);
+        size_t room = buf->capacity - buf->size;
+        int n = vsnprintf(buf->data + buf->size, room, fmt, ap);
+        va_end(ap);
+        if (n < 0) return -1;
+        if ((size_t) n < room) {
+            buf->size += (size_t) n;
+            return 0;
+        }
+        size_t cap = buf->capacity ? buf->capacity * 2 : 1 << 20;
+        char *tmp = TYPED_REALLOC(buf->data, cap, char);
+        if (!tmp) return -1;
+        buf->data = tmp;
+        buf->capacity = cap;
+    }
+}
+
+/**
+ * @brief Программа в духе вывода бэкенда: blocks сравнений-значений и ЕСЛИ, по 5 меток на блок.
+ *
+ * Переходы идут и вперед, и назад (на первую метку), чтобы задействовать оба прохода.
+ */
+function int generate_asm(text_buf_t *buf, size_t blocks) {
+    buf->size = 0;
+    if (buf_printf(buf, "PUSH 0\nPOPR RAX\nJMP :main\n:main\n")) return -1;
+    for (size_t i = 1; i <= blocks; ++i) {
+        int rc = buf_printf(buf,
+            "PUSHR RAX\nPUSH %zu\nJB :cmp_true_%zu\nPUSH 0\nJMP :cmp_end_%zu\n"
+            ":cmp_true_%zu\nPUSH 1\n:cmp_end_%zu\nPOPR RBX\n"
+            "PUSHR RBX\nPUSH 0\nJE :if_%zu_else\n:if_%zu_then\n"
+            "PUSHR RAX\nPUSH 1.5\nADD\nPOPR RAX\nJMP :if_%zu_end\n"
+            ":if_%zu_else\nPUSHR RAX\nPUSH 2\nMUL\nPOPR RAX\n:if_%zu_end\n",
+            i, i, i, i, i, i, i, i, i, i);
+        if (rc) return -1;
+        if (i % 64 == 0 && buf_printf(buf, "PUSHR RAX\nPUSH -1\nJB :main\n")) return -1;
+    }
+    return buf_printf(buf, "PUSHR RAX\nOUT\nHLT\n");
+}
+
+/**
+ * @brief Замер ассемблера на программах из blocks, 4*blocks и 16*blocks блоков.
+ *
+ * Постоянное время на метку при росте программы показывает линейность разрешения меток.
+ */
+function int bench_asm(size_t blocks, size_t repeats) {
+    text_buf_t text = {};
+    double *samples = TYPED_CALLOC(repeats, double);
+    if (!samples) return -1;
+
+    printf("%10s %10s %10s %12s %12s %12s\n", "blocks", "labels", "words", "median ms", "MB/s", "ns/label");
+    int rc = 0;
+    for (size_t scale = 1; scale <= 16 && !rc; scale *= 4) {
+        if (generate_asm(&text, blocks * scale)) {
+            fprintf(stderr, "не удалось сгенерировать программу\n");
+            rc = -1;
+            break;
+        }
+        spu_program_t prog = {};
+        for (size_t r = 0; r < repeats && !rc; ++r) {
+            double start = now_sec();
+            rc = assemble(text.data, text.size, &prog);
+            samples[r] = now_sec() - start;
+            if (!rc && r + 1 < repeats)
+                destruct_program(&prog);
+        }
+        if (rc) break;
+        double t = median(samples, repeats);
+        printf("%10zu %10zu %10zu %12.2f %12.1f %12.1f\n",
+               blocks * scale, prog.symbol_count, prog.size, t * 1e3,
+               (double) text.size / t / 1e6, t * 1e9 / (double) prog.symbol_count);
+        destruct_program(&prog);
+    }
+    free(text.data);
+    free(samples);
+    return rc;
+}
+
+/**
+ * @brief Циклы в форме вывода бэкенда (ПОКА после поворота, i = i + 1 в конце тела).
+ *
+ * sum    - s = s + i; t = i * 3; s = s - t;
+ * nested - внутренний цикл j < 8 с s = s + i * j;
+ * branch - ЕСЛИ s < i ТО s = s + i ИНАЧЕ s = s - 1.
+ */
+function int generate_loop(text_buf_t *buf, const char *kernel, size_t iterations) {
+    buf->size = 0;
+    if (buf_printf(buf, "PUSH 0\nPOPR RAX\nPUSH 0\nPOPR RBX\nJMP :while_1\n:while_1_body\n")) return -1;
+    int rc = 0;
+    if (strcmp(kernel, "sum") == 0) {
+        rc = buf_printf(buf,
+            "PUSHR RBX\nPUSHR RAX\nADD\nPOPR RBX\n"
+            "PUSHR RAX\nPUSH 3\nMUL\nPOPR RCX\n"
+            "PUSHR RBX\nPUSHR RCX\nSUB\nPOPR RBX\n");
+    } else if (strcmp(kernel, "nested") == 0) {
+        rc = buf_printf(buf,
+            "PUSH 0\nPOPR RCX\nJMP :while_2\n:while_2_body\n"
+            "PUSHR RBX\nPUSHR RAX\nPUSHR RCX\nMUL\nADD\nPOPR RBX\n"
+            "PUSHR RCX\nPUSH 1\nADD\nPOPR RCX\n"
+            ":while_2\nPUSHR RCX\nPUSH 8\nJB :while_2_body\n");
+    } else if (strcmp(kernel, "branch") == 0) {
+        rc = buf_printf(buf,
+            "PUSHR RBX\nPUSHR RAX\nJAE :if_1_else\n:if_1_then\n"
+            "PUSHR RBX\nPUSHR RAX\nADD\nPOPR RBX\nJMP :if_1_end\n"
+            ":if_1_else\nPUSHR RBX\nPUSH 1\nSUB\nPOPR RBX\n:if_1_end\n");
+    } else {
+        return -1;
+    }
+    if (rc) return -1;
+    return buf_printf(buf,
+        "PUSHR RAX\nPUSH 1\nADD\nPOPR RAX\n"
+        ":while_1\nPUSHR RAX\nPUSH %zu\nJB :while_1_body\n"
+        "PUSHR RBX\nOUT\nHLT\n", iterations);
+}
+
+function int time_vm(const vm_program_t *prog, size_t repeats, double *median_sec, vm_stats_t *stats) {
+    double *samples = TYPED_CALLOC(repeats, double);
+    if (!samples) return -1;
+    int rc = 0;
+    for (size_t r = 0; r < repeats && !rc; ++r) {
+        double start = now_sec();
+        rc = vm_run(prog, nullptr, stats);
+        samples[r] = now_sec() - start;
+    }
+    if (!rc)
+        *median_sec = median(samples, repeats);
+    free(samples);
+    return rc;
+}
+
+/**
+ * @brief Сравнивает исполнение с суперинструкциями и без на сгенерированных циклах.
+ */
+function int bench_vm(size_t iterations, size_t repeats) {
+    const char *kernels[] = {"sum", "nested", "branch"};
+    text_buf_t text = {};
+    int rc = 0;
+
+    printf("%-8s %-6s %12s %12s %12s %14s %14s %8s\n",
+           "kernel", "fuse", "spu insns", "dispatches", "median ms", "dispatch/s", "spu insn/s", "speedup");
+    for (size_t k = 0; k < ARRAY_COUNT(kernels) && !rc; ++k) {
+        spu_program_t asm_prog = {};
+        if (generate_loop(&text, kernels[k], iterations) || assemble(text.data, text.size, &asm_prog)) {
+            fprintf(stderr, "не удалось собрать программу %s\n", kernels[k]);
+            rc = -1;
+            break;
+        }
+        double base = 0.0;
+        for (int fuse = 0; fuse <= 1 && !rc; ++fuse) {
+            vm_program_t prog = {};
+            vm_stats_t stats = {};
+            double t = 0.0;
+            rc = vm_decode(asm_prog.code, asm_prog.size, nullptr, 0, fuse, &prog);
+            if (!rc)
+                rc = time_vm(&prog, repeats, &t, &stats);
+            vm_destruct(&prog);
+            if (rc) break;
+            if (!fuse) base = t;
+            printf("%-8s %-6s %12llu %12llu %12.2f %14.3e %14.3e %7.2fx\n",
+                   kernels[k], fuse ? "on" : "off",
+                   (unsigned long long) stats.executed, (unsigned long long) stats.dispatches, t * 1e3,
+                   (double) stats.dispatches / t, (double) stats.executed / t, base / t);
+        }
+        destruct_program(&asm_prog);
+    }
+    free(text.data);
+    return rc;
+}
+
+function NODE_T *mk(node_pool_t *pool, NODE_TYPE type, NODE_VALUE_T value, NODE_T *left, NODE_T *right) {
+    NODE_T *node = &pool->nodes[pool->count++];
+    *node = {};
+    node->type = type;
+    node->value = value;
+    node->left = left;
+    node->right = right;
+    return node;
+}
+
+function NODE_T *num(node_pool_t *pool, double x) {
+    NODE_VALUE_T v = {};
+    v.num = x;
+    return mk(pool, NUMBER_T, v, nullptr, nullptr);
+}
+
+function NODE_T *var(node_pool_t *pool, size_t id) {
+    NODE_VALUE_T v = {};
+    v.id = id;
+    return mk(pool, LITERAL_T, v, nullptr, nullptr);
+}
+
+function NODE_T *opr(node_pool_t *pool, OPERATOR::OPERATOR op, NODE_T *left, NODE_T *right) {
+    NODE_VALUE_T v = {};
+    v.opr = op;
+    return mk(pool, OPERATOR_T, v, left, right);
+}
+
+function NODE_T *kw(node_pool_t *pool, KEYWORD::KEYWORD keyword, NODE_T *left, NODE_T *right) {
+    NODE_VALUE_T v = {};
+    v.keyword = keyword;
+    return mk(pool, KEYWORD_T, v, left, right);
+}
+
+/**
+ * @brief Формулы замера в виде AST, как их строит фронтенд. Параметры - id 0, 1, 2.
+ *
+ *     energy(m, v, h): ВОЗВРАТИТЬ m * v * v / 2 + m * 9.81 * h
+ *     branch(x, y):    ЕСЛИ x > y И НЕ x == 0 ТО ВОЗВРАТИТЬ sqrt(x - y)
+ *                      ИНАЧЕ r = y - x; ВОЗВРАТИТЬ r * r + 1
+ *     trig(x, y):      ВОЗВРАТИТЬ sin(x) * cos(y) + x
+ */
+function void build_formulas(node_pool_t *pool, formula_t *formulas) {
+    const size_t fname = FORMULA_VARS - 1, r = 3;
+    NODE_T *p3 = mk(pool, DELIMITER_T, {}, mk(pool, DELIMITER_T, {}, var(pool, 0), var(pool, 1)), var(pool, 2));
+    p3->value.delimiter = DELIMITER::COMA;
+    p3->left->value.delimiter = DELIMITER::COMA;
+    NODE_T *energy = opr(pool, OPERATOR::ADD,
+        opr(pool, OPERATOR::DIV, opr(pool, OPERATOR::MUL, opr(pool, OPERATOR::MUL, var(pool, 0), var(pool, 1)), var(pool, 1)), num(pool, 2)),
+        opr(pool, OPERATOR::MUL, opr(pool, OPERATOR::MUL, var(pool, 0), num(pool, 9.81)), var(pool, 2)));
+    formulas[0] = {"energy", var(pool, fname), 3};
+    formulas[0].func->left = p3;
+    formulas[0].func->right = kw(pool, KEYWORD::RETURN, energy, nullptr);
+
+    NODE_T *p2 = mk(pool, DELIMITER_T, {}, var(pool, 0), var(pool, 1));
+    p2->value.delimiter = DELIMITER::COMA;
+    NODE_T *cond = opr(pool, OPERATOR::AND, opr(pool, OPERATOR::ABOVE, var(pool, 0), var(pool, 1)),
+                       opr(pool, OPERATOR::NOT, opr(pool, OPERATOR::EQ, var(pool, 0), num(pool, 0)), nullptr));
+    NODE_T *then_ops = kw(pool, KEYWORD::RETURN, opr(pool, OPERATOR::SQRT, opr(pool, OPERATOR::SUB, var(pool, 0), var(pool, 1)), nullptr), nullptr);
+    NODE_T *else_ops = opr(pool, OPERATOR::CONNECTOR,
+        opr(pool, OPERATOR::ASSIGNMENT, var(pool, r), opr(pool, OPERATOR::SUB, var(pool, 1), var(pool, 0))),
+        kw(pool, KEYWORD::RETURN, opr(pool, OPERATOR::ADD, opr(pool, OPERATOR::MUL, var(pool, r), var(pool, r)), num(pool, 1)), nullptr));
+    formulas[1] = {"branch", var(pool, fname), 2};
+    formulas[1].func->left = p2;
+    formulas[1].func->right = kw(pool, KEYWORD::IF, cond, kw(pool, KEYWORD::THEN, then_ops, else_ops));
+
+    NODE_T *trig = opr(pool, OPERATOR::ADD, opr(pool, OPERATOR::MUL, opr(pool, OPERATOR::SIN, var(pool, 0), nullptr),
+                       opr(pool, OPERATOR::COS, var(pool, 1), nullptr)), var(pool, 0));
+    formulas[2] = {"trig", var(pool, fname), 2};
+    formulas[2].func->left = p2;
+    formulas[2].func->right = kw(pool, KEYWORD::RETURN, trig, nullptr);
+}
+
+/**
+ * @brief Обход AST для одной строки - то, что делает вызов формулы на каждую строку.
+ */
+function double row_expr(const NODE_T *node, const double *env) {
+    if (node->type == NUMBER_T) return node->value.num;
+    if (node->type == LITERAL_T) return env[node->value.id];
+    double a = node->left ? row_expr(node->left, env) : 0.0;
+    switch (node->value.opr) {
+        case OPERATOR::ADD:   return a + row_expr(node->right, env);
+        case OPERATOR::SUB:   return a - row_expr(node->right, env);
+        case OPERATOR::MUL:   return a * row_expr(node->right, env);
+        case OPERATOR::DIV:   return a / row_expr(node->right, env);
+        case OPERATOR::SQRT:  return sqrt(a);
+        case OPERATOR::SIN:   return sin(a);
+        case OPERATOR::COS:   return cos(a);
+        case OPERATOR::EQ:    return a == row_expr(node->right, env);
+        case OPERATOR::ABOVE: return a > row_expr(node->right, env);
+        case OPERATOR::AND:   return (a != 0.0) && (row_expr(node->right, env) != 0.0);
+        case OPERATOR::NOT:   return a == 0.0;
+        default:              return 0.0;
+    }
+}
+
+function bool row_stmt(const NODE_T *node, double *env, double *ret) {
+    if (!node) return false;
+    if (node->type == OPERATOR_T && node->value.opr == OPERATOR::CONNECTOR)
+        return row_stmt(node->left, env, ret) || row_stmt(node->right, env, ret);
+    if (node->type == OPERATOR_T && node->value.opr == OPERATOR::ASSIGNMENT) {
+        env[node->left->value.id] = row_expr(node->right, env);
+        return false;
+    }
+    if (node->type == KEYWORD_T && node->value.keyword == KEYWORD::RETURN) {
+        *ret = row_expr(node->left, env);
+        return true;
+    }
+    if (node->type == KEYWORD_T && node->value.keyword == KEYWORD::IF) {
+        if (row_expr(node->left, env) != 0.0)
+            return row_stmt(node->right->left, env, ret);
+        return row_stmt(node->right->right, env, ret);
+    }
+    return false;
+}
+
+function double eval_row(const formula_t *formula, const double *const *inputs, size_t row) {
+    double env[FORMULA_VARS] = {};
+    for (size_t p = 0; p < formula->params; ++p)
+        env[p] = inputs[p][row];
+    double ret = 0.0;
+    row_stmt(formula->func->right, env, &ret);
+    return ret;
+}
+
+/**
+ * @brief Сравнивает пакетное вычисление (scalar/SSE2/AVX2) с вызовом формулы на каждую строку.
+ */
+function int bench_batch(size_t rows, size_t repeats) {
+    node_pool_t pool = {};
+    formula_t formulas[3] = {};
+    build_formulas(&pool, formulas);
+
+    double *columns[3] = {};
+    double *expected = TYPED_CALLOC(rows, double);
+    double *got = TYPED_CALLOC(rows, double);
+    double *samples = TYPED_CALLOC(repeats, double);
+    int rc = (expected && got && samples) ? 0 : -1;
+    srand(42);
+    for (size_t p = 0; p < ARRAY_COUNT(columns) && !rc; ++p) {
+        columns[p] = TYPED_CALLOC(rows, double);
+        if (!columns[p]) {
+            rc = -1;
+            break;
+        }
+        for (size_t i = 0; i < rows; ++i)
+            columns[p][i] = (double) rand() / RAND_MAX * 20.0 - 10.0;
+    }
+    const double *const *inputs = columns;
+
+    printf("%-8s %-8s %12s %12s %8s %12s\n", "formula", "mode", "median ms", "ns/row", "speedup", "max rel err");
+    for (size_t f = 0; f < ARRAY_COUNT(formulas) && !rc; ++f) {
+        double base = 0.0;
+        for (size_t r = 0; r < repeats; ++r) {
+            double start = now_sec();
+            for (size_t i = 0; i < rows; ++i)
+                expected[i] = eval_row(&formulas[f], inputs, i);
+            samples[r] = now_sec() - start;
+        }
+        base = median(samples, repeats);
+        printf("%-8s %-8s %12.2f %12.2f %7.2fx %12s\n", formulas[f].name, "per-row", base * 1e3, base * 1e9 / (double) rows, 1.0, "-");
+
+        batch_kernel_t kernel = {};
+        if (compile_formula_batch(formulas[f].func, &kernel)) {
+            rc = -1;
+            break;
+        }
+        BATCH_ISA::BATCH_ISA best = batch_best_isa();
+        for (int isa = BATCH_ISA::SCALAR; isa <= best && !rc; ++isa) {
+            kernel.isa = (BATCH_ISA::BATCH_ISA) isa;
+            for (size_t r = 0; r < repeats && !rc; ++r) {
+                double start = now_sec();
+                rc = eval_formula_batch(&kernel, inputs, rows, got);
+                samples[r] = now_sec() - start;
+            }
+            if (rc) break;
+            double err = 0.0;
+            for (size_t i = 0; i < rows; ++i) {
+                double diff = fabs(got[i] - expected[i]) / (fabs(expected[i]) > 1.0 ? fabs(expected[i]) : 1.0);
+                if (diff > err || got[i] != got[i]) err = (got[i] != got[i]) ? INFINITY : diff;
+            }
+            double t = median(samples, repeats);
+            printf("%-8s %-8s %12.2f %12.2f %7.2fx %12.1e\n", formulas[f].name, batch_isa_name(kernel.isa),
+                   t * 1e3, t * 1e9 / (double) rows, base / t, err);
+        }
+        destruct_batch_kernel(&kernel);
+    }
+
+    for (size_t p = 0; p < ARRAY_COUNT(columns); ++p)
+        free(columns[p]);
+    free(expected);
+    free(got);
+    free(samples);
+    return rc;
+}
+
+/**
+ * @brief Входные файлы в духе измерений: CSV с заголовком по 3 столбца и тот же ряд в *.bin.
+ */
+function int write_inputs(const char *csv_path, const char *bin_path, double *values, size_t count) {
+    FILE *csv = fopen(csv_path, "w");
+    FILE *bin = fopen(bin_path, "wb");
+    int rc = (csv && bin) ? 0 : -1;
+    srand(7);
+    if (!rc)
+        fprintf(csv, "m,v,h\n");
+    for (size_t i = 0; i < count && !rc; ++i) {
+        values[i] = (double) (rand() % 2000000 - 1000000) / 1000.0;
+        fprintf(csv, "%.3f%c", values[i], (i % 3 == 2) ? '\n' : ',');
+    }
+    if (!rc && fwrite(values, sizeof(double), count, bin) != count)
+        rc = -1;
+    if (csv && fclose(csv)) rc = -1;
+    if (bin && fclose(bin)) rc = -1;
+    return rc;
+}
+
+/**
+ * @brief Время чтения count значений: fscanf, как раньше в IN, или vm_io_read.
+ */
+function int time_reads(const char *path, bool use_scanf, size_t count, size_t repeats, double *median_sec) {
+    double *samples = TYPED_CALLOC(repeats, double);
+    if (!samples) return -1;
+    int rc = 0;
+    double sink = 0.0;
+    for (size_t r = 0; r < repeats && !rc; ++r) {
+        double start = now_sec(), x = 0.0;
+        if (use_scanf) {
+            FILE *fp = fopen(path, "r");
+            if (!fp || fscanf(fp, "%*s") != 0) rc = -1;
+            for (size_t i = 0; i < count && !rc; ++i) {
+                if (fscanf(fp, "%lf,", &x) != 1) rc = -1;
+                sink += x;
+            }
+            if (fp) fclose(fp);
+        } else {
+            vm_io_t io = {};
+            vm_io_init(&io, nullptr, nullptr);
+            rc = vm_io_open_input(&io, path);
+            for (size_t i = 0; i < count && !rc; ++i) {
+                rc = vm_io_read(&io, &x);
+                sink += x;
+            }
+            vm_io_close(&io);
+        }
+        samples[r] = now_sec() - start;
+    }
+    if (!rc)
+        *median_sec = median(samples, repeats);
+    free(samples);
+    return (rc || sink != sink) ? -1 : 0;
+}
+
+/**
+ * @brief Время записи: path == nullptr - fprintf в /dev/null, иначе vm_io_write в файл.
+ */
+function int time_writes(const char *path, const double *values, size_t count, size_t repeats, double *median_sec) {
+    double *samples = TYPED_CALLOC(repeats, double);
+    if (!samples) return -1;
+    int rc = 0;
+    for (size_t r = 0; r < repeats && !rc; ++r) {
+        double start = now_sec();
+        if (!path) {
+            FILE *fp = fopen("/dev/null", "w");
+            if (!fp) rc = -1;
+            for (size_t i = 0; i < count && !rc; ++i)
+                fprintf(fp, "%.15g\n", values[i]);
+            if (fp) fclose(fp);
+        } else {
+            vm_io_t io = {};
+            vm_io_init(&io, nullptr, nullptr);
+            rc = vm_io_open_output(&io, path);
+            for (size_t i = 0; i < count && !rc; ++i)
+                rc = vm_io_write(&io, values[i]);
+            if (vm_io_close(&io)) rc = -1;
+        }
+        samples[r] = now_sec() - start;
+    }
+    if (!rc)
+        *median_sec = median(samples, repeats);
+    free(samples);
+    return rc;
+}
+
+/**
+ * @brief Скорость ИЗМЕРИТЬ/ВЫВЕСТИ: fscanf/fprintf против vm_io на CSV и *.bin, для сравнения - memcpy.
+ */
+function int bench_io(size_t count, size_t repeats) {
+    const char *csv_path = "/tmp/physlab-bench-io.csv";
+    const char *bin_path = "/tmp/physlab-bench-io.bin";
+    const char *out_txt = "/tmp/physlab-bench-out.txt";
+    const char *out_bin = "/tmp/physlab-bench-out.bin";
+    double *values = TYPED_CALLOC(count, double);
+    double *copy = TYPED_CALLOC(count, double);
+    int rc = (values && copy) ? write_inputs(csv_path, bin_path, values, count) : -1;
+    if (rc) fprintf(stderr, "не удалось подготовить входные файлы\n");
+
+    struct stat_row { const char *what; double sec; size_t bytes; } rows[7] = {};
+    size_t csv_bytes = 0;
+    FILE *fp = fopen(csv_path, "r");
+    if (fp) {
+        fseek(fp, 0, SEEK_END);
+        csv_bytes = (size_t) ftell(fp);
+        fclose(fp);
+    }
+    size_t bin_bytes = count * sizeof(double);
+    rows[0] = {"read  fscanf csv", 0, csv_bytes};
+    rows[1] = {"read  vm_io csv", 0, csv_bytes};
+    rows[2] = {"read  vm_io bin", 0, bin_bytes};
+    rows[3] = {"write fprintf txt", 0, 0};
+    rows[4] = {"write vm_io txt", 0, 0};
+    rows[5] = {"write vm_io bin", 0, bin_bytes};
+    rows[6] = {"memcpy", 0, bin_bytes};
+    if (!rc) rc = time_reads(csv_path, true, count, repeats, &rows[0].sec);
+    if (!rc) rc = time_reads(csv_path, false, count, repeats, &rows[1].sec);
+    if (!rc) rc = time_reads(bin_path, false, count, repeats, &rows[2].sec);
+    if (!rc) rc = time_writes(nullptr, values, count, repeats, &rows[3].sec);
+    if (!rc) rc = time_writes(out_txt, values, count, repeats, &rows[4].sec);
+    if (!rc) rc = time_writes(out_bin, values, count, repeats, &rows[5].sec);
+    if (!rc) {
+        double *samples = TYPED_CALLOC(repeats, double);
+        for (size_t r = 0; samples && r < repeats; ++r) {
+            double start = now_sec();
+            memcpy(copy, values, bin_bytes);
+            samples[r] = now_sec() - start;
+        }
+        rows[6].sec = samples ? median(samples, repeats) : 0.0;
+        free(samples);
+    }
+
+    if (!rc) {
+        printf("%-18s %12s %12s %12s\n", "path", "median ms", "ns/value", "MB/s");
+        for (size_t i = 0; i < ARRAY_COUNT(rows); ++i) {
+            printf("%-18s %12.2f %12.2f ", rows[i].what, rows[i].sec * 1e3, rows[i].sec * 1e9 / (double) count);
+            if (rows[i].bytes) printf("%12.0f\n", (double) rows[i].bytes / rows[i].sec / 1e6);
+            else               printf("%12s\n", "-");
+        }
+    }
+    remove(csv_path);
+    remove(bin_path);
+    remove(out_txt);
+    remove(out_bin);
+    free(values);
+    free(copy);
+    return rc;
+}
+
+/**
+ * @brief Программа из frames кадров: каждый кадр пишет видеопамять и делает DRAW 0.
+ *
+ * full - все VM_FRAME_CELLS ячеек, row - одна строка y = кадр % VM_FRAME_H.
+ */
+function int generate_frames(text_buf_t *buf, const char *kernel, size_t frames) {
+    buf->size = 0;
+    if (buf_printf(buf, "PUSH 0\nPOPR RAX\nJMP :while_1\n:while_1_body\n")) return -1;
+    int rc = 0;
+    if (strcmp(kernel, "full") == 0)
+        rc = buf_printf(buf, "PUSH 0\nPOPR RBX\nPUSH %zu\nPOPR RCX\n", VM_FRAME_CELLS);
+    else if (strcmp(kernel, "row") == 0)
+        rc = buf_printf(buf,
+            "PUSHR RAX\nPUSH %zu\nMOD\nPUSH %zu\nMUL\nPOPR RBX\n"
+            "PUSHR RBX\nPUSH %zu\nADD\nPOPR RCX\n", VM_FRAME_H, VM_FRAME_W, VM_FRAME_W);
+    else
+        return -1;
+    if (rc) return -1;
+    return buf_printf(buf,
+        "JMP :while_2\n:while_2_body\n"
+        "PUSHR RAX\nPUSHR RBX\nADD\nPOPM [RBX]\n"
+        "PUSHR RBX\nPUSH 1\nADD\nPOPR RBX\n"
+        ":while_2\nPUSHR RBX\nPUSHR RCX\nJB :while_2_body\n"
+        "DRAW 0\n"
+        "PUSHR RAX\nPUSH 1\nADD\nPOPR RAX\n"
+        ":while_1\nPUSHR RAX\nPUSH %zu\nJB :while_1_body\n"
+        "HLT\n", frames);
+}
+
+/**
+ * @brief text - кадры символами в /dev/null, ppm - поток PPM в файл, headless - без вывода.
+ */
+function int time_draw(const vm_program_t *prog, const char *mode, size_t repeats, double *median_sec) {
+    const char *ppm_path = "/tmp/physlab-bench-frames.ppm";
+    double *samples = TYPED_CALLOC(repeats, double);
+    FILE *null_out = fopen("/dev/null", "w");
+    int rc = (samples && null_out) ? 0 : -1;
+    for (size_t r = 0; r < repeats && !rc; ++r) {
+        vm_io_t io = {};
+        vm_io_init(&io, nullptr, null_out);
+        vm_frames_t frames = {};
+        bool text = strcmp(mode, "text") == 0;
+        double start = now_sec();
+        if (!text) {
+            rc = vm_frames_open(&frames, strcmp(mode, "ppm") == 0 ? ppm_path : nullptr);
+            if (!rc) io.frames = &frames;
+        }
+        if (!rc)
+            rc = vm_run(prog, &io, nullptr);
+        if (!text && vm_frames_close(&frames))
+            rc = -1;
+        samples[r] = now_sec() - start;
+    }
+    if (!rc)
+        *median_sec = median(samples, repeats);
+    if (null_out) fclose(null_out);
+    remove(ppm_path);
+    free(samples);
+    return rc;
+}
+
+/**
+ * @brief Кадров в секунду для DRAW: символьный вывод, PPM в отдельном потоке и headless.
+ */
+function int bench_draw(size_t frames, size_t repeats) {
+    const char *kernels[] = {"full", "row"};
+    const char *modes[] = {"text", "ppm", "headless"};
+    text_buf_t text = {};
+    int rc = 0;
+
+    printf("%-6s %-9s %12s %12s %12s\n", "kernel", "mode", "median ms", "us/frame", "frames/s");
+    for (size_t k = 0; k < ARRAY_COUNT(kernels) && !rc; ++k) {
+        spu_program_t asm_prog = {};
+        vm_program_t prog = {};
+        if (generate_frames(&text, kernels[k], frames) || assemble(text.data, text.size, &asm_prog) ||
+            vm_decode(asm_prog.code, asm_prog.size, nullptr, 0, true, &prog)) {
+            fprintf(stderr, "не удалось собрать программу %s\n", kernels[k]);
+            rc = -1;
+        }
+        for (size_t m = 0; m < ARRAY_COUNT(modes) && !rc; ++m) {
+            double t = 0.0;
+            rc = time_draw(&prog, modes[m], repeats, &t);
+            if (!rc)
+                printf("%-6s %-9s %12.2f %12.2f %12.0f\n", kernels[k], modes[m], t * 1e3,
+                       t * 1e6 / (double) frames, (double) frames / t);
+        }
+        vm_destruct(&prog);
+        destruct_program(&asm_prog);
+    }
+    free(text.data);
+    return rc;
+}
+
+/**
+ * @brief Циклы generate_loop() в виде AST, как их строит фронтенд; n читается ИЗМЕРИТЬ,
+ *        чтобы cc не свернул цикл на этапе компиляции. Переменные: i, s, t, j, n - id 0..4.
+ */
+function NODE_T *build_loop_ast(node_pool_t *pool, const char *kernel) {
+    const size_t i = 0, s = 1, t = 2, j = 3, n = 4;
+    NODE_T *body = nullptr;
+    if (strcmp(kernel, "sum") == 0) {
+        body = opr(pool, OPERATOR::CONNECTOR,
+            opr(pool, OPERATOR::ASSIGNMENT, var(pool, s), opr(pool, OPERATOR::ADD, var(pool, s), var(pool, i))),
+            opr(pool, OPERATOR::CONNECTOR,
+                opr(pool, OPERATOR::ASSIGNMENT, var(pool, t), opr(pool, OPERATOR::MUL, var(pool, i), num(pool, 3))),
+                opr(pool, OPERATOR::ASSIGNMENT, var(pool, s), opr(pool, OPERATOR::SUB, var(pool, s), var(pool, t)))));
+    } else if (strcmp(kernel, "nested") == 0) {
+        NODE_T *inner = opr(pool, OPERATOR::CONNECTOR,
+            opr(pool, OPERATOR::ASSIGNMENT, var(pool, s),
+                opr(pool, OPERATOR::ADD, var(pool, s), opr(pool, OPERATOR::MUL, var(pool, i), var(pool, j)))),
+            opr(pool, OPERATOR::ASSIGNMENT, var(pool, j), opr(pool, OPERATOR::ADD, var(pool, j), num(pool, 1))));
+        body = opr(pool, OPERATOR::CONNECTOR,
+            opr(pool, OPERATOR::ASSIGNMENT, var(pool, j), num(pool, 0)),
+            kw(pool, KEYWORD::WHILE, opr(pool, OPERATOR::BELOW, var(pool, j), num(pool, 8)), inner));
+    } else if (strcmp(kernel, "branch") == 0) {
+        body = kw(pool, KEYWORD::IF, opr(pool, OPERATOR::BELOW, var(pool, s), var(pool, i)),
+            kw(pool, KEYWORD::THEN,
+                opr(pool, OPERATOR::ASSIGNMENT, var(pool, s), opr(pool, OPERATOR::ADD, var(pool, s), var(pool, i))),
+                opr(pool, OPERATOR::ASSIGNMENT, var(pool, s), opr(pool, OPERATOR::SUB, var(pool, s), num(pool, 1)))));
+    } else {
+        return nullptr;
+    }
+    body = opr(pool, OPERATOR::CONNECTOR, body,
+        opr(pool, OPERATOR::ASSIGNMENT, var(pool, i), opr(pool, OPERATOR::ADD, var(pool, i), num(pool, 1))));
+    NODE_T *loop = kw(pool, KEYWORD::WHILE, opr(pool, OPERATOR::BELOW, var(pool, i), var(pool, n)), body);
+    NODE_T *main_body = opr(pool, OPERATOR::CONNECTOR, opr(pool, OPERATOR::IN, var(pool, n), nullptr),
+                            opr(pool, OPERATOR::CONNECTOR, loop, opr(pool, OPERATOR::OUT, var(pool, s), nullptr)));
+    /* корень как у фронтенда: CONNECTOR(функции, тело) */
+    return opr(pool, OPERATOR::CONNECTOR, nullptr, main_body);
+}
+
+/**
+ * @brief Файл целиком в буфер (для сравнения выводов).
+ */
+function char *read_text(const char *path) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) return nullptr;
+    fseek(fp, 0, SEEK_END);
+    long len = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    if (len < 0) len = 0;
+    char *data = TYPED_CALLOC((size_t) len + 1, char);
+    if (data && fread(data, 1, (size_t) len, fp) != (size_t) len) {
+        free(data);
+        data = nullptr;
+    }
+    fclose(fp);
+    return data;
+}
+
+/**
+ * @brief VM против backend --target=c, собранного cc -O3, на циклах bench vm.
+ *
+ * Время C - запуск процесса целиком (через system), так что в нем и старт процесса.
+ */
+function int bench_c(size_t iterations, size_t repeats) {
+    const char *kernels[] = {"sum", "nested", "branch"};
+    const char *c_path = "/tmp/physlab-bench-c.c";
+    const char *bin_path = "/tmp/physlab-bench-c";
+    const char *in_path = "/tmp/physlab-bench-c.in";
+    const char *vm_out = "/tmp/physlab-bench-c.vm.txt";
+    const char *c_out = "/tmp/physlab-bench-c.out.txt";
+    const char *names[] = {"i", "s", "t", "j", "n"};
+    varlist::VarList vars = {};
+    varlist::init(&vars);
+    for (size_t k = 0; k < ARRAY_COUNT(names); ++k) {
+        mystr::mystr_t name = mystr::construct(names[k]);
+        varlist::add(&vars, &name);
+    }
+    text_buf_t text = {};
+    double *samples = TYPED_CALLOC(repeats, double);
+    FILE *in = fopen(in_path, "w");
+    int rc = (samples && in && varlist::size(&vars) == ARRAY_COUNT(names)) ? 0 : -1;
+    if (in) {
+        fprintf(in, "%zu\n", iterations);
+        fclose(in);
+    }
+    char command[512] = "";
+
+    printf("%-8s %12s %12s %8s %12s %8s\n", "kernel", "vm ms", "cc -O3 ms", "speedup", "compile ms", "output");
+    for (size_t k = 0; k < ARRAY_COUNT(kernels) && !rc; ++k) {
+        spu_program_t asm_prog = {};
+        vm_program_t prog = {};
+        if (generate_loop(&text, kernels[k], iterations) || assemble(text.data, text.size, &asm_prog) ||
+            vm_decode(asm_prog.code, asm_prog.size, nullptr, 0, true, &prog)) {
+            fprintf(stderr, "не удалось собрать программу %s\n", kernels[k]);
+            rc = -1;
+        }
+        double vm_t = 0.0, c_t = 0.0, compile_t = 0.0;
+        if (!rc) rc = time_vm(&prog, repeats, &vm_t, nullptr);
+
+        /* тот же вывод VM в файл - для сравнения с C */
+        FILE *fp = rc ? nullptr : fopen(vm_out, "w");
+        if (fp) {
+            vm_io_t io = {};
+            vm_io_init(&io, nullptr, fp);
+            rc = vm_run(&prog, &io, nullptr);
+            if (vm_io_close(&io)) rc = -1;
+            fclose(fp);
+        }
+
+        node_pool_t pool = {};
+        NODE_T *root = build_loop_ast(&pool, kernels[k]);
+        fp = (!rc && root) ? fopen(c_path, "w") : nullptr;
+        if (!fp || emit_c_source(root, &vars, fp)) rc = -1;
+        if (fp) fclose(fp);
+        if (!rc) {
+            snprintf(command, sizeof(command), "cc -O3 -o %s %s -lm", bin_path, c_path);
+            double start = now_sec();
+            if (system(command) != 0) {
+                fprintf(stderr, "не удалось собрать %s: %s\n", c_path, command);
+                rc = -1;
+            }
+            compile_t = now_sec() - start;
+        }
+        snprintf(command, sizeof(command), "%s < %s > %s", bin_path, in_path, c_out);
+        for (size_t r = 0; r < repeats && !rc; ++r) {
+            double start = now_sec();
+            if (system(command) != 0) rc = -1;
+            samples[r] = now_sec() - start;
+        }
+        if (!rc) {
+            c_t = median(samples, repeats);
+            char *a = read_text(vm_out), *b = read_text(c_out);
+            bool same = a && b && strcmp(a, b) == 0;
+            printf("%-8s %12.2f %12.2f %7.2fx %12.0f %8s\n", kernels[k], vm_t * 1e3, c_t * 1e3, vm_t / c_t,
+                   compile_t * 1e3, same ? "same" : "DIFF");
+            free(a);
+            free(b);
+        }
+        vm_destruct(&prog);
+        destruct_program(&asm_prog);
+    }
+    remove(c_path);
+    remove(bin_path);
+    remove(in_path);
+    remove(vm_out);
+    remove(c_out);
+    varlist::destruct(&vars);
+    free(samples);
+    free(text.data);
+    return rc;
+}
+
+/**
+ * @brief Следующее псевдослучайное число (xorshift64*): генератор воспроизводим по seed.
+ */
+function uint64_t gen_rand(gen_t *gen) {
+    gen->state ^= gen->state >> 12;
+    gen->state ^= gen->state << 25;
+    gen->state ^= gen->state >> 27;
+    return gen->state * 0x2545F4914F6CDD1DULL;
+}
+
+function size_t gen_below(gen_t *gen, size_t n) {
+    return n ? (size_t) (gen_rand(gen) % n) : 0;
+}
+
+function int gen_indent(gen_t *gen, size_t level) {
+    for (size_t i = 0; i < level; ++i)
+        if (buf_printf(gen->buf, "    ")) return -1;
+    return 0;
+}
+
+/**
+ * @brief Строки текста для разделов с литералами; первая буква не начинает ни одно ключевое слово.
+ */
+function int gen_text(gen_t *gen, size_t lines) {
+    local const char *words[] = {
+        "измерения", "проведены", "многократно", "погрешность", "установки", "мала", "результаты",
+        "согласуются", "с", "теорией", "график", "построен", "по", "точкам", "маятник", "период",
+    };
+    for (size_t i = 0; i < lines; ++i) {
+        if (buf_printf(gen->buf, "Замечание %zu:", ++gen->remarks)) return -1;
+        for (size_t w = 8 + gen_below(gen, 5); w > 0; --w)
+            if (buf_printf(gen->buf, " %s", words[gen_below(gen, ARRAY_COUNT(words))])) return -1;
+        if (buf_printf(gen->buf, ".\n")) return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Переменная или число; счетчики циклов только читаются.
+ */
+function int gen_atom(gen_t *gen) {
+    if (gen->nreads && gen_below(gen, 10) < 7)
+        return buf_printf(gen->buf, "%s", gen->reads[gen_below(gen, gen->nreads)]);
+    if (gen_below(gen, 4) == 0)
+        return buf_printf(gen->buf, "%zu.%zu", gen_below(gen, 100), 1 + gen_below(gen, 9));
+    return buf_printf(gen->buf, "%zu", gen_below(gen, 100));
+}
+
+/**
+ * @brief Выражение глубины ровно depth: левое поддерево глубины depth - 1, правое - меньше.
+ */
+function int gen_expr(gen_t *gen, size_t depth, bool parens) {
+    if (!depth) return gen_atom(gen);
+    local const char ops[] = "+-*/";
+    char op = ops[gen_below(gen, 4)];
+    if (parens && buf_printf(gen->buf, "(")) return -1;
+    if (gen_expr(gen, depth - 1, true)) return -1;
+    if (buf_printf(gen->buf, " %c ", op)) return -1;
+    /* делим только на ненулевое число */
+    int rc = op == '/' ? buf_printf(gen->buf, "%zu", 1 + gen_below(gen, 9)) :
+                         gen_expr(gen, gen_below(gen, depth), true);
+    if (rc) return -1;
+    return parens ? buf_printf(gen->buf, ")") : 0;
+}
+
+function int gen_cond(gen_t *gen) {
+    local const char *cmps[] = {"<", ">", "<=", ">=", "==", "!="};
+    size_t terms = 1 + (gen_below(gen, 3) == 0);
+    for (size_t t = 0; t < terms; ++t) {
+        if (t && buf_printf(gen->buf, gen_below(gen, 2) ? " И " : " ИЛИ ")) return -1;
+        if (gen_expr(gen, gen_below(gen, 2), true)) return -1;
+        if (buf_printf(gen->buf, " %s ", cmps[gen_below(gen, ARRAY_COUNT(cmps))])) return -1;
+        if (gen_expr(gen, gen_below(gen, 2), true)) return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Присваивание выражения или вызова ФОРМУЛЫ с меньшим номером, в теле работы - иногда ВЫВЕСТИ.
+ *
+ * Вызовы только вне циклов (nest == 0): вызванная функция портит регистры вызвавшей,
+ * и счетчик цикла вокруг вызова мог бы не дойти до границы.
+ */
+function int gen_simple(gen_t *gen, size_t level, size_t nest) {
+    if (gen_indent(gen, level)) return -1;
+    size_t kind = gen_below(gen, 10);
+    if (kind == 0 && gen->callable && !nest) {
+        size_t callee = gen_below(gen, gen->callable);
+        if (buf_printf(gen->buf, "%s = f%zu ПРИМЕНЯЕМ ", gen->vars[gen_below(gen, gen->nvars)], callee)) return -1;
+        for (size_t a = 0; a < gen->arity[callee]; ++a) {
+            if (a && buf_printf(gen->buf, ", ")) return -1;
+            if (gen_atom(gen)) return -1;
+        }
+        return buf_printf(gen->buf, "\n");
+    }
+    if (kind == 1 && gen->in_main) {
+        if (buf_printf(gen->buf, "ВЫВЕСТИ ")) return -1;
+    } else if (buf_printf(gen->buf, "%s = ", gen->vars[gen_below(gen, gen->nvars)])) {
+        return -1;
+    }
+    if (gen_expr(gen, gen->params->depth, false)) return -1;
+    return buf_printf(gen->buf, "\n");
+}
+
+/**
+ * @brief Блок из count операторов на уровне вложенности nest.
+ *
+ * У ЕСЛИ нет завершающего слова: ветвь тянется до ИНАЧЕ или до конца блока, поэтому
+ * ЕСЛИ ставится только последним оператором блока, где за ним идет СТОП или ИНАЧЕ
+ * внешнего ЕСЛИ (allow_if). Тело do-while кончается на первом ПОКА (in_do): в нем
+ * только do-while и без ЕСЛИ. Циклы счетные по своему счетчику i<nest>, так что программа завершается.
+ */
+function int gen_block(gen_t *gen, size_t level, size_t nest, size_t count, bool allow_if, bool in_do) {
+    size_t inner = count / 2 ? count / 2 : 1;
+    for (size_t s = 0; s < count; ++s) {
+        bool deeper = nest < gen->nesting;
+        if (deeper && allow_if && s + 1 == count && gen_below(gen, 3) == 0) {
+            if (gen_indent(gen, level) || buf_printf(gen->buf, "ЕСЛИ ") || gen_cond(gen) ||
+                buf_printf(gen->buf, " ТО\n") || gen_block(gen, level + 1, nest + 1, inner, false, false) ||
+                gen_indent(gen, level) || buf_printf(gen->buf, "ИНАЧЕ\n") ||
+                gen_block(gen, level + 1, nest + 1, inner, true, false))
+                return -1;
+            continue;
+        }
+        if (deeper && gen_below(gen, 4) == 0) {
+            size_t bound = 2 + gen_below(gen, 4);
+            bool do_while = in_do || gen_below(gen, 3) == 0;
+            if (gen_indent(gen, level) || buf_printf(gen->buf, "i%zu = 0\n", nest) || gen_indent(gen, level))
+                return -1;
+            if (do_while ? buf_printf(gen->buf, "ПОВТОРЯЕМ\n") :
+                           buf_printf(gen->buf, "ПОКА i%zu < %zu ПОВТОРЯЕМ\n", nest, bound))
+                return -1;
+            if (gen_indent(gen, level + 1) || buf_printf(gen->buf, "i%zu = i%zu + 1\n", nest, nest))
+                return -1;
+            if (gen_block(gen, level + 1, nest + 1, inner, !do_while, do_while) || gen_indent(gen, level))
+                return -1;
+            if (do_while ? buf_printf(gen->buf, "ПОКА i%zu < %zu СТОП\n", nest, bound) : buf_printf(gen->buf, "СТОП\n"))
+                return -1;
+            continue;
+        }
+        if (gen_simple(gen, level, nest)) return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Выбирает params + locals разных имен x<k> подряд из пула, объявляет локальные и счетчики.
+ *
+ * Регистровый бэкенд дает на функцию 8 регистров; 2 оставлены под временные значения.
+ */
+function int gen_scope(gen_t *gen, size_t level, size_t params) {
+    size_t locals = 6 - params - gen->nesting;
+    if (params + locals > gen->params->idents)
+        locals = gen->params->idents > params ? gen->params->idents - params : 0;
+    if (!params && !locals) locals = 1;
+    size_t start = gen_below(gen, gen->params->idents);
+    gen->nvars = gen->nreads = 0;
+    for (size_t k = 0; k < params + locals; ++k) {
+        snprintf(gen->names[k], sizeof(gen->names[k]), "x%zu", (start + k) % gen->params->idents);
+        gen->vars[gen->nvars++] = gen->names[k];
+        gen->reads[gen->nreads++] = gen->names[k];
+    }
+    for (size_t k = 0; k < gen->nesting; ++k)
+        gen->reads[gen->nreads++] = gen->counters[k];
+    if (params) {
+        if (buf_printf(gen->buf, " (")) return -1;
+        for (size_t k = 0; k < params; ++k)
+            if (buf_printf(gen->buf, k ? ", %s" : "%s", gen->names[k])) return -1;
+        if (buf_printf(gen->buf, ")\n")) return -1;
+    }
+    for (size_t k = params; k < params + locals; ++k)
+        if (gen_indent(gen, level) || buf_printf(gen->buf, "ВЕЛИЧИНА %s = %zu\n", gen->names[k], gen_below(gen, 10)))
+            return -1;
+    for (size_t k = 0; k < gen->nesting; ++k)
+        if (gen_indent(gen, level) || buf_printf(gen->buf, "ВЕЛИЧИНА %s = 0\n", gen->counters[k])) return -1;
+    return 0;
+}
+
+/**
+ * @brief Синтетическая программа .physlab заданных размеров (gen_params_t).
+ *
+ * ФОРМУЛА f<k> вызывает только f<j> с j < k, тело работы - любые; рекурсии нет,
+ * циклы счетные, делится только на ненулевые числа.
+ */
+function int generate_program(text_buf_t *buf, const gen_params_t *params) {
+    gen_t gen = {};
+    gen.buf = buf;
+    gen.params = params;
+    gen.state = params->seed ? params->seed : 1;
+    gen.nesting = params->nesting < GEN_MAX_NESTING ? params->nesting : GEN_MAX_NESTING;
+    for (size_t k = 0; k < gen.nesting; ++k)
+        snprintf(gen.counters[k], sizeof(gen.counters[k]), "i%zu", k);
+    gen.arity = TYPED_CALLOC(params->formulas + 1, size_t);
+    if (!gen.arity) return -1;
+    buf->size = 0;
+
+    size_t per_formula = params->formulas ? params->text / params->formulas : 0;
+    int rc = buf_printf(buf, "ЛАБОРАТОРНАЯ РАБОТА Синтетическая\n\nАННОТАЦИЯ\nЦЕЛЬ: Замер\n");
+    if (!rc) rc = gen_text(&gen, params->text);
+    if (!rc) rc = buf_printf(buf, "КОНЕЦ АННОТАЦИИ\n\nТЕОРЕТИЧЕСКИЕ СВЕДЕНИЯ\n");
+    if (!rc && !params->formulas) rc = gen_text(&gen, params->text);
+    for (size_t f = 0; f < params->formulas && !rc; ++f) {
+        gen.arity[f] = 1 + gen_below(&gen, 2);
+        if (gen.arity[f] > params->idents) gen.arity[f] = params->idents;
+        gen.callable = f;
+        rc = gen_text(&gen, per_formula);
+        if (!rc) rc = buf_printf(buf, "ФОРМУЛА f%zu", f);
+        if (!rc) rc = gen_scope(&gen, 1, gen.arity[f]);
+        if (!rc) rc = gen_block(&gen, 1, 0, params->stmts, false, false);
+        if (!rc) rc = gen_indent(&gen, 1) || buf_printf(buf, "ВОЗВРАТИТЬ ") || gen_expr(&gen, params->depth, false);
+        if (!rc) rc = buf_printf(buf, "\nКОНЕЦ ФОРМУЛЫ\n");
+    }
+    if (!rc) rc = buf_printf(buf, "КОНЕЦ ТЕОРИИ\n\nХОД РАБОТЫ\n");
+    gen.callable = params->formulas;
+    gen.in_main = true;
+    if (!rc) rc = gen_scope(&gen, 0, 0);
+    if (!rc) rc = buf_printf(buf, "ИЗМЕРИТЬ %s\n", gen.vars[0]);
+    if (!rc) rc = gen_block(&gen, 0, 0, params->stmts, false, false);
+    for (size_t k = 0; k < gen.nvars && !rc; ++k)
+        rc = buf_printf(buf, "ВЫВЕСТИ %s\n", gen.vars[k]);
+    if (!rc) rc = buf_printf(buf, "КОНЕЦ РАБОТЫ\n\nОБСУЖДЕНИЕ РЕЗУЛЬТАТОВ\nПОКАЗАТЬ 1\nКОНЕЦ РЕЗУЛЬТАТОВ\n\n"
+                                  "ВЫВОДЫ\nЗамер завершен\nКОНЕЦ ВЫВОДОВ\n");
+    free(gen.arity);
+    return rc ? -1 : 0;
+}
+
+/**
+ * @brief Разбирает ключи генератора и, если gate не nullptr, ключи сравнения с базовой линией
+ *        с argv[argi]; первый не-ключ остается позиционным.
+ * @return число позиционных аргументов (0 или 1) или -1 при ошибке.
+ */
+function int parse_gen_args(int argc, char **argv, int argi, gen_params_t *params, gate_opts_t *gate,
+                            const char **positional) {
+    local const struct {const char *flag; size_t gen_params_t::*field;} flags[] = {
+        {"--formulas", &gen_params_t::formulas}, {"--stmts", &gen_params_t::stmts},
+        {"--depth", &gen_params_t::depth},       {"--idents", &gen_params_t::idents},
+        {"--nesting", &gen_params_t::nesting},   {"--text", &gen_params_t::text},
+    };
+    int count = 0;
+    for (; argi < argc; ++argi) {
+        bool matched = false;
+        for (size_t k = 0; k < ARRAY_COUNT(flags) && !matched; ++k) {
+            if (strcmp(argv[argi], flags[k].flag) || argi + 1 >= argc) continue;
+            char *end = nullptr;
+            params->*flags[k].field = strtoul(argv[++argi], &end, 10);
+            if (!end || *end) return -1;
+            matched = true;
+        }
+        if (matched) continue;
+        if (strcmp(argv[argi], "--seed") == 0 && argi + 1 < argc) {
+            params->seed = strtoull(argv[++argi], nullptr, 10);
+            continue;
+        }
+        if (gate && argi + 1 < argc) {
+            const char *flag = argv[argi], *val = argv[argi + 1];
+            char *end = nullptr;
+            bool known = true;
+            if (strcmp(flag, "--compare") == 0) gate->compare = val;
+            else if (strcmp(flag, "--save") == 0) gate->save = val;
+            else if (strcmp(flag, "--threshold") == 0) gate->threshold = strtod(val, &end);
+            else if (strcmp(flag, "--warmup") == 0) gate->warmup = strtoul(val, &end, 10);
+            else if (strcmp(flag, "--cpu") == 0) gate->cpu = (int) strtol(val, &end, 10);
+            else if (strcmp(flag, "--threads") == 0) gate->threads = strtoul(val, &end, 10);
+            else known = false;
+            if (known) {
+                if (end && (end == val || *end)) return -1;
+                ++argi;
+                continue;
+            }
+        }
+        if (argv[argi][0] == '-' || count) return -1;
+        *positional = argv[argi];
+        ++count;
+    }
+    if (!params->idents || !params->stmts) return -1;
+    if (gate && (!gate->threads || gate->threads > FRONT_MAX_THREADS)) return -1;
+    return count;
+}
+
+function int bench_gen(const gen_params_t *params, const char *path) {
+    text_buf_t text = {};
+    int rc = generate_program(&text, params);
+    FILE *fp = rc ? nullptr : path ? fopen(path, "w") : stdout;
+    if (!rc && (!fp || fwrite(text.data, 1, text.size, fp) != text.size)) {
+        fprintf(stderr, "не удалось записать программу %s\n", path ? path : "<stdout>");
+        rc = -1;
+    }
+    if (fp && fp != stdout) fclose(fp);
+    free(text.data);
+    return rc;
+}
+
+/**
+ * @brief Поток, который только считает записанные байты (вывод стадий не нужен, нужен его размер).
+ */
+function ssize_t count_write(void *cookie, const char *data, size_t size) {
+    (void) data;
+    *(size_t *) cookie += size;
+    return (ssize_t) size;
+}
+
+/**
+ * @brief Медиана, p95 и 95% доверительный интервал медианы (порядковые статистики, биномиальное приближение).
+ */
+function void summarize(double *samples, size_t count, double *med, double *lo, double *hi, double *p95) {
+    qsort(samples, count, sizeof(double), compare_doubles);
+    double half = 0.98 * sqrt((double) count);
+    double lo_rank = floor((double) count / 2 - half), hi_rank = ceil((double) count / 2 + half);
+    *med = samples[count / 2];
+    *lo = samples[lo_rank < 0 ? 0 : (size_t) lo_rank];
+    *hi = samples[hi_rank > (double) (count - 1) ? count - 1 : (size_t) hi_rank];
+    /* p95 по времени - медленный край, ему соответствует низкая пропускная способность */
+    *p95 = samples[(count * 95 + 99) / 100 - 1];
+}
+
+/**
+ * @brief Занятая куча в байтах: блоки арен и отдельные mmap-блоки.
+ */
+function double heap_in_use(void) {
+    struct mallinfo2 info = mallinfo2();
+    return (double) (info.uordblks + info.hblkhd);
+}
+
+function void stage_begin(stage_mark_t *mark) {
+    alloc_totals_t totals = {};
+    alloc_stats_totals(&totals);
+    mark->allocs = totals.count;
+    mark->heap = heap_in_use();
+    mark->start = now_sec();
+}
+
+/**
+ * @brief Итог стадии с отметки mark: время в секундах, прирост кучи в байтах и число выделений.
+ */
+function void stage_end(const stage_mark_t *mark, double *elapsed, double *heap, double *allocs) {
+    *elapsed = now_sec() - mark->start;
+    *heap = heap_in_use() - mark->heap;
+    alloc_totals_t totals = {};
+    alloc_stats_totals(&totals);
+    *allocs = (double) (totals.count - mark->allocs);
+}
+
+function void add_metric(metrics_t *metrics, const char *stage, const char *what, double value, double lo, double hi,
+                         bool timed) {
+    if (metrics->count >= GATE_MAX_METRICS) return;
+    metric_t *m = &metrics->items[metrics->count++];
+    snprintf(m->name, sizeof(m->name), "%s.%s", stage, what);
+    m->value = value;
+    m->lo = lo;
+    m->hi = hi;
+    m->timed = timed;
+}
+
+/**
+ * @brief Привязывает процесс к одному ядру, чтобы планировщик не переносил замер между ядрами.
+ * @return 0 при успехе, -1 при ошибке.
+ */
+function int pin_cpu(int cpu) {
+    if (cpu < 0) cpu = sched_getcpu();
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu < 0 ? 0 : cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set)) {
+        fprintf(stderr, "не удалось привязать замер к ядру %d\n", cpu);
+        return -1;
+    }
+    fprintf(stderr, "pinned to CPU %d\n", cpu < 0 ? 0 : cpu);
+    return 0;
+}
+
+/**
+ * @brief Собирает разобранную программу в SPU и исполняет ее в VM с одним входным значением.
+ * @param instructions[out] команд SPU в программе (без слияния).
+ * @param steps[out]        исполнено команд SPU.
+ * @return 0 при успехе, -1 при ошибке.
+ */
+function int measure_vm(const FRONT_COMPL_T *front, double *instructions, double *steps) {
+    char *ast = nullptr, *text = nullptr;
+    size_t ast_len = 0, text_len = 0;
+    NODE_T *root = nullptr;
+    varlist::VarList vars = {};
+    FILE *mem = open_memstream(&ast, &ast_len);
+    int rc = (mem && !write_ast(front, mem)) ? 0 : -1;
+    if (mem) fclose(mem);
+    if (!rc && load_ast_from_buffer(ast, ast_len, &root, &vars)) rc = -1;
+    if (!rc && (eliminate_dead_code(root, &vars) || optimize_loops(root, &vars, DEFAULT_UNROLL))) rc = -1;
+    mem = rc ? nullptr : open_memstream(&text, &text_len);
+    if (!rc && (!mem || reverse_program(root, &vars, mem))) rc = -1;
+    if (mem) fclose(mem);
+    if (root) destroy_ast(root, &vars);
+    free(ast);
+
+    spu_program_t asm_prog = {};
+    vm_program_t prog = {};
+    if (!rc && (assemble(text, text_len, &asm_prog) || vm_decode(asm_prog.code, asm_prog.size, nullptr, 0, false, &prog)))
+        rc = -1;
+    free(text);
+    double input = 3;
+    vm_io_t io = {};
+    vm_stats_t stats = {};
+    if (!rc) {
+        *instructions = (double) prog.size;
+        vm_io_init_memory(&io, &input, 1, false);
+        rc = vm_run(&prog, &io, &stats);
+        if (vm_io_close(&io)) rc = -1;
+        *steps = (double) stats.executed;
+    }
+    if (rc) fprintf(stderr, "сгенерированная программа не исполнилась в VM\n");
+    vm_destruct(&prog);
+    destruct_program(&asm_prog);
+    return rc;
+}
+
+function void format_program(const gen_params_t *params, char *buf, size_t cap) {
+    snprintf(buf, cap, "--formulas %zu --stmts %zu --depth %zu --idents %zu --nesting %zu --text %zu --seed %llu",
+             params->formulas, params->stmts, params->depth, params->idents, params->nesting, params->text,
+             (unsigned long long) params->seed);
+}
+
+/**
+ * @brief Пишет базовую линию: ключи генератора и метрики "имя": [значение, нижняя, верхняя граница].
+ * @return 0 при успехе, -1 при ошибке.
+ */
+function int save_baseline(const char *path, const char *program, const metrics_t *metrics) {
+    FILE *fp = fopen(path, "w");
+    if (!fp) {
+        fprintf(stderr, "не удалось записать базовую линию %s\n", path);
+        return -1;
+    }
+    fprintf(fp, "{\n  \"program\": \"%s\",\n  \"metrics\": {\n", program);
+    for (size_t i = 0; i < metrics->count; ++i) {
+        const metric_t *m = &metrics->items[i];
+        fprintf(fp, "    \"%s\": [%.17g, %.17g, %.17g]%s\n", m->name, m->value, m->lo, m->hi,
+                i + 1 < metrics->count ? "," : "");
+    }
+    fprintf(fp, "  }\n}\n");
+    return fclose(fp) ? -1 : 0;
+}
+
+/**
+ * @brief Читает базовую линию, записанную save_baseline (ключи "имя": [v, lo, hi] в любом порядке).
+ * @return 0 при успехе, -1 если файл не прочитать или он снят на другой программе.
+ */
+function int load_baseline(const char *path, const char *program, metrics_t *metrics) {
+    char *text = read_text(path);
+    if (!text) {
+        fprintf(stderr, "не удалось прочитать базовую линию %s\n", path);
+        return -1;
+    }
+    int rc = 0;
+    const char *prog = strstr(text, "\"program\": \"");
+    size_t len = strlen(program);
+    if (!prog || strncmp(prog + 12, program, len) || prog[12 + len] != '"') {
+        fprintf(stderr, "базовая линия %s снята на другой программе; нужны ключи %.*s\n", path,
+                prog ? (int) strcspn(prog + 12, "\"") : 0, prog ? prog + 12 : "");
+        rc = -1;
+    }
+    metrics->count = 0;
+    const char *cur = prog ? strstr(prog, "\"metrics\"") : nullptr;
+    while (!rc && cur && (cur = strchr(cur + 1, '"')) && metrics->count < GATE_MAX_METRICS) {
+        metric_t *m = &metrics->items[metrics->count];
+        int used = 0;
+        if (sscanf(cur, "\"%31[^\"]\": [%lf, %lf, %lf]%n", m->name, &m->value, &m->lo, &m->hi, &used) == 4 && used) {
+            ++metrics->count;
+            cur += used - 1;
+        }
+    }
+    free(text);
+    return rc;
+}
+
+/**
+ * @brief Печатает базовую линию против текущего замера.
+ *
+ * Время ухудшилось, если медиана выросла больше чем на threshold % и доверительные интервалы
+ * не пересекаются; детерминированные метрики - если выросли больше чем на threshold % и хотя бы на 1.
+ * @return число ухудшившихся метрик.
+ */
+function size_t compare_metrics(const metrics_t *base, const metrics_t *cur, double threshold) {
+    double k = threshold / 100.0;
+    size_t regressed = 0;
+    printf("\n%-20s %24s %24s %9s  %s\n", "metric", "baseline", "current", "change", "status");
+    for (size_t i = 0; i < cur->count; ++i) {
+        const metric_t *c = &cur->items[i];
+        const metric_t *b = nullptr;
+        for (size_t j = 0; j < base->count && !b; ++j)
+            if (strcmp(base->items[j].name, c->name) == 0) b = &base->items[j];
+        char bs[32] = "-", cs[32] = "";
+        if (c->timed) snprintf(cs, sizeof(cs), "%.3f [%.3f..%.3f]", c->value, c->lo, c->hi);
+        else snprintf(cs, sizeof(cs), "%.0f", c->value);
+        if (!b) {
+            printf("%-20s %24s %24s %9s  %s\n", c->name, bs, cs, "", "new");
+            continue;
+        }
+        if (c->timed) snprintf(bs, sizeof(bs), "%.3f [%.3f..%.3f]", b->value, b->lo, b->hi);
+        else snprintf(bs, sizeof(bs), "%.0f", b->value);
+        bool worse = c->timed ? (c->value > b->value * (1 + k) && c->lo > b->hi) :
+                                (c->value > b->value * (1 + k) && c->value - b->value >= 1);
+        bool better = c->timed ? (c->value < b->value * (1 - k) && c->hi < b->lo) :
+                                 (c->value < b->value * (1 - k) && b->value - c->value >= 1);
+        char change[16] = "";
+        if (b->value != 0) snprintf(change, sizeof(change), "%+.1f%%", (c->value / b->value - 1) * 100);
+        printf("%-20s %24s %24s %9s  %s\n", c->name, bs, cs, change, worse ? "REGRESSED" : better ? "improved" : "ok");
+        if (worse) ++regressed;
+    }
+    return regressed;
+}
+
+/**
+ * @brief Замер стадий по отдельности на сгенерированной программе.
+ *
+ * Каждый повтор заново проходит цепочку лексер -> парсер -> сохранение .ast -> загрузка
+ * -> middleend -> бэкенд SPU -> rev-front, засекая каждую стадию и прирост кучи за нее;
+ * вывод только считается. Первые gate->warmup повторов не учитываются. Пропускная способность
+ * считается по размеру исходника .physlab. После замера программа собирается и исполняется
+ * в VM ради числа команд и шагов. С gate->compare печатает сравнение с базовой линией.
+ * @return 0 при успехе, 1 при ухудшении относительно базовой линии, -1 при ошибке.
+ */
+function int bench_stages(const gen_params_t *params, size_t repeats, const gate_opts_t *gate) {
+    local const char *stages[] = {"lex", "parse", "save", "load", "middle", "backend", "rev-front"};
+    const size_t nstages = ARRAY_COUNT(stages);
+    text_buf_t text = {};
+    double *samples = TYPED_CALLOC(nstages * repeats, double);
+    double heap[ARRAY_COUNT(stages)] = {}, allocs[ARRAY_COUNT(stages)] = {};
+    size_t written = 0;
+    cookie_io_functions_t counter = {nullptr, count_write, nullptr, nullptr};
+    FILE *sink = fopencookie(&written, "w", counter);
+    char program[256] = "";
+    format_program(params, program, sizeof(program));
+    metrics_t base = {};
+    int rc = (samples && sink && !generate_program(&text, params)) ? 0 : -1;
+    if (!rc && gate->compare) rc = load_baseline(gate->compare, program, &base);
+    /* потоки на одном ядре только мешали бы друг другу */
+    if (!rc && gate->threads <= 1) rc = pin_cpu(gate->cpu);
+    size_t tokens = 0, asm_bytes = 0;
+    FRONT_COMPL_T front = {};
+    front.threads = gate->threads;
+    backend_set_threads(gate->threads);
+
+    for (size_t r = 0; r < gate->warmup + repeats && !rc; ++r) {
+        double elapsed[ARRAY_COUNT(stages)] = {};
+        stage_mark_t mark = {};
+        char *ast = nullptr;
+        size_t ast_len = 0;
+        NODE_T *root = nullptr;
+        varlist::VarList vars = {};
+
+        lexer_reset(&front);
+        stage_begin(&mark);
+        if (lexer_from_buffer(&front, "<bench>", text.data, text.size)) rc = -1;
+        stage_end(&mark, &elapsed[0], &heap[0], &allocs[0]);
+        tokens = front.token_count;
+        stage_begin(&mark);
+        if (!rc && parse_tokens(&front)) rc = -1;
+        stage_end(&mark, &elapsed[1], &heap[1], &allocs[1]);
+        stage_begin(&mark);
+        if (!rc && write_ast(&front, sink)) rc = -1;
+        stage_end(&mark, &elapsed[2], &heap[2], &allocs[2]);
+        /* текст .ast для загрузки - вне замера */
+        FILE *mem = rc ? nullptr : open_memstream(&ast, &ast_len);
+        if (!rc && (!mem || write_ast(&front, mem))) rc = -1;
+        if (mem) fclose(mem);
+        stage_begin(&mark);
+        if (!rc && load_ast_from_buffer(ast, ast_len, &root, &vars)) rc = -1;
+        stage_end(&mark, &elapsed[3], &heap[3], &allocs[3]);
+        stage_begin(&mark);
+        if (!rc && (eliminate_dead_code(root, &vars) || optimize_loops(root, &vars, DEFAULT_UNROLL))) rc = -1;
+        stage_end(&mark, &elapsed[4], &heap[4], &allocs[4]);
+        fflush(sink);
+        size_t asm_start = written;
+        stage_begin(&mark);
+        if (!rc && (reverse_program(root, &vars, sink) || fflush(sink))) rc = -1;
+        stage_end(&mark, &elapsed[5], &heap[5], &allocs[5]);
+        asm_bytes = written - asm_start;
+        destroy_ast(root, &vars);
+        root = nullptr;
+
+        if (!rc && load_ast_from_buffer(ast, ast_len, &root, &vars)) rc = -1;
+        stage_begin(&mark);
+        if (!rc && emit_physlab(root, &vars, sink)) rc = -1;
+        stage_end(&mark, &elapsed[6], &heap[6], &allocs[6]);
+        destroy_ast(root, &vars);
+        free(ast);
+
+        if (rc) fprintf(stderr, "стадии не прошли на сгенерированной программе (повтор %zu)\n", r + 1);
+        else if (r >= gate->warmup)
+            for (size_t s = 0; s < nstages; ++s)
+                samples[s * repeats + r - gate->warmup] = elapsed[s];
+    }
+
+    metrics_t cur = {};
+    double instructions = 0, steps = 0;
+    if (!rc) rc = measure_vm(&front, &instructions, &steps);
+    if (!rc) {
+        printf("program: %zu bytes, %zu tokens, %zu formulas, %zu bytes of asm; %zu repeats after %zu warmup\n",
+               text.size, tokens, params->formulas, asm_bytes, repeats, gate->warmup);
+        printf("%-10s %10s %21s %10s %12s %12s %10s\n", "stage", "median ms", "95% CI ms", "p95 ms",
+               "median MB/s", "p95 MB/s", "heap KB");
+        double mb = (double) text.size / 1e6;
+        for (size_t s = 0; s < nstages; ++s) {
+            double med = 0, lo = 0, hi = 0, p95 = 0;
+            summarize(samples + s * repeats, repeats, &med, &lo, &hi, &p95);
+            double heap_kb = floor(heap[s] / 1024);
+            printf("%-10s %10.3f %10.3f..%-10.3f %10.3f %12.1f %12.1f %10.0f\n", stages[s], med * 1e3, lo * 1e3,
+                   hi * 1e3, p95 * 1e3, med > 0 ? mb / med : 0.0, p95 > 0 ? mb / p95 : 0.0, heap_kb);
+            add_metric(&cur, stages[s], "ms", med * 1e3, lo * 1e3, hi * 1e3, true);
+            add_metric(&cur, stages[s], "heap_kb", heap_kb, heap_kb, heap_kb, false);
+        }
+        struct rusage usage = {};
+        getrusage(RUSAGE_SELF, &usage);
+        add_metric(&cur, "process", "peak_rss_kb", (double) usage.ru_maxrss, (double) usage.ru_maxrss,
+                   (double) usage.ru_maxrss, false);
+        add_metric(&cur, "asm", "instructions", instructions, instructions, instructions, false);
+        add_metric(&cur, "vm", "steps", steps, steps, steps, false);
+        printf("peak RSS %ld KB, %.0f SPU instructions, %.0f VM steps\n", usage.ru_maxrss, instructions, steps);
+#ifdef ALLOC_STATS
+        printf("allocations per stage:");
+        for (size_t s = 0; s < nstages; ++s) {
+            printf(" %s %.0f", stages[s], allocs[s]);
+            add_metric(&cur, stages[s], "allocs", allocs[s], allocs[s], allocs[s], false);
+        }
+        printf("\n");
+        alloc_stats_dump(stdout);
+#endif
+    }
+
+    if (!rc && gate->save && save_baseline(gate->save, program, &cur)) rc = -1;
+    if (!rc && gate->compare) {
+        size_t regressed = compare_metrics(&base, &cur, gate->threshold);
+        if (regressed) {
+            printf("%zu metric(s) regressed beyond %.1f%% against %s\n", regressed, gate->threshold, gate->compare);
+            rc = 1;
+        }
+    }
+    lexer_reset(&front);
+    backend_set_threads(1);
+    if (sink) fclose(sink);
+    free(samples);
+    free(text.data);
+    return rc;
+}
+
+/**
+ * @brief CLI: bench asm|vm|batch|io|draw|c [size] [repeats], bench gen|stages [program options] [out|repeats].
+ *
+ * bench stages --save base.json пишет метрики стадий в базовую линию, --compare base.json
+ * сравнивает с ней и завершается с кодом 1, если что-то ухудшилось больше --threshold %.
+ */
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        usage(argc ? argv[0] : "bench");
+        return 1;
+    }
+    /* bench --compare base.json - то же, что bench stages --compare base.json */
+    bool is_gate = strncmp(argv[1], "--", 2) == 0;
+    if (is_gate || strcmp(argv[1], "gen") == 0 || strcmp(argv[1], "stages") == 0) {
+        gen_params_t params = {GEN_FORMULAS, GEN_STMTS, GEN_DEPTH, GEN_IDENTS, GEN_NESTING, GEN_TEXT, 1};
+        gate_opts_t gate = {nullptr, nullptr, GATE_THRESHOLD, GATE_WARMUP, -1, 1};
+        bool is_gen = strcmp(argv[1], "gen") == 0;
+        const char *positional = nullptr;
+        if (parse_gen_args(argc, argv, is_gate ? 1 : 2, &params, is_gen ? nullptr : &gate, &positional) < 0) {
+            usage(argv[0]);
+            return 1;
+        }
+        if (is_gen)
+            return bench_gen(&params, positional) ? 1 : 0;
+        size_t repeats = positional ? strtoul(positional, nullptr, 10) : STAGE_REPEATS;
+        if (!repeats) {
+            usage(argv[0]);
+            return 1;
+        }
+        return bench_stages(&params, repeats, &gate) ? 1 : 0;
+    }
+    bool is_asm = strcmp(argv[1], "asm") == 0;
+    bool is_vm = strcmp(argv[1], "vm") == 0;
+    bool is_batch = strcmp(argv[1], "batch") == 0;
+    bool is_io = strcmp(argv[1], "io") == 0;
+    bool is_draw = strcmp(argv[1], "draw") == 0;
+    bool is_c = strcmp(argv[1], "c") == 0;
+    if (!is_asm && !is_vm && !is_batch && !is_io && !is_draw && !is_c) {
+        usage(argv[0]);
+        return 1;
+    }
+    size_t size = is_asm ? DEFAULT_BLOCKS : (is_vm || is_c) ? DEFAULT_ITERATIONS : is_batch ? DEFAULT_ROWS :
+                  is_io ? DEFAULT_VALUES : DEFAULT_FRAMES;
+    if (argc > 2)
+        size = strtoul(argv[2], nullptr, 10);
+    size_t repeats = (argc > 3) ? strtoul(argv[3], nullptr, 10) : DEFAULT_REPEATS;
+    if (!size || !repeats) {
+        usage(argv[0]);
+        return 1;
+    }
+    int rc = 0;
+    if (is_asm)        rc = bench_asm(size, repeats);
+    else if (is_vm)    rc = bench_vm(size, repeats);
+    else if (is_batch) rc = bench_batch(size, repeats);
+    else if (is_io)    rc = bench_io(size, repeats);
+    else if (is_draw)  rc = bench_draw(size, repeats);
+    else               rc = bench_c(size, repeats);
+    return rc ? 1 : 0;
+}
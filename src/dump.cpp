@@ -476,7 +476,7 @@ static void print_token_value(const FRONT_COMPL_T *ctx, const TOKEN_T *tok, FILE
     }
 }
 
-void dump_lexer_tokens(const FRONT_COMPL_T *ctx, const char *title) {
+void dump_lexer_tokens(FRONT_COMPL_T *ctx, const char *title) {
     FILE *log_file = logger_get_file();
     if (!ctx || !log_file) return;
 
@@ -515,14 +515,15 @@ void dump_lexer_tokens(const FRONT_COMPL_T *ctx, const char *title) {
         fputs("</td>", log_file);
 
         fputs("<td>", log_file);
-        if (tok->line > 0 && tok->pos > 0) {
+        int32_t line = 0, pos = 0;
+        if (token_location(ctx, i, &line, &pos) == 0) {
             const char *href = tok->filename ? tok->filename : ctx->name;
             if (href && href[0]) {
                 fputs("<a href=\"", log_file);
                 html_escape(log_file, href, strlen(href));
-                fprintf(log_file, "#L%d\">%d:%d</a>", tok->line, tok->line, tok->pos);
+                fprintf(log_file, "#L%d\">%d:%d</a>", line, line, pos);
             } else {
-                fprintf(log_file, "%d:%d", tok->line, tok->pos);
+                fprintf(log_file, "%d:%d", line, pos);
             }
         } else {
             fputs("&mdash;", log_file);
@@ -1,8 +1,14 @@
 #include <ctype.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+    #include <immintrin.h>
+    #define LEXER_X86 1
+#endif
+
 #include "base.h"
 #include "io_utils.h"
 #include "frontend.h"
@@ -10,6 +16,9 @@
 #include "utf8.h"
 #include "enhanced_string.h"
 
+/** Меньше стольких байтов на поток исходник не делится: запуск потока дороже. */
+const size_t LEX_MIN_CHUNK = 64 * 1024;
+
 typedef struct {
     const char *text;
     size_t      len;
@@ -19,6 +28,24 @@ typedef struct {
     int         word_boundary;
 } fixed_token_t;
 
+/** Классы байтов, серию которых сканер пропускает целиком. */
+namespace SCAN {
+    enum SCAN {
+        SPACE,      ///< isspace: ' ', '\t', '\n', '\v', '\f', '\r'
+        DIGIT,      ///< '0'..'9'
+        WORD,       ///< ascii_word: латинские буквы, цифры, '_'
+    };
+}
+
+/** Кусок исходника [start, end) для потока: свои токены и VarList, буфер общий. */
+typedef struct {
+    FRONT_COMPL_T part;
+    size_t        start,
+                  end;
+    size_t        bad;      ///< смещение незакрытой строки или SIZE_MAX
+    int           rc;
+} lex_chunk_t;
+
 #define FIXED(text, t, val, fold, bound) { text, sizeof(text) - 1, t, val, fold, bound }
 #define y 1
 #define n 0
@@ -114,12 +141,10 @@ static int ensure_varlist(FRONT_COMPL_T *ctx);
  * @param ctx[in,out]   контекст компилятора.
  * @param ft[in]        описание лексемы.
  * @param idx[in]       смещение в буфере.
- * @param line[in]      номер строки.
- * @param pos[in]       позиция в строке.
  * @return 0 при успехе, -1 при ошибке.
  */
 static int emit_fixed(FRONT_COMPL_T *ctx,
-    const fixed_token_t *ft, size_t idx, int32_t line, int32_t pos
+    const fixed_token_t *ft, size_t idx
 );
 
 /**
@@ -131,18 +156,6 @@ static int emit_fixed(FRONT_COMPL_T *ctx,
  */
 static size_t store_span(FRONT_COMPL_T *ctx, const char *text, size_t len);
 
-/**
- * @brief Обновляет счетчики строки/позиции для диапазона UTF-8.
- * @param buf[in]       исходный текст.
- * @param start[in]     начало диапазона.
- * @param end[in]       конец диапазона.
- * @param line[in,out]  счетчик строк.
- * @param pos[in,out]   позиция в строке.
- */
-static void advance_pos(const char *buf,
-    size_t start, size_t end, int32_t *line, int32_t *pos
-);
-
 /**
  * @brief Ищет совпадение с таблицей фиксированных лексем.
  * @param buf[in]       исходный текст.
@@ -155,6 +168,20 @@ static const fixed_token_t *match_fixed(const char *buf, size_t len,
     size_t idx, char *tmp
 );
 
+/**
+ * @brief Пропускает серию байтов класса kind, начиная с idx.
+ * @param avx2[in]      можно ли использовать AVX2 (иначе SSE2 на x86, скаляр на прочих).
+ * @return первая позиция вне серии.
+ */
+static size_t scan_run(SCAN::SCAN kind, bool avx2,
+    const char *buf, size_t idx, size_t len
+);
+
+/**
+ * @brief Позиция первого байта c в [idx, len) или len (memchr).
+ */
+static size_t find_byte(const char *buf, size_t idx, size_t len, char c);
+
 /**
  * @brief Обходит буфер и формирует все токены.
  * @param ctx[in,out]   контекст компилятора.
@@ -162,6 +189,43 @@ static const fixed_token_t *match_fixed(const char *buf, size_t len,
  */
 static int lex_buffer(FRONT_COMPL_T *ctx);
 
+/**
+ * @brief Формирует токены куска [idx, len) буфера ctx->buf; len - начало строки или конец буфера.
+ * @param bad[out]      при ошибке в тексте - ее смещение (иначе не меняется).
+ * @return 0 при успехе, -1 при ошибке.
+ */
+static int lex_range(FRONT_COMPL_T *ctx, size_t idx, size_t len, size_t *bad);
+
+/**
+ * @brief Параллельный lex_buffer: куски между границами разделов лексятся в потоках и сливаются.
+ * @param threads[in]   сколько кусков не больше.
+ * @param bad[out]      смещение первой ошибки в тексте, как у последовательного лексера.
+ * @return 0 при успехе, -1 при ошибке.
+ */
+static int lex_parallel(FRONT_COMPL_T *ctx, size_t threads, size_t *bad);
+
+/**
+ * @brief Пишет в ctx->errors (или stderr) ошибку лексера со строкой и позицией смещения off.
+ */
+static void report_lex_error(FRONT_COMPL_T *ctx, size_t off, const char *reason);
+
+/**
+ * @brief Первое начало строки не раньше from, с которого начинается раздел
+ *        (ТЕОРЕТИЧЕСКИЕ СВЕДЕНИЯ, ХОД РАБОТЫ, ОБСУЖДЕНИЕ РЕЗУЛЬТАТОВ, ФОРМУЛА), или len.
+ */
+static size_t find_section_start(const char *buf, size_t from, size_t len);
+
+/**
+ * @brief Тело потока lex_parallel: лексит chunk->part, код возврата - в chunk->rc.
+ */
+static void *lex_chunk_main(void *arg);
+
+/**
+ * @brief Дописывает токены куска в ctx, переводя индексы его VarList в индексы ctx->vars.
+ * @return 0 при успехе, -1 при нехватке памяти.
+ */
+static int merge_chunk(FRONT_COMPL_T *ctx, const FRONT_COMPL_T *part);
+
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 
 /**
@@ -177,14 +241,14 @@ int lexer_from_buffer(
     const char *name, const char *text, size_t bytes
 ) {
     if (!ctx || !text) return -1;
-    lexer_reset(ctx);
-    char *copy = strndup(text, bytes);
+    lexer_recycle(ctx);
+    char *copy = STRNDUP(text, bytes);
     if (!copy) return -1;
     ctx->buf = copy;
     ctx->buf_len = bytes;
     ctx->owns_buf = true;
     if (name) {
-        char *n = strdup(name);
+        char *n = STRDUP(name);
         if (!n) {
             lexer_reset(ctx);
             return -1;
@@ -232,6 +296,15 @@ void lexer_reset(FRONT_COMPL_T *ctx) {
     ctx->tokens = nullptr;
     ctx->token_count = 0;
     ctx->token_capacity = 0;
+    ctx->lexed_count = 0;
+    for (size_t i = 0; i < ctx->node_pool_count; ++i)
+        free(ctx->node_pools[i]);
+    free(ctx->node_pools);
+    ctx->node_pools = nullptr;
+    ctx->node_pool_count = 0;
+    if (ctx->line_starts) free(ctx->line_starts);
+    ctx->line_starts = nullptr;
+    ctx->line_count = 0;
     if (ctx->owns_name && ctx->name) free((void *)ctx->name);
     ctx->name = nullptr;
     ctx->owns_name = false;
@@ -244,6 +317,23 @@ void lexer_reset(FRONT_COMPL_T *ctx) {
     }
 }
 
+/**
+ * @brief Готовит контекст к новому тексту: как lexer_reset, но массив токенов остается.
+ *
+ * Узлы AST живут в том же массиве, так что повторная компиляция в одном контексте
+ * (physlabd) не выделяет память, пока программа не больше прошлых.
+ * @param ctx[in,out]   контекст компилятора.
+ */
+void lexer_recycle(FRONT_COMPL_T *ctx) {
+    if (!ctx) return;
+    TOKEN_T *tokens = ctx->tokens;
+    size_t capacity = ctx->token_capacity;
+    ctx->tokens = nullptr;
+    lexer_reset(ctx);
+    ctx->tokens = tokens;
+    ctx->token_capacity = capacity;
+}
+
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 
@@ -286,14 +376,12 @@ int ensure_token_cap(FRONT_COMPL_T *ctx, size_t need) {
  * @param value[in] значение узла.
  * @param text[in] указатель на исходную подстроку.
  * @param len[in] длина подстроки.
- * @param line[in] номер строки.
- * @param pos[in] позиция в строке.
  * @return 0 при успехе, -1 при ошибке.
  */
 int add_token(
     FRONT_COMPL_T *ctx,
     NODE_TYPE type, NODE_VALUE_T value,
-    const char *text, size_t len, int32_t line, int32_t pos
+    const char *text, size_t len
 ) {
     if (ensure_token_cap(ctx, ctx->token_count + 1)) return -1;
     TOKEN_T *tok = &ctx->tokens[ctx->token_count++];
@@ -306,14 +394,14 @@ int add_token(
     tok->node.parent = nullptr;
     tok->text = text;
     tok->length = len;
-    tok->line = line;
-    tok->pos = pos;
     tok->filename = ctx->name;
     return 0;
 }
 
 /**
  * @brief Сохраняет подстроку в VarList и возвращает индекс.
+ *
+ * Уже известное имя не копируется; сам токен ссылается на подстроку в ctx->buf.
  * @param ctx[in]  контекст компилятора.
  * @param text[in] подстрока.
  * @param len[in]  длина в байтах.
@@ -321,41 +409,97 @@ int add_token(
  */
 static size_t store_span(FRONT_COMPL_T *ctx, const char *text, size_t len) {
     if (ensure_varlist(ctx)) return varlist::NPOS;
-    char *tmp = strndup(text, len);
-    if (!tmp) return varlist::NPOS;
-    mystr::mystr_t str = mystr::construct(tmp);
-    size_t id = varlist::add(ctx->vars, &str);
-    free(tmp);
-    return id;
+    return varlist::add_span(ctx->vars, text, len);
 }
 
 /**
- * @brief Обновляет счетчики строки/позиции для диапазона UTF-8.
- * @param buf[in]       исходный текст.
- * @param start[in]     начало диапазона.
- * @param end[in]       конец диапазона.
- * @param line[in,out]  счетчик строк.
- * @param pos[in,out]   позиция в строке.
+ * @brief Скалярный вариант scan_run; им же дочищаются хвосты короче вектора.
  */
-static void advance_pos(
-    const char *buf,
-    size_t start, size_t end,
-    int32_t *line, int32_t *pos
-) {
-    size_t i = start;
-    while (i < end) {
-        unsigned char c = (unsigned char) buf[i];
-        if (c == '\n') {
-            ++(*line);
-            *pos = 1;
-            ++i;
-            continue;
-        }
-        uint8_t step = utf8_char_length(c);
-        if (!step) step = 1;
-        i += step;
-        ++(*pos);
+static size_t scan_scalar(SCAN::SCAN kind, const char *buf, size_t idx, size_t len) {
+    for (; idx < len; ++idx) {
+        unsigned char c = (unsigned char) buf[idx];
+        bool in = kind == SCAN::SPACE ? isspace(c) : kind == SCAN::DIGIT ? isdigit(c) : ascii_word(c);
+        if (!in) break;
+    }
+    return idx;
+}
+
+#ifdef LEXER_X86
+
+/** Байты x из [lo, lo + span] (беззнаково): x - lo <= span. */
+static inline __m128i range_sse2(__m128i x, int lo, int span) {
+    __m128i t = _mm_sub_epi8(x, _mm_set1_epi8((char) lo));
+    return _mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8((char) span)), t);
+}
+
+static inline uint32_t class_mask_sse2(SCAN::SCAN kind, __m128i x) {
+    __m128i digit = range_sse2(x, '0', 9);
+    if (kind == SCAN::DIGIT)
+        return (uint32_t) _mm_movemask_epi8(digit);
+    if (kind == SCAN::SPACE)
+        return (uint32_t) _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8(' ')), range_sse2(x, 9, 4)));
+    __m128i alpha = range_sse2(_mm_or_si128(x, _mm_set1_epi8(0x20)), 'a', 25);
+    return (uint32_t) _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(digit, alpha), _mm_cmpeq_epi8(x, _mm_set1_epi8('_'))));
+}
+
+static size_t scan_sse2(SCAN::SCAN kind, const char *buf, size_t idx, size_t len) {
+    while (idx + 16 <= len) {
+        __m128i x = _mm_loadu_si128((const __m128i *) (buf + idx));
+        uint32_t stop = ~class_mask_sse2(kind, x) & 0xFFFFu;
+        if (stop) return idx + (size_t) __builtin_ctz(stop);
+        idx += 16;
+    }
+    return scan_scalar(kind, buf, idx, len);
+}
+
+/* AVX2-варианты собираются отдельно и выбираются во время исполнения, как в batch.cpp */
+
+__attribute__((target("avx2")))
+static inline __m256i range_avx2(__m256i x, int lo, int span) {
+    __m256i t = _mm256_sub_epi8(x, _mm256_set1_epi8((char) lo));
+    return _mm256_cmpeq_epi8(_mm256_min_epu8(t, _mm256_set1_epi8((char) span)), t);
+}
+
+__attribute__((target("avx2")))
+static inline uint32_t class_mask_avx2(SCAN::SCAN kind, __m256i x) {
+    __m256i digit = range_avx2(x, '0', 9);
+    if (kind == SCAN::DIGIT)
+        return (uint32_t) _mm256_movemask_epi8(digit);
+    if (kind == SCAN::SPACE)
+        return (uint32_t) _mm256_movemask_epi8(
+            _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8(' ')), range_avx2(x, 9, 4)));
+    __m256i alpha = range_avx2(_mm256_or_si256(x, _mm256_set1_epi8(0x20)), 'a', 25);
+    return (uint32_t) _mm256_movemask_epi8(
+        _mm256_or_si256(_mm256_or_si256(digit, alpha), _mm256_cmpeq_epi8(x, _mm256_set1_epi8('_'))));
+}
+
+__attribute__((target("avx2")))
+static size_t scan_avx2(SCAN::SCAN kind, const char *buf, size_t idx, size_t len) {
+    while (idx + 32 <= len) {
+        __m256i x = _mm256_loadu_si256((const __m256i *) (buf + idx));
+        uint32_t stop = ~class_mask_avx2(kind, x);
+        if (stop) return idx + (size_t) __builtin_ctz(stop);
+        idx += 32;
     }
+    return scan_sse2(kind, buf, idx, len);
+}
+
+#endif // LEXER_X86
+
+static size_t scan_run(SCAN::SCAN kind, bool avx2,
+    const char *buf, size_t idx, size_t len
+) {
+#ifdef LEXER_X86
+    return avx2 ? scan_avx2(kind, buf, idx, len) : scan_sse2(kind, buf, idx, len);
+#else
+    (void) avx2;
+    return scan_scalar(kind, buf, idx, len);
+#endif
+}
+
+static size_t find_byte(const char *buf, size_t idx, size_t len, char c) {
+    const char *hit = idx < len ? (const char *) memchr(buf + idx, c, len - idx) : nullptr;
+    return hit ? (size_t) (hit - buf) : len;
 }
 
 /**
@@ -370,11 +514,16 @@ static const fixed_token_t *match_fixed(
     const char *buf, size_t len,
     size_t idx, char *tmp
 ) {
+    /* первые два байта в верхнем регистре отсеивают почти все записи без полного copy_upper */
+    char head[8] = "";
+    size_t head_len = idx + 2 <= len ? 2 : len - idx;
+    copy_upper(head, buf + idx, head_len);
     size_t i;
     for (i = 0; i < ARRAY_COUNT(g_fixed); ++i) {
         const fixed_token_t *ft = &g_fixed[i];
         if (idx + ft->len > len) continue;
         if (ft->casefold) {
+            if (head[0] != ft->text[0] || (ft->len > 1 && head[1] != ft->text[1])) continue;
             copy_upper(tmp, buf + idx, ft->len);
             if (strncmp(tmp, ft->text, ft->len) != 0) continue;
         } else {
@@ -400,13 +549,11 @@ static const fixed_token_t *match_fixed(
  * @param ctx[in,out] контекст компилятора.
  * @param ft[in]      описание лексемы.
  * @param idx[in]     смещение в буфере.
- * @param line[in]    номер строки.
- * @param pos[in]     позиция в строке.
  * @return 0 при успехе, -1 при ошибке.
  */
 static int emit_fixed(
     FRONT_COMPL_T *ctx,
-    const fixed_token_t *ft, size_t idx, int32_t line, int32_t pos
+    const fixed_token_t *ft, size_t idx
 ) {
     NODE_VALUE_T val;
     if (ft->type == KEYWORD_T)
@@ -417,141 +564,246 @@ static int emit_fixed(
         val.delimiter = (DELIMITER::DELIMITER) ft->value;
     return add_token(ctx,
         ft->type, val,
-        ctx->buf + idx, ft->len, line, pos
+        ctx->buf + idx, ft->len
     );
 }
 
 /**
  * @brief Обходит буфер и формирует все токены.
+ *
+ * С ctx->threads > 1 и достаточно большим исходником делит его на куски по разделам (lex_parallel).
  * @param ctx[in,out]   контекст компилятора.
  * @return 0 при успехе, -1 при ошибке.
  */
 static int lex_buffer(FRONT_COMPL_T *ctx) {
     if (!ctx || !ctx->buf) return -1;
+    size_t threads = ctx->threads < ctx->buf_len / LEX_MIN_CHUNK ? ctx->threads : ctx->buf_len / LEX_MIN_CHUNK;
+    size_t bad = SIZE_MAX;
+    int rc = threads > 1 ? lex_parallel(ctx, threads, &bad) : lex_range(ctx, 0, ctx->buf_len, &bad);
+    if (rc) {
+        if (bad != SIZE_MAX) report_lex_error(ctx, bad, "unterminated string");
+        return -1;
+    }
+    ctx->lexed_count = ctx->token_count;
+    return 0;
+}
+
+static void report_lex_error(FRONT_COMPL_T *ctx, size_t off, const char *reason) {
+    FILE *err = ctx->errors ? ctx->errors : stderr;
+    size_t line = 1, from = 0;
+    for (size_t i = 0; i < off; ++i) {
+        if (ctx->buf[i] == '\n') {
+            ++line;
+            from = i + 1;
+        }
+    }
+    size_t pos = 1;
+    for (size_t i = from; i < off; ++i)
+        if (((unsigned char) ctx->buf[i] & 0xC0) != 0x80) ++pos;
+    fprintf(err, "lexer error: %s\n", reason);
+    fprintf(err, "  file: %s\n", ctx->name ? ctx->name : "<buffer>");
+    fprintf(err, "  line=%zu pos=%zu\n", line, pos);
+}
+
+static size_t find_section_start(const char *buf, size_t from, size_t len) {
+    char tmp[64];
+    size_t line = (from == 0 || buf[from - 1] == '\n') ? from : find_byte(buf, from, len, '\n') + 1;
+    while (line < len) {
+        size_t idx = line;
+        while (idx < len && (buf[idx] == ' ' || buf[idx] == '\t')) ++idx;
+        const fixed_token_t *ft = idx < len ? match_fixed(buf, len, idx, tmp) : nullptr;
+        if (ft && ft->type == KEYWORD_T &&
+            (ft->value == KEYWORD::THEORETICAL || ft->value == KEYWORD::EXPERIMENTAL ||
+             ft->value == KEYWORD::RESULTS || ft->value == KEYWORD::FORMULA))
+            return line;
+        line = find_byte(buf, line, len, '\n') + 1;
+    }
+    return len;
+}
+
+static void *lex_chunk_main(void *arg) {
+    lex_chunk_t *chunk = (lex_chunk_t *) arg;
+    chunk->rc = lex_range(&chunk->part, chunk->start, chunk->end, &chunk->bad);
+    return nullptr;
+}
+
+static int merge_chunk(FRONT_COMPL_T *ctx, const FRONT_COMPL_T *part) {
+    size_t names = varlist::size(part->vars);
+    size_t *remap = TYPED_CALLOC(names + 1, size_t);
+    if (!remap) return -1;
+    int rc = ensure_varlist(ctx) || ensure_token_cap(ctx, ctx->token_count + part->token_count) ? -1 : 0;
+    /* куски сливаются по порядку, так что индексы выходят в порядке первого появления, как без потоков */
+    for (size_t i = 0; !rc && i < names; ++i) {
+        remap[i] = varlist::add(ctx->vars, varlist::get(part->vars, i));
+        if (remap[i] == varlist::NPOS) rc = -1;
+    }
+    for (size_t i = 0; !rc && i < part->token_count; ++i) {
+        TOKEN_T *tok = &ctx->tokens[ctx->token_count++];
+        *tok = part->tokens[i];
+        if (tok->node.type == IDENTIFIER_T || tok->node.type == LITERAL_T)
+            tok->node.value.id = remap[tok->node.value.id];
+    }
+    free(remap);
+    return rc;
+}
+
+/**
+ * Разделы всегда начинаются с новой строки, а строка в кавычках, комментарий и строка текста
+ * не переходят через перевод строки, так что с начала строки лексер стартует в том же состоянии,
+ * что и без деления. Первый кусок лексится прямо в ctx в вызывающем потоке, остальные - в своих
+ * потоках со своим VarList; затем токены дописываются по порядку с переводом индексов имен.
+ */
+static int lex_parallel(FRONT_COMPL_T *ctx, size_t threads, size_t *bad) {
     const char *buf = ctx->buf;
     size_t len = ctx->buf_len;
-    size_t idx = 0;
-    int32_t line = 1;
-    int32_t pos = 1;
+    lex_chunk_t *chunks = TYPED_CALLOC(threads, lex_chunk_t);
+    pthread_t *tids = TYPED_CALLOC(threads, pthread_t);
+    if (!chunks || !tids) {
+        free(chunks);
+        free(tids);
+        return -1;
+    }
+    size_t count = 1;
+    for (size_t k = 1; k < threads; ++k) {
+        size_t from = len / threads * k;
+        if (from <= chunks[count - 1].start) from = chunks[count - 1].start + 1;
+        size_t at = find_section_start(buf, from, len);
+        if (at >= len) break;
+        chunks[count - 1].end = at;
+        chunks[count++].start = at;
+    }
+    chunks[count - 1].end = len;
+    for (size_t k = 1; k < count; ++k) {
+        chunks[k].part.buf = ctx->buf;
+        chunks[k].part.buf_len = len;
+        chunks[k].part.name = ctx->name;
+        chunks[k].bad = SIZE_MAX;
+    }
+
+    size_t started = 1;
+    for (; started < count; ++started) {
+        if (pthread_create(&tids[started], nullptr, lex_chunk_main, &chunks[started])) break;
+    }
+    int rc = lex_range(ctx, 0, chunks[0].end, bad);
+    /* куски, для которых поток не запустился, лексятся здесь */
+    for (size_t k = started; k < count; ++k)
+        lex_chunk_main(&chunks[k]);
+    for (size_t k = 1; k < started; ++k)
+        pthread_join(tids[k], nullptr);
+
+    for (size_t k = 1; k < count; ++k) {
+        /* ошибка сообщается из первого по порядку куска, где она есть */
+        if (!rc && chunks[k].rc) *bad = chunks[k].bad;
+        if (!rc) rc = chunks[k].rc ? -1 : merge_chunk(ctx, &chunks[k].part);
+        lexer_reset(&chunks[k].part);
+    }
+    free(chunks);
+    free(tids);
+    return rc;
+}
+
+/**
+ * @brief Формирует токены куска буфера.
+ *
+ * Пробелы, комментарии, числа, идентификаторы и строки текста пропускаются векторно
+ * (scan_run, memchr). Строка и позиция здесь не считаются: токен хранит только смещение,
+ * а token_location восстанавливает их, когда нужен дамп или диагностика.
+ * @param ctx[in,out]   контекст компилятора (токены и VarList).
+ * @param idx[in]       начало куска.
+ * @param len[in]       конец куска: начало строки или конец буфера.
+ * @return 0 при успехе, -1 при ошибке.
+ */
+static int lex_range(FRONT_COMPL_T *ctx, size_t idx, size_t len, size_t *bad) {
+    const char *buf = ctx->buf;
     char tmp[64];
+    bool avx2 = false;
+#ifdef LEXER_X86
+    __builtin_cpu_init();
+    avx2 = __builtin_cpu_supports("avx2");
+#endif
 
     while (idx < len) {
-        if (buf[idx] == '\n') {
-            ++line;
-            pos = 1;
-            ++idx;
-            continue;
-        }
-
-        while (idx < len && isspace((unsigned char) buf[idx])) {
-            if (buf[idx] == '\n') {
-                ++line;
-                pos = 1;
-            } else
-                ++pos;
-            ++idx;
-        }
+        idx = scan_run(SCAN::SPACE, avx2, buf, idx, len);
         if (idx >= len) break;
 
         const fixed_token_t *ft = match_fixed(buf, len, idx, tmp);
         if (ft) {
-            if (emit_fixed(ctx, ft, idx, line, pos)) return -1;
-            advance_pos(buf, idx, idx + ft->len, &line, &pos);
+            if (emit_fixed(ctx, ft, idx)) return -1;
             idx += ft->len;
             continue;
         }
 
         if (buf[idx] == '"') {
             size_t start = idx;
-            size_t end = idx + 1;
-            while (end < len && buf[end] != '"') {
-                if (buf[end] == '\n') return -1;
-                ++end;
+            size_t end = find_byte(buf, idx + 1, len, '"');
+            if (end >= len || find_byte(buf, idx + 1, end, '\n') < end) {
+                *bad = start;
+                return -1;
             }
-            if (end >= len) return -1;
             size_t content_start = start + 1;
             size_t content_len = end - content_start;
             size_t id = store_span(ctx, buf + content_start, content_len);
             if (id == varlist::NPOS) return -1;
             NODE_VALUE_T val;
             val.delimiter = DELIMITER::QUOTE;
-            if (add_token(ctx, DELIMITER_T, val, buf + start, 1, line, pos + 1)) return -1;
+            if (add_token(ctx, DELIMITER_T, val, buf + start, 1)) return -1;
             val.id = id;
-            if (add_token(ctx, LITERAL_T, val, buf + content_start, content_len, line, pos + 1)) return -1;
+            if (add_token(ctx, LITERAL_T, val, buf + content_start, content_len)) return -1;
             val.delimiter = DELIMITER::QUOTE;
-            if (add_token(ctx, DELIMITER_T, val, buf + end, 1, line, pos + 1)) return -1;
-            advance_pos(buf, start, end + 1, &line, &pos);
+            if (add_token(ctx, DELIMITER_T, val, buf + end, 1)) return -1;
             idx = end + 1;
             continue;
         }
 
         if (buf[idx] == '/' && idx + 1 < len && buf[idx + 1] == '/') {
-            idx += 2;
-            pos += 2;
-            while (idx < len && buf[idx] != '\n') {
-                ++idx;
-                ++pos;
-            }
+            idx = find_byte(buf, idx, len, '\n');
             continue;
         }
 
         unsigned char c = (unsigned char) buf[idx];
         if (isdigit(c)) {
             size_t start = idx;
-            while (idx < len && isdigit((unsigned char)buf[idx])) ++idx;
-            if (idx < len && buf[idx] == '.') {
-                ++idx;
-                while (idx < len && isdigit((unsigned char)buf[idx])) ++idx;
-            }
+            idx = scan_run(SCAN::DIGIT, avx2, buf, idx, len);
+            if (idx < len && buf[idx] == '.')
+                idx = scan_run(SCAN::DIGIT, avx2, buf, idx + 1, len);
             size_t num_len = idx - start;
-            char *num = (char *)malloc(num_len + 1);
-            if (!num) return -1;
-            memcpy(num, buf + start, num_len);
-            num[num_len] = '\0';
+            /* strtod нужен завершающий ноль; обычные числа разбираются со стека */
+            char stack_num[64];
+            char *num = stack_num;
+            if (num_len < sizeof(stack_num)) {
+                memcpy(num, buf + start, num_len);
+                num[num_len] = '\0';
+            } else {
+                num = STRNDUP(buf + start, num_len);
+                if (!num) return -1;
+            }
             NODE_VALUE_T val;
             val.num = strtod(num, nullptr);
-            free(num);
-            if (add_token(ctx, NUMBER_T, val, buf + start, num_len, line, pos)) return -1;
-            advance_pos(buf, start, idx, &line, &pos);
+            if (num != stack_num) free(num);
+            if (add_token(ctx, NUMBER_T, val, buf + start, num_len)) return -1;
             continue;
         }
 
         if (isascii(c) && (isalpha(c) || c == '_')) {
             size_t start = idx;
-            ++idx;
-            while (idx < len) {
-                unsigned char cc = (unsigned char) buf[idx];
-                if (!ascii_word(cc)) break;
-                ++idx;
-            }
-            size_t span = idx - start;
-            size_t id = store_span(ctx, buf + start, span);
-            if (id == varlist::NPOS) return -1;
-            NODE_VALUE_T val;
-            val.id = id;
-            if (add_token(ctx, IDENTIFIER_T, val, buf + start, span, line, pos)) return -1;
-            advance_pos(buf, start, idx, &line, &pos);
-            continue;
-        }
-
-        {
-            size_t start = idx;
-            while (idx < len && buf[idx] != '\n') ++idx;
+            idx = scan_run(SCAN::WORD, avx2, buf, idx + 1, len);
             size_t span = idx - start;
-            if (span == 0) continue;
             size_t id = store_span(ctx, buf + start, span);
             if (id == varlist::NPOS) return -1;
             NODE_VALUE_T val;
             val.id = id;
-            if (add_token(ctx, LITERAL_T, val, buf + start, span, line, pos)) return -1;
-            advance_pos(buf, start, idx, &line, &pos);
+            if (add_token(ctx, IDENTIFIER_T, val, buf + start, span)) return -1;
             continue;
         }
 
-        uint8_t step = utf8_char_length(c);
-        if (!step) step = 1;
-        advance_pos(buf, idx, idx + step, &line, &pos);
-        idx += step;
+        /* остаток строки - текст; пробелы уже пропущены, так что он не пуст */
+        size_t start = idx;
+        idx = find_byte(buf, idx, len, '\n');
+        size_t id = store_span(ctx, buf + start, idx - start);
+        if (id == varlist::NPOS) return -1;
+        NODE_VALUE_T val;
+        val.id = id;
+        if (add_token(ctx, LITERAL_T, val, buf + start, idx - start)) return -1;
     }
     return 0;
-}
\ No newline at end of file
+}
@@ -13,24 +13,36 @@
 #include "base.h"
 
 function void usage(const char *prog) {
-    fprintf(stderr, "usage: %s <input.physlab> [output.ast]\n", prog ? prog : "frontend");
+    fprintf(stderr, "usage: %s [--parallel N] <input.physlab> [output.ast]\n", prog ? prog : "frontend");
 }
 
 int main(int argc, char **argv) {
     const char *input = nullptr;
     const char *output = nullptr;
-
-    if (argc < 2) {
-        usage(argc ? argv[0] : "frontend");
-        return 1;
+    size_t threads = 1;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--parallel") == 0 && i + 1 < argc) {
+            char *end = nullptr;
+            unsigned long val = strtoul(argv[++i], &end, 10);
+            if (!end || *end || !val || val > FRONT_MAX_THREADS) {
+                usage(argv[0]);
+                return 1;
+            }
+            threads = (size_t) val;
+        } else if (!input && argv[i][0])
+            input = argv[i];
+        else if (!output && argv[i][0])
+            output = argv[i];
+        else {
+            usage(argv[0]);
+            return 1;
+        }
     }
-    input = argv[1];
-    if (!input || !*input) {
+    if (!input) {
         usage(argc ? argv[0] : "frontend");
         return 1;
     }
-    if (argc > 2 && argv[2] && argv[2][0])
-        output = argv[2];
 
     char exe_path[PATH_MAX] = ".";
     if (realpath(argv[0], exe_path) == nullptr)
@@ -61,6 +73,7 @@ int main(int argc, char **argv) {
     }
 
     FRONT_COMPL_T ctx = {};
+    ctx.threads = threads;
     if (lexer_load_file(&ctx, input) != 0) {
         fprintf(stderr, "lexer failed on \"%s\"\n", input);
         destruct_logger();
@@ -1,3 +1,4 @@
+#include <pthread.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -6,14 +7,39 @@
 #include "ast.h"
 #include "base.h"
 
+/** Меньше стольких токенов ФОРМУЛ на поток парсер не делит. */
+const size_t PARSE_MIN_SHARD = 4096;
+
+/** ФОРМУЛА в массиве токенов: [start, end) от "ФОРМУЛА" до "КОНЕЦ ФОРМУЛЫ" включительно и ее разобранный узел. */
+typedef struct {
+    size_t  start,
+            end;
+    NODE_T *node;
+} parsed_func_t;
+
 struct parser_t {
     FRONT_COMPL_T *ctx;
     size_t         pos;
     bool           error;
+    size_t         end;             ///< токены с этого индекса не читаются (граница ФОРМУЛЫ в потоке)
+    FRONT_COMPL_T *nodes;           ///< куда добавляются синтетические узлы: ctx или пул потока
+    parsed_func_t *funcs;           ///< заранее разобранные ФОРМУЛЫ или nullptr
+    size_t         func_count,
+                   next_func;
 };
 
+/** Поток parse_functions: подряд идущие ФОРМУЛЫ и свой пул узлов. */
+typedef struct {
+    FRONT_COMPL_T *ctx;
+    FRONT_COMPL_T  nodes;
+    parsed_func_t *funcs;
+    size_t         count;
+    NODE_T        *saved;           ///< узлы токенов куска до разбора: парсер меняет их тип и связи
+    bool           error;
+} parse_shard_t;
+
 static void log_parse_state(parser_t *p, const char *reason);
-static void dump_token_brief(const TOKEN_T *tok, size_t idx);
+static void dump_token_brief(FRONT_COMPL_T *ctx, size_t idx);
 
 static NODE_T *get_program                  (parser_t *p);
 static NODE_T *get_report                   (parser_t *p);
@@ -56,6 +82,11 @@ static NODE_T  *make_comma_node             (parser_t *p, NODE_T *left, NODE_T *
 static NODE_T  *clone_identifier_literal    (parser_t *p, const TOKEN_T *tok);
 static NODE_T  *make_literal_from_id        (parser_t *p, size_t id, const TOKEN_T *src);
 static NODE_T  *attach_comma_chain          (parser_t *p, NODE_T *first);
+static NODE_T  *take_parsed_function        (parser_t *p);
+
+static size_t   index_functions             (const FRONT_COMPL_T *ctx, parsed_func_t **out);
+static void    *parse_shard_main            (void *arg);
+static int      parse_functions             (FRONT_COMPL_T *ctx, parsed_func_t *funcs, size_t count, size_t threads);
 
 /**
  * @brief Создает AST для массива токенов и сохраняет его в ctx->root.
@@ -68,8 +99,15 @@ int parse_tokens(FRONT_COMPL_T *ctx) {
     size_t reserve = ctx->token_count * 8 + 64;
     if (ensure_token_cap(ctx, reserve))
         return -1;
-    parser_t p = { ctx, 0, false };
+    parser_t p = { ctx, 0, false, SIZE_MAX, ctx, nullptr, 0, 0 };
+    parsed_func_t *funcs = nullptr;
+    size_t count = ctx->threads > 1 ? index_functions(ctx, &funcs) : 0;
+    if (count && parse_functions(ctx, funcs, count, ctx->threads) == 0) {
+        p.funcs = funcs;
+        p.func_count = count;
+    }
     NODE_T *root = get_program(&p);
+    free(funcs);
     if (p.error || !root) {
         log_parse_state(&p, "parse failed");
         return -1;
@@ -80,27 +118,163 @@ int parse_tokens(FRONT_COMPL_T *ctx) {
     return 0;
 }
 
-static void dump_token_brief(const TOKEN_T *tok, size_t idx) {
-    if (!tok) return;
-    fprintf(stderr, "  token[%zu]: type=%d line=%d pos=%d", idx, tok->node.type, tok->line, tok->pos);
+/**
+ * @brief Находит ФОРМУЛЫ раздела ТЕОРЕТИЧЕСКИЕ СВЕДЕНИЯ так же, как их обходит get_theoretical_background.
+ *
+ * Обход останавливается на первом токене, который не литерал и не целая ФОРМУЛА;
+ * дальше разберет последовательный парсер.
+ * @param out[out] массив границ (освобождает вызывающий).
+ * @return число найденных ФОРМУЛ.
+ */
+static size_t index_functions(const FRONT_COMPL_T *ctx, parsed_func_t **out) {
+    *out = nullptr;
+    const TOKEN_T *toks = ctx->tokens;
+    size_t n = ctx->lexed_count, i = 0;
+    while (i < n && !is_keyword_tok(&toks[i], KEYWORD::THEORETICAL)) ++i;
+    parsed_func_t *funcs = nullptr;
+    size_t count = 0, cap = 0;
+    for (++i; i < n; ) {
+        if (toks[i].node.type == LITERAL_T) {
+            ++i;
+            continue;
+        }
+        if (!is_keyword_tok(&toks[i], KEYWORD::FORMULA)) break;
+        size_t j = i + 1;
+        for (; j < n; ++j) {
+            if (toks[j].node.type != KEYWORD_T) continue;
+            KEYWORD::KEYWORD kw = toks[j].node.value.keyword;
+            if (kw == KEYWORD::END_FORMULA || kw == KEYWORD::FORMULA || kw == KEYWORD::END_THEORETICAL) break;
+        }
+        if (j >= n || !is_keyword_tok(&toks[j], KEYWORD::END_FORMULA)) break;
+        if (count == cap) {
+            cap = cap ? cap * 2 : 16;
+            parsed_func_t *tmp = TYPED_REALLOC(funcs, cap, parsed_func_t);
+            if (!tmp) break;
+            funcs = tmp;
+        }
+        funcs[count++] = {i, j + 1, nullptr};
+        i = j + 1;
+    }
+    *out = funcs;
+    return count;
+}
+
+static void *parse_shard_main(void *arg) {
+    parse_shard_t *sh = (parse_shard_t *) arg;
+    TOKEN_T *pool = sh->nodes.tokens;
+    size_t first = sh->funcs[0].start;
+    for (size_t i = first; i < sh->funcs[sh->count - 1].end; ++i)
+        sh->saved[i - first] = sh->ctx->tokens[i].node;
+    for (size_t i = 0; i < sh->count && !sh->error; ++i) {
+        parsed_func_t *f = &sh->funcs[i];
+        parser_t q = { sh->ctx, f->start, false, f->end, &sh->nodes, nullptr, 0, 0 };
+        f->node = get_function_declaration(&q);
+        if (!f->node || q.error || q.pos != f->end) sh->error = true;
+    }
+    /* пул переехал при росте - указатели на его узлы недействительны */
+    if (sh->nodes.tokens != pool) sh->error = true;
+    return nullptr;
+}
+
+/**
+ * @brief Разбирает ФОРМУЛЫ в потоках до основного разбора.
+ *
+ * ФОРМУЛЫ делятся на подряд идущие куски с примерно равным числом токенов. Каждый поток
+ * разбирает свой кусок парсером, ограниченным границами ФОРМУЛЫ, и кладет синтетические
+ * узлы в свой пул; пулы переходят к ctx. Токены ФОРМУЛ разных потоков не пересекаются,
+ * так что связи set_children не конфликтуют. Если хоть одна ФОРМУЛА не разобралась,
+ * все откатывается и работает последовательный разбор, с теми же сообщениями об ошибке.
+ * @return 0 при успехе, -1 - разбирать последовательно.
+ */
+static int parse_functions(FRONT_COMPL_T *ctx, parsed_func_t *funcs, size_t count, size_t threads) {
+    size_t total = 0;
+    for (size_t i = 0; i < count; ++i) total += funcs[i].end - funcs[i].start;
+    if (threads > count) threads = count;
+    if (threads > total / PARSE_MIN_SHARD) threads = total / PARSE_MIN_SHARD;
+    if (threads < 2) return -1;
+
+    parse_shard_t *shards = TYPED_CALLOC(threads, parse_shard_t);
+    pthread_t *tids = TYPED_CALLOC(threads, pthread_t);
+    TOKEN_T **pools = TYPED_REALLOC(ctx->node_pools, ctx->node_pool_count + threads, TOKEN_T *);
+    if (pools) ctx->node_pools = pools;
+    int rc = (shards && tids && pools) ? 0 : -1;
+    size_t used = 0;
+    for (size_t i = 0, acc = 0; !rc && i < count; ++i) {
+        if (!used || (acc >= total / threads * used && used < threads)) {
+            shards[used].ctx = ctx;
+            shards[used].nodes.name = ctx->name;
+            shards[used].funcs = &funcs[i];
+            ++used;
+        }
+        ++shards[used - 1].count;
+        acc += funcs[i].end - funcs[i].start;
+    }
+    for (size_t t = 0; !rc && t < used; ++t) {
+        size_t tokens = shards[t].funcs[shards[t].count - 1].end - shards[t].funcs[0].start;
+        /* тот же запас, что у последовательного разбора: пул не должен расти */
+        if (ensure_token_cap(&shards[t].nodes, tokens * 8 + 64)) rc = -1;
+        shards[t].saved = TYPED_CALLOC(tokens, NODE_T);
+        if (!shards[t].saved) rc = -1;
+    }
+
+    if (!rc) {
+        size_t started = 1;
+        for (; started < used; ++started) {
+            if (pthread_create(&tids[started], nullptr, parse_shard_main, &shards[started])) break;
+        }
+        parse_shard_main(&shards[0]);
+        for (size_t t = started; t < used; ++t)
+            parse_shard_main(&shards[t]);
+        for (size_t t = 1; t < started; ++t)
+            pthread_join(tids[t], nullptr);
+        for (size_t t = 0; t < used; ++t)
+            if (shards[t].error) rc = -1;
+    }
+
+    for (size_t t = 0; shards && t < threads; ++t) {
+        parse_shard_t *sh = &shards[t];
+        if (rc && sh->saved && sh->count) {
+            /* откат: последовательный разбор видит токены такими, какими их оставил лексер */
+            size_t first = sh->funcs[0].start;
+            for (size_t i = first; i < sh->funcs[sh->count - 1].end; ++i)
+                ctx->tokens[i].node = sh->saved[i - first];
+        }
+        if (rc) free(sh->nodes.tokens);
+        else if (t < used) ctx->node_pools[ctx->node_pool_count++] = sh->nodes.tokens;
+        free(sh->saved);
+    }
+    free(shards);
+    free(tids);
+    return rc;
+}
+
+static void dump_token_brief(FRONT_COMPL_T *ctx, size_t idx) {
+    if (!ctx || idx >= ctx->token_count) return;
+    const TOKEN_T *tok = &ctx->tokens[idx];
+    FILE *err = ctx->errors ? ctx->errors : stderr;
+    int32_t line = 0, pos = 0;
+    token_location(ctx, idx, &line, &pos);
+    fprintf(err, "  token[%zu]: type=%d line=%d pos=%d", idx, tok->node.type, line, pos);
     if (tok->text && tok->length) {
         size_t snip = tok->length;
         if (snip > 48) snip = 48;
-        fprintf(stderr, " text=\"%.*s\"%s", (int) snip, tok->text, (tok->length > snip) ? "..." : "");
+        fprintf(err, " text=\"%.*s\"%s", (int) snip, tok->text, (tok->length > snip) ? "..." : "");
     }
-    fputc('\n', stderr);
+    fputc('\n', err);
 }
 
 static void log_parse_state(parser_t *p, const char *reason) {
     if (!p || !p->ctx) return;
     size_t pos = p->pos;
-    size_t last = (p->ctx->token_count > 0) ? p->ctx->token_count - 1 : 0;
-    size_t idx = (pos < p->ctx->token_count) ? pos : last;
-    TOKEN_T *tok = (p->ctx->token_count > 0) ? &p->ctx->tokens[idx] : nullptr;
-    fprintf(stderr, "parser error: %s\n", reason ? reason : "unknown");
-    fprintf(stderr, "  file: %s\n", p->ctx->name ? p->ctx->name : "<buffer>");
-    fprintf(stderr, "  tokens: %zu, at index %zu\n", p->ctx->token_count, idx);
-    if (tok) dump_token_brief(tok, idx);
+    /* только токены исходника: синтетических узлов при --parallel меньше, и число не совпало бы */
+    size_t lexed = p->ctx->lexed_count;
+    size_t last = (lexed > 0) ? lexed - 1 : 0;
+    size_t idx = (pos < lexed) ? pos : last;
+    FILE *err = p->ctx->errors ? p->ctx->errors : stderr;
+    fprintf(err, "parser error: %s\n", reason ? reason : "unknown");
+    fprintf(err, "  file: %s\n", p->ctx->name ? p->ctx->name : "<buffer>");
+    fprintf(err, "  tokens: %zu, at index %zu\n", lexed, idx);
+    dump_token_brief(p->ctx, idx);
 }
 
 /**
@@ -108,7 +282,7 @@ static void log_parse_state(parser_t *p, const char *reason) {
  */
 static TOKEN_T *get_token(parser_t *p) {
     if (!p || !p->ctx) return nullptr;
-    return (p->pos < p->ctx->token_count) ? &p->ctx->tokens[p->pos] : nullptr;
+    return (p->pos < p->ctx->token_count && p->pos < p->end) ? &p->ctx->tokens[p->pos] : nullptr;
 }
 
 /**
@@ -117,7 +291,7 @@ static TOKEN_T *get_token(parser_t *p) {
 static TOKEN_T *get_next(parser_t *p) {
     if (!p || !p->ctx) return nullptr;
     size_t idx = p->pos + 1;
-    return (idx < p->ctx->token_count) ? &p->ctx->tokens[idx] : nullptr;
+    return (idx < p->ctx->token_count && idx < p->end) ? &p->ctx->tokens[idx] : nullptr;
 }
 
 /**
@@ -125,7 +299,7 @@ static TOKEN_T *get_next(parser_t *p) {
  */
 static TOKEN_T *next_token(parser_t *p) {
     if (!p || !p->ctx) return nullptr;
-    if (p->pos >= p->ctx->token_count) return nullptr;
+    if (p->pos >= p->ctx->token_count || p->pos >= p->end) return nullptr;
     return &p->ctx->tokens[p->pos++];
 }
 
@@ -133,7 +307,7 @@ static TOKEN_T *next_token(parser_t *p) {
  * @brief Проверяет, достигнут ли конец потока токенов.
  */
 static bool is_end(parser_t *p) {
-    return !p || !p->ctx || p->pos >= p->ctx->token_count;
+    return !p || !p->ctx || p->pos >= p->ctx->token_count || p->pos >= p->end;
 }
 
 /**
@@ -180,11 +354,11 @@ static bool match_delim(parser_t *p, DELIMITER::DELIMITER d, TOKEN_T **out) {
  */
 static NODE_T *make_synthetic(parser_t *p, NODE_TYPE type, NODE_VALUE_T val) {
     if (!p || !p->ctx) return nullptr;
-    if (add_token(p->ctx, type, val, nullptr, 0, 0, 0)) {
+    if (add_token(p->nodes, type, val, nullptr, 0)) {
         p->error = true;
         return nullptr;
     }
-    return &p->ctx->tokens[p->ctx->token_count - 1].node;
+    return &p->nodes->tokens[p->nodes->token_count - 1].node;
 }
 
 /**
@@ -228,11 +402,11 @@ static NODE_T *make_literal_from_id(parser_t *p, size_t id, const TOKEN_T *src)
     v.id = id;
     const char *text = src ? src->text : nullptr;
     size_t len = src ? src->length : 0;
-    if (add_token(p->ctx, LITERAL_T, v, text, len, 0, 0)) {
+    if (add_token(p->nodes, LITERAL_T, v, text, len)) {
         p->error = true;
         return nullptr;
     }
-    return &p->ctx->tokens[p->ctx->token_count - 1].node;
+    return &p->nodes->tokens[p->nodes->token_count - 1].node;
 }
 
 /**
@@ -255,6 +429,18 @@ static NODE_T *attach_comma_chain(parser_t *p, NODE_T *first) {
     return current;
 }
 
+/**
+ * @brief Отдает ФОРМУЛУ, разобранную в потоке, если разбор дошел до ее начала, и пропускает ее токены.
+ * @return узел ФОРМУЛЫ или nullptr, если ее надо разбирать здесь.
+ */
+static NODE_T *take_parsed_function(parser_t *p) {
+    while (p->next_func < p->func_count && p->funcs[p->next_func].start < p->pos) ++p->next_func;
+    if (p->next_func >= p->func_count || p->funcs[p->next_func].start != p->pos) return nullptr;
+    const parsed_func_t *f = &p->funcs[p->next_func++];
+    p->pos = f->end;
+    return f->node;
+}
+
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 /* Грамматические правила.                                            */
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
@@ -350,7 +536,8 @@ static NODE_T *get_theoretical_background(parser_t *p) {
             next_token(p);
             continue;
         }
-        NODE_T *f = get_function_declaration(p);
+        NODE_T *f = take_parsed_function(p);
+        if (!f) f = get_function_declaration(p);
         if (!f) {
             p->error = true;
             return nullptr;
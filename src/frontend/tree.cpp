@@ -373,8 +373,22 @@ int save_ast_to_file(const FRONT_COMPL_T *ctx, const char *path) {
     FILE *fp = fopen(path, "w");
     if (!fp)
         return -1;
+    int rc = write_ast(ctx, fp);
+    if (fclose(fp))
+        rc = -1;
+    return rc;
+}
+
+/**
+ * @brief Пишет текущее AST в поток в префиксной форме.
+ * @param ctx   контекст фронтенда с деревом.
+ * @param fp    поток вывода.
+ * @return 0 при успехе, -1 при ошибке.
+ */
+int write_ast(const FRONT_COMPL_T *ctx, FILE *fp) {
+    if (!ctx || !ctx->root || !fp)
+        return -1;
     write_node(fp, ctx, ctx->root, 0);
     fputc('\n', fp);
-    fclose(fp);
-    return 0;
+    return ferror(fp) ? -1 : 0;
 }
\ No newline at end of file
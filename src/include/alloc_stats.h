@@ -0,0 +1,53 @@
+#ifndef ALLOC_STATS_H
+#define ALLOC_STATS_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+/**
+ * Учет выделений памяти, включается флагом сборки -DALLOC_STATS (extra_flag:-DALLOC_STATS в .gppp.cfg).
+ *
+ * С флагом TYPED_CALLOC/TYPED_MALLOC/TYPED_REALLOC/STRDUP/STRNDUP/FREE и free из base.h
+ * идут через функции ниже: считаются вызовы, байты, живой объем и его пик, а по каждому
+ * месту вызова (файл:строка функция) - гистограмма размеров. Без флага макросы раскрываются
+ * в обычные calloc/realloc/free, счетчики нулевые, а дамп сообщает, что учет выключен.
+ */
+
+/** Границы корзин гистограммы размеров, последняя корзина - все, что больше. */
+const size_t ALLOC_BUCKET_LIMITS[] = {16, 64, 256, 1024, 4096, 65536};
+const size_t ALLOC_BUCKETS = sizeof(ALLOC_BUCKET_LIMITS) / sizeof(ALLOC_BUCKET_LIMITS[0]) + 1;
+
+/** Суммарные счетчики отслеживаемых выделений. */
+typedef struct {
+    size_t count;   ///< выделений, realloc считается за одно
+    size_t bytes;   ///< запрошено байт всего
+    size_t live;    ///< байт выделено и еще не освобождено
+    size_t peak;    ///< максимум live
+} alloc_totals_t;
+
+#ifdef ALLOC_STATS
+
+void *alloc_stats_calloc(size_t nmemb, size_t size, const char *file, int line, const char *func);
+void *alloc_stats_realloc(void *ptr, size_t size, const char *file, int line, const char *func);
+char *alloc_stats_strndup(const char *text, size_t len, const char *file, int line, const char *func);
+char *alloc_stats_strdup(const char *text, const char *file, int line, const char *func);
+void alloc_stats_free(void *ptr);
+
+/** Копирует суммарные счетчики в out. */
+void alloc_stats_totals(alloc_totals_t *out);
+/** Печатает итоги и таблицу мест вызова по убыванию числа выделений. */
+void alloc_stats_dump(FILE *fp);
+
+#else
+
+static inline void alloc_stats_totals(alloc_totals_t *out) {
+    if (out) *out = {};
+}
+
+static inline void alloc_stats_dump(FILE *fp) {
+    if (fp) fprintf(fp, "allocation tracking is off: rebuild with -DALLOC_STATS\n");
+}
+
+#endif // ALLOC_STATS
+
+#endif // ALLOC_STATS_H
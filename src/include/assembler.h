@@ -0,0 +1,55 @@
+#ifndef ASSEMBLER_H
+#define ASSEMBLER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "spu.h"
+
+/**
+ * @brief Метка программы: адрес в словах и имя без ':'.
+ */
+typedef struct {
+    uint64_t    addr;
+    const char *name;           /**< Указатель в names программы, без завершающего нуля. */
+    size_t      len;
+} spu_symbol_t;
+
+/**
+ * @brief Собранная программа: 64-битные слова кода без заголовка и таблица меток.
+ */
+typedef struct {
+    uint64_t     *code;
+    size_t        size;         /**< Число слов. */
+    size_t        capacity;
+    spu_symbol_t *symbols;      /**< В порядке объявления. */
+    size_t        symbol_count;
+    size_t        symbol_capacity;
+    char         *names;
+} spu_program_t;
+
+/**
+ * @brief Собирает текстовый ассемблер бэкенда в байт-код за два прохода.
+ *
+ * Первый проход разбирает команды и заносит метки в хэш-таблицу, второй
+ * проставляет адреса в переходах и CALL. Время линейно по размеру текста.
+ *
+ * @param text текст программы (не обязан заканчиваться нулем).
+ * @param len  длина текста.
+ * @param prog[out] результат; освобождать через destruct_program().
+ * @return 0 при успехе, -1 при ошибке (сообщение в stderr).
+ */
+int assemble(const char *text, size_t len, spu_program_t *prog);
+
+/**
+ * @brief Пишет заголовок, код и таблицу символов программы в бинарный файл.
+ */
+int write_bytecode(const spu_program_t *prog, FILE *out);
+
+/**
+ * @brief Освобождает код и символы программы и обнуляет структуру.
+ */
+void destruct_program(spu_program_t *prog);
+
+#endif // ASSEMBLER_H
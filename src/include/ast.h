@@ -91,10 +91,8 @@ typedef struct NODE_T {
 
 typedef struct {
     NODE_T       node;
-    const char  *text;
+    const char  *text;      ///< смещение в исходнике - text - buf; строка и позиция считаются по требованию (token_location)
     size_t       length;
-    int32_t      line;
-    int32_t      pos;
     const char  *filename;
 } TOKEN_T;
 
@@ -117,6 +115,12 @@ NODE_T *new_node(NODE_TYPE type, NODE_VALUE_T value, NODE_T *left, NODE_T *right
  * @param node корень удаляемого поддерева.
  */
 void destruct_node(NODE_T *node);
+/**
+ * @brief Создает глубокую копию поддерева (parent корня копии = nullptr).
+ * @param node корень копируемого поддерева или nullptr.
+ * @return корень копии; nullptr если node == nullptr или при нехватке памяти.
+ */
+NODE_T *clone_node(const NODE_T *node);
 /**
  * @brief Проверяет наличие обоих потомков.
  * @param node проверяемый узел.
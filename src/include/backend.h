@@ -2,10 +2,57 @@
 #define BACKEND_H
 
 #include "ast.h"
+#include "profile.h"
 
 /**
  * @brief Точка входа генерации: main-тело + функции + HLT.
  */
 int reverse_program(NODE_T *root, varlist::VarList *vars, FILE *out);
 
+/**
+ * @brief Задает профиль прошлого запуска (nullptr - без профиля).
+ *
+ * По профилю горячая ветка ЕСЛИ ставится сразу за условием, функции выводятся
+ * от самых часто вызываемых, а маленькие горячие нерекурсивные функции
+ * подставляются в место вызова.
+ */
+void backend_set_profile(const profile_t *profile);
+
+/** Наибольшее число потоков генерации. */
+const size_t BACKEND_MAX_THREADS = 64;
+
+/**
+ * @brief Задает число потоков генерации ФОРМУЛ SPU (0 и 1 - без потоков).
+ *
+ * Каждая ФОРМУЛА генерируется в свой буфер со своей нумерацией меток,
+ * буферы склеиваются в порядке объявления: вывод не зависит от числа потоков.
+ */
+void backend_set_threads(size_t threads);
+
+/**
+ * @brief Задает каталог кэша кода функций (nullptr - без кэша), создает его при необходимости.
+ *
+ * Код ФОРМУЛЫ хранится в <dir>/<хэш>.asm, где хэш считается по имени, параметрам,
+ * телу и сигнатурам вызываемых функций; неизмененные функции берутся из кэша.
+ * @return 0 при успехе, -1 если каталог не создать.
+ */
+int backend_set_cache(const char *dir);
+
+/**
+ * @brief Генерирует перемещаемый объектный файл ELF x86-64 с функцией main.
+ *
+ * Код строится прямо по AST: промежуточные значения в XMM, переменные в кадре.
+ * IN/OUT/SET_PIXEL/DRAW вызывают physlab_rt (src/runtime), математика - libm.
+ * @return 0 при успехе, -1 при ошибке (сообщение в stderr).
+ */
+int emit_elf_object(NODE_T *root, varlist::VarList *vars, FILE *out);
+
+/**
+ * @brief Генерирует самостоятельный исходник C99: ФОРМУЛЫ - static double функции, переменные - локальные.
+ *
+ * Рантайм (ИЗМЕРИТЬ/ВЫВЕСТИ/DRAW) пишется в тот же файл, LN/POW/тригонометрия - из libm.
+ * @return 0 при успехе, -1 при ошибке (сообщение в stderr).
+ */
+int emit_c_source(NODE_T *root, varlist::VarList *vars, FILE *out);
+
 #endif // BACKEND_H
\ No newline at end of file
@@ -33,7 +33,36 @@ static inline int randint(int min, int max) {
 
 #define ARRAY_COUNT(a) (sizeof(a) / (sizeof(a[0])))
 
-#ifdef _STDLIB_H
+#include "alloc_stats.h"
+
+#if defined(_STDLIB_H) && defined(ALLOC_STATS)
+
+    #define ALLOC_SITE __FILE__, __LINE__, __func__
+
+    #define TYPED_CALLOC(NMEMB, TYPE) \
+        (TYPE *) alloc_stats_calloc((NMEMB), sizeof(TYPE), ALLOC_SITE);
+
+    #define TYPED_MALLOC(TYPE) \
+        (TYPE *) alloc_stats_calloc(1, sizeof(TYPE), ALLOC_SITE);
+
+    #define TYPED_REALLOC(PTR, NMEM, TYPE) \
+        (TYPE *) alloc_stats_realloc((PTR), NMEM * sizeof(TYPE), ALLOC_SITE);
+
+    #define STRDUP(TEXT) \
+        alloc_stats_strdup((TEXT), ALLOC_SITE)
+
+    #define STRNDUP(TEXT, LEN) \
+        alloc_stats_strndup((TEXT), (LEN), ALLOC_SITE)
+
+    /* free() тоже перехватывается, иначе живой объем не уменьшается; чужие указатели просто освобождаются */
+    #define free(PTR) \
+        alloc_stats_free(PTR)
+
+    #define FREE(ptr)     \
+        free((ptr));      \
+        (ptr) = nullptr;
+
+#elif defined(_STDLIB_H)
 
     #define TYPED_CALLOC(NMEMB, TYPE) \
         (TYPE *) calloc((NMEMB), sizeof(TYPE));
@@ -44,6 +73,12 @@ static inline int randint(int min, int max) {
     #define TYPED_REALLOC(PTR, NMEM, TYPE) \
         (TYPE *) realloc((PTR), NMEM * sizeof(TYPE));
 
+    #define STRDUP(TEXT) \
+        strdup((TEXT))
+
+    #define STRNDUP(TEXT, LEN) \
+        strndup((TEXT), (LEN))
+
     #define FREE(ptr)     \
         free((ptr));      \
         (ptr) = nullptr;
@@ -0,0 +1,96 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ast.h"
+
+/** Строк за один проход по ленте команд: все временные столбцы помещаются в L1/L2. */
+const size_t BATCH_BLOCK = 256;
+
+namespace BATCH_ISA {
+    enum BATCH_ISA {
+        SCALAR,
+        SSE2,
+        AVX2,
+    };
+}
+
+/**
+ * Команды ядра. Каждая обрабатывает целый столбец из BATCH_BLOCK строк.
+ * Сравнения и логика работают с масками (все биты 1 - истина, 0 - ложь),
+ * TO_NUM переводит маску в 1.0/0.0, TO_MASK - число в маску (x != 0).
+ */
+namespace BATCH_OP {
+    enum BATCH_OP {
+        ADD, SUB, MUL, DIV, SQRT,
+        MOD, POW, LN,
+        SIN, COS, TAN, CTG,
+        ASIN, ACOS, ATAN, ACTG,
+        EQ, NEQ, BELOW, ABOVE, BELOW_EQ, ABOVE_EQ,
+        AND, OR, NOT,
+        BLEND,                  /**< dst = c ? a : b, c - маска. */
+        TO_NUM, TO_MASK,
+
+        COUNT,
+    };
+}
+
+typedef struct {
+    uint8_t  op;
+    uint32_t dst, a, b, c;      /**< Номера слотов-столбцов. */
+} batch_insn_t;
+
+/**
+ * @brief Скомпилированная формула.
+ *
+ * Слоты 0 .. param_count-1 - входные столбцы, далее const_count констант,
+ * далее временные столбцы; result - слот с ответом.
+ */
+typedef struct {
+    batch_insn_t        *code;
+    size_t               size;
+    size_t               capacity;
+    double              *consts;
+    size_t               const_count;
+    size_t               param_count;
+    size_t               slot_count;
+    uint32_t             result;
+    BATCH_ISA::BATCH_ISA isa;   /**< По умолчанию лучший набор, доступный процессору. */
+} batch_kernel_t;
+
+/**
+ * @brief Компилирует ФОРМУЛУ в ядро для пакетного вычисления.
+ *
+ * Тело должно быть линейным: ВЕЛИЧИНА, присваивания, ЕСЛИ/ИНАЧЕ и ВОЗВРАТИТЬ.
+ * Обе ветви ЕСЛИ вычисляются для всех строк, а результат выбирается по маске
+ * условия. Строки, для которых формула ничего не вернула, получают 0.
+ *
+ * @param func   узел функции (LITERAL_T: left - параметры, right - тело).
+ * @param kernel[out] результат; освобождать через destruct_batch_kernel().
+ * @return 0 при успехе, -1 если тело не подходит (сообщение в stderr).
+ */
+int compile_formula_batch(const NODE_T *func, batch_kernel_t *kernel);
+
+/**
+ * @brief Вычисляет формулу для n строк.
+ *
+ * @param kernel скомпилированная формула.
+ * @param inputs param_count столбцов по n значений, в порядке параметров.
+ * @param n      число строк.
+ * @param out    n результатов.
+ * @return 0 при успехе, -1 при ошибке.
+ */
+int eval_formula_batch(const batch_kernel_t *kernel, const double *const *inputs, size_t n, double *out);
+
+/**
+ * @brief Лучший набор инструкций, который поддерживает процессор.
+ */
+BATCH_ISA::BATCH_ISA batch_best_isa();
+
+const char *batch_isa_name(BATCH_ISA::BATCH_ISA isa);
+
+void destruct_batch_kernel(batch_kernel_t *kernel);
+
+#endif // BATCH_H
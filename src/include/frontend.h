@@ -4,6 +4,7 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 
 #include "ast.h"
 #include "var_list.h"
@@ -16,16 +17,40 @@ typedef struct {
     TOKEN_T          *tokens;
     size_t            token_count;
     size_t            token_capacity;
+    size_t            lexed_count;      ///< токены из исходника; дальше идут синтетические узлы парсера
+    TOKEN_T         **node_pools;       ///< пулы узлов потоков парсера, живут до lexer_reset
+    size_t            node_pool_count;
+    size_t           *line_starts;      ///< смещения начал строк, строится token_location по требованию
+    size_t            line_count;
     varlist::VarList *vars;
+    size_t            threads;          ///< потоков для лексера и парсера; 0 и 1 - без потоков, lexer_reset не сбрасывает
+    FILE             *errors;           ///< куда лексер и парсер пишут ошибки; nullptr - stderr, lexer_reset не сбрасывает
     bool              owns_vars,
                       owns_name,
                       owns_buf;
 } FRONT_COMPL_T;
 
+/** Больше стольких потоков фронтенд не запускает. */
+const size_t FRONT_MAX_THREADS = 64;
+
 int lexer_load_file(FRONT_COMPL_T *ctx, const char *filename);
 int lexer_from_buffer(FRONT_COMPL_T *ctx, const char *name, const char *text, size_t bytes);
 void lexer_reset(FRONT_COMPL_T *ctx);
-void dump_lexer_tokens(const FRONT_COMPL_T *ctx, const char *title);
+void lexer_recycle(FRONT_COMPL_T *ctx);
+void dump_lexer_tokens(FRONT_COMPL_T *ctx, const char *title);
+
+/**
+ * @brief Находит строку и позицию токена (с 1) по его смещению в буфере.
+ *
+ * Токены хранят только смещение; при первом вызове строится индекс начал строк,
+ * дальше строка ищется двоичным поиском, а позиция - подсчетом символов UTF-8 от начала строки.
+ * @param ctx[in,out]   контекст компилятора, в нем кэшируется индекс.
+ * @param idx[in]       номер токена.
+ * @param line[out]     номер строки.
+ * @param pos[out]      позиция в строке.
+ * @return 0 при успехе, -1 если у токена нет места в исходнике (синтетический узел) или нет памяти.
+ */
+int token_location(FRONT_COMPL_T *ctx, size_t idx, int32_t *line, int32_t *pos);
 
 /**
  * @brief Выполняет синтаксический разбор массива токенов и строит AST.
@@ -49,13 +74,11 @@ int ensure_token_cap(FRONT_COMPL_T *ctx, size_t need);
  * @param value[in]     значение узла.
  * @param text[in]      указатель на исходную подстроку.
  * @param len[in]       длина подстроки.
- * @param line[in]      номер строки.
- * @param pos[in]       позиция в строке.
  * @return 0 при успехе, -1 при ошибке.
  */
 int add_token(FRONT_COMPL_T *ctx,
     NODE_TYPE type, NODE_VALUE_T value,
-    const char *text, size_t len, int32_t line, int32_t pos
+    const char *text, size_t len
 );
 
 /**
@@ -66,6 +89,12 @@ int add_token(FRONT_COMPL_T *ctx,
  */
 int save_ast_to_file(const FRONT_COMPL_T *ctx, const char *path);
 
+/**
+ * @brief Пишет текущее AST в поток в том же формате, что save_ast_to_file.
+ * @return 0 при успехе, -1 при ошибке.
+ */
+int write_ast(const FRONT_COMPL_T *ctx, FILE *fp);
+
 /**
  * @brief Строит dot+svg дамп AST (подробный стиль).
  */
@@ -0,0 +1,78 @@
+#ifndef MIDDLEEND_H
+#define MIDDLEEND_H
+
+#include "ast.h"
+#include "var_list.h"
+
+/**
+ * @brief Удаляет мертвый код в загруженном AST (функции и основное тело).
+ *
+ * Убирает операторы после RETURN, ветви ЕСЛИ/циклы с константным условием,
+ * присваивания переменным, которые не читаются до следующей записи (по живости),
+ * и объявления ВЕЛИЧИНА, на которые больше нет ссылок. Освобождает регистры,
+ * которые иначе занял бы add_binding в бэкенде.
+ *
+ * @param root корень AST из load_ast_from_file().
+ * @param vars таблица имен того же AST.
+ * @return 0 при успехе, -1 при ошибке.
+ */
+int eliminate_dead_code(NODE_T *root, const varlist::VarList *vars);
+
+/**
+ * @brief Оптимизирует счетные циклы ПОКА i < n ... i = i + c СТОП.
+ *
+ * Заменяет i * K в теле на переменную, растущую на K * c (снижение стоимости
+ * операций), если у функции остается свободный регистр, и разворачивает цикл
+ * в unroll_factor копий тела с исходным циклом для остатка итераций.
+ *
+ * @param root          корень AST из load_ast_from_file().
+ * @param vars          таблица имен; сюда добавляются новые переменные.
+ * @param unroll_factor число копий тела; 0 или 1 отключают развертку.
+ * @return 0 при успехе, -1 при ошибке.
+ */
+int optimize_loops(NODE_T *root, varlist::VarList *vars, size_t unroll_factor);
+
+/** Сколько счетчиков цикла по строкам поддерживает анализ. */
+const size_t ROW_LOOP_MAX_IVS = 4;
+
+/**
+ * @brief Цикл ХОДА РАБОТЫ, итерации которого независимы: каждая - строка измерений.
+ *
+ * Между итерациями переходят только счетчики: величина k-го счетчика в итерации r
+ * равна значению до цикла плюс r * step[k].
+ */
+typedef struct {
+    size_t  iv[ROW_LOOP_MAX_IVS];
+    double  step[ROW_LOOP_MAX_IVS];
+    size_t  iv_count;
+    size_t  inputs;             /**< ИЗМЕРИТЬ за итерацию (одинаково на любом пути). */
+    bool   *live_in;            /**< По величинам: читается в итерации до записи в ней. */
+    /* условие: iv[cond_iv] + cond_offset cond_op bound */
+    size_t              cond_iv;
+    double              cond_offset;
+    OPERATOR::OPERATOR  cond_op;    /**< BELOW, BELOW_EQ, ABOVE или ABOVE_EQ по знаку шага. */
+    const NODE_T       *bound;      /**< Число или величина, которая в теле не пишется. */
+} row_loop_t;
+
+/**
+ * @brief Доказывает, что итерации цикла ПОКА можно исполнять независимо и параллельно.
+ *
+ * Требуется: условие и тело читают до записи только счетчики и величины, которые
+ * в теле не пишутся; счетчики меняются только приращениями на целое число на верхнем
+ * уровне тела; условие - сравнение счетчика (возможно, плюс целое число) с неизменной
+ * границей, к которой счетчик движется, так что число итераций известно заранее; ИЗМЕРИТЬ не стоит во вложенных циклах, и на обоих путях ЕСЛИ их поровну;
+ * нет ВОЗВРАТИТЬ, записи в видеопамять и вызовов функций, которые вводят, выводят
+ * или рисуют (в том числе через другие функции). ВЫВЕСТИ разрешен.
+ *
+ * @param funcs  список функций программы.
+ * @param loop   узел WHILE.
+ * @param nvars  размер таблицы имен.
+ * @param info[out] описание цикла; освобождать через destruct_row_loop().
+ * @param reason[out] при false - почему итерации зависимы; может быть nullptr.
+ * @return true, если итерации независимы.
+ */
+bool analyze_row_loop(const NODE_T *funcs, const NODE_T *loop, size_t nvars, row_loop_t *info, const char **reason);
+
+void destruct_row_loop(row_loop_t *info);
+
+#endif // MIDDLEEND_H
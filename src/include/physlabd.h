@@ -0,0 +1,87 @@
+#ifndef PHYSLABD_H
+#define PHYSLABD_H
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * Протокол physlabd поверх потокового Unix-сокета; в одном соединении сколько угодно запросов.
+ *
+ * Запрос:  "<вид> <unroll> <байт>\n" и исходник .physlab, вид - ast, asm, c или elf.
+ * Ответ:   "OK <байт>\n" и результат (текст .ast/.asm/.c или объектный файл),
+ *          либо "ERR <байт>\n" и сообщение.
+ */
+
+/** Сокет, если не задан --socket. */
+#define PHYSLABD_SOCKET "/tmp/physlabd.sock"
+
+/** Длина строки заголовка вместе с '\n'. */
+const size_t PHYSLABD_HEADER_CAP = 64;
+/** Больше этого исходник или ответ не принимается. */
+const size_t PHYSLABD_MAX_BODY = (size_t) 64 << 20;
+
+/**
+ * @brief Читает ровно size байт.
+ * @return 0 при успехе, 1 при конце потока до первого байта, -1 при ошибке или обрыве.
+ */
+static inline int physlabd_read_full(int fd, void *buf, size_t size) {
+    char *p = (char *) buf;
+    size_t done = 0;
+    while (done < size) {
+        ssize_t got = read(fd, p + done, size - done);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) return (got == 0 && done == 0) ? 1 : -1;
+        done += (size_t) got;
+    }
+    return 0;
+}
+
+/**
+ * @brief Пишет ровно size байт.
+ * @return 0 при успехе, -1 при ошибке.
+ */
+static inline int physlabd_write_full(int fd, const void *buf, size_t size) {
+    const char *p = (const char *) buf;
+    while (size) {
+        ssize_t put = write(fd, p, size);
+        if (put < 0 && errno == EINTR) continue;
+        if (put <= 0) return -1;
+        p += put;
+        size -= (size_t) put;
+    }
+    return 0;
+}
+
+/**
+ * @brief Читает строку заголовка до '\n' (сам '\n' заменяется нулем).
+ * @return 0 при успехе, 1 при конце потока между запросами, -1 при ошибке.
+ */
+static inline int physlabd_read_header(int fd, char *line) {
+    for (size_t len = 0; len + 1 < PHYSLABD_HEADER_CAP; ++len) {
+        int rc = physlabd_read_full(fd, line + len, 1);
+        if (rc) return (rc == 1 && len == 0) ? 1 : -1;
+        if (line[len] == '\n') {
+            line[len] = '\0';
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Отправляет заголовок "<head> <size>\n" и тело.
+ * @return 0 при успехе, -1 при ошибке.
+ */
+static inline int physlabd_send(int fd, const char *head, const void *body, size_t size) {
+    char line[PHYSLABD_HEADER_CAP] = "";
+    int len = snprintf(line, sizeof(line), "%s %zu\n", head, size);
+    if (len <= 0 || (size_t) len >= sizeof(line)) return -1;
+    if (physlabd_write_full(fd, line, (size_t) len)) return -1;
+    return size ? physlabd_write_full(fd, body, size) : 0;
+}
+
+#endif // PHYSLABD_H
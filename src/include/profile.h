@@ -0,0 +1,54 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Текстовый профиль исполнения, его пишет `spu --profile`:
+ *
+ *     # physlab profile 1
+ *     label <метка> <сколько раз управление пришло на метку>
+ *     branch <метка-цель> <сколько раз переход сработал> <сколько раз исполнен>
+ *
+ * Имена меток - те, что генерирует бэкенд (if_N_then, while_N_body, имя функции),
+ * без ':'. Нумерация меток детерминирована, поэтому профиль прошлой сборки
+ * подходит к следующей сборке того же исходника.
+ */
+
+typedef struct {
+    const char *name;           /**< Указатель в text профиля. */
+    size_t      len;
+    uint64_t    hash;
+    uint64_t    count;
+    uint64_t    taken;
+    uint64_t    executed;
+} profile_entry_t;
+
+typedef struct {
+    profile_entry_t *data;      /**< Открытая адресация, емкость - степень двойки. */
+    size_t           capacity;
+    size_t           size;
+    char            *text;
+} profile_t;
+
+/**
+ * @brief Читает профиль из файла.
+ * @return 0 при успехе, -1 при ошибке (сообщение в stderr).
+ */
+int load_profile(const char *path, profile_t *profile);
+
+/**
+ * @brief Ищет метку (допускается ведущее ':').
+ * @return запись или nullptr, если метки нет в профиле.
+ */
+const profile_entry_t *profile_find(const profile_t *profile, const char *label);
+
+/**
+ * @brief Сколько раз исполнялась метка; 0, если профиля или метки нет.
+ */
+uint64_t profile_label_count(const profile_t *profile, const char *label);
+
+void destruct_profile(profile_t *profile);
+
+#endif // PROFILE_H
@@ -0,0 +1,55 @@
+#ifndef SPU_H
+#define SPU_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** PROC_SIGNATURE: "PHYS_SPU" в little-endian. */
+const uint64_t SPU_SIGNATURE = 0x5550535F53594850ULL;
+/** BYTECODE_COMMANDS_VERSION: меняется при любом изменении кодировки команд. */
+const uint64_t SPU_VERSION = 1;
+/** Число регистров процессора (RAX ... CURVA). */
+const size_t SPU_REGISTERS = 8;
+
+/**
+ * @brief Заголовок файла байт-кода; за ним идут byte_count байт кода.
+ */
+typedef struct {
+    uint64_t signature;         /**< PROC_SIGNATURE. */
+    uint64_t version;           /**< BYTECODE_COMMANDS_VERSION. */
+    uint64_t byte_count;        /**< COUNT_OF_BYTES_IN_BYTECODE, кратно 8. */
+    uint64_t assembly_date;     /**< ASSEMBLY_DATE, unix-время сборки. */
+} spu_header_t;
+
+/**
+ * За кодом может идти таблица символов для профилирования и отладки:
+ * слово с числом меток, затем для каждой метки слово адреса, слово длины
+ * имени и само имя (без ':'), дополненное нулями до кратного 8 размера.
+ * Исполнению она не нужна; byte_count ее не учитывает.
+ */
+
+/**
+ * Команда - 64-битное слово: биты 0..7 код операции, 8..15 номер регистра.
+ * PUSH и DRAW несут следом слово с double, переходы и CALL - слово с адресом
+ * (индекс слова в коде).
+ */
+namespace SPU_OP {
+    enum SPU_OP {
+        HLT,
+        PUSH, PUSHR, POPR, PUSHM, POPM,
+        ADD, SUB, MUL, DIV, MOD,
+        SQRT, SIN, COS,
+        IN, OUT,
+        JMP, JE, JNE, JB, JA, JBE, JAE,
+        CALL, RET,
+        DRAW,
+
+        COUNT,
+    };
+}
+
+#define SPU_WORD_OP(word)          ((unsigned) ((word) & 0xFF))
+#define SPU_WORD_REG(word)         ((unsigned) (((word) >> 8) & 0xFF))
+#define SPU_MAKE_WORD(op, reg)     ((uint64_t) (op) | ((uint64_t) (reg) << 8))
+
+#endif // SPU_H
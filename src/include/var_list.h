@@ -49,6 +49,19 @@ void destruct(VarList *list);
  */
 size_t add(VarList *list, const mystr::mystr_t *name);
 
+/**
+ * @brief Добавляет имя, заданное куском текста без завершающего нуля (например, токеном в исходнике).
+ *
+ * Короткие куски для хэша копируются на стек, так что уже известное имя не выделяет памяти;
+ * в куче оказывается только копия самого списка при первом добавлении.
+ *
+ * @param list Указатель на список VarList. Не может быть NULL.
+ * @param text Начало имени.
+ * @param len  Длина в байтах.
+ * @return Индекс имени в списке или NPOS при ошибке.
+ */
+size_t add_span(VarList *list, const char *text, size_t len);
+
 /**
  * @brief Проверяет наличие имени в списке.
  *
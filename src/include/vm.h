@@ -0,0 +1,136 @@
+#ifndef VM_H
+#define VM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "spu.h"
+#include "vm_io.h"
+
+/** Ячеек оперативной памяти (PUSHM/POPM, SET_PIXEL). */
+const size_t VM_RAM_SIZE = 1 << 16;
+/** Глубина стека данных и стека вызовов. */
+const size_t VM_STACK_SIZE = 1 << 16;
+/* Видеопамять - первые VM_FRAME_CELLS ячеек RAM (vm_frames.h). */
+
+/**
+ * Внутренние команды после декодирования. Первые SPU_OP::COUNT совпадают
+ * с SPU_OP, далее суперинструкции, которые собирает vm_decode().
+ */
+namespace VM_OP {
+    enum VM_OP {
+        ADDRRR = SPU_OP::COUNT,    /**< PUSHR a; PUSHR b; ADD; POPR c  ->  c = a + b */
+        SUBRRR, MULRRR, DIVRRR,
+        ADDRIR,                    /**< PUSHR a; PUSH k;  ADD; POPR c  ->  c = a + k */
+        SUBRIR, MULRIR, DIVRIR,
+        INCR,                      /**< PUSHR a; PUSH k;  ADD; POPR a  ->  a += k */
+        MOVRI,                     /**< PUSH k;  POPR c                ->  c = k */
+        MOVRR,                     /**< PUSHR a; POPR c                ->  c = a */
+        CMPJRR,                    /**< PUSHR a; PUSHR b; Jcc L        ->  if (a cc b) goto L */
+        CMPJRI,                    /**< PUSHR a; PUSH k;  Jcc L        ->  if (a cc k) goto L */
+        ROWSTOP,                   /**< Остановка vm_run_parallel() на метке rows_*; исходная команда отложена. */
+
+        COUNT,
+    };
+}
+
+/**
+ * @brief Декодированная команда: одна диспетчеризация в vm_run().
+ */
+typedef struct {
+    uint8_t  op;
+    uint8_t  a, b, c;           /**< Регистры операндов и результата. */
+    uint8_t  cc;                /**< Для CMPJ*: исходный SPU_OP::J*. */
+    uint8_t  width;             /**< Сколько команд SPU заменяет. */
+    double   imm;
+    size_t   target;            /**< Индекс команды перехода/вызова. */
+} vm_insn_t;
+
+/**
+ * @brief Метка из таблицы символов байт-кода.
+ */
+typedef struct {
+    size_t      addr;           /**< В файле - индекс слова, после vm_decode() - индекс команды. */
+    const char *name;           /**< Строка с завершающим нулем, без ':'. */
+} vm_symbol_t;
+
+/**
+ * @brief Содержимое файла байт-кода.
+ */
+typedef struct {
+    uint64_t    *words;
+    size_t       count;
+    vm_symbol_t *symbols;
+    size_t       symbol_count;
+    char        *names;
+} vm_image_t;
+
+typedef struct {
+    vm_insn_t   *code;
+    size_t       size;
+    size_t       fused;         /**< Сколько исходных команд поглощено суперинструкциями. */
+    vm_symbol_t *labels;        /**< Метки с адресами команд; имена принадлежат образу. */
+    size_t       label_count;
+} vm_program_t;
+
+typedef struct {
+    uint64_t  dispatches;
+    uint64_t  executed;         /**< Исходных команд SPU (суперинструкция считается за все свои). */
+    uint64_t *hits;             /**< Если не nullptr: prog->size счетчиков исполнения команд. */
+    uint64_t *taken;            /**< Если не nullptr: prog->size счетчиков сработавших переходов. */
+} vm_stats_t;
+
+/**
+ * @brief Читает файл байт-кода, проверяет заголовок и читает таблицу символов, если она есть.
+ *
+ * @param image[out] освобождать через vm_free_image().
+ * @return 0 при успехе, -1 при ошибке.
+ */
+int vm_load_file(const char *path, vm_image_t *image);
+
+void vm_free_image(vm_image_t *image);
+
+/**
+ * @brief Декодирует байт-код во внутренние команды.
+ *
+ * При fuse == true частые шаблоны бэкенда сливаются в суперинструкции, если
+ * внутрь шаблона не ведет ни один переход. Метки из symbols (может быть nullptr)
+ * тоже не попадают внутрь шаблонов, чтобы у каждой был свой счетчик профиля.
+ */
+int vm_decode(const uint64_t *words, size_t count, const vm_symbol_t *symbols, size_t symbol_count,
+              bool fuse, vm_program_t *prog);
+
+/**
+ * @brief Исполняет программу до HLT; IN и OUT идут через io, DRAW рисует в io->screen
+ *        или отдает кадр в io->frames.
+ *
+ * @param io    ввод-вывод (vm_io.h); nullptr - IN завершается ошибкой, OUT отбрасывается.
+ * @param stats[in,out] счетчики, может быть nullptr.
+ * @return 0 при успехе, -1 при ошибке исполнения.
+ */
+int vm_run(const vm_program_t *prog, vm_io_t *io, vm_stats_t *stats);
+
+/**
+ * @brief Как vm_run(), но циклы с метками rows_* исполняются в threads потоков.
+ *
+ * Метки rows_<id>_in<K>_r<reg><шаг>..._<lt|le|gt|ge><k><+c>_<граница> и rows_<id>_end
+ * ставит бэкенд на циклы ХОДА РАБОТЫ, итерации которых независимы (analyze_row_loop):
+ * каждая читает K входных значений, между итерациями переходят только счетчики
+ * в регистрах reg, а условие сравнивает k-й счетчик плюс c с неизменной границей,
+ * так что потоки не исполняют итераций после выхода.
+ * Первые итерации цикла идут последовательно; дальше входные строки делятся между
+ * потоками, вывод собирается в исходном порядке, и результат совпадает с vm_run().
+ * Метки должны быть в prog (см. vm_decode()); со счетчиками профиля в stats
+ * исполнение последовательное.
+ */
+int vm_run_parallel(const vm_program_t *prog, vm_io_t *io, vm_stats_t *stats, size_t threads);
+
+/**
+ * @brief Пишет профиль в формате profile.h: счетчики меток и переходов по именам меток.
+ */
+int vm_write_profile(const vm_program_t *prog, const vm_stats_t *stats, FILE *out);
+
+void vm_destruct(vm_program_t *prog);
+
+#endif // VM_H
@@ -0,0 +1,81 @@
+#ifndef VM_FRAMES_H
+#define VM_FRAMES_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** Видеопамять - первые VM_FRAME_CELLS ячеек RAM, построчно. */
+const size_t VM_FRAME_W = 32;
+const size_t VM_FRAME_H = 32;
+const size_t VM_FRAME_CELLS = VM_FRAME_W * VM_FRAME_H;
+/** Ячейка видеопамяти становится квадратом VM_FRAMES_SCALE x VM_FRAMES_SCALE пикселей PPM. */
+const size_t VM_FRAMES_SCALE = 4;
+/** На сколько кадров DRAW может опередить кодировщик, прежде чем ждать его. */
+const size_t VM_FRAMES_QUEUE = 8;
+
+/**
+ * @brief Изменившиеся ячейки видеопамяти: x в [x0, x1), y в [y0, y1); пуст при x0 >= x1.
+ */
+typedef struct {
+    size_t x0, y0, x1, y1;
+} vm_rect_t;
+
+/**
+ * @brief Приемник кадров DRAW: поток PPM (P6) в файл или только счетчики (headless).
+ *
+ * Кадр хранится как яркости ячеек 0..255 (значение ячейки, обрезанное до диапазона).
+ * DRAW обновляет в нем только dirty-прямоугольник и ставит копию в очередь; PPM
+ * собирает и пишет отдельный поток, так что DRAW не ждет ни диска, ни задержки.
+ */
+typedef struct {
+    int             fd;                     /**< -1 - кадры только считаются. */
+    uint8_t         cells[VM_FRAME_CELLS];  /**< Последний кадр. */
+    uint8_t        *queue;                  /**< VM_FRAMES_QUEUE снимков cells. */
+    size_t          head, count;
+    uint8_t        *image;                  /**< PPM одного кадра (заголовок и пиксели). */
+    size_t          image_size;
+    bool            threaded;               /**< Поток кодировщика запущен, иначе commit пишет сам. */
+    bool            stop;
+    bool            failed;
+    pthread_t       thread;
+    pthread_mutex_t lock;
+    pthread_cond_t  ready, space;
+    uint64_t        frames;
+    uint64_t        dirty_cells;            /**< Сумма площадей dirty-прямоугольников. */
+} vm_frames_t;
+
+/**
+ * @brief Открывает приемник; path == nullptr - headless: кадры только считаются.
+ * @return 0 при успехе, -1 при ошибке (сообщение в stderr).
+ */
+int vm_frames_open(vm_frames_t *fr, const char *path);
+
+/**
+ * @brief Расширяет dirty до ячейки addr видеопамяти.
+ */
+static inline void vm_rect_add(vm_rect_t *dirty, size_t addr) {
+    size_t x = addr % VM_FRAME_W, y = addr / VM_FRAME_W;
+    if (dirty->x0 >= dirty->x1) {
+        *dirty = {x, y, x + 1, y + 1};
+        return;
+    }
+    if (x < dirty->x0) dirty->x0 = x;
+    if (x >= dirty->x1) dirty->x1 = x + 1;
+    if (y < dirty->y0) dirty->y0 = y;
+    if (y >= dirty->y1) dirty->y1 = y + 1;
+}
+
+/**
+ * @brief Фиксирует кадр: переносит из ram ячейки dirty и отдает кадр кодировщику.
+ * @return 0 при успехе, -1 если запись кадров не удалась.
+ */
+int vm_frames_commit(vm_frames_t *fr, const double *ram, const vm_rect_t *dirty);
+
+/**
+ * @brief Дожидается записи всех кадров и закрывает файл.
+ * @return 0, если все кадры записаны, иначе -1.
+ */
+int vm_frames_close(vm_frames_t *fr);
+
+#endif // VM_FRAMES_H
@@ -0,0 +1,115 @@
+#ifndef VM_IO_H
+#define VM_IO_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "vm_frames.h"
+
+/** Размер буфера вывода: OUT копирует в него текст, write(2) идет только при заполнении. */
+const size_t VM_IO_BUFFER = 1 << 20;
+
+/**
+ * @brief Ввод-вывод VM: источник для IN (ИЗМЕРИТЬ), приемник для OUT (ВЫВЕСТИ, ПОКАЗАТЬ).
+ *
+ * Вход - поток (консоль) или файл, отображенный в память: CSV/текст с числами через
+ * запятые, точки с запятой и пробельные символы (первая строка может быть заголовком),
+ * либо *.bin - подряд идущие double. Значения читаются построчно слева направо,
+ * так что каждый ИЗМЕРИТЬ берет следующий столбец текущей строки.
+ *
+ * Выход - поток или файл: текст по числу в строке, либо *.bin - подряд идущие double.
+ */
+typedef struct {
+    FILE       *in;             /**< Поток ввода, если файл не открыт. */
+    bool        interactive;    /**< in - терминал: перед чтением выводится накопленное. */
+    const char *data;           /**< Входные данные: отображенный файл, owned или чужой массив. */
+    size_t      size;
+    size_t      pos;
+    bool        mapped;
+    char       *owned;          /**< Дочитанный в память поток (vm_io_buffer_input). */
+    bool        in_binary;
+    bool        header_checked;
+
+    FILE       *out;            /**< Поток вывода, если файл не открыт. */
+    int         out_fd;         /**< -1, если вывод в поток. */
+    bool        out_binary;
+    bool        out_memory;     /**< Вывод копится в buf целиком (vm_io_init_memory). */
+    char       *buf;
+    size_t      buf_size;
+    size_t      buf_cap;
+    bool        write_failed;
+
+    FILE       *screen;         /**< Куда DRAW выводит кадры (nullptr - никуда). */
+    vm_frames_t *frames;        /**< Если задан, DRAW не рисует в screen и не ждет, а отдает кадр сюда. */
+} vm_io_t;
+
+/**
+ * @brief Ввод и вывод через потоки (любой может быть nullptr); DRAW пишет в out.
+ */
+void vm_io_init(vm_io_t *io, FILE *in, FILE *out);
+
+/**
+ * @brief Отображает входной файл в память; *.bin читается как массив double, прочее - как CSV.
+ * @return 0 при успехе, -1 при ошибке (сообщение в stderr).
+ */
+int vm_io_open_input(vm_io_t *io, const char *path);
+
+/**
+ * @brief Направляет OUT в файл; *.bin - двоичные double, прочее - текст.
+ * @return 0 при успехе, -1 при ошибке (сообщение в stderr).
+ */
+int vm_io_open_output(vm_io_t *io, const char *path);
+
+/**
+ * @brief Следующее входное значение.
+ * @return 0 при успехе, -1 если данные кончились или значение не число.
+ */
+int vm_io_read(vm_io_t *io, double *value);
+
+/**
+ * @brief Читает до count значений подряд, не печатая ошибок.
+ * @return сколько прочитано; чтение останавливается в конце данных или перед нечисловым значением.
+ */
+size_t vm_io_read_ahead(vm_io_t *io, double *values, size_t count);
+
+/**
+ * @brief Позиция во входных данных, отображенных или дочитанных в память.
+ */
+size_t vm_io_tell(const vm_io_t *io);
+
+void vm_io_seek(vm_io_t *io, size_t pos);
+
+/**
+ * @brief Дочитывает поток ввода в память, чтобы по нему можно было читать вперед и возвращаться.
+ * @return 0 при успехе (и если вход уже в памяти), -1 для терминала или при ошибке.
+ */
+int vm_io_buffer_input(vm_io_t *io);
+
+/**
+ * @brief Ввод из массива double, вывод в растущий буфер buf - для потоков spu --parallel.
+ * @param out_binary формат вывода, как у основного приемника.
+ */
+void vm_io_init_memory(vm_io_t *io, const double *values, size_t count, bool out_binary);
+
+/**
+ * @return 0 при успехе, -1 при ошибке записи.
+ */
+int vm_io_write(vm_io_t *io, double value);
+
+/**
+ * @brief Дописывает уже отформатированный вывод (buf другого vm_io_t с тем же форматом).
+ */
+int vm_io_append(vm_io_t *io, const char *data, size_t len);
+
+/**
+ * @brief Сбрасывает буфер вывода (перед DRAW и чтением с терминала).
+ */
+int vm_io_flush(vm_io_t *io);
+
+/**
+ * @brief Сбрасывает вывод, закрывает файлы и снимает отображение.
+ * @return 0, если весь вывод записан, иначе -1.
+ */
+int vm_io_close(vm_io_t *io);
+
+#endif // VM_IO_H
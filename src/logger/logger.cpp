@@ -71,6 +71,9 @@ void destruct_logger(void) {
     Logger *logger = get_global_logger();
 
     if (logger->file != nullptr) {
+#ifdef ALLOC_STATS
+        alloc_stats_dump(logger->file);
+#endif
         fprintf(logger->file, "</pre>\n</body>\n</html>\n");
         fclose(logger->file);
         logger->file = nullptr;
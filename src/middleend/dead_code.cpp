@@ -0,0 +1,502 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "ast.h"
+#include "base.h"
+#include "middleend.h"
+
+typedef struct {
+    NODE_T **data;
+    size_t   size;
+    size_t   capacity;
+} stmt_list_t;
+
+typedef struct {
+    size_t  nvars;      /**< Размер таблицы имен: длина битовых множеств живости. */
+    size_t  removed;    /**< Сколько операторов удалено на текущем проходе. */
+    bool    failed;
+} dce_ctx_t;
+
+function bool is_connector(const NODE_T *node);
+function bool is_keyword(const NODE_T *node, KEYWORD::KEYWORD kw);
+function bool is_operator(const NODE_T *node, OPERATOR::OPERATOR op);
+function bool const_value(const NODE_T *node, double *out);
+function void stmt_push(dce_ctx_t *ctx, stmt_list_t *list, NODE_T *node);
+function void collect_stmts(dce_ctx_t *ctx, NODE_T *chain, stmt_list_t *list);
+function void release_connectors(NODE_T *chain);
+function NODE_T *rebuild_chain(dce_ctx_t *ctx, const stmt_list_t *list);
+function void prune_chain_into(dce_ctx_t *ctx, NODE_T *chain, stmt_list_t *out, bool *terminates);
+function void prune_into(dce_ctx_t *ctx, NODE_T *node, stmt_list_t *out, bool *terminates);
+function NODE_T *prune_block(dce_ctx_t *ctx, NODE_T *chain, bool *terminates);
+function bool expr_is_pure(const NODE_T *node);
+function void expr_uses(const dce_ctx_t *ctx, const NODE_T *node, bool *live);
+function void live_stmt(dce_ctx_t *ctx, NODE_T **slot, bool *live, bool remove);
+function void live_block(dce_ctx_t *ctx, NODE_T **chain, bool *live, bool remove);
+function void count_refs(const dce_ctx_t *ctx, const NODE_T *node, size_t *refs);
+function void drop_unused_decls(dce_ctx_t *ctx, NODE_T **chain, const size_t *refs);
+function void process_scope(dce_ctx_t *ctx, NODE_T **body);
+function void process_function_list(dce_ctx_t *ctx, NODE_T *node);
+
+function bool is_connector(const NODE_T *node) {
+    return node && node->type == OPERATOR_T && node->value.opr == OPERATOR::CONNECTOR;
+}
+
+function bool is_keyword(const NODE_T *node, KEYWORD::KEYWORD kw) {
+    return node && node->type == KEYWORD_T && node->value.keyword == kw;
+}
+
+function bool is_operator(const NODE_T *node, OPERATOR::OPERATOR op) {
+    return node && node->type == OPERATOR_T && node->value.opr == op;
+}
+
+/**
+ * @brief Вычисляет выражение из одних чисел (арифметика, сравнения, И/ИЛИ/НЕ).
+ * @return true если выражение константное и значение записано в out.
+ */
+function bool const_value(const NODE_T *node, double *out) {
+    if (!node || !out) return false;
+    if (node->type == NUMBER_T) {
+        *out = node->value.num;
+        return true;
+    }
+    if (node->type != OPERATOR_T) return false;
+    double l = 0.0, r = 0.0;
+    if (node->value.opr == OPERATOR::NOT) {
+        if (!const_value(node->left, &l)) return false;
+        *out = (l == 0.0) ? 1.0 : 0.0;
+        return true;
+    }
+    if (!const_value(node->left, &l) || !const_value(node->right, &r)) return false;
+    switch (node->value.opr) {
+        case OPERATOR::ADD:      *out = l + r;                           return true;
+        case OPERATOR::SUB:      *out = l - r;                           return true;
+        case OPERATOR::MUL:      *out = l * r;                           return true;
+        case OPERATOR::EQ:       *out = (l == r);                        return true;
+        case OPERATOR::NEQ:      *out = (l != r);                        return true;
+        case OPERATOR::BELOW:    *out = (l <  r);                        return true;
+        case OPERATOR::ABOVE:    *out = (l >  r);                        return true;
+        case OPERATOR::BELOW_EQ: *out = (l <= r);                        return true;
+        case OPERATOR::ABOVE_EQ: *out = (l >= r);                        return true;
+        case OPERATOR::AND:      *out = (l != 0.0 && r != 0.0);          return true;
+        case OPERATOR::OR:       *out = (l != 0.0 || r != 0.0);          return true;
+        default:                                                         return false;
+    }
+}
+
+function void stmt_push(dce_ctx_t *ctx, stmt_list_t *list, NODE_T *node) {
+    if (list->size >= list->capacity) {
+        size_t cap = list->capacity ? list->capacity * 2 : 16;
+        NODE_T **tmp = TYPED_REALLOC(list->data, cap, NODE_T *);
+        if (!tmp) {
+            ctx->failed = true;
+            return;
+        }
+        list->data = tmp;
+        list->capacity = cap;
+    }
+    list->data[list->size++] = node;
+}
+
+/**
+ * @brief Раскладывает цепочку CONNECTOR в массив операторов в порядке исполнения.
+ */
+function void collect_stmts(dce_ctx_t *ctx, NODE_T *chain, stmt_list_t *list) {
+    if (!chain) return;
+    if (is_connector(chain)) {
+        collect_stmts(ctx, chain->left, list);
+        collect_stmts(ctx, chain->right, list);
+        return;
+    }
+    stmt_push(ctx, list, chain);
+}
+
+/**
+ * @brief Освобождает только узлы CONNECTOR цепочки, операторы остаются живыми.
+ */
+function void release_connectors(NODE_T *chain) {
+    if (!is_connector(chain)) return;
+    release_connectors(chain->left);
+    release_connectors(chain->right);
+    free(chain);
+}
+
+/**
+ * @brief Собирает левую цепочку CONNECTOR, как ее строит парсер; nullptr-элементы пропускаются.
+ */
+function NODE_T *rebuild_chain(dce_ctx_t *ctx, const stmt_list_t *list) {
+    NODE_T *acc = nullptr;
+    for (size_t i = 0; i < list->size; ++i) {
+        NODE_T *stmt = list->data[i];
+        if (!stmt) continue;
+        if (!acc) {
+            acc = stmt;
+            continue;
+        }
+        NODE_VALUE_T v = {};
+        v.opr = OPERATOR::CONNECTOR;
+        NODE_T *conn = new_node(OPERATOR_T, v, acc, stmt);
+        if (!conn) {
+            ctx->failed = true;
+            return acc;
+        }
+        acc = conn;
+    }
+    return acc;
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/*  Недостижимый код                                                     */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/**
+ * @brief Переносит операторы цепочки в out, отбрасывая все после безусловного выхода.
+ */
+function void prune_chain_into(dce_ctx_t *ctx, NODE_T *chain, stmt_list_t *out, bool *terminates) {
+    stmt_list_t in = {};
+    collect_stmts(ctx, chain, &in);
+    release_connectors(chain);
+    for (size_t i = 0; i < in.size; ++i) {
+        if (*terminates) {
+            destruct_node(in.data[i]);
+            ctx->removed++;
+        } else {
+            prune_into(ctx, in.data[i], out, terminates);
+        }
+    }
+    free(in.data);
+}
+
+/**
+ * @brief Упрощает один оператор и добавляет результат (0..n операторов) в out.
+ * @param terminates[out] true, если после оператора управление не идет дальше.
+ */
+function void prune_into(dce_ctx_t *ctx, NODE_T *node, stmt_list_t *out, bool *terminates) {
+    double cond = 0.0;
+    if (is_keyword(node, KEYWORD::IF)) {
+        NODE_T *branches = node->right;
+        NODE_T *then_ops = branches ? branches->left : nullptr;
+        NODE_T *else_ops = branches ? branches->right : nullptr;
+        if (const_value(node->left, &cond)) {
+            NODE_T *keep = (cond != 0.0) ? then_ops : else_ops;
+            NODE_T *drop = (cond != 0.0) ? else_ops : then_ops;
+            if (branches) branches->left = branches->right = nullptr;
+            destruct_node(node);
+            destruct_node(drop);
+            ctx->removed++;
+            prune_chain_into(ctx, keep, out, terminates);
+            return;
+        }
+        bool then_term = false, else_term = false;
+        if (branches) {
+            branches->left = prune_block(ctx, then_ops, &then_term);
+            branches->right = prune_block(ctx, else_ops, &else_term);
+        }
+        *terminates = branches && branches->right && then_term && else_term;
+        stmt_push(ctx, out, node);
+        return;
+    }
+    if (is_keyword(node, KEYWORD::WHILE)) {
+        if (const_value(node->left, &cond) && cond == 0.0) {
+            destruct_node(node);
+            ctx->removed++;
+            return;
+        }
+        bool body_term = false;
+        node->right = prune_block(ctx, node->right, &body_term);
+        stmt_push(ctx, out, node);
+        return;
+    }
+    if (is_keyword(node, KEYWORD::DO_WHILE)) {
+        if (const_value(node->left, &cond) && cond == 0.0) {
+            NODE_T *body = node->right;
+            node->right = nullptr;
+            destruct_node(node);
+            ctx->removed++;
+            prune_chain_into(ctx, body, out, terminates);
+            return;
+        }
+        node->right = prune_block(ctx, node->right, terminates);
+        stmt_push(ctx, out, node);
+        return;
+    }
+    if (is_keyword(node, KEYWORD::RETURN))
+        *terminates = true;
+    stmt_push(ctx, out, node);
+}
+
+function NODE_T *prune_block(dce_ctx_t *ctx, NODE_T *chain, bool *terminates) {
+    *terminates = false;
+    if (!chain) return nullptr;
+    stmt_list_t out = {};
+    prune_chain_into(ctx, chain, &out, terminates);
+    NODE_T *res = rebuild_chain(ctx, &out);
+    free(out.data);
+    return res;
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/*  Живость и мертвые присваивания                                       */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/**
+ * @brief Проверяет, что выражение можно выкинуть без потери побочных эффектов.
+ */
+function bool expr_is_pure(const NODE_T *node) {
+    if (!node) return true;
+    if (node->type == KEYWORD_T && node->value.keyword == KEYWORD::FUNC_CALL)
+        return false;
+    if (node->type == OPERATOR_T) {
+        switch (node->value.opr) {
+            case OPERATOR::ASSIGNMENT:
+            case OPERATOR::IN:
+            case OPERATOR::OUT:
+            case OPERATOR::SET_PIXEL:
+            case OPERATOR::DRAW:
+                return false;
+            default:
+                break;
+        }
+    }
+    return expr_is_pure(node->left) && expr_is_pure(node->right);
+}
+
+/**
+ * @brief Помечает живыми все переменные, читаемые поддеревом (имя вызываемой функции не считается).
+ */
+function void expr_uses(const dce_ctx_t *ctx, const NODE_T *node, bool *live) {
+    if (!node) return;
+    if (node->type == LITERAL_T) {
+        if (node->value.id < ctx->nvars)
+            live[node->value.id] = true;
+        return;
+    }
+    if (is_keyword(node, KEYWORD::FUNC_CALL)) {
+        expr_uses(ctx, node->right, live);
+        return;
+    }
+    expr_uses(ctx, node->left, live);
+    expr_uses(ctx, node->right, live);
+}
+
+/**
+ * @brief Обратный шаг живости через оператор.
+ * @param slot[in,out]  оператор; при remove мертвый оператор освобождается и зануляется.
+ * @param live[in,out]  на входе - живые после оператора, на выходе - живые перед ним.
+ * @param remove        удалять ли мертвые присваивания (только на финальном проходе).
+ */
+function void live_stmt(dce_ctx_t *ctx, NODE_T **slot, bool *live, bool remove) {
+    NODE_T *node = *slot;
+    if (!node) return;
+    size_t bytes = ctx->nvars * sizeof(bool);
+
+    if (is_operator(node, OPERATOR::ASSIGNMENT) && node->left && node->left->type == LITERAL_T &&
+        node->left->value.id < ctx->nvars) {
+        size_t id = node->left->value.id;
+        if (!live[id] && expr_is_pure(node->right)) {
+            if (remove) {
+                destruct_node(node);
+                *slot = nullptr;
+                ctx->removed++;
+            }
+            return;
+        }
+        live[id] = false;
+        expr_uses(ctx, node->right, live);
+        return;
+    }
+    if (is_operator(node, OPERATOR::IN) && node->left && node->left->type == LITERAL_T &&
+        node->left->value.id < ctx->nvars) {
+        live[node->left->value.id] = false;
+        return;
+    }
+    if (is_keyword(node, KEYWORD::VAR_DECLARATION))
+        return;
+    if (is_keyword(node, KEYWORD::RETURN)) {
+        memset(live, 0, bytes);
+        expr_uses(ctx, node->left, live);
+        return;
+    }
+    if (is_keyword(node, KEYWORD::IF)) {
+        NODE_T *branches = node->right;
+        bool *other = TYPED_CALLOC(ctx->nvars ? ctx->nvars : 1, bool);
+        if (!other) {
+            ctx->failed = true;
+            return;
+        }
+        memcpy(other, live, bytes);
+        if (branches) {
+            live_block(ctx, &branches->left, live, remove);
+            live_block(ctx, &branches->right, other, remove);
+        }
+        for (size_t i = 0; i < ctx->nvars; ++i)
+            live[i] = live[i] || other[i];
+        free(other);
+        expr_uses(ctx, node->left, live);
+        return;
+    }
+    if (is_keyword(node, KEYWORD::WHILE) || is_keyword(node, KEYWORD::DO_WHILE)) {
+        bool is_do = is_keyword(node, KEYWORD::DO_WHILE);
+        bool *after = TYPED_CALLOC(ctx->nvars ? ctx->nvars : 1, bool);
+        bool *head  = TYPED_CALLOC(ctx->nvars ? ctx->nvars : 1, bool);
+        bool *tmp   = TYPED_CALLOC(ctx->nvars ? ctx->nvars : 1, bool);
+        if (!after || !head || !tmp) {
+            free(after); free(head); free(tmp);
+            ctx->failed = true;
+            return;
+        }
+        /* after = живые после цикла и в точке проверки условия; head = живые в начале тела */
+        memcpy(after, live, bytes);
+        expr_uses(ctx, node->left, after);
+        if (!is_do)
+            memcpy(head, after, bytes);
+        bool changed = true;
+        while (changed && !ctx->failed) {
+            changed = false;
+            memcpy(tmp, after, bytes);
+            for (size_t i = 0; i < ctx->nvars; ++i)
+                tmp[i] = tmp[i] || head[i];
+            live_block(ctx, &node->right, tmp, false);
+            for (size_t i = 0; i < ctx->nvars; ++i) {
+                if (tmp[i] && !head[i]) {
+                    head[i] = true;
+                    changed = true;
+                }
+            }
+        }
+        if (remove) {
+            memcpy(tmp, after, bytes);
+            for (size_t i = 0; i < ctx->nvars; ++i)
+                tmp[i] = tmp[i] || head[i];
+            live_block(ctx, &node->right, tmp, true);
+        }
+        memcpy(live, head, bytes);
+        free(after); free(head); free(tmp);
+        return;
+    }
+    expr_uses(ctx, node, live);
+}
+
+/**
+ * @brief Обратный проход живости по цепочке операторов.
+ */
+function void live_block(dce_ctx_t *ctx, NODE_T **chain, bool *live, bool remove) {
+    if (!chain || !*chain) return;
+    stmt_list_t list = {};
+    collect_stmts(ctx, *chain, &list);
+    if (ctx->failed) {
+        free(list.data);
+        return;
+    }
+    if (remove)
+        release_connectors(*chain);
+    for (size_t i = list.size; i > 0; --i)
+        live_stmt(ctx, &list.data[i - 1], live, remove);
+    if (remove)
+        *chain = rebuild_chain(ctx, &list);
+    free(list.data);
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/*  Неиспользуемые объявления                                            */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/**
+ * @brief Считает ссылки на имена вне объявлений ВЕЛИЧИНА и имен вызываемых функций.
+ */
+function void count_refs(const dce_ctx_t *ctx, const NODE_T *node, size_t *refs) {
+    if (!node) return;
+    if (is_keyword(node, KEYWORD::VAR_DECLARATION))
+        return;
+    if (is_keyword(node, KEYWORD::FUNC_CALL)) {
+        count_refs(ctx, node->right, refs);
+        return;
+    }
+    if (node->type == LITERAL_T && node->value.id < ctx->nvars)
+        refs[node->value.id]++;
+    count_refs(ctx, node->left, refs);
+    count_refs(ctx, node->right, refs);
+}
+
+function void drop_unused_decls(dce_ctx_t *ctx, NODE_T **chain, const size_t *refs) {
+    if (!chain || !*chain) return;
+    stmt_list_t list = {};
+    collect_stmts(ctx, *chain, &list);
+    if (ctx->failed) {
+        free(list.data);
+        return;
+    }
+    release_connectors(*chain);
+    for (size_t i = 0; i < list.size; ++i) {
+        NODE_T *node = list.data[i];
+        if (is_keyword(node, KEYWORD::VAR_DECLARATION)) {
+            const NODE_T *name = node->left;
+            if (name && name->type == LITERAL_T && name->value.id < ctx->nvars && refs[name->value.id] == 0) {
+                destruct_node(node);
+                list.data[i] = nullptr;
+                ctx->removed++;
+            }
+        } else if (is_keyword(node, KEYWORD::IF) && node->right) {
+            drop_unused_decls(ctx, &node->right->left, refs);
+            drop_unused_decls(ctx, &node->right->right, refs);
+        } else if (is_keyword(node, KEYWORD::WHILE) || is_keyword(node, KEYWORD::DO_WHILE)) {
+            drop_unused_decls(ctx, &node->right, refs);
+        }
+    }
+    *chain = rebuild_chain(ctx, &list);
+    free(list.data);
+}
+
+/**
+ * @brief Прогоняет все чистки над телом одной функции (или основного тела) до неподвижной точки.
+ */
+function void process_scope(dce_ctx_t *ctx, NODE_T **body) {
+    if (!body || !*body) return;
+    bool terminates = false;
+    *body = prune_block(ctx, *body, &terminates);
+
+    size_t cap = ctx->nvars ? ctx->nvars : 1;
+    bool   *live = TYPED_CALLOC(cap, bool);
+    size_t *refs = TYPED_CALLOC(cap, size_t);
+    if (!live || !refs) {
+        free(live);
+        free(refs);
+        ctx->failed = true;
+        return;
+    }
+    do {
+        ctx->removed = 0;
+        memset(live, 0, cap * sizeof(bool));
+        live_block(ctx, body, live, true);
+    } while (ctx->removed && !ctx->failed);
+
+    count_refs(ctx, *body, refs);
+    drop_unused_decls(ctx, body, refs);
+    free(live);
+    free(refs);
+}
+
+function void process_function_list(dce_ctx_t *ctx, NODE_T *node) {
+    if (!node) return;
+    if (node->type == DELIMITER_T && node->value.delimiter == DELIMITER::COMA) {
+        process_function_list(ctx, node->left);
+        process_function_list(ctx, node->right);
+        return;
+    }
+    if (node->type == LITERAL_T)
+        process_scope(ctx, &node->right);
+}
+
+int eliminate_dead_code(NODE_T *root, const varlist::VarList *vars) {
+    if (!root || !vars) return -1;
+    dce_ctx_t ctx = {};
+    ctx.nvars = varlist::size(vars);
+
+    /* корень программы - CONNECTOR: слева функции, справа тело (см. контракт парсера) */
+    if (!is_connector(root)) return 0;
+    process_function_list(&ctx, root->left);
+    process_scope(&ctx, &root->right);
+
+    recount_elements(root);
+    root->parent = nullptr;
+    return ctx.failed ? -1 : 0;
+}
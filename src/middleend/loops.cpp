@@ -0,0 +1,531 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ast.h"
+#include "base.h"
+#include "middleend.h"
+
+/** Предел размера развернутого тела в узлах AST, чтобы не раздувать код. */
+const size_t MAX_UNROLLED_NODES = 512;
+/** Регистров у бэкенда; один держим свободным под alloc_temp_reg. */
+const size_t BACKEND_REGISTERS = 8;
+/** Стоимость обновления t = t + K * step в командах SPU. */
+const size_t SR_UPDATE_COST = 4;
+/** Предполагаемое число итераций вложенного цикла при оценке выгоды. */
+const size_t NESTED_TRIP_ESTIMATE = 8;
+/** Целые double до 2^53 складываются и умножаются точно. */
+const double EXACT_INT_LIMIT = 9007199254740992.0;
+
+typedef struct {
+    NODE_T **data;
+    size_t   size;
+    size_t   capacity;
+} stmt_list_t;
+
+typedef struct {
+    varlist::VarList *vars;
+    size_t            unroll;
+    size_t            scope_vars;     /**< Сколько имен уже занимает текущая функция. */
+    size_t            sr_counter;
+    bool              failed;
+} loop_ctx_t;
+
+typedef struct {
+    double data[8];
+    size_t size;
+} factor_set_t;
+
+/** Описание счетного цикла ПОКА i (<|<=|>|>=) bound ... i = i + step СТОП. */
+typedef struct {
+    size_t              iv;
+    double              step;
+    NODE_T             *cond;
+} counted_loop_t;
+
+function bool is_connector(const NODE_T *node);
+function bool is_keyword(const NODE_T *node, KEYWORD::KEYWORD kw);
+function bool is_operator(const NODE_T *node, OPERATOR::OPERATOR op);
+function bool is_var(const NODE_T *node, size_t id);
+function NODE_T *make_number(double num);
+function NODE_T *make_var(size_t id);
+function NODE_T *make_binary(OPERATOR::OPERATOR op, NODE_T *left, NODE_T *right);
+function void stmt_push(loop_ctx_t *ctx, stmt_list_t *list, NODE_T *node);
+function void collect_stmts(loop_ctx_t *ctx, NODE_T *chain, stmt_list_t *list);
+function void release_connectors(NODE_T *chain);
+function NODE_T *rebuild_chain(loop_ctx_t *ctx, const stmt_list_t *list);
+function size_t subtree_size(const NODE_T *node);
+function bool writes_var(const NODE_T *node, size_t id);
+function bool has_return(const NODE_T *node);
+function bool match_increment(const NODE_T *stmt, size_t iv, double *step);
+function bool match_counted_loop(NODE_T *node, const stmt_list_t *body, counted_loop_t *loop);
+function bool starts_integral(const stmt_list_t *out, size_t iv);
+function size_t reduce_multiplications(loop_ctx_t *ctx, NODE_T *node, size_t iv, double factor, size_t tmp_id);
+function bool find_iv_multiplier(const NODE_T *node, size_t iv, const factor_set_t *rejected, double *factor);
+function size_t product_weight(const NODE_T *node, size_t iv, double factor, size_t weight);
+function size_t new_temp_var(loop_ctx_t *ctx, size_t iv);
+function void strength_reduce(loop_ctx_t *ctx, const counted_loop_t *loop, stmt_list_t *body, stmt_list_t *out);
+function NODE_T *unroll_loop(loop_ctx_t *ctx, const counted_loop_t *loop, const stmt_list_t *body);
+function NODE_T *optimize_block(loop_ctx_t *ctx, NODE_T *chain);
+function void mark_scope_vars(const NODE_T *node, bool *seen, size_t cap);
+function void optimize_scope(loop_ctx_t *ctx, const NODE_T *params, NODE_T **body);
+function void optimize_function_list(loop_ctx_t *ctx, NODE_T *node);
+
+function bool is_connector(const NODE_T *node) {
+    return node && node->type == OPERATOR_T && node->value.opr == OPERATOR::CONNECTOR;
+}
+
+function bool is_keyword(const NODE_T *node, KEYWORD::KEYWORD kw) {
+    return node && node->type == KEYWORD_T && node->value.keyword == kw;
+}
+
+function bool is_operator(const NODE_T *node, OPERATOR::OPERATOR op) {
+    return node && node->type == OPERATOR_T && node->value.opr == op;
+}
+
+function bool is_var(const NODE_T *node, size_t id) {
+    return node && node->type == LITERAL_T && node->value.id == id;
+}
+
+function NODE_T *make_number(double num) {
+    NODE_VALUE_T v = {};
+    v.num = num;
+    return new_node(NUMBER_T, v, nullptr, nullptr);
+}
+
+function NODE_T *make_var(size_t id) {
+    NODE_VALUE_T v = {};
+    v.id = id;
+    return new_node(LITERAL_T, v, nullptr, nullptr);
+}
+
+function NODE_T *make_binary(OPERATOR::OPERATOR op, NODE_T *left, NODE_T *right) {
+    if (!left || !right) {
+        destruct_node(left);
+        destruct_node(right);
+        return nullptr;
+    }
+    NODE_VALUE_T v = {};
+    v.opr = op;
+    NODE_T *node = new_node(OPERATOR_T, v, left, right);
+    if (!node) {
+        destruct_node(left);
+        destruct_node(right);
+    }
+    return node;
+}
+
+function void stmt_push(loop_ctx_t *ctx, stmt_list_t *list, NODE_T *node) {
+    if (!node) {
+        ctx->failed = true;
+        return;
+    }
+    if (list->size >= list->capacity) {
+        size_t cap = list->capacity ? list->capacity * 2 : 16;
+        NODE_T **tmp = TYPED_REALLOC(list->data, cap, NODE_T *);
+        if (!tmp) {
+            ctx->failed = true;
+            destruct_node(node);
+            return;
+        }
+        list->data = tmp;
+        list->capacity = cap;
+    }
+    list->data[list->size++] = node;
+}
+
+/**
+ * @brief Раскладывает цепочку CONNECTOR в массив операторов в порядке исполнения.
+ */
+function void collect_stmts(loop_ctx_t *ctx, NODE_T *chain, stmt_list_t *list) {
+    if (!chain) return;
+    if (is_connector(chain)) {
+        collect_stmts(ctx, chain->left, list);
+        collect_stmts(ctx, chain->right, list);
+        return;
+    }
+    stmt_push(ctx, list, chain);
+}
+
+/**
+ * @brief Освобождает только узлы CONNECTOR цепочки, операторы остаются живыми.
+ */
+function void release_connectors(NODE_T *chain) {
+    if (!is_connector(chain)) return;
+    release_connectors(chain->left);
+    release_connectors(chain->right);
+    free(chain);
+}
+
+/**
+ * @brief Собирает левую цепочку CONNECTOR, как ее строит парсер.
+ */
+function NODE_T *rebuild_chain(loop_ctx_t *ctx, const stmt_list_t *list) {
+    NODE_T *acc = nullptr;
+    for (size_t i = 0; i < list->size; ++i) {
+        NODE_T *stmt = list->data[i];
+        if (!stmt) continue;
+        if (!acc) {
+            acc = stmt;
+            continue;
+        }
+        NODE_VALUE_T v = {};
+        v.opr = OPERATOR::CONNECTOR;
+        NODE_T *conn = new_node(OPERATOR_T, v, acc, stmt);
+        if (!conn) {
+            ctx->failed = true;
+            return acc;
+        }
+        acc = conn;
+    }
+    return acc;
+}
+
+function size_t subtree_size(const NODE_T *node) {
+    if (!node) return 0;
+    return 1 + subtree_size(node->left) + subtree_size(node->right);
+}
+
+/**
+ * @brief Проверяет, пишет ли поддерево в переменную id (присваивание или ИЗМЕРИТЬ).
+ */
+function bool writes_var(const NODE_T *node, size_t id) {
+    if (!node) return false;
+    if ((is_operator(node, OPERATOR::ASSIGNMENT) || is_operator(node, OPERATOR::IN)) && is_var(node->left, id))
+        return true;
+    return writes_var(node->left, id) || writes_var(node->right, id);
+}
+
+function bool has_return(const NODE_T *node) {
+    if (!node) return false;
+    if (is_keyword(node, KEYWORD::RETURN)) return true;
+    return has_return(node->left) || has_return(node->right);
+}
+
+/**
+ * @brief Распознает i = i + c, i = c + i, i = i - c с целым ненулевым c.
+ */
+function bool match_increment(const NODE_T *stmt, size_t iv, double *step) {
+    if (!is_operator(stmt, OPERATOR::ASSIGNMENT) || !is_var(stmt->left, iv)) return false;
+    const NODE_T *rhs = stmt->right;
+    if (!rhs || rhs->type != OPERATOR_T) return false;
+    const NODE_T *num = nullptr;
+    double sign = 1.0;
+    if (rhs->value.opr == OPERATOR::ADD) {
+        if (is_var(rhs->left, iv))       num = rhs->right;
+        else if (is_var(rhs->right, iv)) num = rhs->left;
+    } else if (rhs->value.opr == OPERATOR::SUB && is_var(rhs->left, iv)) {
+        num = rhs->right;
+        sign = -1.0;
+    }
+    if (!num || num->type != NUMBER_T) return false;
+    double c = sign * num->value.num;
+    /* целый шаг при целом i (starts_integral): i + k*c совпадает с k последовательными сложениями */
+    if (c == 0.0 || floor(c) != c) return false;
+    *step = c;
+    return true;
+}
+
+/**
+ * @brief Распознает ПОКА i op bound ПОВТОРЯЕМ ... i = i +- c СТОП с монотонным i.
+ */
+function bool match_counted_loop(NODE_T *node, const stmt_list_t *body, counted_loop_t *loop) {
+    if (!is_keyword(node, KEYWORD::WHILE) || !body->size) return false;
+    NODE_T *cond = node->left;
+    if (!cond || cond->type != OPERATOR_T) return false;
+    OPERATOR::OPERATOR op = cond->value.opr;
+    bool up = (op == OPERATOR::BELOW || op == OPERATOR::BELOW_EQ);
+    bool down = (op == OPERATOR::ABOVE || op == OPERATOR::ABOVE_EQ);
+    if (!up && !down) return false;
+    if (!cond->left || cond->left->type != LITERAL_T) return false;
+    size_t iv = cond->left->value.id;
+    const NODE_T *bound = cond->right;
+    if (!bound || (bound->type != NUMBER_T && bound->type != LITERAL_T) || is_var(bound, iv)) return false;
+
+    double step = 0.0;
+    if (!match_increment(body->data[body->size - 1], iv, &step)) return false;
+    if ((up && step < 0) || (down && step > 0)) return false;
+
+    for (size_t i = 0; i < body->size; ++i) {
+        if (i + 1 < body->size && writes_var(body->data[i], iv)) return false;
+        if (bound->type == LITERAL_T && writes_var(body->data[i], bound->value.id)) return false;
+        if (has_return(body->data[i])) return false;
+    }
+    loop->iv = iv;
+    loop->step = step;
+    loop->cond = cond;
+    return true;
+}
+
+/**
+ * @brief Проверяет, что перед циклом i последний раз задан как i = <целое число>.
+ *
+ * Только тогда счетчик с целым шагом остается целым. Дробное i (например, после ИЗМЕРИТЬ i)
+ * ломает побитное совпадение и накопления t + K * step, и проверки i + (N - 1) * step.
+ */
+function bool starts_integral(const stmt_list_t *out, size_t iv) {
+    for (size_t i = out->size; i-- > 0;) {
+        const NODE_T *stmt = out->data[i];
+        if (!writes_var(stmt, iv)) continue;
+        if (!is_operator(stmt, OPERATOR::ASSIGNMENT) || !is_var(stmt->left, iv)) return false;
+        const NODE_T *num = stmt->right;
+        return num && num->type == NUMBER_T && floor(num->value.num) == num->value.num
+            && fabs(num->value.num) < EXACT_INT_LIMIT;
+    }
+    return false;
+}
+
+/**
+ * @brief Ищет умножение i * K с целым K, которого нет среди отвергнутых множителей.
+ */
+function bool find_iv_multiplier(const NODE_T *node, size_t iv, const factor_set_t *rejected, double *factor) {
+    if (!node) return false;
+    if (is_operator(node, OPERATOR::MUL)) {
+        const NODE_T *num = is_var(node->left, iv) ? node->right : is_var(node->right, iv) ? node->left : nullptr;
+        /* целый K при целом i: накопление t + K * step дает тот же double, что и i * K */
+        if (num && num->type == NUMBER_T && floor(num->value.num) == num->value.num) {
+            bool seen = false;
+            for (size_t i = 0; i < rejected->size && !seen; ++i)
+                seen = (rejected->data[i] == num->value.num);
+            if (!seen) {
+                *factor = num->value.num;
+                return true;
+            }
+        }
+    }
+    return find_iv_multiplier(node->left, iv, rejected, factor) || find_iv_multiplier(node->right, iv, rejected, factor);
+}
+
+/**
+ * @brief Оценивает, сколько раз за итерацию вычисляется i * factor (вложенные циклы - с весом).
+ */
+function size_t product_weight(const NODE_T *node, size_t iv, double factor, size_t weight) {
+    if (!node) return 0;
+    if (is_operator(node, OPERATOR::MUL)) {
+        const NODE_T *num = is_var(node->left, iv) ? node->right : is_var(node->right, iv) ? node->left : nullptr;
+        if (num && num->type == NUMBER_T && num->value.num == factor)
+            return weight;
+    }
+    if (is_keyword(node, KEYWORD::WHILE) || is_keyword(node, KEYWORD::DO_WHILE))
+        weight *= NESTED_TRIP_ESTIMATE;
+    return product_weight(node->left, iv, factor, weight) + product_weight(node->right, iv, factor, weight);
+}
+
+/**
+ * @brief Заменяет все i * factor в поддереве на переменную tmp_id.
+ * @return число замен.
+ */
+function size_t reduce_multiplications(loop_ctx_t *ctx, NODE_T *node, size_t iv, double factor, size_t tmp_id) {
+    if (!node) return 0;
+    if (is_operator(node, OPERATOR::MUL)) {
+        const NODE_T *num = is_var(node->left, iv) ? node->right : is_var(node->right, iv) ? node->left : nullptr;
+        if (num && num->type == NUMBER_T && num->value.num == factor) {
+            destruct_node(node->left);
+            destruct_node(node->right);
+            node->left = node->right = nullptr;
+            node->type = LITERAL_T;
+            node->value.id = tmp_id;
+            return 1;
+        }
+    }
+    return reduce_multiplications(ctx, node->left, iv, factor, tmp_id) +
+           reduce_multiplications(ctx, node->right, iv, factor, tmp_id);
+}
+
+/**
+ * @brief Заводит в VarList новое уникальное имя вида <iv>_sr<N>.
+ */
+function size_t new_temp_var(loop_ctx_t *ctx, size_t iv) {
+    const mystr::mystr_t *base = varlist::get(ctx->vars, iv);
+    char name[128] = "";
+    do {
+        snprintf(name, sizeof(name), "%s_sr%zu", (base && base->str) ? base->str : "iv", ++ctx->sr_counter);
+        mystr::mystr_t probe = mystr::construct(name);
+        if (!varlist::contains(ctx->vars, &probe))
+            return varlist::add(ctx->vars, &probe);
+    } while (true);
+}
+
+/**
+ * @brief Заменяет i * K в теле переменной t: t = i * K до цикла, t = t + K * step после инкремента.
+ * @param body[in,out] тело цикла; последний элемент - инкремент.
+ * @param out[in,out]  список, куда кладутся инициализации перед циклом.
+ */
+function void strength_reduce(loop_ctx_t *ctx, const counted_loop_t *loop, stmt_list_t *body, stmt_list_t *out) {
+    double factor = 0.0;
+    factor_set_t rejected = {};
+    while (ctx->scope_vars + 1 < BACKEND_REGISTERS && !ctx->failed) {
+        bool found = false;
+        for (size_t i = 0; i + 1 < body->size && !found; ++i)
+            found = find_iv_multiplier(body->data[i], loop->iv, &rejected, &factor);
+        if (!found) return;
+
+        /* PUSHR t вместо PUSHR i; PUSH K; MUL экономит 2 команды на вхождение,
+           обновление t = t + K * step стоит 4 */
+        size_t weight = 0;
+        for (size_t i = 0; i + 1 < body->size; ++i)
+            weight += product_weight(body->data[i], loop->iv, factor, 1);
+        if (2 * weight <= SR_UPDATE_COST) {
+            if (rejected.size >= ARRAY_COUNT(rejected.data)) return;
+            rejected.data[rejected.size++] = factor;
+            continue;
+        }
+
+        size_t tmp = new_temp_var(ctx, loop->iv);
+        if (tmp == varlist::NPOS) {
+            ctx->failed = true;
+            return;
+        }
+        for (size_t i = 0; i + 1 < body->size; ++i)
+            reduce_multiplications(ctx, body->data[i], loop->iv, factor, tmp);
+        ctx->scope_vars++;
+
+        stmt_push(ctx, out, make_binary(OPERATOR::ASSIGNMENT, make_var(tmp),
+            make_binary(OPERATOR::MUL, make_var(loop->iv), make_number(factor))));
+        stmt_push(ctx, body, make_binary(OPERATOR::ASSIGNMENT, make_var(tmp),
+            make_binary(OPERATOR::ADD, make_var(tmp), make_number(factor * loop->step))));
+    }
+}
+
+/**
+ * @brief Строит цикл с телом из unroll копий: ПОКА i + (unroll - 1) * step op bound.
+ *
+ * Остаток итераций выполняет исходный цикл, который ставится следом.
+ */
+function NODE_T *unroll_loop(loop_ctx_t *ctx, const counted_loop_t *loop, const stmt_list_t *body) {
+    stmt_list_t copies = {};
+    for (size_t k = 0; k < ctx->unroll && !ctx->failed; ++k) {
+        for (size_t i = 0; i < body->size; ++i)
+            stmt_push(ctx, &copies, clone_node(body->data[i]));
+    }
+    NODE_T *new_body = rebuild_chain(ctx, &copies);
+    free(copies.data);
+
+    NODE_T *guard = make_binary(loop->cond->value.opr,
+        make_binary(OPERATOR::ADD, make_var(loop->iv), make_number((double) (ctx->unroll - 1) * loop->step)),
+        clone_node(loop->cond->right));
+    if (ctx->failed || !new_body || !guard) {
+        ctx->failed = true;
+        destruct_node(new_body);
+        destruct_node(guard);
+        return nullptr;
+    }
+    NODE_VALUE_T v = {};
+    v.keyword = KEYWORD::WHILE;
+    NODE_T *node = new_node(KEYWORD_T, v, guard, new_body);
+    if (!node) {
+        ctx->failed = true;
+        destruct_node(new_body);
+        destruct_node(guard);
+    }
+    return node;
+}
+
+/**
+ * @brief Обрабатывает цепочку операторов: сначала вложенные блоки, затем счетные циклы этого уровня.
+ */
+function NODE_T *optimize_block(loop_ctx_t *ctx, NODE_T *chain) {
+    if (!chain) return nullptr;
+    stmt_list_t in = {}, out = {};
+    collect_stmts(ctx, chain, &in);
+    release_connectors(chain);
+
+    for (size_t i = 0; i < in.size; ++i) {
+        NODE_T *node = in.data[i];
+        if (ctx->failed) {
+            destruct_node(node);
+            continue;
+        }
+        if (is_keyword(node, KEYWORD::IF) && node->right) {
+            node->right->left = optimize_block(ctx, node->right->left);
+            node->right->right = optimize_block(ctx, node->right->right);
+        } else if (is_keyword(node, KEYWORD::DO_WHILE)) {
+            node->right = optimize_block(ctx, node->right);
+        } else if (is_keyword(node, KEYWORD::WHILE)) {
+            node->right = optimize_block(ctx, node->right);
+
+            stmt_list_t body = {};
+            collect_stmts(ctx, node->right, &body);
+            counted_loop_t loop = {};
+            if (!ctx->failed && match_counted_loop(node, &body, &loop) && starts_integral(&out, loop.iv)) {
+                release_connectors(node->right);
+                strength_reduce(ctx, &loop, &body, &out);
+                NODE_T *unrolled = nullptr;
+                size_t unit = 0;
+                for (size_t j = 0; j < body.size; ++j)
+                    unit += subtree_size(body.data[j]);
+                if (ctx->unroll > 1 && unit * ctx->unroll <= MAX_UNROLLED_NODES)
+                    unrolled = unroll_loop(ctx, &loop, &body);
+                node->right = rebuild_chain(ctx, &body);
+                if (unrolled)
+                    stmt_push(ctx, &out, unrolled);
+            }
+            free(body.data);
+        }
+        stmt_push(ctx, &out, node);
+    }
+    NODE_T *res = rebuild_chain(ctx, &out);
+    free(in.data);
+    free(out.data);
+    return res;
+}
+
+/**
+ * @brief Помечает имена переменных области (кроме имен вызываемых функций).
+ */
+function void mark_scope_vars(const NODE_T *node, bool *seen, size_t cap) {
+    if (!node) return;
+    if (node->type == LITERAL_T && node->value.id < cap)
+        seen[node->value.id] = true;
+    if (is_keyword(node, KEYWORD::FUNC_CALL)) {
+        mark_scope_vars(node->right, seen, cap);
+        return;
+    }
+    mark_scope_vars(node->left, seen, cap);
+    mark_scope_vars(node->right, seen, cap);
+}
+
+function void optimize_scope(loop_ctx_t *ctx, const NODE_T *params, NODE_T **body) {
+    if (!body || !*body) return;
+    size_t cap = varlist::size(ctx->vars);
+    bool *seen = TYPED_CALLOC(cap ? cap : 1, bool);
+    if (!seen) {
+        ctx->failed = true;
+        return;
+    }
+    mark_scope_vars(params, seen, cap);
+    mark_scope_vars(*body, seen, cap);
+    ctx->scope_vars = 0;
+    for (size_t i = 0; i < cap; ++i)
+        ctx->scope_vars += seen[i];
+    free(seen);
+
+    *body = optimize_block(ctx, *body);
+}
+
+function void optimize_function_list(loop_ctx_t *ctx, NODE_T *node) {
+    if (!node) return;
+    if (node->type == DELIMITER_T && node->value.delimiter == DELIMITER::COMA) {
+        optimize_function_list(ctx, node->left);
+        optimize_function_list(ctx, node->right);
+        return;
+    }
+    if (node->type == LITERAL_T)
+        optimize_scope(ctx, node->left, &node->right);
+}
+
+int optimize_loops(NODE_T *root, varlist::VarList *vars, size_t unroll_factor) {
+    if (!root || !vars) return -1;
+    if (!is_connector(root)) return 0;
+    loop_ctx_t ctx = {};
+    ctx.vars = vars;
+    ctx.unroll = unroll_factor;
+
+    optimize_function_list(&ctx, root->left);
+    optimize_scope(&ctx, nullptr, &root->right);
+
+    recount_elements(root);
+    root->parent = nullptr;
+    return ctx.failed ? -1 : 0;
+}
@@ -0,0 +1,365 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ast.h"
+#include "base.h"
+#include "middleend.h"
+
+typedef struct {
+    const NODE_T *funcs;
+    size_t        nvars;
+    bool         *live_in;      /**< Прочитана в итерации до записи. */
+    bool         *written;      /**< Записывается где-либо в итерации. */
+    bool         *visiting;     /**< Функции на пути проверки чистоты (рекурсия). */
+    const char   *reason;
+    bool          failed;
+} rows_ctx_t;
+
+function bool is_connector(const NODE_T *node);
+function bool is_keyword(const NODE_T *node, KEYWORD::KEYWORD kw);
+function bool is_operator(const NODE_T *node, OPERATOR::OPERATOR op);
+function bool is_var(const NODE_T *node, size_t id);
+function const NODE_T *find_function(const NODE_T *list, size_t id);
+function bool function_is_pure(rows_ctx_t *ctx, const NODE_T *func);
+function bool body_is_pure(rows_ctx_t *ctx, const NODE_T *node);
+function bool reject(rows_ctx_t *ctx, const char *reason);
+function bool scan_expr(rows_ctx_t *ctx, const NODE_T *node, const bool *defined);
+function bool scan_stmt(rows_ctx_t *ctx, const NODE_T *node, bool *defined, bool nested, size_t *inputs);
+function bool *copy_flags(rows_ctx_t *ctx, const bool *src);
+function size_t count_writes(const NODE_T *node, size_t id);
+function bool match_step(const NODE_T *stmt, double *step);
+function void collect_ivs(const NODE_T *chain, row_loop_t *info, const rows_ctx_t *ctx, size_t *matched);
+function bool match_condition(rows_ctx_t *ctx, const NODE_T *cond, row_loop_t *info);
+
+function bool is_connector(const NODE_T *node) {
+    return node && node->type == OPERATOR_T && node->value.opr == OPERATOR::CONNECTOR;
+}
+
+function bool is_keyword(const NODE_T *node, KEYWORD::KEYWORD kw) {
+    return node && node->type == KEYWORD_T && node->value.keyword == kw;
+}
+
+function bool is_operator(const NODE_T *node, OPERATOR::OPERATOR op) {
+    return node && node->type == OPERATOR_T && node->value.opr == op;
+}
+
+function bool is_var(const NODE_T *node, size_t id) {
+    return node && node->type == LITERAL_T && node->value.id == id;
+}
+
+function const NODE_T *find_function(const NODE_T *list, size_t id) {
+    if (!list) return nullptr;
+    if (list->type == DELIMITER_T && list->value.delimiter == DELIMITER::COMA) {
+        const NODE_T *found = find_function(list->left, id);
+        return found ? found : find_function(list->right, id);
+    }
+    return is_var(list, id) ? list : nullptr;
+}
+
+function bool reject(rows_ctx_t *ctx, const char *reason) {
+    if (!ctx->reason) ctx->reason = reason;
+    return false;
+}
+
+/**
+ * @brief Тело функции не вводит, не выводит, не рисует и вызывает только чистые функции.
+ */
+function bool body_is_pure(rows_ctx_t *ctx, const NODE_T *node) {
+    if (!node) return true;
+    if (is_operator(node, OPERATOR::IN) || is_operator(node, OPERATOR::OUT))
+        return reject(ctx, "функция вводит или выводит");
+    if (is_operator(node, OPERATOR::SET_PIXEL) || is_operator(node, OPERATOR::DRAW))
+        return reject(ctx, "функция пишет в видеопамять");
+    if (is_keyword(node, KEYWORD::FUNC_CALL)) {
+        const NODE_T *callee = node->left ? find_function(ctx->funcs, node->left->value.id) : nullptr;
+        if (!callee)
+            return reject(ctx, "вызов встроенной функции с побочным эффектом");
+        if (!function_is_pure(ctx, callee)) return false;
+        return body_is_pure(ctx, node->right);
+    }
+    return body_is_pure(ctx, node->left) && body_is_pure(ctx, node->right);
+}
+
+function bool function_is_pure(rows_ctx_t *ctx, const NODE_T *func) {
+    size_t id = func->value.id;
+    if (id >= ctx->nvars) return reject(ctx, "неизвестная функция");
+    /* рекурсивный вызов: чистота решается по остальной части тела */
+    if (ctx->visiting[id]) return true;
+    ctx->visiting[id] = true;
+    bool pure = body_is_pure(ctx, func->right);
+    ctx->visiting[id] = false;
+    return pure;
+}
+
+function bool *copy_flags(rows_ctx_t *ctx, const bool *src) {
+    bool *dst = TYPED_CALLOC(ctx->nvars ? ctx->nvars : 1, bool);
+    if (!dst) {
+        ctx->failed = true;
+        return nullptr;
+    }
+    memcpy(dst, src, ctx->nvars * sizeof(bool));
+    return dst;
+}
+
+/**
+ * @brief Отмечает величины, прочитанные до записи, и проверяет вызовы в выражении.
+ */
+function bool scan_expr(rows_ctx_t *ctx, const NODE_T *node, const bool *defined) {
+    if (!node) return true;
+    if (node->type == LITERAL_T) {
+        if (node->value.id < ctx->nvars && !defined[node->value.id])
+            ctx->live_in[node->value.id] = true;
+        return true;
+    }
+    if (is_keyword(node, KEYWORD::FUNC_CALL)) {
+        const NODE_T *callee = node->left ? find_function(ctx->funcs, node->left->value.id) : nullptr;
+        if (!callee)
+            return reject(ctx, "вызов встроенной функции с побочным эффектом");
+        if (!function_is_pure(ctx, callee)) return false;
+        return scan_expr(ctx, node->right, defined);
+    }
+    if (is_operator(node, OPERATOR::SET_PIXEL) || is_operator(node, OPERATOR::DRAW))
+        return reject(ctx, "запись в видеопамять");
+    return scan_expr(ctx, node->left, defined) && scan_expr(ctx, node->right, defined);
+}
+
+/**
+ * @brief Обходит операторы итерации в порядке исполнения.
+ *
+ * defined - величины, записанные на всех путях к текущей точке; после оператора
+ * дополняется его записями. inputs - число ИЗМЕРИТЬ на любом пути через оператор.
+ */
+function bool scan_stmt(rows_ctx_t *ctx, const NODE_T *node, bool *defined, bool nested, size_t *inputs) {
+    *inputs = 0;
+    if (!node) return true;
+    if (is_connector(node)) {
+        size_t left = 0, right = 0;
+        if (!scan_stmt(ctx, node->left, defined, nested, &left)) return false;
+        if (!scan_stmt(ctx, node->right, defined, nested, &right)) return false;
+        *inputs = left + right;
+        return true;
+    }
+    if (is_operator(node, OPERATOR::ASSIGNMENT) || is_operator(node, OPERATOR::IN)) {
+        if (!node->left || node->left->type != LITERAL_T || node->left->value.id >= ctx->nvars)
+            return reject(ctx, "запись не в величину");
+        if (is_operator(node, OPERATOR::IN)) {
+            if (nested) return reject(ctx, "ИЗМЕРИТЬ во вложенном цикле");
+            *inputs = 1;
+        } else if (!scan_expr(ctx, node->right, defined)) {
+            return false;
+        }
+        ctx->written[node->left->value.id] = true;
+        defined[node->left->value.id] = true;
+        return true;
+    }
+    /* ВЕЛИЧИНА x без значения оставляет в регистре прошлое значение */
+    if (is_keyword(node, KEYWORD::VAR_DECLARATION))
+        return true;
+    if (is_keyword(node, KEYWORD::RETURN))
+        return reject(ctx, "ВОЗВРАТИТЬ в цикле");
+    if (is_keyword(node, KEYWORD::IF)) {
+        if (!scan_expr(ctx, node->left, defined)) return false;
+        const NODE_T *branches = node->right;
+        bool *then_def = copy_flags(ctx, defined);
+        bool *else_def = copy_flags(ctx, defined);
+        size_t then_in = 0, else_in = 0;
+        bool ok = then_def && else_def
+               && scan_stmt(ctx, branches ? branches->left : nullptr, then_def, nested, &then_in)
+               && scan_stmt(ctx, branches ? branches->right : nullptr, else_def, nested, &else_in);
+        if (ok && then_in != else_in)
+            ok = reject(ctx, "разное число ИЗМЕРИТЬ в ветвях ЕСЛИ");
+        for (size_t i = 0; ok && i < ctx->nvars; ++i)
+            defined[i] = defined[i] || (then_def[i] && else_def[i]);
+        *inputs = then_in;
+        free(then_def);
+        free(else_def);
+        return ok;
+    }
+    if (is_keyword(node, KEYWORD::WHILE) || is_keyword(node, KEYWORD::DO_WHILE)) {
+        bool do_while = is_keyword(node, KEYWORD::DO_WHILE);
+        if (!do_while && !scan_expr(ctx, node->left, defined)) return false;
+        bool *body_def = copy_flags(ctx, defined);
+        size_t body_in = 0;
+        bool ok = body_def && scan_stmt(ctx, node->right, body_def, true, &body_in);
+        if (ok && do_while) {
+            ok = scan_expr(ctx, node->left, body_def);
+            /* тело ПОВТОРЯТЬ исполняется хотя бы раз */
+            memcpy(defined, body_def, ctx->nvars * sizeof(bool));
+        }
+        free(body_def);
+        return ok;
+    }
+    if (is_operator(node, OPERATOR::OUT))
+        return scan_expr(ctx, node->left, defined);
+    return scan_expr(ctx, node, defined);
+}
+
+function size_t count_writes(const NODE_T *node, size_t id) {
+    if (!node) return 0;
+    size_t own = ((is_operator(node, OPERATOR::ASSIGNMENT) || is_operator(node, OPERATOR::IN)) && is_var(node->left, id)) ? 1 : 0;
+    return own + count_writes(node->left, id) + count_writes(node->right, id);
+}
+
+/**
+ * @brief Распознает v = v + c, v = c + v, v = v - c с целым c.
+ */
+function bool match_step(const NODE_T *stmt, double *step) {
+    if (!is_operator(stmt, OPERATOR::ASSIGNMENT) || !stmt->left || stmt->left->type != LITERAL_T) return false;
+    size_t id = stmt->left->value.id;
+    const NODE_T *rhs = stmt->right;
+    if (!rhs || rhs->type != OPERATOR_T) return false;
+    const NODE_T *num = nullptr;
+    double sign = 1.0;
+    if (rhs->value.opr == OPERATOR::ADD) {
+        if (is_var(rhs->left, id))       num = rhs->right;
+        else if (is_var(rhs->right, id)) num = rhs->left;
+    } else if (rhs->value.opr == OPERATOR::SUB && is_var(rhs->left, id)) {
+        num = rhs->right;
+        sign = -1.0;
+    }
+    if (!num || num->type != NUMBER_T || floor(num->value.num) != num->value.num) return false;
+    *step = sign * num->value.num;
+    return true;
+}
+
+/**
+ * @brief Суммирует шаги приращений верхнего уровня тела по величинам.
+ */
+function void collect_ivs(const NODE_T *chain, row_loop_t *info, const rows_ctx_t *ctx, size_t *matched) {
+    if (!chain) return;
+    if (is_connector(chain)) {
+        collect_ivs(chain->left, info, ctx, matched);
+        collect_ivs(chain->right, info, ctx, matched);
+        return;
+    }
+    double step = 0.0;
+    if (!match_step(chain, &step) || chain->left->value.id >= ctx->nvars) return;
+    size_t id = chain->left->value.id;
+    size_t k = 0;
+    while (k < info->iv_count && info->iv[k] != id)
+        ++k;
+    if (k == info->iv_count) {
+        if (k == ROW_LOOP_MAX_IVS) return;
+        info->iv[k] = id;
+        info->step[k] = 0.0;
+        matched[k] = 0;
+        info->iv_count++;
+    }
+    info->step[k] += step;
+    matched[k]++;
+}
+
+/**
+ * @brief Распознает условие v op bound или v +- c op bound, где v - счетчик, идущий к bound.
+ *
+ * Тогда VM заранее знает, сколько итераций осталось, и не исполняет строки за выходом
+ * из цикла: с другим условием (например, v != n) такие строки могут не завершиться.
+ */
+function bool match_condition(rows_ctx_t *ctx, const NODE_T *cond, row_loop_t *info) {
+    if (!cond || cond->type != OPERATOR_T)
+        return reject(ctx, "условие не сравнивает счетчик с границей");
+    OPERATOR::OPERATOR op = cond->value.opr;
+    bool up = (op == OPERATOR::BELOW || op == OPERATOR::BELOW_EQ);
+    bool down = (op == OPERATOR::ABOVE || op == OPERATOR::ABOVE_EQ);
+    if (!up && !down)
+        return reject(ctx, "условие не сравнивает счетчик с границей");
+
+    const NODE_T *lhs = cond->left;
+    double offset = 0.0;
+    if (is_operator(lhs, OPERATOR::ADD) || is_operator(lhs, OPERATOR::SUB)) {
+        const NODE_T *num = lhs->right;
+        if (!num || num->type != NUMBER_T || floor(num->value.num) != num->value.num)
+            return reject(ctx, "условие не сравнивает счетчик с границей");
+        offset = is_operator(lhs, OPERATOR::SUB) ? -num->value.num : num->value.num;
+        lhs = lhs->left;
+    }
+    if (!lhs || lhs->type != LITERAL_T)
+        return reject(ctx, "условие не сравнивает счетчик с границей");
+
+    const NODE_T *bound = cond->right;
+    if (!bound || (bound->type != NUMBER_T && bound->type != LITERAL_T))
+        return reject(ctx, "граница цикла не число и не величина");
+    if (bound->type == LITERAL_T && (bound->value.id >= ctx->nvars || ctx->written[bound->value.id]))
+        return reject(ctx, "граница цикла меняется в теле");
+
+    for (size_t k = 0; k < info->iv_count; ++k) {
+        if (info->iv[k] != lhs->value.id) continue;
+        if ((up && info->step[k] < 0) || (down && info->step[k] > 0))
+            return reject(ctx, "счетчик удаляется от границы цикла");
+        info->cond_iv = k;
+        info->cond_offset = offset;
+        info->cond_op = op;
+        info->bound = bound;
+        return true;
+    }
+    return reject(ctx, "условие не по счетчику");
+}
+
+bool analyze_row_loop(const NODE_T *funcs, const NODE_T *loop, size_t nvars, row_loop_t *info, const char **reason) {
+    if (reason) *reason = nullptr;
+    if (!info || !is_keyword(loop, KEYWORD::WHILE)) {
+        if (reason) *reason = "не цикл ПОКА";
+        return false;
+    }
+    *info = {};
+    rows_ctx_t ctx = {};
+    ctx.funcs = funcs;
+    ctx.nvars = nvars;
+    size_t n = nvars ? nvars : 1;
+    ctx.live_in = TYPED_CALLOC(n, bool);
+    ctx.written = TYPED_CALLOC(n, bool);
+    ctx.visiting = TYPED_CALLOC(n, bool);
+    bool *defined = TYPED_CALLOC(n, bool);
+
+    /* условие проверяется в начале каждой итерации, до записей тела */
+    bool ok = ctx.live_in && ctx.written && ctx.visiting && defined
+           && scan_expr(&ctx, loop->left, defined)
+           && scan_stmt(&ctx, loop->right, defined, false, &info->inputs);
+
+    size_t matched[ROW_LOOP_MAX_IVS] = {};
+    if (ok)
+        collect_ivs(loop->right, info, &ctx, matched);
+    /* счетчик пишется только приращениями верхнего уровня: v_r = v_0 + r * step */
+    size_t kept = 0;
+    for (size_t k = 0; k < info->iv_count; ++k) {
+        if (count_writes(loop->right, info->iv[k]) != matched[k] || info->step[k] == 0.0)
+            continue;
+        info->iv[kept] = info->iv[k];
+        info->step[kept] = info->step[k];
+        ++kept;
+    }
+    info->iv_count = kept;
+    for (size_t id = 0; ok && id < nvars; ++id) {
+        if (!ctx.live_in[id] || !ctx.written[id]) continue;
+        bool is_iv = false;
+        for (size_t k = 0; k < info->iv_count && !is_iv; ++k)
+            is_iv = (info->iv[k] == id);
+        if (!is_iv)
+            ok = reject(&ctx, "величина переносит значение в следующую итерацию");
+    }
+    if (ok && !info->iv_count)
+        ok = reject(&ctx, "нет счетчика итераций");
+    if (ok)
+        ok = match_condition(&ctx, loop->left, info);
+
+    if (ctx.failed && !ctx.reason)
+        ctx.reason = "не хватило памяти";
+    if (reason) *reason = ok ? nullptr : ctx.reason;
+    free(ctx.written);
+    free(ctx.visiting);
+    free(defined);
+    if (ok) {
+        info->live_in = ctx.live_in;
+    } else {
+        free(ctx.live_in);
+        *info = {};
+    }
+    return ok;
+}
+
+void destruct_row_loop(row_loop_t *info) {
+    if (!info) return;
+    free(info->live_in);
+    *info = {};
+}
@@ -0,0 +1,170 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "base.h"
+#include "io_utils.h"
+#include "physlabd.h"
+
+/** Число копий тела счетного цикла по умолчанию, как у backend. */
+const size_t DEFAULT_UNROLL = 4;
+
+function void usage(const char *prog);
+function double now_sec(void);
+function int connect_socket(const char *path);
+function int request(int fd, const char *header, const char *text, size_t size, char **reply, size_t *reply_len);
+
+function void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [--socket path] [--emit ast|asm|c|elf] [--unroll N] [--repeat N]\n"
+                    "          <input.physlab> [output]\n", prog ? prog : "physlab");
+}
+
+function double now_sec(void) {
+    struct timespec ts = {};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
+
+/**
+ * @brief Подключается к physlabd.
+ * @return дескриптор или -1 при ошибке.
+ */
+function int connect_socket(const char *path) {
+    struct sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "слишком длинный путь сокета %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *) &addr, sizeof(addr))) {
+        fprintf(stderr, "physlabd не отвечает на %s (запустите physlabd)\n", path);
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * @brief Отправляет один запрос и читает ответ в *reply (буфер переиспользуется между вызовами).
+ * @return 0 при OK, 1 при ERR (сообщение в *reply), -1 при ошибке соединения.
+ */
+function int request(int fd, const char *header, const char *text, size_t size, char **reply, size_t *reply_len) {
+    char line[PHYSLABD_HEADER_CAP] = "";
+    if (physlabd_send(fd, header, text, size) || physlabd_read_header(fd, line))
+        return -1;
+    char status[8] = "";
+    unsigned long long len = 0;
+    if (sscanf(line, "%7s %llu", status, &len) != 2 || len > PHYSLABD_MAX_BODY)
+        return -1;
+    char *buf = TYPED_REALLOC(*reply, len + 1, char);
+    if (!buf) return -1;
+    *reply = buf;
+    if (physlabd_read_full(fd, buf, (size_t) len))
+        return -1;
+    buf[len] = '\0';
+    *reply_len = (size_t) len;
+    return strcmp(status, "OK") == 0 ? 0 : 1;
+}
+
+/**
+ * @brief CLI: physlab [--socket path] [--emit ast|asm|c|elf] [--unroll N] [--repeat N] <input.physlab> [output].
+ *
+ * Тонкий клиент physlabd вместо frontend + backend: отправляет исходник и пишет ответ
+ * в output (без него - в stdout). --emit ast - только фронтенд, asm (по умолчанию),
+ * c и elf - как backend --target=spu|c|elf. --repeat N повторяет запрос N раз в одном
+ * соединении и печатает в stderr число запросов в секунду.
+ */
+int main(int argc, char **argv) {
+    const char *socket_path = PHYSLABD_SOCKET;
+    const char *emit = "asm";
+    const char *input = nullptr;
+    const char *output = nullptr;
+    size_t unroll = DEFAULT_UNROLL;
+    size_t repeat = 1;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc)
+            socket_path = argv[++i];
+        else if (strcmp(argv[i], "--emit") == 0 && i + 1 < argc) {
+            emit = argv[++i];
+            if (strcmp(emit, "ast") && strcmp(emit, "asm") && strcmp(emit, "c") && strcmp(emit, "elf")) {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if ((strcmp(argv[i], "--unroll") == 0 || strcmp(argv[i], "--repeat") == 0) && i + 1 < argc) {
+            char *end = nullptr;
+            unsigned long val = strtoul(argv[i + 1], &end, 10);
+            if (!end || *end || end == argv[i + 1] || (argv[i][2] == 'r' && !val)) {
+                usage(argv[0]);
+                return 1;
+            }
+            if (argv[i][2] == 'r') repeat = (size_t) val;
+            else unroll = (size_t) val;
+            ++i;
+        } else if (!input && argv[i][0])
+            input = argv[i];
+        else if (!output && argv[i][0])
+            output = argv[i];
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (!input) {
+        usage(argc ? argv[0] : "physlab");
+        return 1;
+    }
+
+    size_t size = 0;
+    char *text = read_file_to_buf(input, &size);
+    if (!text) {
+        fprintf(stderr, "cannot read %s\n", input);
+        return 1;
+    }
+    if (size && text[size - 1] == '\0') --size;
+    char header[PHYSLABD_HEADER_CAP] = "";
+    snprintf(header, sizeof(header), "%s %zu", emit, unroll);
+
+    int fd = connect_socket(socket_path);
+    if (fd < 0) {
+        free(text);
+        return 1;
+    }
+    char *reply = nullptr;
+    size_t reply_len = 0;
+    int rc = 0;
+    double start = now_sec();
+    for (size_t i = 0; i < repeat && !rc; ++i)
+        rc = request(fd, header, text, size, &reply, &reply_len);
+    double elapsed = now_sec() - start;
+    close(fd);
+    free(text);
+
+    if (rc < 0)
+        fprintf(stderr, "physlabd оборвал соединение\n");
+    else if (rc > 0)
+        fprintf(stderr, "%s: %s\n", input, reply);
+    else {
+        if (repeat > 1)
+            fprintf(stderr, "%zu requests in %.3f s: %.0f requests/s\n", repeat, elapsed,
+                    elapsed > 0 ? (double) repeat / elapsed : 0.0);
+        FILE *fp = output ? fopen(output, "wb") : stdout;
+        if (!fp) {
+            fprintf(stderr, "cannot open %s for writing\n", output);
+            rc = -1;
+        } else {
+            if (fwrite(reply, 1, reply_len, fp) != reply_len)
+                rc = -1;
+            if (fp != stdout && fclose(fp))
+                rc = -1;
+        }
+    }
+    free(reply);
+    return rc ? 1 : 0;
+}
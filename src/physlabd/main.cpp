@@ -0,0 +1,331 @@
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "ast.h"
+#include "base.h"
+#include "backend.h"
+#include "frontend.h"
+#include "io_utils.h"
+#include "logger.h"
+#include "middleend.h"
+#include "physlabd.h"
+
+namespace REQUEST {
+    enum REQUEST {
+        AST, ASM, C, ELF,
+    };
+}
+
+global volatile sig_atomic_t g_stop = 0;
+
+function void usage(const char *prog);
+function void on_signal(int sig);
+function int parse_request(const char *line, REQUEST::REQUEST *kind, size_t *unroll, size_t *size);
+function int compile(FRONT_COMPL_T *front, REQUEST::REQUEST kind, size_t unroll,
+                     const char *text, size_t size, FILE *out, const char **error);
+function int send_error(int fd, const char *error, const char *details, size_t details_len);
+function int serve_client(int fd, FRONT_COMPL_T *front);
+function int open_socket(const char *path);
+function int init_log(const char *argv0);
+
+function void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [--socket path] [--cache dir]\n", prog ? prog : "physlabd");
+}
+
+function void on_signal(int sig) {
+    (void) sig;
+    g_stop = 1;
+}
+
+/**
+ * @brief Разбирает заголовок "<вид> <unroll> <байт>".
+ * @return 0 при успехе, -1 при ошибке.
+ */
+function int parse_request(const char *line, REQUEST::REQUEST *kind, size_t *unroll, size_t *size) {
+    local const struct {const char *name; REQUEST::REQUEST kind;} kinds[] = {
+        {"ast", REQUEST::AST}, {"asm", REQUEST::ASM}, {"c", REQUEST::C}, {"elf", REQUEST::ELF},
+    };
+    char name[8] = "";
+    unsigned long long u = 0, s = 0;
+    if (sscanf(line, "%7s %llu %llu", name, &u, &s) != 3 || s > PHYSLABD_MAX_BODY)
+        return -1;
+    for (size_t i = 0; i < ARRAY_COUNT(kinds); ++i) {
+        if (strcmp(name, kinds[i].name) == 0) {
+            *kind = kinds[i].kind;
+            *unroll = (size_t) u;
+            *size = (size_t) s;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Компилирует исходник в out: фронтенд, для всего кроме ast - middleend и бэкенд.
+ *
+ * Текст .ast и есть граница между фронтендом и бэкендом, как у отдельных программ,
+ * поэтому результат совпадает с frontend + backend побайтно.
+ * @param error[out] краткое описание ошибки для ответа ERR.
+ * @return 0 при успехе, -1 при ошибке.
+ */
+function int compile(FRONT_COMPL_T *front, REQUEST::REQUEST kind, size_t unroll,
+                     const char *text, size_t size, FILE *out, const char **error) {
+    if (lexer_from_buffer(front, "<physlabd>", text, size)) {
+        *error = "lexer failed";
+        return -1;
+    }
+    if (parse_tokens(front)) {
+        *error = "parser failed";
+        return -1;
+    }
+    if (kind == REQUEST::AST) {
+        if (write_ast(front, out)) {
+            *error = "save failed";
+            return -1;
+        }
+        return 0;
+    }
+
+    char *ast = nullptr;
+    size_t ast_len = 0;
+    FILE *ast_fp = open_memstream(&ast, &ast_len);
+    if (!ast_fp) {
+        *error = "out of memory";
+        return -1;
+    }
+    int rc = write_ast(front, ast_fp);
+    if (fclose(ast_fp))
+        rc = -1;
+    NODE_T *root = nullptr;
+    varlist::VarList vars = {};
+    if (rc || load_ast_from_buffer(ast, ast_len, &root, &vars)) {
+        free(ast);
+        *error = "failed to load AST";
+        return -1;
+    }
+    free(ast);
+
+    if (eliminate_dead_code(root, &vars)) {
+        *error = "dead code elimination failed";
+        rc = -1;
+    } else if (optimize_loops(root, &vars, unroll)) {
+        *error = "loop optimization failed";
+        rc = -1;
+    } else {
+        rc = kind == REQUEST::ELF ? emit_elf_object(root, &vars, out) :
+             kind == REQUEST::C ? emit_c_source(root, &vars, out) : reverse_program(root, &vars, out);
+        if (rc)
+            *error = "code generation failed";
+    }
+    destroy_ast(root, &vars);
+    return rc ? -1 : 0;
+}
+
+/**
+ * @brief Отвечает ERR: краткое описание, а с новой строки - сообщения лексера или парсера.
+ * @return 0 при успехе, -1 при ошибке записи.
+ */
+function int send_error(int fd, const char *error, const char *details, size_t details_len) {
+    size_t len = strlen(error);
+    while (details_len && details[details_len - 1] == '\n')
+        --details_len;
+    if (!details_len || len + 1 + details_len > PHYSLABD_MAX_BODY)
+        return physlabd_send(fd, "ERR", error, len);
+    char *body = TYPED_CALLOC(len + 1 + details_len, char);
+    if (!body)
+        return physlabd_send(fd, "ERR", error, len);
+    memcpy(body, error, len);
+    body[len] = '\n';
+    memcpy(body + len + 1, details, details_len);
+    int rc = physlabd_send(fd, "ERR", body, len + 1 + details_len);
+    free(body);
+    return rc;
+}
+
+/**
+ * @brief Обслуживает запросы одного соединения, пока клиент их шлет.
+ * @return 0, если клиент закрыл соединение между запросами, -1 при ошибке протокола или записи.
+ */
+function int serve_client(int fd, FRONT_COMPL_T *front) {
+    char line[PHYSLABD_HEADER_CAP] = "";
+    char *text = nullptr;
+    size_t text_cap = 0;
+    int rc = 0;
+    while (!g_stop) {
+        rc = physlabd_read_header(fd, line);
+        if (rc) {
+            rc = rc == 1 ? 0 : -1;
+            break;
+        }
+        REQUEST::REQUEST kind = REQUEST::ASM;
+        size_t unroll = 0, size = 0;
+        if (parse_request(line, &kind, &unroll, &size)) {
+            const char msg[] = "bad request header";
+            physlabd_send(fd, "ERR", msg, sizeof(msg) - 1);
+            rc = -1;
+            break;
+        }
+        if (size + 1 > text_cap) {
+            char *tmp = TYPED_REALLOC(text, size + 1, char);
+            if (!tmp) {
+                rc = -1;
+                break;
+            }
+            text = tmp;
+            text_cap = size + 1;
+        }
+        if (physlabd_read_full(fd, text, size)) {
+            rc = -1;
+            break;
+        }
+        text[size] = '\0';
+
+        char *result = nullptr, *details = nullptr;
+        size_t result_len = 0, details_len = 0;
+        FILE *out = open_memstream(&result, &result_len);
+        /* место ошибки из лексера и парсера уходит клиенту, а не в stderr демона */
+        front->errors = open_memstream(&details, &details_len);
+        const char *error = "out of memory";
+        int status = out && front->errors ? compile(front, kind, unroll, text, size, out, &error) : -1;
+        if (front->errors)
+            fclose(front->errors);
+        front->errors = nullptr;
+        if (out && fclose(out) && !status) {
+            error = "write failed";
+            status = -1;
+        }
+        if (!status && result_len > PHYSLABD_MAX_BODY) {
+            error = "result too large";
+            status = -1;
+        }
+        rc = status ? send_error(fd, error, details, details_len) :
+                      physlabd_send(fd, "OK", result, result_len);
+        free(result);
+        free(details);
+        if (rc)
+            break;
+    }
+    free(text);
+    return rc;
+}
+
+/**
+ * @brief Создает слушающий сокет; файл оставшегося от прошлого запуска сокета удаляется.
+ * @return дескриптор или -1 при ошибке.
+ */
+function int open_socket(const char *path) {
+    struct sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "слишком длинный путь сокета %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+    unlink(path);
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) || listen(fd, 16)) {
+        fprintf(stderr, "не удалось слушать %s: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * @brief Открывает лог в <каталог программы>/log, как frontend.
+ * @return 0 при успехе, -1 при ошибке.
+ */
+function int init_log(const char *argv0) {
+    char exe_path[PATH_MAX] = ".";
+    if (!argv0 || realpath(argv0, exe_path) == nullptr)
+        strncpy(exe_path, ".", sizeof(exe_path));
+    char *slash = strrchr(exe_path, '/');
+    if (slash)
+        *slash = '\0';
+
+    char logdir[PATH_MAX] = "";
+    snprintf(logdir, sizeof(logdir), "%s/log", exe_path);
+    if (create_folder_if_not_exists(logdir) != 0) {
+        fprintf(stderr, "cannot create log directory \"%s\"\n", logdir);
+        return -1;
+    }
+    if (init_logger(logdir) != 0) {
+        fprintf(stderr, "cannot init logger at \"%s\"\n", logdir);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief CLI: physlabd [--socket path] [--cache dir].
+ *
+ * Принимает запросы клиента physlab по Unix-сокету (протокол в include/physlabd.h)
+ * и обслуживает их по одному. Между запросами остаются логгер, кэш функций бэкенда
+ * и массив токенов фронтенда, в котором живут узлы AST. Дампы dot/svg не строятся.
+ * SIGINT/SIGTERM завершают работу и удаляют сокет.
+ */
+int main(int argc, char **argv) {
+    const char *socket_path = PHYSLABD_SOCKET;
+    const char *cache_dir = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc)
+            socket_path = argv[++i];
+        else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc)
+            cache_dir = argv[++i];
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (init_log(argc ? argv[0] : nullptr))
+        return 1;
+    if (cache_dir && backend_set_cache(cache_dir)) {
+        destruct_logger();
+        return 1;
+    }
+    int listen_fd = open_socket(socket_path);
+    if (listen_fd < 0) {
+        destruct_logger();
+        return 1;
+    }
+
+    struct sigaction sa = {};
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, nullptr);
+    sigaction(SIGTERM, &sa, nullptr);
+    signal(SIGPIPE, SIG_IGN);
+    fprintf(stderr, "physlabd: listening on %s\n", socket_path);
+
+    FRONT_COMPL_T front = {};
+    int rc = 0;
+    while (!g_stop) {
+        int fd = accept(listen_fd, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            perror("accept");
+            rc = -1;
+            break;
+        }
+        if (serve_client(fd, &front))
+            fprintf(stderr, "physlabd: connection dropped\n");
+        close(fd);
+    }
+
+    close(listen_fd);
+    unlink(socket_path);
+    lexer_reset(&front);
+    destruct_logger();
+    return rc ? 1 : 0;
+}
@@ -439,14 +439,14 @@ function NODE_T *extract_res(NODE_T *root) {
     return nullptr;
 }
 
-int reverse_program(NODE_T *root, varlist::VarList *vars, FILE *out) {
+int emit_physlab(NODE_T *root, varlist::VarList *vars, FILE *out) {
     if (!root || !vars || !out)
         return -1;
 
     size_t sym_cap = varlist::size(vars);
     char *known = nullptr;
     if (sym_cap) {
-        known = (char *) calloc(sym_cap, sizeof(char));
+        known = TYPED_CALLOC(sym_cap, char);
         if (!known)
             return -1;
     }
@@ -0,0 +1,71 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "base.h"
+#include "vm.h"
+
+/* Рантайм объектных файлов backend --target=elf: ввод-вывод и видеопамять как у SPU.
+   Сборка: c++ -O2 -I../include -c physlab_rt.cpp && cc prog.o physlab_rt.o -lm -o prog */
+global double g_ram[VM_RAM_SIZE];
+
+function void fail(const char *err) {
+    fflush(stdout);
+    fprintf(stderr, "ошибка исполнения: %s\n", err);
+    exit(1);
+}
+
+/**
+ * @brief Следующее число из stdin; разделители - пробельные, ',' и ';', как в CSV spu --input.
+ */
+extern "C" double physlab_in(void) {
+    int ch = getchar_unlocked();
+    while (ch == ',' || ch == ';' || ch == ' ' || ch == '\t' || ch == '\r' || ch == '\n')
+        ch = getchar_unlocked();
+    char token[64] = "";
+    size_t len = 0;
+    while (ch != EOF && ch != ',' && ch != ';' && ch != ' ' && ch != '\t' && ch != '\r' && ch != '\n') {
+        if (len + 1 < sizeof(token)) token[len++] = (char) ch;
+        ch = getchar_unlocked();
+    }
+    char *end = nullptr;
+    double value = strtod(token, &end);
+    if (!len || end != token + len)
+        fail("IN: нет числа во входных данных");
+    return value;
+}
+
+extern "C" double physlab_out(double value) {
+    printf("%.15g\n", value);
+    return value;
+}
+
+extern "C" double physlab_set_pixel(double value, double index) {
+    if (!(index >= 0) || index >= (double) VM_RAM_SIZE)
+        fail("адрес памяти вне диапазона");
+    g_ram[(size_t) index] = value;
+    return value;
+}
+
+/**
+ * @brief Кадр символами в stdout и пауза delay_ms - как DRAW в spu без --frames.
+ */
+extern "C" double physlab_draw(double delay_ms) {
+    for (size_t y = 0; y < VM_FRAME_H; ++y) {
+        for (size_t x = 0; x < VM_FRAME_W; ++x) {
+            int ch = (int) g_ram[y * VM_FRAME_W + x];
+            putchar((ch >= 32 && ch < 127) ? ch : ' ');
+        }
+        putchar('\n');
+    }
+    fflush(stdout);
+    if (delay_ms > 0) {
+        struct timespec ts = {};
+        ts.tv_sec = (time_t) (delay_ms / 1000);
+        ts.tv_nsec = (long) (fmod(delay_ms, 1000) * 1e6);
+        nanosleep(&ts, nullptr);
+    }
+    return 0;
+}
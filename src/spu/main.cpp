@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "base.h"
+#include "vm.h"
+
+/** Предел --parallel. */
+const unsigned long MAX_THREADS = 256;
+
+function void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [--no-fuse] [--stats] [--profile out.profile] [--input in.csv|in.bin]\n"
+                    "          [--output out.txt|out.bin] [--parallel N] [--frames out.ppm|--headless] <program.spu>\n",
+            prog ? prog : "spu");
+}
+
+function double now_sec(void) {
+    struct timespec ts = {};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
+
+/**
+ * @brief CLI: spu [--no-fuse] [--stats] [--profile out.profile] [--input file] [--output file]
+ *            [--parallel N] [--frames out.ppm|--headless] <program.spu>.
+ *
+ * Без --input IN читает stdin, без --output OUT пишет в stdout. --parallel N исполняет
+ * циклы с независимыми итерациями (метки rows_* от бэкенда) в N потоков.
+ * DRAW без ключей печатает кадр символами и ждет; с --frames кадры пишутся потоком PPM
+ * без ожидания, с --headless только считаются.
+ */
+int main(int argc, char **argv) {
+    const char *input = nullptr;
+    const char *profile_path = nullptr;
+    const char *input_path = nullptr;
+    const char *output_path = nullptr;
+    const char *frames_path = nullptr;
+    bool headless = false;
+    bool fuse = true;
+    bool print_stats = false;
+    size_t threads = 1;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--no-fuse") == 0)
+            fuse = false;
+        else if (strcmp(argv[i], "--stats") == 0)
+            print_stats = true;
+        else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc)
+            profile_path = argv[++i];
+        else if (strcmp(argv[i], "--input") == 0 && i + 1 < argc)
+            input_path = argv[++i];
+        else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+            output_path = argv[++i];
+        else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+            frames_path = argv[++i];
+        else if (strcmp(argv[i], "--headless") == 0)
+            headless = true;
+        else if (strcmp(argv[i], "--parallel") == 0 && i + 1 < argc) {
+            char *end = nullptr;
+            unsigned long val = strtoul(argv[++i], &end, 10);
+            if (!end || *end || !val || val > MAX_THREADS) {
+                usage(argv[0]);
+                return 1;
+            }
+            threads = (size_t) val;
+        }
+        else if (!input && argv[i][0])
+            input = argv[i];
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (!input || (frames_path && headless)) {
+        usage(argc ? argv[0] : "spu");
+        return 1;
+    }
+
+    vm_image_t image = {};
+    if (vm_load_file(input, &image))
+        return 1;
+    if (profile_path && !image.symbol_count)
+        fprintf(stderr, "%s has no symbol table, profile will be empty\n", input);
+
+    /* метки нужны декодеру для профиля и для циклов rows_* (--parallel): иначе они лишь мешают слиянию */
+    vm_symbol_t *symbols = TYPED_CALLOC(image.symbol_count + 1, vm_symbol_t);
+    size_t symbol_count = 0;
+    for (size_t i = 0; symbols && i < image.symbol_count; ++i) {
+        if (profile_path || (threads > 1 && strncmp(image.symbols[i].name, "rows_", 5) == 0))
+            symbols[symbol_count++] = image.symbols[i];
+    }
+    vm_program_t prog = {};
+    int rc = symbols ? vm_decode(image.words, image.count, symbols, symbol_count, fuse, &prog) : -1;
+    free(symbols);
+    if (rc) {
+        fprintf(stderr, "cannot decode %s\n", input);
+        vm_free_image(&image);
+        return 1;
+    }
+
+    vm_stats_t stats = {};
+    if (profile_path) {
+        stats.hits = TYPED_CALLOC(prog.size + 1, uint64_t);
+        stats.taken = TYPED_CALLOC(prog.size + 1, uint64_t);
+        if (!stats.hits || !stats.taken) rc = -1;
+    }
+    vm_io_t io = {};
+    vm_io_init(&io, stdin, stdout);
+    if (!rc && input_path)
+        rc = vm_io_open_input(&io, input_path);
+    if (!rc && output_path)
+        rc = vm_io_open_output(&io, output_path);
+    vm_frames_t frames = {};
+    bool use_frames = frames_path || headless;
+    if (!rc && use_frames) {
+        rc = vm_frames_open(&frames, frames_path);
+        if (!rc) io.frames = &frames;
+    }
+    double start = now_sec();
+    if (!rc)
+        rc = vm_run_parallel(&prog, &io, &stats, threads);
+    if (use_frames && vm_frames_close(&frames))
+        rc = -1;
+    double elapsed = now_sec() - start;
+    if (vm_io_close(&io))
+        rc = -1;
+    if (print_stats) {
+        fprintf(stderr, "instructions: %zu decoded (%zu fused), %llu executed, %llu dispatches\n",
+                prog.size, prog.fused, (unsigned long long) stats.executed, (unsigned long long) stats.dispatches);
+        if (use_frames)
+            fprintf(stderr, "frames: %llu (%llu dirty cells), %.1f frames/s\n", (unsigned long long) frames.frames,
+                    (unsigned long long) frames.dirty_cells, elapsed > 0 ? (double) frames.frames / elapsed : 0.0);
+        alloc_stats_dump(stderr);
+    }
+
+    if (!rc && profile_path) {
+        FILE *fp = fopen(profile_path, "w");
+        if (!fp || vm_write_profile(&prog, &stats, fp)) {
+            fprintf(stderr, "cannot write profile %s\n", profile_path);
+            rc = -1;
+        }
+        if (fp) fclose(fp);
+    }
+
+    free(stats.hits);
+    free(stats.taken);
+    vm_destruct(&prog);
+    vm_free_image(&image);
+    return rc ? 1 : 0;
+}
@@ -0,0 +1,1004 @@
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "base.h"
+#include "io_utils.h"
+#include "vm.h"
+
+/** Строк за раунд параллельного цикла: потоки запускаются заново на каждый раунд. */
+const size_t VM_ROWS_PER_ROUND = 1 << 16;
+/** Столько итераций цикл исполняется последовательно, прежде чем звать потоки. */
+const uint64_t VM_ROWS_PROBE = 256;
+const size_t VM_ROW_MAX_IVS = 4;
+/** До 2^53 double представляет целые точно: счетчик v0 + r * step совпадает с суммой шагов. */
+const double VM_EXACT_INT = 9007199254740992.0;
+
+typedef struct {
+    uint8_t  op;
+    uint8_t  reg;
+    double   imm;
+    size_t   target_word;
+} src_insn_t;
+
+typedef struct {
+    double      regs[SPU_REGISTERS];
+    double     *ram;
+    double     *stack;
+    size_t     *calls;
+    size_t      sp, csp, pc;
+    bool        own_ram;
+    vm_rect_t   dirty;          /**< Ячейки видеопамяти, измененные после последнего DRAW. */
+    uint64_t    dispatches;
+    uint64_t    executed;
+    const char *err;
+} vm_state_t;
+
+/**
+ * @brief Цикл, итерации которого бэкенд признал независимыми (analyze_row_loop).
+ */
+typedef struct {
+    size_t   id;
+    size_t   start, end;        /**< Команды меток rows_<id>_... и rows_<id>_end. */
+    size_t   inputs;            /**< IN за итерацию. */
+    uint8_t  reg[VM_ROW_MAX_IVS];
+    double   step[VM_ROW_MAX_IVS];
+    size_t   iv_count;
+    /* условие: reg[cond_iv] + offset cc граница (bound_reg или bound) */
+    size_t   cond_iv;
+    double   offset;
+    unsigned cc;                /**< SPU_OP::JB, JBE, JA или JAE. */
+    int      bound_reg;         /**< -1 - граница - число bound. */
+    double   bound;
+    uint64_t visits;            /**< Итераций с последнего входа, пока цикл идет последовательно. */
+} vm_row_loop_t;
+
+/**
+ * @brief Непрерывный кусок строк раунда для одного потока.
+ */
+typedef struct {
+    const vm_program_t  *prog;
+    const vm_row_loop_t *loop;
+    const vm_insn_t     *traps;
+    vm_state_t           state;
+    vm_io_t              io;
+    size_t               rows;
+    size_t               done;
+    bool                 ended;     /**< Условие цикла ложно перед строкой done. */
+    int                  rc;
+} vm_shard_t;
+
+function bool has_imm_word(unsigned op);
+function bool is_jump(unsigned op);
+function bool is_arith(unsigned op);
+function int read_symbols(const char *path, const char *data, size_t len, vm_image_t *image);
+function int decode_words(const uint64_t *words, size_t count, src_insn_t **out, size_t *out_count, size_t **word_map);
+function size_t try_fuse(const src_insn_t *src, size_t n, size_t i, const bool *is_target, vm_insn_t *insn);
+function bool compare(unsigned cc, double a, double b);
+function void draw_frame(const double *ram, FILE *out, double delay_ms);
+function bool is_conditional(unsigned op);
+function int state_init(vm_state_t *st, double *shared_ram);
+function void state_free(vm_state_t *st);
+function void report_error(const vm_state_t *st);
+function int exec(const vm_program_t *prog, vm_state_t *st, vm_io_t *io, vm_stats_t *stats, const vm_insn_t *traps);
+function int parse_row_condition(const char *p, vm_row_loop_t *loop);
+function size_t parse_row_loops(const vm_program_t *prog, vm_row_loop_t *loops, size_t cap);
+function size_t rows_left(const vm_row_loop_t *loop, const vm_state_t *st, size_t cap);
+function void *run_shard(void *arg);
+function int run_rows(const vm_program_t *prog, vm_row_loop_t *loop, const vm_insn_t *traps,
+                      vm_state_t *st, vm_io_t *io, size_t threads);
+
+function bool has_imm_word(unsigned op) {
+    return op == SPU_OP::PUSH || op == SPU_OP::DRAW || is_jump(op) || op == SPU_OP::CALL;
+}
+
+function bool is_jump(unsigned op) {
+    return op >= SPU_OP::JMP && op <= SPU_OP::JAE;
+}
+
+function bool is_arith(unsigned op) {
+    return op == SPU_OP::ADD || op == SPU_OP::SUB || op == SPU_OP::MUL || op == SPU_OP::DIV;
+}
+
+/**
+ * @brief Читает необязательную таблицу символов после кода (формат в spu.h).
+ */
+function int read_symbols(const char *path, const char *data, size_t len, vm_image_t *image) {
+    if (len < sizeof(uint64_t)) return 0;
+    uint64_t count = 0;
+    memcpy(&count, data, sizeof(count));
+    if (count > len / (2 * sizeof(uint64_t))) {
+        fprintf(stderr, "%s: испорчена таблица символов\n", path);
+        return -1;
+    }
+    image->symbols = TYPED_CALLOC(count ? count : 1, vm_symbol_t);
+    image->names = TYPED_CALLOC(len, char);
+    if (!image->symbols || !image->names) return -1;
+
+    size_t pos = sizeof(uint64_t);
+    char *dst = image->names;
+    for (uint64_t i = 0; i < count; ++i) {
+        uint64_t meta[2] = {};
+        if (pos + sizeof(meta) > len) {
+            fprintf(stderr, "%s: испорчена таблица символов\n", path);
+            return -1;
+        }
+        memcpy(meta, data + pos, sizeof(meta));
+        pos += sizeof(meta);
+        size_t padded = (size_t) ((meta[1] + 7) / 8 * 8);
+        if (meta[1] > len || pos + padded > len || meta[0] > image->count) {
+            fprintf(stderr, "%s: испорчена таблица символов\n", path);
+            return -1;
+        }
+        memcpy(dst, data + pos, (size_t) meta[1]);
+        image->symbols[i].addr = (size_t) meta[0];
+        image->symbols[i].name = dst;
+        dst += meta[1] + 1;
+        pos += padded;
+    }
+    image->symbol_count = (size_t) count;
+    return 0;
+}
+
+int vm_load_file(const char *path, vm_image_t *image) {
+    if (!path || !image) return -1;
+    *image = {};
+    size_t len = 0;
+    char *buf = read_file_to_buf(path, &len);
+    if (!buf) {
+        fprintf(stderr, "не удалось прочитать %s\n", path);
+        return -1;
+    }
+    spu_header_t hdr = {};
+    if (len < sizeof(hdr)) {
+        fprintf(stderr, "%s: файл короче заголовка\n", path);
+        free(buf);
+        return -1;
+    }
+    memcpy(&hdr, buf, sizeof(hdr));
+    if (hdr.signature != SPU_SIGNATURE || hdr.version != SPU_VERSION) {
+        fprintf(stderr, "%s: неверная сигнатура или версия байт-кода\n", path);
+        free(buf);
+        return -1;
+    }
+    if (hdr.byte_count % sizeof(uint64_t) || hdr.byte_count > len - sizeof(hdr)) {
+        fprintf(stderr, "%s: размер кода не совпадает с заголовком\n", path);
+        free(buf);
+        return -1;
+    }
+    image->count = hdr.byte_count / sizeof(uint64_t);
+    image->words = TYPED_CALLOC(image->count ? image->count : 1, uint64_t);
+    if (!image->words) {
+        free(buf);
+        return -1;
+    }
+    memcpy(image->words, buf + sizeof(hdr), hdr.byte_count);
+
+    size_t tail = sizeof(hdr) + hdr.byte_count;
+    int rc = read_symbols(path, buf + tail, len - tail, image);
+    free(buf);
+    if (rc)
+        vm_free_image(image);
+    return rc;
+}
+
+void vm_free_image(vm_image_t *image) {
+    if (!image) return;
+    free(image->words);
+    free(image->symbols);
+    free(image->names);
+    *image = {};
+}
+
+/**
+ * @brief Разбирает слова в команды SPU; word_map[слово] = индекс команды или SIZE_MAX.
+ *
+ * word_map имеет count + 1 элементов: метка может стоять за последней командой.
+ */
+function int decode_words(const uint64_t *words, size_t count, src_insn_t **out, size_t *out_count, size_t **word_map) {
+    src_insn_t *src = TYPED_CALLOC(count ? count : 1, src_insn_t);
+    size_t *map = TYPED_CALLOC(count + 1, size_t);
+    if (!src || !map) {
+        free(src);
+        free(map);
+        return -1;
+    }
+    for (size_t w = 0; w <= count; ++w)
+        map[w] = SIZE_MAX;
+
+    size_t n = 0;
+    for (size_t w = 0; w < count; ) {
+        unsigned op = SPU_WORD_OP(words[w]);
+        unsigned reg = SPU_WORD_REG(words[w]);
+        if (op >= SPU_OP::COUNT || reg >= SPU_REGISTERS) {
+            fprintf(stderr, "слово %zu: неизвестная команда %u или регистр %u\n", w, op, reg);
+            free(src);
+            free(map);
+            return -1;
+        }
+        map[w] = n;
+        src[n].op = (uint8_t) op;
+        src[n].reg = (uint8_t) reg;
+        ++w;
+        if (has_imm_word(op)) {
+            if (w >= count) {
+                fprintf(stderr, "слово %zu: команда без операнда в конце кода\n", w - 1);
+                free(src);
+                free(map);
+                return -1;
+            }
+            if (op == SPU_OP::PUSH || op == SPU_OP::DRAW)
+                memcpy(&src[n].imm, &words[w], sizeof(double));
+            else
+                src[n].target_word = (size_t) words[w];
+            ++w;
+        }
+        ++n;
+    }
+    /* метка после последней команды */
+    map[count] = n;
+    *out = src;
+    *out_count = n;
+    *word_map = map;
+    return 0;
+}
+
+/**
+ * @brief Пробует слить команды с i-й в суперинструкцию.
+ * @return число поглощенных команд SPU или 0.
+ */
+function size_t try_fuse(const src_insn_t *src, size_t n, size_t i, const bool *is_target, vm_insn_t *insn) {
+    const src_insn_t *s = src + i;
+    size_t avail = n - i;
+    /* в середину шаблона не должен вести переход */
+    size_t clean = 1;
+    while (clean < avail && clean < 4 && !is_target[i + clean])
+        ++clean;
+
+    if (clean >= 4 && s[0].op == SPU_OP::PUSHR && is_arith(s[2].op) && s[3].op == SPU_OP::POPR) {
+        unsigned k = s[2].op - SPU_OP::ADD;
+        insn->a = s[0].reg;
+        insn->c = s[3].reg;
+        if (s[1].op == SPU_OP::PUSHR) {
+            insn->op = (uint8_t) (VM_OP::ADDRRR + k);
+            insn->b = s[1].reg;
+            return 4;
+        }
+        if (s[1].op == SPU_OP::PUSH) {
+            insn->imm = s[1].imm;
+            if (s[0].reg == s[3].reg && (s[2].op == SPU_OP::ADD || s[2].op == SPU_OP::SUB)) {
+                insn->op = VM_OP::INCR;
+                if (s[2].op == SPU_OP::SUB) insn->imm = -insn->imm;
+            } else {
+                insn->op = (uint8_t) (VM_OP::ADDRIR + k);
+            }
+            return 4;
+        }
+    }
+    if (clean >= 3 && s[0].op == SPU_OP::PUSHR && is_jump(s[2].op) && s[2].op != SPU_OP::JMP &&
+        (s[1].op == SPU_OP::PUSHR || s[1].op == SPU_OP::PUSH)) {
+        insn->op = (s[1].op == SPU_OP::PUSHR) ? VM_OP::CMPJRR : VM_OP::CMPJRI;
+        insn->a = s[0].reg;
+        insn->b = s[1].reg;
+        insn->imm = s[1].imm;
+        insn->cc = s[2].op;
+        insn->target = s[2].target_word;
+        return 3;
+    }
+    if (clean >= 2 && s[1].op == SPU_OP::POPR && (s[0].op == SPU_OP::PUSH || s[0].op == SPU_OP::PUSHR)) {
+        insn->op = (s[0].op == SPU_OP::PUSH) ? VM_OP::MOVRI : VM_OP::MOVRR;
+        insn->a = s[0].reg;
+        insn->imm = s[0].imm;
+        insn->c = s[1].reg;
+        return 2;
+    }
+    return 0;
+}
+
+int vm_decode(const uint64_t *words, size_t count, const vm_symbol_t *symbols, size_t symbol_count,
+              bool fuse, vm_program_t *prog) {
+    if (!words || !prog) return -1;
+    *prog = {};
+    src_insn_t *src = nullptr;
+    size_t n = 0;
+    size_t *word_map = nullptr;
+    if (decode_words(words, count, &src, &n, &word_map)) return -1;
+
+    int rc = 0;
+    bool *is_target = TYPED_CALLOC(n + 1, bool);
+    size_t *src_map = TYPED_CALLOC(n + 1, size_t);
+    prog->code = TYPED_CALLOC(n ? n : 1, vm_insn_t);
+    prog->labels = TYPED_CALLOC(symbol_count ? symbol_count : 1, vm_symbol_t);
+    if (!is_target || !src_map || !prog->code || !prog->labels) rc = -1;
+
+    for (size_t i = 0; i < symbol_count && !rc; ++i) {
+        size_t w = symbols[i].addr;
+        if (w > count || word_map[w] == SIZE_MAX) {
+            fprintf(stderr, "метка %s не попадает на начало команды\n", symbols[i].name);
+            rc = -1;
+            break;
+        }
+        is_target[word_map[w]] = true;
+        prog->labels[prog->label_count].name = symbols[i].name;
+        prog->labels[prog->label_count].addr = word_map[w];
+        prog->label_count++;
+    }
+
+    /* адреса переходов - индексы слов; переводим в индексы команд */
+    for (size_t i = 0; i < n && !rc; ++i) {
+        if (!is_jump(src[i].op) && src[i].op != SPU_OP::CALL) continue;
+        size_t w = src[i].target_word;
+        if (w > count || word_map[w] == SIZE_MAX) {
+            fprintf(stderr, "команда %zu: переход на %zu не попадает на начало команды\n", i, w);
+            rc = -1;
+            break;
+        }
+        src[i].target_word = word_map[w];
+        is_target[word_map[w]] = true;
+    }
+
+    for (size_t i = 0; i < n && !rc; ) {
+        vm_insn_t *insn = &prog->code[prog->size];
+        size_t width = fuse ? try_fuse(src, n, i, is_target, insn) : 0;
+        if (!width) {
+            insn->op = src[i].op;
+            insn->a = insn->c = src[i].reg;
+            insn->imm = src[i].imm;
+            insn->target = src[i].target_word;
+            width = 1;
+        } else {
+            prog->fused += width;
+        }
+        insn->width = (uint8_t) width;
+        for (size_t k = 0; k < width; ++k)
+            src_map[i + k] = prog->size;
+        prog->size++;
+        i += width;
+    }
+    src_map[n] = prog->size;
+
+    for (size_t i = 0; i < prog->label_count && !rc; ++i)
+        prog->labels[i].addr = src_map[prog->labels[i].addr];
+    for (size_t i = 0; i < prog->size && !rc; ++i) {
+        vm_insn_t *insn = &prog->code[i];
+        if (is_jump(insn->op) || insn->op == SPU_OP::CALL || insn->op == VM_OP::CMPJRR || insn->op == VM_OP::CMPJRI)
+            insn->target = src_map[insn->target];
+    }
+
+    free(src);
+    free(word_map);
+    free(is_target);
+    free(src_map);
+    if (rc)
+        vm_destruct(prog);
+    return rc;
+}
+
+function bool compare(unsigned cc, double a, double b) {
+    switch (cc) {
+        case SPU_OP::JE:  return a == b;
+        case SPU_OP::JNE: return a != b;
+        case SPU_OP::JB:  return a < b;
+        case SPU_OP::JA:  return a > b;
+        case SPU_OP::JBE: return a <= b;
+        case SPU_OP::JAE: return a >= b;
+        default:          return true;
+    }
+}
+
+/**
+ * @brief Печатает видеопамять символами (код ячейки) и ждет delay_ms.
+ */
+function void draw_frame(const double *ram, FILE *out, double delay_ms) {
+    for (size_t y = 0; y < VM_FRAME_H; ++y) {
+        for (size_t x = 0; x < VM_FRAME_W; ++x) {
+            int ch = (int) ram[y * VM_FRAME_W + x];
+            fputc((ch >= 32 && ch < 127) ? ch : ' ', out);
+        }
+        fputc('\n', out);
+    }
+    fflush(out);
+    if (delay_ms > 0) {
+        struct timespec ts = {};
+        ts.tv_sec = (time_t) (delay_ms / 1000);
+        ts.tv_nsec = (long) (fmod(delay_ms, 1000) * 1e6);
+        nanosleep(&ts, nullptr);
+    }
+}
+
+#define VM_PUSH(val)                                                 \
+    do {                                                             \
+        if (sp >= VM_STACK_SIZE) { err = "переполнение стека"; goto fail; } \
+        stack[sp++] = (val);                                         \
+    } while (0)
+
+#define VM_BRANCH(cond)                                              \
+    do {                                                             \
+        if (cond) {                                                  \
+            if (taken) taken[pc - 1]++;                              \
+            pc = insn->target;                                       \
+        }                                                            \
+    } while (0)
+
+#define VM_POP(dst)                                                  \
+    do {                                                             \
+        if (!sp) { err = "чтение из пустого стека"; goto fail; }      \
+        (dst) = stack[--sp];                                         \
+    } while (0)
+
+/**
+ * @brief Исполняет команды с st->pc до HLT или до ROWSTOP.
+ *
+ * ROWSTOP, с которого начинается вызов, исполняет замененную команду traps[target],
+ * так что из точки остановки исполнение продолжается тем же вызовом.
+ *
+ * @return 0 - HLT, 1 - остановка на ROWSTOP (st->pc указывает на него), -1 - ошибка (текст в st->err).
+ */
+function int exec(const vm_program_t *prog, vm_state_t *st, vm_io_t *io, vm_stats_t *stats, const vm_insn_t *traps) {
+    double regs[SPU_REGISTERS] = {};
+    memcpy(regs, st->regs, sizeof(regs));
+    double *ram = st->ram, *stack = st->stack;
+    size_t *calls = st->calls;
+    size_t sp = st->sp, csp = st->csp, pc = st->pc;
+    vm_rect_t dirty = st->dirty;
+    uint64_t dispatches = 0, executed = 0;
+    uint64_t *hits = stats ? stats->hits : nullptr;
+    uint64_t *taken = stats ? stats->taken : nullptr;
+    const char *err = nullptr;
+    int rc = 0;
+
+    while (true) {
+        if (pc >= prog->size) {
+            err = "выход за конец программы без HLT";
+            goto fail;
+        }
+        if (hits) hits[pc]++;
+        const vm_insn_t *insn = &prog->code[pc++];
+        double x = 0, y = 0;
+        size_t addr = 0;
+        dispatches++;
+    redispatch:
+        executed += insn->width;
+
+        switch (insn->op) {
+            case SPU_OP::HLT:
+                rc = 0;
+                goto done;
+            case SPU_OP::PUSH:  VM_PUSH(insn->imm); break;
+            case SPU_OP::PUSHR: VM_PUSH(regs[insn->a]); break;
+            case SPU_OP::POPR:  VM_POP(regs[insn->c]); break;
+            case SPU_OP::PUSHM:
+            case SPU_OP::POPM:
+                /* проверка до приведения: double вне [0, VM_RAM_SIZE) и NaN в size_t не приводятся */
+                if (!(regs[insn->a] >= 0 && regs[insn->a] < (double) VM_RAM_SIZE)) {
+                    err = "адрес памяти вне диапазона";
+                    goto fail;
+                }
+                addr = (size_t) regs[insn->a];
+                if (insn->op == SPU_OP::PUSHM) {
+                    VM_PUSH(ram[addr]);
+                } else {
+                    VM_POP(ram[addr]);
+                    if (addr < VM_FRAME_CELLS) vm_rect_add(&dirty, addr);
+                }
+                break;
+            case SPU_OP::ADD: VM_POP(y); VM_POP(x); VM_PUSH(x + y); break;
+            case SPU_OP::SUB: VM_POP(y); VM_POP(x); VM_PUSH(x - y); break;
+            case SPU_OP::MUL: VM_POP(y); VM_POP(x); VM_PUSH(x * y); break;
+            case SPU_OP::DIV: VM_POP(y); VM_POP(x); VM_PUSH(x / y); break;
+            case SPU_OP::MOD: VM_POP(y); VM_POP(x); VM_PUSH(fmod(x, y)); break;
+            case SPU_OP::SQRT: VM_POP(x); VM_PUSH(sqrt(x)); break;
+            case SPU_OP::SIN:  VM_POP(x); VM_PUSH(sin(x)); break;
+            case SPU_OP::COS:  VM_POP(x); VM_PUSH(cos(x)); break;
+            case SPU_OP::IN:
+                if (!io || vm_io_read(io, &x)) {
+                    err = "IN: нет числа во входных данных";
+                    goto fail;
+                }
+                VM_PUSH(x);
+                break;
+            case SPU_OP::OUT:
+                VM_POP(x);
+                if (io && vm_io_write(io, x)) {
+                    err = "OUT: ошибка записи";
+                    goto fail;
+                }
+                break;
+            case SPU_OP::JMP:
+                pc = insn->target;
+                break;
+            case SPU_OP::JE: case SPU_OP::JNE: case SPU_OP::JB:
+            case SPU_OP::JA: case SPU_OP::JBE: case SPU_OP::JAE:
+                VM_POP(y); VM_POP(x);
+                VM_BRANCH(compare(insn->op, x, y));
+                break;
+            case SPU_OP::CALL:
+                if (csp >= VM_STACK_SIZE) {
+                    err = "переполнение стека вызовов";
+                    goto fail;
+                }
+                calls[csp++] = pc;
+                pc = insn->target;
+                break;
+            case SPU_OP::RET:
+                if (!csp) {
+                    err = "RET без CALL";
+                    goto fail;
+                }
+                pc = calls[--csp];
+                break;
+            case SPU_OP::DRAW:
+                if (io && io->frames) {
+                    if (vm_frames_commit(io->frames, ram, &dirty)) {
+                        err = "DRAW: ошибка записи кадра";
+                        goto fail;
+                    }
+                } else if (io && io->screen) {
+                    vm_io_flush(io);
+                    draw_frame(ram, io->screen, insn->imm);
+                }
+                dirty = {};
+                break;
+
+            case VM_OP::ADDRRR: regs[insn->c] = regs[insn->a] + regs[insn->b]; break;
+            case VM_OP::SUBRRR: regs[insn->c] = regs[insn->a] - regs[insn->b]; break;
+            case VM_OP::MULRRR: regs[insn->c] = regs[insn->a] * regs[insn->b]; break;
+            case VM_OP::DIVRRR: regs[insn->c] = regs[insn->a] / regs[insn->b]; break;
+            case VM_OP::ADDRIR: regs[insn->c] = regs[insn->a] + insn->imm; break;
+            case VM_OP::SUBRIR: regs[insn->c] = regs[insn->a] - insn->imm; break;
+            case VM_OP::MULRIR: regs[insn->c] = regs[insn->a] * insn->imm; break;
+            case VM_OP::DIVRIR: regs[insn->c] = regs[insn->a] / insn->imm; break;
+            case VM_OP::INCR:   regs[insn->c] += insn->imm; break;
+            case VM_OP::MOVRI:  regs[insn->c] = insn->imm; break;
+            case VM_OP::MOVRR:  regs[insn->c] = regs[insn->a]; break;
+            case VM_OP::CMPJRR: VM_BRANCH(compare(insn->cc, regs[insn->a], regs[insn->b])); break;
+            case VM_OP::CMPJRI: VM_BRANCH(compare(insn->cc, regs[insn->a], insn->imm)); break;
+            case VM_OP::ROWSTOP:
+                if (dispatches > 1) {
+                    pc--;
+                    dispatches--;
+                    rc = 1;
+                    goto done;
+                }
+                insn = &traps[insn->target];
+                goto redispatch;
+            default:
+                err = "неизвестная команда";
+                goto fail;
+        }
+    }
+
+fail:
+    rc = -1;
+done:
+    memcpy(st->regs, regs, sizeof(regs));
+    st->sp = sp;
+    st->csp = csp;
+    st->pc = pc;
+    st->dirty = dirty;
+    st->err = err;
+    st->dispatches += dispatches;
+    st->executed += executed;
+    return rc;
+}
+
+#undef VM_PUSH
+#undef VM_POP
+#undef VM_BRANCH
+
+function int state_init(vm_state_t *st, double *shared_ram) {
+    *st = {};
+    st->own_ram = !shared_ram;
+    st->ram = shared_ram ? shared_ram : TYPED_CALLOC(VM_RAM_SIZE, double);
+    st->stack = TYPED_CALLOC(VM_STACK_SIZE, double);
+    st->calls = TYPED_CALLOC(VM_STACK_SIZE, size_t);
+    if (!st->ram || !st->stack || !st->calls) {
+        state_free(st);
+        return -1;
+    }
+    return 0;
+}
+
+function void state_free(vm_state_t *st) {
+    if (st->own_ram)
+        free(st->ram);
+    free(st->stack);
+    free(st->calls);
+    st->ram = nullptr;
+    st->stack = nullptr;
+    st->calls = nullptr;
+}
+
+function void report_error(const vm_state_t *st) {
+    fprintf(stderr, "ошибка исполнения в команде %zu: %s\n", st->pc ? st->pc - 1 : 0, st->err ? st->err : "?");
+}
+
+/**
+ * @brief Разбирает хвост метки _<lt|le|gt|ge><k><+offset>_<r<reg>|n<число>>.
+ */
+function int parse_row_condition(const char *p, vm_row_loop_t *loop) {
+    const char *names[] = {"_lt", "_le", "_gt", "_ge"};
+    const unsigned codes[] = {SPU_OP::JB, SPU_OP::JBE, SPU_OP::JA, SPU_OP::JAE};
+    size_t op = 0;
+    while (op < ARRAY_COUNT(names) && strncmp(p, names[op], 3) != 0)
+        ++op;
+    if (op == ARRAY_COUNT(names)) return -1;
+    loop->cc = codes[op];
+    p += 3;
+    int used = 0;
+    if (sscanf(p, "%zu%lf%n", &loop->cond_iv, &loop->offset, &used) != 2 || loop->cond_iv >= loop->iv_count)
+        return -1;
+    p += used;
+    unsigned reg = 0;
+    loop->bound_reg = -1;
+    if (sscanf(p, "_r%u%n", &reg, &used) == 1 && reg < SPU_REGISTERS)
+        loop->bound_reg = (int) reg;
+    else if (sscanf(p, "_n%lf%n", &loop->bound, &used) != 1)
+        return -1;
+    return p[used] ? -1 : 0;
+}
+
+/**
+ * @brief Собирает циклы по меткам rows_<id>_in<K>_r<reg><+step>... и rows_<id>_end.
+ * @return число циклов, у которых нашлись обе метки.
+ */
+function size_t parse_row_loops(const vm_program_t *prog, vm_row_loop_t *loops, size_t cap) {
+    size_t count = 0;
+    for (size_t i = 0; i < prog->label_count && count < cap; ++i) {
+        const char *name = prog->labels[i].name;
+        vm_row_loop_t loop = {};
+        int used = 0;
+        if (sscanf(name, "rows_%zu_in%zu%n", &loop.id, &loop.inputs, &used) != 2) continue;
+        const char *p = name + used;
+        unsigned reg = 0;
+        double step = 0.0;
+        while (loop.iv_count < VM_ROW_MAX_IVS && sscanf(p, "_r%u%lf%n", &reg, &step, &used) == 2 && reg < SPU_REGISTERS) {
+            loop.reg[loop.iv_count] = (uint8_t) reg;
+            loop.step[loop.iv_count++] = step;
+            p += used;
+        }
+        /* без условия в метке число итераций неизвестно: цикл идет последовательно */
+        if (!loop.iv_count || parse_row_condition(p, &loop)) continue;
+        loop.start = prog->labels[i].addr;
+        loop.end = prog->size;
+        loops[count++] = loop;
+    }
+    size_t kept = 0;
+    for (size_t k = 0; k < count; ++k) {
+        char end_name[48] = "";
+        snprintf(end_name, sizeof(end_name), "rows_%zu_end", loops[k].id);
+        for (size_t i = 0; i < prog->label_count; ++i) {
+            if (strcmp(prog->labels[i].name, end_name) == 0)
+                loops[k].end = prog->labels[i].addr;
+        }
+        if (loops[k].end < prog->size && loops[k].start < prog->size)
+            loops[kept++] = loops[k];
+    }
+    return kept;
+}
+
+/**
+ * @brief Сколько строк (не больше cap) исполнить с текущей: итерации до выхода и строка,
+ *        где условие уже ложно.
+ *
+ * Счетчики в раунде точны (VM_EXACT_INT), а граница в теле не меняется, поэтому условие
+ * строки r вычисляется как в VM, без исполнения; истинно оно на префиксе строк.
+ */
+function size_t rows_left(const vm_row_loop_t *loop, const vm_state_t *st, size_t cap) {
+    double v = st->regs[loop->reg[loop->cond_iv]];
+    double step = loop->step[loop->cond_iv];
+    double bound = loop->bound_reg >= 0 ? st->regs[loop->bound_reg] : loop->bound;
+    size_t lo = 0, hi = cap;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (compare(loop->cc, (v + (double) mid * step) + loop->offset, bound))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo < cap ? lo + 1 : cap;
+}
+
+/**
+ * @brief Исполняет строки куска: от метки начала итерации до возврата к ней, rows раз.
+ */
+function void *run_shard(void *arg) {
+    vm_shard_t *sh = (vm_shard_t *) arg;
+    while (sh->done < sh->rows) {
+        int rc = exec(sh->prog, &sh->state, &sh->io, nullptr, sh->traps);
+        if (rc == 0) {
+            sh->state.err = "HLT внутри цикла по строкам";
+            rc = -1;
+        }
+        if (rc < 0) {
+            sh->rc = -1;
+            break;
+        }
+        if (sh->state.pc == sh->loop->end) {
+            sh->ended = true;
+            break;
+        }
+        sh->done++;
+    }
+    return nullptr;
+}
+
+/**
+ * @brief Исполняет цикл по строкам с текущей итерации до выхода, раундами по threads потоков.
+ *
+ * Раунд заранее читает входные значения до VM_ROWS_PER_ROUND строк, но не дальше
+ * выхода по условию (rows_left), и делит строки на непрерывные куски: строк, которых
+ * нет при последовательном исполнении, потоки не трогают. Поток начинает кусок с состоянием на входе в цикл и
+ * счетчиками v0 + first * step: по анализу бэкенда другие величины между итерациями
+ * не переходят. Вывод кусков склеивается по порядку; первый кусок, где условие
+ * стало ложным или случилась ошибка, завершает цикл, его состояние становится
+ * состоянием программы, а ввод возвращается к концу последней исполненной строки.
+ *
+ * @return 0 - st на выходе из цикла, 1 - цикл нельзя исполнить параллельно
+ *         (st и ввод не тронуты), -1 - ошибка исполнения (уже напечатана).
+ */
+function int run_rows(const vm_program_t *prog, vm_row_loop_t *loop, const vm_insn_t *traps,
+                      vm_state_t *st, vm_io_t *io, size_t threads) {
+    size_t k_in = loop->inputs;
+    if (st->csp || (k_in && (!io || vm_io_buffer_input(io)))) return 1;
+    for (size_t k = 0; k < loop->iv_count; ++k) {
+        double v = st->regs[loop->reg[k]];
+        if (v != floor(v) || fabs(v) + (double) VM_ROWS_PER_ROUND * fabs(loop->step[k]) >= VM_EXACT_INT)
+            return 1;
+    }
+
+    vm_shard_t *shards = TYPED_CALLOC(threads, vm_shard_t);
+    pthread_t *tids = TYPED_CALLOC(threads, pthread_t);
+    double *values = TYPED_CALLOC(VM_ROWS_PER_ROUND * k_in + 1, double);
+    size_t *row_pos = TYPED_CALLOC(VM_ROWS_PER_ROUND + 1, size_t);
+    int rc = (shards && tids && values && row_pos) ? 0 : -1;
+    size_t ready = 0;
+    for (; !rc && ready < threads; ++ready) {
+        if (state_init(&shards[ready].state, st->ram)) rc = -1;
+    }
+    if (rc) fprintf(stderr, "не хватило памяти для --parallel\n");
+
+    bool out_binary = io && io->out_binary;
+    bool finished = false;
+    while (!rc && !finished) {
+        bool exact = true;
+        for (size_t k = 0; k < loop->iv_count; ++k)
+            exact = exact && fabs(st->regs[loop->reg[k]]) + (double) VM_ROWS_PER_ROUND * fabs(loop->step[k]) < VM_EXACT_INT;
+        if (!exact) {
+            /* дальше счетчики теряют точность: остаток цикла идет последовательно */
+            rc = 1;
+            break;
+        }
+
+        size_t rows = rows_left(loop, st, VM_ROWS_PER_ROUND), got = 0;
+        row_pos[0] = vm_io_tell(io);
+        for (size_t r = 0; k_in && r < rows; ++r) {
+            size_t n = vm_io_read_ahead(io, values + got, k_in);
+            got += n;
+            row_pos[r + 1] = vm_io_tell(io);
+            /* неполная строка тоже исполняется: условие или IN решат, как без потоков */
+            if (n < k_in) {
+                rows = r + 1;
+                break;
+            }
+        }
+
+        size_t per = (rows + threads - 1) / threads, used = 0;
+        for (size_t t = 0; t < threads; ++t) {
+            vm_shard_t *sh = &shards[t];
+            size_t first = t * per;
+            if (first >= rows) break;
+            vm_state_t state = sh->state;
+            memcpy(state.regs, st->regs, sizeof(state.regs));
+            for (size_t k = 0; k < loop->iv_count; ++k)
+                state.regs[loop->reg[k]] += (double) first * loop->step[k];
+            memcpy(state.stack, st->stack, st->sp * sizeof(double));
+            state.sp = st->sp;
+            state.csp = 0;
+            state.pc = loop->start;
+            state.dispatches = state.executed = 0;
+            state.err = nullptr;
+            *sh = {};
+            sh->prog = prog;
+            sh->loop = loop;
+            sh->traps = traps;
+            sh->state = state;
+            sh->rows = (rows - first < per) ? rows - first : per;
+            size_t from = first * k_in < got ? first * k_in : got;
+            size_t to = (first + sh->rows) * k_in < got ? (first + sh->rows) * k_in : got;
+            vm_io_init_memory(&sh->io, values + from, to - from, out_binary);
+            used = t + 1;
+        }
+        size_t started = 1;
+        for (; started < used; ++started) {
+            if (pthread_create(&tids[started], nullptr, run_shard, &shards[started])) break;
+        }
+        run_shard(&shards[0]);
+        /* не запущенные потоком куски доделываются здесь */
+        for (size_t t = started; t < used; ++t)
+            run_shard(&shards[t]);
+        for (size_t t = 1; t < started; ++t)
+            pthread_join(tids[t], nullptr);
+
+        const vm_shard_t *last = nullptr;
+        size_t consumed = rows;
+        for (size_t t = 0; t < used && !finished; ++t) {
+            vm_shard_t *sh = &shards[t];
+            if (io && vm_io_append(io, sh->io.buf, sh->io.buf_size)) {
+                fprintf(stderr, "ошибка исполнения: OUT: ошибка записи\n");
+                rc = -1;
+                finished = true;
+            }
+            st->dispatches += sh->state.dispatches;
+            st->executed += sh->state.executed;
+            last = sh;
+            if (!rc && sh->rc) {
+                /* повторное чтение строки печатает, какое значение не число */
+                double x = 0;
+                vm_io_seek(io, row_pos[t * per + sh->done]);
+                for (size_t i = 0; i < k_in && !vm_io_read(io, &x); ++i) {}
+                report_error(&sh->state);
+                rc = -1;
+                finished = true;
+            } else if (!rc && sh->ended) {
+                consumed = t * per + sh->done;
+                finished = true;
+            }
+        }
+        for (size_t t = 0; t < used; ++t)
+            vm_io_close(&shards[t].io);
+        if (rc || !last) break;
+
+        memcpy(st->regs, last->state.regs, sizeof(st->regs));
+        memcpy(st->stack, last->state.stack, last->state.sp * sizeof(double));
+        st->sp = last->state.sp;
+        st->pc = finished ? loop->end : loop->start;
+        if (k_in)
+            vm_io_seek(io, row_pos[consumed]);
+    }
+
+    for (size_t t = 0; t < ready; ++t)
+        state_free(&shards[t].state);
+    free(shards);
+    free(tids);
+    free(values);
+    free(row_pos);
+    return rc;
+}
+
+int vm_run_parallel(const vm_program_t *prog, vm_io_t *io, vm_stats_t *stats, size_t threads) {
+    if (!prog || !prog->code) return -1;
+    vm_row_loop_t loops[16] = {};
+    size_t loop_count = 0;
+    /* счетчики профиля потоки не ведут: с профилем все исполняется последовательно */
+    if (threads > 1 && !(stats && (stats->hits || stats->taken)))
+        loop_count = parse_row_loops(prog, loops, ARRAY_COUNT(loops));
+
+    /* начало и конец каждого цикла заменяются на ROWSTOP в копии кода */
+    vm_program_t run = *prog;
+    vm_insn_t *code = nullptr;
+    vm_insn_t traps[2 * ARRAY_COUNT(loops)] = {};
+    size_t trap_count = 0;
+    if (loop_count) {
+        code = TYPED_CALLOC(prog->size, vm_insn_t);
+        if (!code) return -1;
+        memcpy(code, prog->code, prog->size * sizeof(vm_insn_t));
+        for (size_t k = 0; k < loop_count; ++k) {
+            size_t at[2] = {loops[k].start, loops[k].end};
+            for (size_t j = 0; j < 2; ++j) {
+                if (code[at[j]].op == VM_OP::ROWSTOP) continue;
+                traps[trap_count] = code[at[j]];
+                code[at[j]] = {};
+                code[at[j]].op = VM_OP::ROWSTOP;
+                code[at[j]].target = trap_count++;
+            }
+        }
+        run.code = code;
+    }
+
+    vm_state_t st = {};
+    if (state_init(&st, nullptr)) {
+        free(code);
+        return -1;
+    }
+    int rc = 0;
+    while (true) {
+        rc = exec(&run, &st, io, stats, traps);
+        if (rc <= 0) break;
+        for (size_t k = 0; k < loop_count; ++k) {
+            vm_row_loop_t *loop = &loops[k];
+            if (st.pc == loop->end) {
+                loop->visits = 0;
+            } else if (st.pc == loop->start && ++loop->visits > VM_ROWS_PROBE) {
+                /* короткие циклы не стоят запуска потоков */
+                int rows_rc = run_rows(&run, loop, traps, &st, io, threads);
+                loop->visits = 0;
+                if (rows_rc < 0) {
+                    rc = -1;
+                    break;
+                }
+            }
+        }
+        if (rc < 0) break;
+    }
+    if (rc < 0 && st.err)
+        report_error(&st);
+    if (stats) {
+        stats->dispatches = st.dispatches;
+        stats->executed = st.executed;
+    }
+    state_free(&st);
+    free(code);
+    return rc < 0 ? -1 : 0;
+}
+
+int vm_run(const vm_program_t *prog, vm_io_t *io, vm_stats_t *stats) {
+    return vm_run_parallel(prog, io, stats, 1);
+}
+
+function bool is_conditional(unsigned op) {
+    return (is_jump(op) && op != SPU_OP::JMP) || op == VM_OP::CMPJRR || op == VM_OP::CMPJRI;
+}
+
+int vm_write_profile(const vm_program_t *prog, const vm_stats_t *stats, FILE *out) {
+    if (!prog || !stats || !stats->hits || !stats->taken || !out) return -1;
+    /* переходы суммируются по команде-цели: на одну метку может вести несколько Jcc */
+    uint64_t *br_taken = TYPED_CALLOC(prog->size + 1, uint64_t);
+    uint64_t *br_exec = TYPED_CALLOC(prog->size + 1, uint64_t);
+    if (!br_taken || !br_exec) {
+        free(br_taken);
+        free(br_exec);
+        return -1;
+    }
+    for (size_t i = 0; i < prog->size; ++i) {
+        if (!is_conditional(prog->code[i].op)) continue;
+        br_taken[prog->code[i].target] += stats->taken[i];
+        br_exec[prog->code[i].target] += stats->hits[i];
+    }
+
+    /* входы CALL по адресу: метки конца прошлой ФОРМУЛЫ делят адрес с началом следующей */
+    uint64_t *calls = TYPED_CALLOC(prog->size + 1, uint64_t);
+    if (!calls) {
+        free(br_taken);
+        free(br_exec);
+        return -1;
+    }
+    for (size_t i = 0; i < prog->size; ++i) {
+        if (prog->code[i].op == SPU_OP::CALL)
+            calls[prog->code[i].target] += stats->hits[i];
+    }
+
+    fprintf(out, "# physlab profile 1\n");
+    for (size_t i = 0; i < prog->label_count; ++i) {
+        size_t at = prog->labels[i].addr;
+        uint64_t count = at < prog->size ? stats->hits[at] : 0;
+        /* метка перед меткой-именем ФОРМУЛЫ (без точки) на том же адресе - из прошлой функции,
+           в нее CALL не входят */
+        bool before_entry = false;
+        for (size_t j = i + 1; j < prog->label_count && prog->labels[j].addr == at && !before_entry; ++j)
+            before_entry = !strchr(prog->labels[j].name, '.');
+        if (before_entry)
+            count = count > calls[at] ? count - calls[at] : 0;
+        fprintf(out, "label %s %llu\n", prog->labels[i].name, (unsigned long long) count);
+    }
+    for (size_t i = 0; i < prog->label_count; ++i) {
+        size_t at = prog->labels[i].addr;
+        if (!br_exec[at]) continue;
+        fprintf(out, "branch %s %llu %llu\n", prog->labels[i].name,
+                (unsigned long long) br_taken[at], (unsigned long long) br_exec[at]);
+    }
+    free(br_taken);
+    free(br_exec);
+    free(calls);
+    return ferror(out) ? -1 : 0;
+}
+
+void vm_destruct(vm_program_t *prog) {
+    if (!prog) return;
+    free(prog->code);
+    free(prog->labels);
+    *prog = {};
+}
@@ -0,0 +1,162 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "base.h"
+#include "vm_frames.h"
+
+function uint8_t brightness(double value);
+function int write_all(int fd, const uint8_t *data, size_t len);
+function int encode_frame(vm_frames_t *fr, const uint8_t *cells);
+function void *encoder_main(void *arg);
+
+/**
+ * @brief Значение ячейки как яркость: обрезается до 0..255, NaN - черный.
+ */
+function uint8_t brightness(double value) {
+    if (!(value > 0)) return 0;
+    if (value >= 255) return 255;
+    return (uint8_t) value;
+}
+
+function int write_all(int fd, const uint8_t *data, size_t len) {
+    while (len) {
+        ssize_t n = write(fd, data, len);
+        if (n <= 0) return -1;
+        data += n;
+        len -= (size_t) n;
+    }
+    return 0;
+}
+
+/**
+ * @brief Пишет кадр в PPM: заголовок уже лежит в начале fr->image.
+ */
+function int encode_frame(vm_frames_t *fr, const uint8_t *cells) {
+    const size_t row_bytes = VM_FRAME_W * VM_FRAMES_SCALE * 3;
+    uint8_t *pixels = fr->image + fr->image_size - VM_FRAME_H * VM_FRAMES_SCALE * row_bytes;
+    for (size_t y = 0; y < VM_FRAME_H; ++y) {
+        uint8_t *row = pixels + y * VM_FRAMES_SCALE * row_bytes;
+        uint8_t *dst = row;
+        for (size_t x = 0; x < VM_FRAME_W; ++x) {
+            uint8_t b = cells[y * VM_FRAME_W + x];
+            memset(dst, b, VM_FRAMES_SCALE * 3);
+            dst += VM_FRAMES_SCALE * 3;
+        }
+        for (size_t k = 1; k < VM_FRAMES_SCALE; ++k)
+            memcpy(row + k * row_bytes, row, row_bytes);
+    }
+    return write_all(fr->fd, fr->image, fr->image_size);
+}
+
+function void *encoder_main(void *arg) {
+    vm_frames_t *fr = (vm_frames_t *) arg;
+    pthread_mutex_lock(&fr->lock);
+    while (true) {
+        while (!fr->count && !fr->stop)
+            pthread_cond_wait(&fr->ready, &fr->lock);
+        if (!fr->count) break;
+        const uint8_t *cells = fr->queue + fr->head * VM_FRAME_CELLS;
+        pthread_mutex_unlock(&fr->lock);
+        /* слот не переиспользуется, пока count не уменьшен */
+        int rc = fr->failed ? -1 : encode_frame(fr, cells);
+        pthread_mutex_lock(&fr->lock);
+        if (rc) fr->failed = true;
+        fr->head = (fr->head + 1) % VM_FRAMES_QUEUE;
+        fr->count--;
+        pthread_cond_signal(&fr->space);
+    }
+    pthread_mutex_unlock(&fr->lock);
+    return nullptr;
+}
+
+int vm_frames_open(vm_frames_t *fr, const char *path) {
+    if (!fr) return -1;
+    *fr = {};
+    fr->fd = -1;
+    if (!path) return 0;
+
+    char header[64] = "";
+    int len = snprintf(header, sizeof(header), "P6\n%zu %zu\n255\n",
+                       VM_FRAME_W * VM_FRAMES_SCALE, VM_FRAME_H * VM_FRAMES_SCALE);
+    fr->image_size = (size_t) len + VM_FRAME_CELLS * VM_FRAMES_SCALE * VM_FRAMES_SCALE * 3;
+    fr->image = TYPED_CALLOC(fr->image_size, uint8_t);
+    fr->queue = TYPED_CALLOC(VM_FRAMES_QUEUE * VM_FRAME_CELLS, uint8_t);
+    if (!fr->image || !fr->queue) {
+        vm_frames_close(fr);
+        return -1;
+    }
+    memcpy(fr->image, header, (size_t) len);
+
+    fr->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fr->fd < 0) {
+        fprintf(stderr, "не удалось открыть %s для записи кадров\n", path);
+        vm_frames_close(fr);
+        return -1;
+    }
+    pthread_mutex_init(&fr->lock, nullptr);
+    pthread_cond_init(&fr->ready, nullptr);
+    pthread_cond_init(&fr->space, nullptr);
+    /* без потока кадры кодируются прямо в DRAW */
+    fr->threaded = pthread_create(&fr->thread, nullptr, encoder_main, fr) == 0;
+    return 0;
+}
+
+int vm_frames_commit(vm_frames_t *fr, const double *ram, const vm_rect_t *dirty) {
+    if (!fr || !ram) return -1;
+    if (dirty && dirty->x0 < dirty->x1) {
+        for (size_t y = dirty->y0; y < dirty->y1; ++y) {
+            for (size_t x = dirty->x0; x < dirty->x1; ++x)
+                fr->cells[y * VM_FRAME_W + x] = brightness(ram[y * VM_FRAME_W + x]);
+        }
+        fr->dirty_cells += (dirty->x1 - dirty->x0) * (dirty->y1 - dirty->y0);
+    }
+    fr->frames++;
+    if (fr->fd < 0) return 0;
+    if (!fr->threaded) {
+        if (!fr->failed && encode_frame(fr, fr->cells)) fr->failed = true;
+        return fr->failed ? -1 : 0;
+    }
+
+    pthread_mutex_lock(&fr->lock);
+    while (fr->count == VM_FRAMES_QUEUE && !fr->failed)
+        pthread_cond_wait(&fr->space, &fr->lock);
+    bool failed = fr->failed;
+    if (!failed) {
+        size_t slot = (fr->head + fr->count) % VM_FRAMES_QUEUE;
+        memcpy(fr->queue + slot * VM_FRAME_CELLS, fr->cells, VM_FRAME_CELLS);
+        fr->count++;
+        pthread_cond_signal(&fr->ready);
+    }
+    pthread_mutex_unlock(&fr->lock);
+    return failed ? -1 : 0;
+}
+
+int vm_frames_close(vm_frames_t *fr) {
+    if (!fr) return -1;
+    if (fr->threaded) {
+        pthread_mutex_lock(&fr->lock);
+        fr->stop = true;
+        pthread_cond_signal(&fr->ready);
+        pthread_mutex_unlock(&fr->lock);
+        pthread_join(fr->thread, nullptr);
+        fr->threaded = false;
+    }
+    int rc = fr->failed ? -1 : 0;
+    if (fr->fd >= 0) {
+        pthread_mutex_destroy(&fr->lock);
+        pthread_cond_destroy(&fr->ready);
+        pthread_cond_destroy(&fr->space);
+        if (close(fr->fd)) rc = -1;
+        fr->fd = -1;
+    }
+    if (rc && fr->image)
+        fprintf(stderr, "не удалось записать кадры\n");
+    free(fr->image);
+    free(fr->queue);
+    fr->image = nullptr;
+    fr->queue = nullptr;
+    return rc;
+}
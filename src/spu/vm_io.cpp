@@ -0,0 +1,397 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "base.h"
+#include "vm_io.h"
+
+/** Самая длинная запись числа, которую разбирает strtod. */
+const size_t MAX_NUMBER_TOKEN = 64;
+
+/** Точные степени 10: mantissa * 10^e с |e| <= 22 округляется верно, пока mantissa < 2^53. */
+global const double POW10[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+function bool has_suffix(const char *path, const char *suffix);
+function bool is_separator(char c);
+function bool parse_fast(const char *p, const char *end, double *value);
+function bool parse_token(const char *p, const char *end, double *value);
+function size_t line_of(const vm_io_t *io, size_t pos);
+function int write_all(int fd, const char *data, size_t len);
+function size_t format_number(char *dst, double value);
+function int read_value(vm_io_t *io, double *value, bool report);
+function int reserve_output(vm_io_t *io, size_t len);
+
+function bool has_suffix(const char *path, const char *suffix) {
+    size_t len = strlen(path), slen = strlen(suffix);
+    return len >= slen && strcmp(path + len - slen, suffix) == 0;
+}
+
+function bool is_separator(char c) {
+    return c == ',' || c == ';' || c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+/**
+ * @brief Десятичное число без strtod: [-+]digits[.digits][(e|E)[-+]digits].
+ * @return false, если запись длиннее 19 цифр, порядок вне [-22, 22] или это не число.
+ */
+function bool parse_fast(const char *p, const char *end, double *value) {
+    bool neg = false;
+    if (p < end && (*p == '-' || *p == '+'))
+        neg = (*p++ == '-');
+    uint64_t mant = 0;
+    int digits = 0, exp10 = 0;
+    for (; p < end && *p >= '0' && *p <= '9'; ++p, ++digits)
+        mant = mant * 10 + (uint64_t) (*p - '0');
+    if (p < end && *p == '.') {
+        for (++p; p < end && *p >= '0' && *p <= '9'; ++p, ++digits, --exp10)
+            mant = mant * 10 + (uint64_t) (*p - '0');
+    }
+    if (!digits || digits > 19) return false;
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        ++p;
+        bool eneg = false;
+        if (p < end && (*p == '-' || *p == '+'))
+            eneg = (*p++ == '-');
+        int e = 0;
+        if (p == end || *p < '0' || *p > '9') return false;
+        for (; p < end && *p >= '0' && *p <= '9' && e < 1000; ++p)
+            e = e * 10 + (*p - '0');
+        exp10 += eneg ? -e : e;
+    }
+    if (p != end || mant > (1ULL << 53) || exp10 < -22 || exp10 > 22) return false;
+    double d = (double) mant;
+    d = (exp10 < 0) ? d / POW10[-exp10] : d * POW10[exp10];
+    *value = neg ? -d : d;
+    return true;
+}
+
+/**
+ * @brief Токен целиком как число: быстрый разбор, иначе strtod на копии.
+ */
+function bool parse_token(const char *p, const char *end, double *value) {
+    if (parse_fast(p, end, value)) return true;
+    size_t len = (size_t) (end - p);
+    if (!len || len >= MAX_NUMBER_TOKEN) return false;
+    char tmp[MAX_NUMBER_TOKEN] = "";
+    memcpy(tmp, p, len);
+    char *stop = nullptr;
+    *value = strtod(tmp, &stop);
+    return stop == tmp + len;
+}
+
+function size_t line_of(const vm_io_t *io, size_t pos) {
+    size_t line = 1;
+    for (const char *p = io->data; p && (p = (const char *) memchr(p, '\n', (size_t) (io->data + pos - p))); ++p)
+        ++line;
+    return line;
+}
+
+function int write_all(int fd, const char *data, size_t len) {
+    while (len) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        data += n;
+        len -= (size_t) n;
+    }
+    return 0;
+}
+
+/**
+ * @brief Как "%.15g\n", но числа с не более чем 6 знаками после запятой печатаются без snprintf.
+ *
+ * Если value * 10^k отличается от целого r (|r| < 10^15) меньше чем на 2.5e-16 * |r|,
+ * то округление value до 15 значащих цифр - это r / 10^k: до половины единицы
+ * 15-го разряда (не меньше 5e-16 * |r|) остается запас на погрешность умножения.
+ */
+function size_t format_number(char *dst, double value) {
+    double a = fabs(value);
+    if (a < 1e15 && (a >= 1e-4 || value == 0) && !(value == 0 && signbit(value))) {
+        for (int k = 0; k <= 6; ++k) {
+            double x = value * POW10[k];
+            if (fabs(x) >= 1e15)
+                break;
+            int64_t r = (int64_t) (x + (x < 0 ? -0.5 : 0.5));
+            if (r >= 1000000000000000 || r <= -1000000000000000)
+                break;
+            if (fabs(x - (double) r) > fabs((double) r) * 2.5e-16)
+                continue;
+            uint64_t u = (uint64_t) (r < 0 ? -r : r);
+            int frac = k;
+            for (; frac && u % 10 == 0; --frac)
+                u /= 10;
+            char tmp[24];
+            size_t n = 0;
+            for (int d = 0; u || d <= frac; ++d) {
+                if (d == frac && frac) tmp[n++] = '.';
+                tmp[n++] = (char) ('0' + u % 10);
+                u /= 10;
+            }
+            size_t len = 0;
+            if (r < 0) dst[len++] = '-';
+            while (n) dst[len++] = tmp[--n];
+            dst[len++] = '\n';
+            return len;
+        }
+    }
+    return (size_t) snprintf(dst, 32, "%.15g\n", value);
+}
+
+void vm_io_init(vm_io_t *io, FILE *in, FILE *out) {
+    if (!io) return;
+    *io = {};
+    io->in = in;
+    io->interactive = in && isatty(fileno(in));
+    io->out = out;
+    io->out_fd = -1;
+    io->screen = out;
+}
+
+int vm_io_open_input(vm_io_t *io, const char *path) {
+    if (!io || !path) return -1;
+    int fd = open(path, O_RDONLY);
+    struct stat st = {};
+    if (fd < 0 || fstat(fd, &st)) {
+        fprintf(stderr, "не удалось открыть входные данные %s\n", path);
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    io->size = (size_t) st.st_size;
+    io->pos = 0;
+    io->data = nullptr;
+    if (io->size) {
+        void *map = mmap(nullptr, io->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            fprintf(stderr, "не удалось отобразить %s в память\n", path);
+            close(fd);
+            return -1;
+        }
+        madvise(map, io->size, MADV_SEQUENTIAL);
+        io->data = (const char *) map;
+        io->mapped = true;
+    }
+    close(fd);
+    io->in = nullptr;
+    io->interactive = false;
+    io->in_binary = has_suffix(path, ".bin");
+    io->header_checked = false;
+    if (io->in_binary && io->size % sizeof(double)) {
+        fprintf(stderr, "%s: размер не кратен %zu байтам\n", path, sizeof(double));
+        return -1;
+    }
+    return 0;
+}
+
+int vm_io_open_output(vm_io_t *io, const char *path) {
+    if (!io || !path) return -1;
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "не удалось открыть %s для записи\n", path);
+        return -1;
+    }
+    if (io->screen == io->out)
+        io->screen = stdout;
+    io->out = nullptr;
+    io->out_fd = fd;
+    io->out_binary = has_suffix(path, ".bin");
+    return 0;
+}
+
+/**
+ * @brief Следующее значение; при report == false нечисловое значение не печатается.
+ *
+ * При ошибке позиция остается перед нечисловым значением.
+ */
+function int read_value(vm_io_t *io, double *value, bool report) {
+    if (!io) return -1;
+    if (!io->data && io->in) {
+        if (io->interactive)
+            vm_io_flush(io);
+        return fscanf(io->in, "%lf", value) == 1 ? 0 : -1;
+    }
+    if (io->in_binary) {
+        if (io->pos + sizeof(double) > io->size) return -1;
+        memcpy(value, io->data + io->pos, sizeof(double));
+        io->pos += sizeof(double);
+        return 0;
+    }
+    while (true) {
+        while (io->pos < io->size && is_separator(io->data[io->pos]))
+            ++io->pos;
+        if (io->pos >= io->size) return -1;
+        const char *start = io->data + io->pos;
+        const char *end = start;
+        const char *limit = io->data + io->size;
+        while (end < limit && !is_separator(*end))
+            ++end;
+        bool first_line = !io->header_checked;
+        io->header_checked = true;
+        if (parse_token(start, end, value)) {
+            io->pos = (size_t) (end - io->data);
+            return 0;
+        }
+        /* нечисловая первая строка - заголовок CSV */
+        const char *eol = (const char *) memchr(start, '\n', (size_t) (limit - start));
+        if (first_line && !memchr(io->data, '\n', io->pos)) {
+            io->pos = eol ? (size_t) (eol - io->data) : io->size;
+            continue;
+        }
+        if (report)
+            fprintf(stderr, "входные данные, строка %zu: '%.*s' не число\n",
+                    line_of(io, io->pos), (int) (end - start), start);
+        return -1;
+    }
+}
+
+int vm_io_read(vm_io_t *io, double *value) {
+    return read_value(io, value, true);
+}
+
+size_t vm_io_read_ahead(vm_io_t *io, double *values, size_t count) {
+    size_t got = 0;
+    while (got < count && !read_value(io, &values[got], false))
+        ++got;
+    return got;
+}
+
+size_t vm_io_tell(const vm_io_t *io) {
+    return io ? io->pos : 0;
+}
+
+void vm_io_seek(vm_io_t *io, size_t pos) {
+    if (io && pos <= io->size)
+        io->pos = pos;
+}
+
+int vm_io_buffer_input(vm_io_t *io) {
+    if (!io) return -1;
+    if (io->data || !io->in) return 0;
+    if (io->interactive) return -1;
+    size_t cap = 1 << 16, len = 0;
+    char *data = TYPED_CALLOC(cap, char);
+    while (data) {
+        len += fread(data + len, 1, cap - len, io->in);
+        if (len < cap) break;
+        cap *= 2;
+        char *tmp = TYPED_REALLOC(data, cap, char);
+        if (!tmp) {
+            free(data);
+            data = nullptr;
+        } else {
+            data = tmp;
+        }
+    }
+    if (!data || ferror(io->in)) {
+        fprintf(stderr, "не удалось прочитать входные данные\n");
+        free(data);
+        return -1;
+    }
+    io->owned = data;
+    io->data = data;
+    io->size = len;
+    io->pos = 0;
+    io->in = nullptr;
+    return 0;
+}
+
+void vm_io_init_memory(vm_io_t *io, const double *values, size_t count, bool out_binary) {
+    if (!io) return;
+    *io = {};
+    io->data = (const char *) values;
+    io->size = values ? count * sizeof(double) : 0;
+    io->in_binary = true;
+    io->out_fd = -1;
+    io->out_memory = true;
+    io->out_binary = out_binary;
+}
+
+/**
+ * @brief Готовит в буфере вывода место под len байт: растит буфер памяти или сбрасывает заполненный.
+ */
+function int reserve_output(vm_io_t *io, size_t len) {
+    if (!io->buf) {
+        io->buf_cap = io->out_memory ? (1 << 12) : VM_IO_BUFFER;
+        io->buf = TYPED_CALLOC(io->buf_cap, char);
+        if (!io->buf) return -1;
+    }
+    if (io->buf_size + len <= io->buf_cap) return 0;
+    if (!io->out_memory)
+        return vm_io_flush(io);
+    size_t cap = io->buf_cap;
+    while (io->buf_size + len > cap)
+        cap *= 2;
+    char *tmp = TYPED_REALLOC(io->buf, cap, char);
+    if (!tmp) return -1;
+    io->buf = tmp;
+    io->buf_cap = cap;
+    return 0;
+}
+
+int vm_io_write(vm_io_t *io, double value) {
+    if (!io || (!io->out && io->out_fd < 0 && !io->out_memory)) return 0;
+    if (reserve_output(io, 32)) return -1;
+    if (io->out_binary) {
+        memcpy(io->buf + io->buf_size, &value, sizeof(value));
+        io->buf_size += sizeof(value);
+    } else {
+        io->buf_size += format_number(io->buf + io->buf_size, value);
+    }
+    return 0;
+}
+
+int vm_io_append(vm_io_t *io, const char *data, size_t len) {
+    if (!io || !len || (!io->out && io->out_fd < 0 && !io->out_memory)) return 0;
+    if (io->out_memory || len < VM_IO_BUFFER) {
+        if (reserve_output(io, len)) return -1;
+        memcpy(io->buf + io->buf_size, data, len);
+        io->buf_size += len;
+        return 0;
+    }
+    /* большой кусок идет мимо буфера */
+    int rc = vm_io_flush(io);
+    if (!rc && io->out_fd >= 0)
+        rc = write_all(io->out_fd, data, len);
+    else if (!rc)
+        rc = fwrite(data, 1, len, io->out) == len ? 0 : -1;
+    if (rc) io->write_failed = true;
+    return rc;
+}
+
+int vm_io_flush(vm_io_t *io) {
+    if (!io || !io->buf_size || io->out_memory) return 0;
+    int rc = 0;
+    if (io->out_fd >= 0)
+        rc = write_all(io->out_fd, io->buf, io->buf_size);
+    else if (io->out)
+        rc = (fwrite(io->buf, 1, io->buf_size, io->out) == io->buf_size && !fflush(io->out)) ? 0 : -1;
+    io->buf_size = 0;
+    if (rc) io->write_failed = true;
+    return rc;
+}
+
+int vm_io_close(vm_io_t *io) {
+    if (!io) return 0;
+    vm_io_flush(io);
+    int rc = io->write_failed ? -1 : 0;
+    if (io->out_fd >= 0 && close(io->out_fd))
+        rc = -1;
+    if (io->mapped)
+        munmap((void *) io->data, io->size);
+    free(io->owned);
+    free(io->buf);
+    if (rc)
+        fprintf(stderr, "ошибка записи выходных данных\n");
+    *io = {};
+    io->out_fd = -1;
+    return rc;
+}
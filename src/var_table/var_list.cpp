@@ -8,6 +8,9 @@ namespace varlist {
 
 using mystr::mystr_t;
 
+/** Куски короче этого add_span копирует на стек, длиннее - в кучу. */
+const size_t SPAN_STACK_CAP = 256;
+
 /**
  * @brief Находит позицию вставки для заданного хэша в массиве order.
  *
@@ -52,9 +55,9 @@ function int ensure_capacity(VarList *list, size_t need) {
     if (list->capacity >= need) return 0;
     size_t cap = list->capacity ? list->capacity : 4;
     while (cap < need) cap <<= 1;
-    mystr_t *new_data = (mystr_t *) malloc(cap * sizeof(mystr_t));
+    mystr_t *new_data = TYPED_CALLOC(cap, mystr_t);
     if (!new_data) return -1;
-    size_t *new_order = (size_t *) malloc(cap * sizeof(size_t));
+    size_t *new_order = TYPED_CALLOC(cap, size_t);
     if (!new_order) {
         free(new_data);
         return -1;
@@ -110,6 +113,23 @@ size_t add(VarList *list, const mystr_t *name) {
     return new_idx;
 }
 
+size_t add_span(VarList *list, const char *text, size_t len) {
+    if (!list || !text) return NPOS;
+    char stack_buf[SPAN_STACK_CAP];
+    char *tmp = stack_buf;
+    if (len < sizeof(stack_buf)) {
+        memcpy(stack_buf, text, len);
+        stack_buf[len] = '\0';
+    } else {
+        tmp = STRNDUP(text, len);
+        if (!tmp) return NPOS;
+    }
+    mystr_t name = mystr::construct(tmp);
+    size_t id = add(list, &name);
+    if (tmp != stack_buf) free(tmp);
+    return id;
+}
+
 bool contains(const VarList *list, const mystr_t *name) {
     return find_internal(list, name) != NPOS;
 }